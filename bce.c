@@ -0,0 +1,627 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "optimize.h"
+#include "cfg.h"
+#include "ssa.h"
+
+#define MAX_CHAIN_DEPTH 16
+#define MAX_RANGE_DEPTH 4
+#define MAX_INDEX_OFFSET (1 << 20)
+#define MAX_GUARD_OFFSET 32767  // The bytecode keeps a guard's offsets in 16 bits
+
+typedef struct {
+    TACFunction* function;
+    const CFG* cfg;
+    const DefUseChains* chains;
+    IntList accesses;   // Every load and store of an element, in order
+    int proven;
+} BoundsChecker;
+
+// The accesses of one array in a loop that a guard in its preheader can check
+typedef struct {
+    TACOperand array;
+    long long low;      // Smallest offset from the counter of the accesses that run every iteration
+    long long high;     // Largest one
+} GuardRange;
+
+typedef struct {
+    int index;          // Where the guard goes
+    int order;          // When it was made, which orders the guards going to the same place
+    TACInstruction instr;
+} PendingGuard;
+
+static TACOperand AccessArray(const TACInstruction* instr) {
+    return instr->op == TAC_LOAD_INDEX ? instr->arg1 : instr->result;
+}
+
+static TACOperand AccessIndex(const TACInstruction* instr) {
+    return instr->op == TAC_LOAD_INDEX ? instr->arg2 : instr->arg1;
+}
+
+/**
+ * @brief Splits an integer operand into a variable plus a constant
+ *
+ * Copies and additions or subtractions of constants are followed back
+ * through their definitions, so j = i + 1 - 3 comes out as i and -2. The
+ * sum is the operand's value modulo 2^32, which is all that matters for an
+ * index that ends up in range.
+ *
+ * @param bc The pass state
+ * @param operand The operand to split
+ * @param base Receives the variable, or -1 if the operand is a constant
+ * @param offset Receives the constant
+ * @return 1 if the operand is an integer variable or constant, 0 otherwise
+ */
+static int SplitOffset(const BoundsChecker* bc, TACOperand operand, int* base, long long* offset) {
+    *offset = 0;
+
+    for (int depth = 0;; depth++) {
+        if (operand.kind == TAC_OPERAND_INT) {
+            *base = -1;
+            *offset += operand.value.intValue;
+            return 1;
+        }
+        if (operand.kind != TAC_OPERAND_VAR || bc->function->vars[operand.value.id].type != INTEGER) {
+            return 0;
+        }
+
+        *base = operand.value.id;
+        int def = bc->chains->def[operand.value.id];
+        if (def < 0 || depth == MAX_CHAIN_DEPTH) {
+            return 1;
+        }
+
+        TACInstruction* instr = &bc->function->code[def];
+        TACOperand next;
+        long long step;
+        if (instr->op == TAC_ASSIGN) {
+            next = instr->arg1;
+            step = 0;
+        } else if (instr->op == TAC_ADD && instr->arg2.kind == TAC_OPERAND_INT) {
+            next = instr->arg1;
+            step = instr->arg2.value.intValue;
+        } else if (instr->op == TAC_ADD && instr->arg1.kind == TAC_OPERAND_INT) {
+            next = instr->arg2;
+            step = instr->arg1.value.intValue;
+        } else if (instr->op == TAC_SUB && instr->arg2.kind == TAC_OPERAND_INT) {
+            next = instr->arg1;
+            step = -(long long)instr->arg2.value.intValue;
+        } else {
+            return 1;
+        }
+
+        if (llabs(*offset + step) > MAX_INDEX_OFFSET) {
+            return 1;
+        }
+        *offset += step;
+        operand = next;
+    }
+}
+
+/**
+ * @brief Finds the number of elements of an array, when it is a constant
+ *
+ * Arrays are made by newarray with their length and never grow, so the
+ * length is known wherever the array can be traced back to one with a
+ * constant length, through copies and phis that agree.
+ *
+ * @return The length, or -1 if it is unknown
+ */
+static long long ArrayLength(const BoundsChecker* bc, TACOperand array, int depth) {
+    if (array.kind != TAC_OPERAND_VAR || depth == MAX_CHAIN_DEPTH) {
+        return -1;
+    }
+    int def = bc->chains->def[array.value.id];
+    if (def < 0) {
+        return -1;
+    }
+
+    TACInstruction* instr = &bc->function->code[def];
+    switch (instr->op) {
+    case TAC_NEWARRAY:
+        return instr->arg1.kind == TAC_OPERAND_INT ? instr->arg1.value.intValue : -1;
+    case TAC_ASSIGN:
+        return ArrayLength(bc, instr->arg1, depth + 1);
+    case TAC_PHI: {
+        long long length = -1;
+        for (int k = 0; k < instr->phiCount; k++) {
+            // A phi can only read itself around a loop, which keeps whatever it came in with
+            TACOperand arg = instr->phiArgs[k].value;
+            if (arg.kind == TAC_OPERAND_VAR && arg.value.id == array.value.id) {
+                continue;
+            }
+            long long argLength = ArrayLength(bc, arg, depth + 1);
+            if (argLength < 0 || (length >= 0 && argLength != length)) {
+                return -1;
+            }
+            length = argLength;
+        }
+        return length;
+    }
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Finds the loop a block is the header of
+ *
+ * @return The loop, or -1 if the block heads none
+ */
+static int LoopWithHeader(const CFG* cfg, int block) {
+    for (int l = 0; l < cfg->loopCount; l++) {
+        if (cfg->loops[l].header == block) {
+            return l;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Finds the test a loop's header decides on whether to run the body
+ *
+ * The header must end with a branch on a comparison made there, with one
+ * way into the loop and the other out of it. The comparison is returned
+ * with the variable on the left, as the condition for running the body.
+ *
+ * @param var The variable the comparison has to read
+ * @param op Receives the condition
+ * @param bound Receives what the variable is compared with
+ * @return 1 if the header has such a test, 0 otherwise
+ */
+static int HeaderTest(const BoundsChecker* bc, int loop, int var, TACOpcode* op, TACOperand* bound) {
+    const CFG* cfg = bc->cfg;
+    const BasicBlock* header = &cfg->blocks[cfg->loops[loop].header];
+    if (header->succs.count != 2 || header->end <= header->start) {
+        return 0;
+    }
+
+    TACInstruction* branch = &bc->function->code[header->end - 1];
+    if ((branch->op != TAC_IF && branch->op != TAC_IFFALSE) || branch->arg1.kind != TAC_OPERAND_VAR) {
+        return 0;
+    }
+    int inside = LoopContains(cfg, loop, header->succs.items[0]) + LoopContains(cfg, loop, header->succs.items[1]);
+    int compare = bc->chains->def[branch->arg1.value.id];
+    if (inside != 1 || compare < 0 || cfg->blockOf[compare] != cfg->loops[loop].header) {
+        return 0;
+    }
+
+    TACInstruction* test = &bc->function->code[compare];
+    int onLeft = test->arg1.kind == TAC_OPERAND_VAR && test->arg1.value.id == var;
+    int onRight = test->arg2.kind == TAC_OPERAND_VAR && test->arg2.value.id == var;
+    if (onLeft == onRight) {
+        return 0;
+    }
+
+    TACOpcode cond;
+    switch (test->op) {
+    case TAC_LT: cond = onLeft ? TAC_LT : TAC_GT; break;
+    case TAC_LE: cond = onLeft ? TAC_LE : TAC_GE; break;
+    case TAC_GT: cond = onLeft ? TAC_GT : TAC_LT; break;
+    case TAC_GE: cond = onLeft ? TAC_GE : TAC_LE; break;
+    default: return 0;
+    }
+
+    // The body runs when the comparison is false if the branch goes out on true
+    int targetInLoop = LoopContains(cfg, loop, cfg->labelBlock[branch->result.value.id]);
+    if (targetInLoop != (branch->op == TAC_IF)) {
+        switch (cond) {
+        case TAC_LT: cond = TAC_GE; break;
+        case TAC_LE: cond = TAC_GT; break;
+        case TAC_GT: cond = TAC_LE; break;
+        default: cond = TAC_LT; break;
+        }
+    }
+
+    *op = cond;
+    *bound = onLeft ? test->arg2 : test->arg1;
+    return 1;
+}
+
+/**
+ * @brief Finds how a header phi advances on every iteration of its loop
+ *
+ * @param init Receives the value it starts with
+ * @param step Receives the constant added to it on the way back to the header
+ * @return The loop, or -1 if the variable is not a counter of one
+ */
+static int CounterLoop(const BoundsChecker* bc, int var, TACOperand* init, long long* step) {
+    const CFG* cfg = bc->cfg;
+    int def = bc->chains->def[var];
+    if (def < 0 || bc->function->code[def].op != TAC_PHI) {
+        return -1;
+    }
+
+    int loop = LoopWithHeader(cfg, cfg->blockOf[def]);
+    TACInstruction* phi = &bc->function->code[def];
+    if (loop < 0 || phi->phiCount != 2 || SingleLatch(cfg, loop) < 0) {
+        return -1;
+    }
+
+    int latchLabel = BlockLabel(cfg, SingleLatch(cfg, loop));
+    int back = phi->phiArgs[0].pred == latchLabel ? 0 : 1;
+    int base;
+    if (phi->phiArgs[back].pred != latchLabel || phi->phiArgs[1 - back].pred == latchLabel ||
+        !SplitOffset(bc, phi->phiArgs[back].value, &base, step) || base != var || *step == 0) {
+        return -1;
+    }
+
+    *init = phi->phiArgs[1 - back].value;
+    return loop;
+}
+
+static int ValueRange(const BoundsChecker* bc, TACOperand operand, int block, long long* lo, long long* hi,
+                      int depth);
+
+/**
+ * @brief Finds the values a loop counter can have in a block of its loop's body
+ *
+ * Every time the body runs, the header has just compared the counter with
+ * the bound and found it on the right side, and the counter only moves
+ * towards the bound from where it started. Loops whose counter could wrap
+ * around before failing the test are left alone.
+ *
+ * @param var The header phi
+ * @param block A block of the loop other than its header
+ * @param lo Receives the smallest value
+ * @param hi Receives the largest value, below lo if the body never runs
+ * @return 1 if the range is known, 0 otherwise
+ */
+static int CounterRange(const BoundsChecker* bc, int var, int block, long long* lo, long long* hi, int depth) {
+    TACOperand init;
+    TACOperand bound;
+    TACOpcode op;
+    long long step;
+    long long initLo, initHi, boundLo, boundHi;
+
+    int loop = CounterLoop(bc, var, &init, &step);
+    if (loop < 0 || block == bc->cfg->loops[loop].header || !LoopContains(bc->cfg, loop, block) ||
+        !HeaderTest(bc, loop, var, &op, &bound)) {
+        return 0;
+    }
+
+    int header = bc->cfg->loops[loop].header;
+    if (!ValueRange(bc, init, header, &initLo, &initHi, depth + 1) ||
+        !ValueRange(bc, bound, header, &boundLo, &boundHi, depth + 1)) {
+        return 0;
+    }
+    int exact = initLo == initHi && boundLo == boundHi;
+
+    if (step > 0 && (op == TAC_LT || op == TAC_LE)) {
+        long long last = op == TAC_LT ? boundHi - 1 : boundHi;
+        if (last + step > INT_MAX) {
+            return 0;
+        }
+        // With constant ends, the counter stops at the last multiple of the step short of the bound
+        if (exact && last >= initLo) {
+            last = initLo + (last - initLo) / step * step;
+        }
+        *lo = initLo;
+        *hi = last;
+        return 1;
+    }
+    if (step < 0 && (op == TAC_GT || op == TAC_GE)) {
+        long long last = op == TAC_GT ? boundLo + 1 : boundLo;
+        if (last + step < INT_MIN) {
+            return 0;
+        }
+        if (exact && last <= initHi) {
+            last = initHi - (initHi - last) / -step * -step;
+        }
+        *lo = last;
+        *hi = initHi;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the values an integer operand can have in a block
+ *
+ * @param lo Receives the smallest value
+ * @param hi Receives the largest value, below lo if the block never runs
+ * @return 1 if the range is known, 0 otherwise
+ */
+static int ValueRange(const BoundsChecker* bc, TACOperand operand, int block, long long* lo, long long* hi,
+                      int depth) {
+    int base;
+    long long offset;
+    if (depth > MAX_RANGE_DEPTH || !SplitOffset(bc, operand, &base, &offset)) {
+        return 0;
+    }
+    if (base < 0) {
+        *lo = *hi = offset;
+        return 1;
+    }
+    if (!CounterRange(bc, base, block, lo, hi, depth)) {
+        return 0;
+    }
+    *lo += offset;
+    *hi += offset;
+    return 1;
+}
+
+/**
+ * @brief Checks whether an access can be seen to be in range at compile time
+ *
+ * That is when the index is a constant or a loop counter plus a constant
+ * whose whole range falls inside an array of known length.
+ */
+static int ProvenInRange(const BoundsChecker* bc, int index) {
+    TACInstruction* instr = &bc->function->code[index];
+    long long lo, hi;
+    if (!ValueRange(bc, AccessIndex(instr), bc->cfg->blockOf[index], &lo, &hi, 0)) {
+        return 0;
+    }
+    if (lo > hi) {
+        return 1;
+    }
+    long long length = ArrayLength(bc, AccessArray(instr), 0);
+    return lo >= 0 && hi < length;
+}
+
+/**
+ * @brief Checks whether an earlier access has already checked the same element
+ *
+ * Another access to the same array with the same index, which runs on every
+ * path to this one, has either failed its check or passed it, so this one
+ * would pass too. A load whose result is unused does not count, since code
+ * generation drops it along with its check.
+ */
+static int CheckedBefore(const BoundsChecker* bc, int index) {
+    TACInstruction* instr = &bc->function->code[index];
+    int block = bc->cfg->blockOf[index];
+    int base;
+    long long offset;
+    if (!SplitOffset(bc, AccessIndex(instr), &base, &offset)) {
+        return 0;
+    }
+
+    for (int a = 0; a < bc->accesses.count; a++) {
+        int other = bc->accesses.items[a];
+        TACInstruction* earlier = &bc->function->code[other];
+        int otherBlock = bc->cfg->blockOf[other];
+        int otherBase;
+        long long otherOffset;
+
+        int runsFirst = otherBlock == block ? other < index : Dominates(bc->cfg, otherBlock, block);
+        int checks = earlier->op == TAC_STORE_INDEX || earlier->inBounds ||
+                     bc->chains->uses[earlier->result.value.id].count > 0;
+        if (!runsFirst || !checks || !SameOperand(AccessArray(earlier), AccessArray(instr)) ||
+            !SplitOffset(bc, AccessIndex(earlier), &otherBase, &otherOffset)) {
+            continue;
+        }
+        if (otherBase == base && otherOffset == offset) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks whether a loop can have its checks done up front
+ *
+ * The body must run to the latch every time the header lets it in: no
+ * inner loop that might not finish, no way out but the header, and nothing
+ * that prints or can fail other than the element accesses themselves.
+ */
+static int IsGuardable(const BoundsChecker* bc, int loop) {
+    const CFG* cfg = bc->cfg;
+    const Loop* l = &cfg->loops[loop];
+
+    for (int m = 0; m < cfg->loopCount; m++) {
+        if (cfg->loops[m].parent == loop) {
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < l->blocks.count; i++) {
+        const BasicBlock* block = &cfg->blocks[l->blocks.items[i]];
+        for (int j = 0; j < block->succs.count; j++) {
+            if (l->blocks.items[i] != l->header && !LoopContains(cfg, loop, block->succs.items[j])) {
+                return 0;
+            }
+        }
+        for (int k = block->start; k < block->end; k++) {
+            TACInstruction* instr = &bc->function->code[k];
+            switch (instr->op) {
+            case TAC_PARAM:
+            case TAC_CALL:
+            case TAC_NEWARRAY:
+            case TAC_RETURN:
+            case TAC_VECLOOP:
+            case TAC_POP:
+            case TAC_PEEK:
+                return 0;
+            case TAC_DIV:
+            case TAC_MOD:
+                if (HasSideEffects(instr)) {
+                    return 0;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Replaces the checks of a counted loop by one per array before it
+ *
+ * In a loop running i from its start while i < n, one up at a time, an
+ * access to a[i + c] on every iteration reads each element from
+ * start + c to n - 1 + c. A guard in the preheader checks the extremes of
+ * all such accesses of an array at once, so none of them, nor any other
+ * access of the array whose offset lies in between, needs its own check.
+ *
+ * @return The number of accesses that no longer need a check
+ */
+static int GuardLoop(BoundsChecker* bc, int loop, PendingGuard* guards, int* guardCount) {
+    const CFG* cfg = bc->cfg;
+    const Loop* l = &cfg->loops[loop];
+    int latch = SingleLatch(cfg, loop);
+    int preheader = FindPreheader(cfg, loop);
+    int header = l->header;
+    int var = -1;
+    TACOperand init;
+    TACOperand bound;
+    TACOpcode op;
+    long long step;
+
+    if (latch < 0 || preheader < 0 || !IsGuardable(bc, loop)) {
+        return 0;
+    }
+    for (int i = cfg->blocks[header].start; i < cfg->blocks[header].end && var < 0; i++) {
+        TACInstruction* phi = &bc->function->code[i];
+        if (phi->op == TAC_PHI && CounterLoop(bc, phi->result.value.id, &init, &step) == loop && step == 1 &&
+            HeaderTest(bc, loop, phi->result.value.id, &op, &bound) && op == TAC_LT) {
+            var = phi->result.value.id;
+        }
+    }
+    if (var < 0 || !IsLoopInvariant(cfg, bc->chains, loop, bound)) {
+        return 0;
+    }
+
+    GuardRange* ranges = CheckedMalloc(bc->accesses.count * sizeof(GuardRange));
+    int rangeCount = 0;
+
+    // The guard covers the accesses that run every iteration; the others may share it afterwards
+    for (int pass = 0; pass < 2; pass++) {
+        for (int a = 0; a < bc->accesses.count; a++) {
+            int index = bc->accesses.items[a];
+            TACInstruction* instr = &bc->function->code[index];
+            int block = cfg->blockOf[index];
+            int base;
+            long long offset;
+            if (instr->inBounds || block == header || !LoopContains(cfg, loop, block) ||
+                !IsLoopInvariant(cfg, bc->chains, loop, AccessArray(instr)) ||
+                !SplitOffset(bc, AccessIndex(instr), &base, &offset) || base != var ||
+                llabs(offset) > MAX_GUARD_OFFSET) {
+                continue;
+            }
+
+            GuardRange* range = NULL;
+            for (int r = 0; r < rangeCount && range == NULL; r++) {
+                if (SameOperand(ranges[r].array, AccessArray(instr))) {
+                    range = &ranges[r];
+                }
+            }
+
+            if (pass == 0 && Dominates(cfg, block, latch)) {
+                if (range == NULL) {
+                    range = &ranges[rangeCount++];
+                    range->array = AccessArray(instr);
+                    range->low = range->high = offset;
+                }
+                range->low = offset < range->low ? offset : range->low;
+                range->high = offset > range->high ? offset : range->high;
+            } else if (pass == 1 && range != NULL && offset >= range->low && offset <= range->high) {
+                instr->inBounds = 1;
+                bc->proven++;
+            }
+        }
+    }
+
+    int insertAt = PreheaderInsertIndex(bc->function, cfg, preheader);
+    for (int r = 0; r < rangeCount; r++) {
+        PendingGuard* guard = &guards[(*guardCount)++];
+        guard->index = insertAt;
+        guard->order = *guardCount;
+        memset(&guard->instr, 0, sizeof(TACInstruction));
+        guard->instr.op = TAC_CHECKBOUNDS;
+        guard->instr.arg1 = IntOperand((int)ranges[r].low);
+        guard->instr.arg2 = IntOperand((int)ranges[r].high);
+        guard->instr.result = NoOperand();
+        guard->instr.phiArgs = CheckedMalloc(3 * sizeof(TACPhiArg));
+        guard->instr.phiCount = 3;
+        guard->instr.phiArgs[0].value = ranges[r].array;
+        guard->instr.phiArgs[1].value = init;
+        guard->instr.phiArgs[2].value = bound;
+        for (int k = 0; k < 3; k++) {
+            guard->instr.phiArgs[k].pred = -1;
+        }
+    }
+
+    free(ranges);
+    return rangeCount;
+}
+
+static int CompareGuards(const void* a, const void* b) {
+    const PendingGuard* x = a;
+    const PendingGuard* y = b;
+    return x->index != y->index ? y->index - x->index : y->order - x->order;
+}
+
+/**
+ * @brief Removes the bounds checks of element accesses that cannot fail
+ *
+ * An access is left unchecked when its index is known to be in range at
+ * compile time, when an access to the same element has been checked on
+ * every path to it, or when it runs on every iteration of a counted loop,
+ * whose checks are then done once by a checkbounds guard before the loop.
+ * The guard fails exactly when one of the accesses it covers would have,
+ * so the program still stops with the same error, just before the loop
+ * rather than in it. This runs last, so nothing removes a check another
+ * access relies on.
+ *
+ * @param function The function, in SSA form
+ * @return The number of accesses that no longer need a check
+ */
+int RunBoundsCheckElimination(TACFunction* function) {
+    InsertPreheaders(function);
+
+    CFG cfg = AnalyzeCFG(function);
+    DefUseChains chains = BuildDefUseChains(function);
+    BoundsChecker bc;
+    memset(&bc, 0, sizeof(BoundsChecker));
+    bc.function = function;
+    bc.cfg = &cfg;
+    bc.chains = &chains;
+
+    for (int i = 0; i < function->count; i++) {
+        TACOpcode op = function->code[i].op;
+        if ((op == TAC_LOAD_INDEX || op == TAC_STORE_INDEX) && IsReachable(&cfg, cfg.blockOf[i])) {
+            IntListPush(&bc.accesses, i);
+        }
+    }
+
+    for (int a = 0; a < bc.accesses.count; a++) {
+        TACInstruction* instr = &function->code[bc.accesses.items[a]];
+        if (ProvenInRange(&bc, bc.accesses.items[a])) {
+            instr->inBounds = 1;
+            bc.proven++;
+        }
+    }
+
+    // Rather than a guard, a loop's accesses may be covered by a check that runs before it
+    for (int a = 0; a < bc.accesses.count; a++) {
+        TACInstruction* instr = &function->code[bc.accesses.items[a]];
+        if (!instr->inBounds && CheckedBefore(&bc, bc.accesses.items[a])) {
+            instr->inBounds = 1;
+            bc.proven++;
+        }
+    }
+
+    PendingGuard* guards = CheckedMalloc((bc.accesses.count + 1) * sizeof(PendingGuard));
+    int guardCount = 0;
+    for (int l = 0; l < cfg.loopCount; l++) {
+        GuardLoop(&bc, l, guards, &guardCount);
+    }
+
+    // From the last position back, so the earlier positions stay valid
+    qsort(guards, guardCount, sizeof(PendingGuard), CompareGuards);
+    for (int g = 0; g < guardCount; g++) {
+        InsertInstructions(function, guards[g].index, &guards[g].instr, 1);
+    }
+
+    free(guards);
+    IntListFree(&bc.accesses);
+    FreeDefUseChains(&chains);
+    FreeCFG(&cfg);
+    return bc.proven;
+}
@@ -0,0 +1,866 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "bytecode.h"
+#include "liveness.h"
+
+// Slots after the parameters for values converted on the way to an instruction
+#define SCRATCH_SLOTS 2
+
+// Slots after those that operands past BC_MAX_SLOTS are moved through, one per operand
+#define FAR_SLOTS 3
+
+// How an opcode uses its A, B and C operands
+#define READS_A 1
+#define WRITES_A 2
+#define READS_B 4
+#define READS_C 8
+
+typedef struct {
+    TACProgram* program;
+    BytecodeFunction* out;
+    TACFunction* function;
+
+    int* labelTargets;  // Label -> instruction index, -1 until placed
+    IntList jumpFixups; // Pairs of jump index and label
+    int* slots;         // Variable -> its frame slot
+    int scratch;        // First scratch slot
+    int far;            // First of the slots far operands are moved through
+    int* useCounts;     // Variable -> number of instructions reading it
+    int last;           // Index of the last instruction emitted, -1 if none
+    int lastLabel;      // Index the last label was placed at, -1 if none
+    ZaraString** strings; // String id -> its literal, shared by the whole program
+} Lowering;
+
+static const char* opcodeNames[BC_OPCODE_COUNT] = {
+    [BC_MOVE] = "move",           [BC_ITOF] = "itof",       [BC_FTOI] = "ftoi",
+    [BC_LOADFAR] = "loadfar",     [BC_STOREFAR] = "storefar",
+    [BC_ADDI] = "addi",           [BC_SUBI] = "subi",       [BC_MULI] = "muli",
+    [BC_DIVI] = "divi",           [BC_MODI] = "modi",       [BC_ADDF] = "addf",
+    [BC_SUBF] = "subf",           [BC_MULF] = "mulf",       [BC_DIVF] = "divf",
+    [BC_LTI] = "lti",             [BC_LEI] = "lei",         [BC_GTI] = "gti",
+    [BC_GEI] = "gei",             [BC_EQI] = "eqi",         [BC_NEI] = "nei",
+    [BC_LTF] = "ltf",             [BC_LEF] = "lef",         [BC_GTF] = "gtf",
+    [BC_GEF] = "gef",             [BC_EQF] = "eqf",         [BC_NEF] = "nef",
+    [BC_NEWARRAY] = "newarray",   [BC_LOADINDEX] = "loadindex", [BC_STOREINDEX] = "storeindex",
+    [BC_NEWSTACK] = "newstack",   [BC_PUSH] = "push",       [BC_POP] = "pop",
+    [BC_PEEK] = "peek",           [BC_STACKSIZE] = "stacksize", [BC_CONCAT] = "concat",
+    [BC_STREQ] = "streq",
+    [BC_JUMP] = "jump",           [BC_JUMPIF] = "jumpif",   [BC_JUMPIFNOT] = "jumpifnot",
+    [BC_ARG] = "arg",             [BC_CALL] = "call",       [BC_RETURN] = "return",
+    [BC_PRINTI] = "printi",       [BC_PRINTF] = "printf",   [BC_PRINTS] = "prints",
+    [BC_PRINTA] = "printa",       [BC_PRINTK] = "printk",   [BC_PRINTEND] = "printend",
+    [BC_ADDIK] = "addik",
+    [BC_JLTI] = "jlti",           [BC_JLEI] = "jlei",       [BC_JGTI] = "jgti",
+    [BC_JGEI] = "jgei",           [BC_JEQI] = "jeqi",       [BC_JNEI] = "jnei",
+    [BC_MOVEJ] = "movej",
+};
+
+static const unsigned char operandUses[BC_OPCODE_COUNT] = {
+    [BC_MOVE] = WRITES_A | READS_B,           [BC_ITOF] = WRITES_A | READS_B,
+    [BC_FTOI] = WRITES_A | READS_B,           [BC_LOADFAR] = WRITES_A,
+    [BC_STOREFAR] = READS_A,
+    [BC_ADDI] = WRITES_A | READS_B | READS_C, [BC_SUBI] = WRITES_A | READS_B | READS_C,
+    [BC_MULI] = WRITES_A | READS_B | READS_C, [BC_DIVI] = WRITES_A | READS_B | READS_C,
+    [BC_MODI] = WRITES_A | READS_B | READS_C, [BC_ADDF] = WRITES_A | READS_B | READS_C,
+    [BC_SUBF] = WRITES_A | READS_B | READS_C, [BC_MULF] = WRITES_A | READS_B | READS_C,
+    [BC_DIVF] = WRITES_A | READS_B | READS_C, [BC_LTI] = WRITES_A | READS_B | READS_C,
+    [BC_LEI] = WRITES_A | READS_B | READS_C,  [BC_GTI] = WRITES_A | READS_B | READS_C,
+    [BC_GEI] = WRITES_A | READS_B | READS_C,  [BC_EQI] = WRITES_A | READS_B | READS_C,
+    [BC_NEI] = WRITES_A | READS_B | READS_C,  [BC_LTF] = WRITES_A | READS_B | READS_C,
+    [BC_LEF] = WRITES_A | READS_B | READS_C,  [BC_GTF] = WRITES_A | READS_B | READS_C,
+    [BC_GEF] = WRITES_A | READS_B | READS_C,  [BC_EQF] = WRITES_A | READS_B | READS_C,
+    [BC_NEF] = WRITES_A | READS_B | READS_C,
+    [BC_NEWARRAY] = WRITES_A | READS_B,       [BC_LOADINDEX] = WRITES_A | READS_B | READS_C,
+    [BC_STOREINDEX] = READS_A | READS_B | READS_C,
+    [BC_NEWSTACK] = WRITES_A,                 [BC_PUSH] = READS_A | READS_B,
+    [BC_POP] = WRITES_A | READS_B,            [BC_PEEK] = WRITES_A | READS_B,
+    [BC_STACKSIZE] = WRITES_A | READS_B,      [BC_CONCAT] = WRITES_A | READS_B | READS_C,
+    [BC_STREQ] = WRITES_A | READS_B | READS_C,
+    [BC_JUMPIF] = READS_A,                    [BC_JUMPIFNOT] = READS_A,
+    [BC_ARG] = READS_A,                       [BC_CALL] = WRITES_A,
+    [BC_RETURN] = READS_A,
+    [BC_PRINTI] = READS_A,                    [BC_PRINTF] = READS_A,
+    [BC_PRINTS] = READS_A,                    [BC_PRINTA] = READS_A,
+    [BC_PRINTK] = READS_A,
+    [BC_ADDIK] = WRITES_A | READS_B,          [BC_MOVEJ] = WRITES_A | READS_B,
+    [BC_JLTI] = READS_A | READS_B,            [BC_JLEI] = READS_A | READS_B,
+    [BC_JGTI] = READS_A | READS_B,            [BC_JGEI] = READS_A | READS_B,
+    [BC_JEQI] = READS_A | READS_B,            [BC_JNEI] = READS_A | READS_B,
+};
+
+const char* BytecodeOpcodeName(int op) {
+    return opcodeNames[op];
+}
+
+static int IsCompareBranch(int op) {
+    return op >= BC_JLTI && op <= BC_JNEI;
+}
+
+/**
+ * @brief Returns how many words an instruction takes, counting the offset word of a superinstruction that jumps
+ */
+int BytecodeWords(BytecodeInstr instr) {
+    return IsCompareBranch(BC_OP(instr)) || BC_OP(instr) == BC_MOVEJ ? 2 : 1;
+}
+
+static int EmitWord(Lowering* lower, BytecodeInstr word) {
+    BytecodeFunction* out = lower->out;
+
+    if (out->count == out->capacity) {
+        out->capacity = out->capacity == 0 ? 64 : out->capacity * 2;
+        out->code = CheckedRealloc(out->code, out->capacity * sizeof(BytecodeInstr));
+    }
+    out->code[out->count] = word;
+    return out->count++;
+}
+
+static void EmitFar(Lowering* lower, int op, int near, int far) {
+    lower->last = EmitWord(lower, (BytecodeInstr)op | (BytecodeInstr)near << 8 | (BytecodeInstr)far << 16);
+}
+
+/**
+ * @brief Emits an instruction, moving operands the instruction cannot name through the far slots
+ *
+ * Slots past BC_MAX_SLOTS are read into a far slot before the instruction
+ * and a result meant for one is written back after it.
+ *
+ * @return The index of the instruction itself
+ */
+static int Emit3(Lowering* lower, int op, int a, int b, int c) {
+    int uses = operandUses[op];
+    int writeBack = -1;
+
+    if ((uses & READS_A) && a >= BC_MAX_SLOTS) {
+        EmitFar(lower, BC_LOADFAR, lower->far, a);
+        a = lower->far;
+    } else if ((uses & WRITES_A) && a >= BC_MAX_SLOTS) {
+        writeBack = a;
+        a = lower->far;
+    }
+    if ((uses & READS_B) && b >= BC_MAX_SLOTS) {
+        EmitFar(lower, BC_LOADFAR, lower->far + 1, b);
+        b = lower->far + 1;
+    }
+    if ((uses & READS_C) && c >= BC_MAX_SLOTS) {
+        EmitFar(lower, BC_LOADFAR, lower->far + 2, c);
+        c = lower->far + 2;
+    }
+
+    int index = EmitWord(lower, (BytecodeInstr)op | (BytecodeInstr)a << 8 | (BytecodeInstr)b << 16 |
+                                    (BytecodeInstr)(c & 0xff) << 24);
+    lower->last = index;
+    if (writeBack >= 0) {
+        EmitFar(lower, BC_STOREFAR, lower->far, writeBack);
+    }
+    return index;
+}
+
+static int EmitBx(Lowering* lower, int op, int a, int bx) {
+    return Emit3(lower, op, a, bx & 0xff, (bx >> 8) & 0xff);
+}
+
+static void EmitJump(Lowering* lower, int op, int a, int label) {
+    int index = EmitBx(lower, op, a, 0);
+    IntListPush(&lower->jumpFixups, index);
+    IntListPush(&lower->jumpFixups, label);
+}
+
+static void EmitCompareBranch(Lowering* lower, int op, int a, int b, int label) {
+    int index = Emit3(lower, op, a, b, 0);
+    EmitWord(lower, 0);
+    IntListPush(&lower->jumpFixups, index);
+    IntListPush(&lower->jumpFixups, label);
+}
+
+/**
+ * @brief Emits a goto, folded into the move before it unless something jumps in between
+ *
+ * The copies SSA destruction leaves at the end of a loop body are followed
+ * by the jump back to its header.
+ */
+static void EmitGoto(Lowering* lower, int label) {
+    BytecodeFunction* out = lower->out;
+
+    if (lower->last >= 0 && lower->last == out->count - 1 && lower->lastLabel != out->count &&
+        BC_OP(out->code[lower->last]) == BC_MOVE) {
+        int index = lower->last;
+        out->code[index] = (out->code[index] & ~0xffu) | BC_MOVEJ;
+        EmitWord(lower, 0);
+        IntListPush(&lower->jumpFixups, index);
+        IntListPush(&lower->jumpFixups, label);
+        return;
+    }
+    EmitJump(lower, BC_JUMP, 0, label);
+}
+
+/**
+ * @brief Returns the frame slot holding a constant, adding it to the pool if it is new
+ */
+static int ConstantSlot(Lowering* lower, VMValue value, int isString) {
+    BytecodeFunction* out = lower->out;
+
+    for (int k = 0; k < out->constantCount; k++) {
+        if (memcmp(&out->constants[k], &value, sizeof(VMValue)) == 0 && out->stringConstants[k] == isString) {
+            return out->varCount + k;
+        }
+    }
+    if (out->varCount + out->constantCount >= BC_MAX_FRAME) {
+        fprintf(stderr, "Error: %s needs more than %d bytecode slots\n", lower->function->name, BC_MAX_FRAME);
+        exit(EXIT_FAILURE);
+    }
+    out->constants = CheckedRealloc(out->constants, (out->constantCount + 1) * sizeof(VMValue));
+    out->stringConstants = CheckedRealloc(out->stringConstants, out->constantCount + 1);
+    out->constants[out->constantCount] = value;
+    out->stringConstants[out->constantCount] = isString;
+    return out->varCount + out->constantCount++;
+}
+
+static int IntConstant(Lowering* lower, int value) {
+    VMValue constant;
+    memset(&constant, 0, sizeof(VMValue));
+    constant.i = value;
+    return ConstantSlot(lower, constant, 0);
+}
+
+/**
+ * @brief Returns the slot an instruction reads a TAC operand from
+ */
+static int Slot(Lowering* lower, TACOperand operand) {
+    VMValue constant;
+    memset(&constant, 0, sizeof(VMValue));
+
+    switch (operand.kind) {
+    case TAC_OPERAND_VAR:
+        return lower->slots[operand.value.id];
+    case TAC_OPERAND_INT:
+        return IntConstant(lower, operand.value.intValue);
+    case TAC_OPERAND_FLOAT:
+        constant.f = operand.value.floatValue;
+        return ConstantSlot(lower, constant, 0);
+    case TAC_OPERAND_STRING:
+        constant.p = lower->strings[operand.value.id];
+        return ConstantSlot(lower, constant, 1);
+    default:
+        return IntConstant(lower, 0);
+    }
+}
+
+/**
+ * @brief Returns the slot holding an operand as the given type, converting it into a scratch slot if needed
+ */
+static int ConvertedSlot(Lowering* lower, TACOperand operand, DataType type, int scratch) {
+    DataType from = OperandType(lower->function, operand);
+    int slot = Slot(lower, operand);
+
+    if (type == FLOAT && from != FLOAT) {
+        Emit3(lower, BC_ITOF, lower->scratch + scratch, slot, 0);
+        return lower->scratch + scratch;
+    }
+    if (type != FLOAT && from == FLOAT) {
+        Emit3(lower, BC_FTOI, lower->scratch + scratch, slot, 0);
+        return lower->scratch + scratch;
+    }
+    return slot;
+}
+
+/**
+ * @brief Moves a value of one type from a slot into a slot of another type
+ */
+static void StoreSlot(Lowering* lower, int from, DataType fromType, int to, DataType toType) {
+    if (toType == FLOAT && fromType != FLOAT) {
+        Emit3(lower, BC_ITOF, to, from, 0);
+    } else if (toType != FLOAT && fromType == FLOAT) {
+        Emit3(lower, BC_FTOI, to, from, 0);
+    } else if (from != to) {
+        Emit3(lower, BC_MOVE, to, from, 0);
+    }
+}
+
+static void LowerArithmetic(Lowering* lower, const TACInstruction* instr) {
+    static const int intOps[] = {BC_ADDI, BC_SUBI, BC_MULI, BC_DIVI, BC_MODI, BC_LTI, BC_LEI, BC_GTI, BC_GEI, BC_EQI,
+                                 BC_NEI};
+    static const int floatOps[] = {BC_ADDF, BC_SUBF, BC_MULF, BC_DIVF, -1, BC_LTF, BC_LEF, BC_GTF, BC_GEF, BC_EQF,
+                                   BC_NEF};
+    TACFunction* function = lower->function;
+    int result = instr->result.value.id;
+    int slot = lower->slots[result];
+    int isFloat = OperandType(function, instr->arg1) == FLOAT || OperandType(function, instr->arg2) == FLOAT;
+    int op = (isFloat ? floatOps : intOps)[instr->op - TAC_ADD];
+
+    if (op < 0) {
+        fprintf(stderr, "Error: %% is not defined for floats in %s\n", function->name);
+        exit(EXIT_FAILURE);
+    }
+
+    DataType operandType = isFloat ? FLOAT : INTEGER;
+    int a = ConvertedSlot(lower, instr->arg1, operandType, 0);
+    int b = ConvertedSlot(lower, instr->arg2, operandType, 1);
+    DataType produced = IsComparisonOp(instr->op) ? INTEGER : operandType;
+    DataType wanted = function->vars[result].type == FLOAT ? FLOAT : INTEGER;
+
+    // x + k and x - k with a small constant k take one operand less
+    if (!isFloat && produced == wanted && (instr->op == TAC_ADD || instr->op == TAC_SUB)) {
+        TACOperand value = instr->arg1;
+        TACOperand constant = instr->arg2;
+        if (instr->op == TAC_ADD && instr->arg1.kind == TAC_OPERAND_INT) {
+            value = instr->arg2;
+            constant = instr->arg1;
+        }
+        long long k = constant.value.intValue;
+        k = instr->op == TAC_SUB ? -k : k;
+        if (constant.kind == TAC_OPERAND_INT && k >= INT8_MIN && k <= INT8_MAX) {
+            Emit3(lower, BC_ADDIK, slot, Slot(lower, value), (int)k);
+            return;
+        }
+    }
+
+    if (produced == wanted) {
+        Emit3(lower, op, slot, a, b);
+    } else {
+        Emit3(lower, op, lower->scratch, a, b);
+        StoreSlot(lower, lower->scratch, produced, slot, wanted);
+    }
+}
+
+/**
+ * @brief Returns the call a parameter is passed to; the parameters of a call come right before it
+ */
+static int CallOfParam(TACFunction* function, int index) {
+    while (function->code[index].op == TAC_PARAM) {
+        index++;
+    }
+    return index;
+}
+
+static void LowerParam(Lowering* lower, int index) {
+    TACFunction* function = lower->function;
+    int call = CallOfParam(function, index);
+    const TACInstruction* instr = &function->code[call];
+    const char* name = lower->program->strings[instr->arg1.value.id];
+    TACFunction* callee = LookUpTACFunction(lower->program, name);
+
+    // The parameters of print are lowered with the call itself
+    if (callee == NULL) {
+        return;
+    }
+
+    // Arguments past the callee's parameters are never read
+    int k = instr->arg2.value.intValue - (call - index);
+    if (k < callee->paramCount) {
+        Emit3(lower, BC_ARG, ConvertedSlot(lower, function->code[index].arg1, callee->vars[k].type, 0), k, 0);
+    }
+}
+
+static void LowerPrint(Lowering* lower, int index) {
+    TACFunction* function = lower->function;
+    int argc = function->code[index].arg2.value.intValue;
+
+    for (int k = 0; k < argc; k++) {
+        TACOperand arg = function->code[index - argc + k].arg1;
+        int op;
+        int flag = 0;
+        switch (OperandType(function, arg)) {
+        case FLOAT:
+            op = BC_PRINTF;
+            break;
+        case STRING:
+            op = BC_PRINTS;
+            break;
+        case ARRAY:
+            op = BC_PRINTA;
+            flag = function->vars[arg.value.id].elementType == FLOAT;
+            break;
+        case STACK:
+            op = BC_PRINTK;
+            flag = function->vars[arg.value.id].elementType == FLOAT;
+            break;
+        default:
+            op = BC_PRINTI;
+            break;
+        }
+        Emit3(lower, op, Slot(lower, arg), flag, 0);
+    }
+    Emit3(lower, BC_PRINTEND, 0, 0, 0);
+}
+
+static void LowerCall(Lowering* lower, int index) {
+    TACFunction* function = lower->function;
+    const TACInstruction* instr = &function->code[index];
+    const char* name = lower->program->strings[instr->arg1.value.id];
+    TACFunction* callee = LookUpTACFunction(lower->program, name);
+    int result = TACDefinedVar(instr);
+    int slot = result >= 0 ? lower->slots[result] : -1;
+
+    if (callee == NULL && strcmp(name, "print") == 0) {
+        LowerPrint(lower, index);
+        if (result >= 0) {
+            Emit3(lower, BC_MOVE, slot, IntConstant(lower, 0), 0);
+        }
+        return;
+    }
+    if (callee == NULL) {
+        fprintf(stderr, "Error: call to undefined function %s in %s\n", name, function->name);
+        exit(EXIT_FAILURE);
+    }
+
+    int calleeIndex = (int)(callee - lower->program->functions);
+    DataType returned = callee->returnType == FLOAT ? FLOAT : INTEGER;
+    DataType wanted = result >= 0 && function->vars[result].type == FLOAT ? FLOAT : INTEGER;
+    if (result >= 0 && returned == wanted) {
+        EmitBx(lower, BC_CALL, slot, calleeIndex);
+    } else {
+        EmitBx(lower, BC_CALL, lower->scratch, calleeIndex);
+        if (result >= 0) {
+            StoreSlot(lower, lower->scratch, returned, slot, wanted);
+        }
+    }
+}
+
+/**
+ * @brief Lowers an integer comparison and the branch on it right after as one instruction
+ *
+ * Only when the branch is the one reader of the comparison, so its result
+ * never needs to be stored.
+ *
+ * @return Whether the pair was lowered
+ */
+static int LowerCompareBranch(Lowering* lower, int index) {
+    static const int branchOps[] = {BC_JLTI, BC_JLEI, BC_JGTI, BC_JGEI, BC_JEQI, BC_JNEI};
+    static const int negatedOps[] = {BC_JGEI, BC_JGTI, BC_JLEI, BC_JLTI, BC_JNEI, BC_JEQI};
+    TACFunction* function = lower->function;
+    const TACInstruction* instr = &function->code[index];
+
+    if (index + 1 >= function->count) {
+        return 0;
+    }
+    const TACInstruction* branch = &function->code[index + 1];
+    if ((branch->op != TAC_IF && branch->op != TAC_IFFALSE) || !SameOperand(branch->arg1, instr->result) ||
+        lower->useCounts[instr->result.value.id] != 1) {
+        return 0;
+    }
+    if (OperandType(function, instr->arg1) == FLOAT || OperandType(function, instr->arg2) == FLOAT) {
+        return 0;
+    }
+
+    int k = instr->op - TAC_LT;
+    EmitCompareBranch(lower, branch->op == TAC_IF ? branchOps[k] : negatedOps[k], Slot(lower, instr->arg1),
+                      Slot(lower, instr->arg2), branch->result.value.id);
+    return 1;
+}
+
+/**
+ * @brief Lowers pop, peek or size, converting the element into the result when their types differ
+ */
+static void LowerStackRead(Lowering* lower, const TACInstruction* instr) {
+    static const int ops[] = {BC_POP, BC_PEEK, BC_STACKSIZE};
+    TACFunction* function = lower->function;
+    int result = TACDefinedVar(instr);
+    int slot = result >= 0 ? lower->slots[result] : -1;
+    DataType from = instr->op == TAC_STACKSIZE ? INTEGER : function->vars[instr->arg1.value.id].elementType;
+    int to = result >= 0 && (function->vars[result].type == FLOAT) == (from == FLOAT) ? slot : lower->scratch;
+
+    Emit3(lower, ops[instr->op - TAC_POP], to, Slot(lower, instr->arg1), 0);
+    if (result >= 0 && to != slot) {
+        StoreSlot(lower, to, from, slot, function->vars[result].type);
+    }
+}
+
+/**
+ * @brief Lowers the instruction at index
+ *
+ * @return How many instructions were lowered, two when a comparison was fused with its branch
+ */
+static int LowerInstruction(Lowering* lower, int index) {
+    TACFunction* function = lower->function;
+    const TACInstruction* instr = &function->code[index];
+    int result = TACDefinedVar(instr);
+    int slot = result >= 0 ? lower->slots[result] : -1;
+
+    switch (instr->op) {
+    case TAC_NOP:
+        break;
+    case TAC_ASSIGN:
+        StoreSlot(lower, Slot(lower, instr->arg1), OperandType(function, instr->arg1), slot,
+                  function->vars[result].type);
+        break;
+    case TAC_LT:
+    case TAC_LE:
+    case TAC_GT:
+    case TAC_GE:
+    case TAC_EQ:
+    case TAC_NE:
+        if (LowerCompareBranch(lower, index)) {
+            return 2;
+        }
+        LowerArithmetic(lower, instr);
+        break;
+    case TAC_ADD:
+    case TAC_SUB:
+    case TAC_MUL:
+    case TAC_DIV:
+    case TAC_MOD:
+        LowerArithmetic(lower, instr);
+        break;
+    case TAC_NEWARRAY:
+        Emit3(lower, BC_NEWARRAY, slot, ConvertedSlot(lower, instr->arg1, INTEGER, 0), 0);
+        break;
+    case TAC_LOAD_INDEX:
+        Emit3(lower, BC_LOADINDEX, slot, Slot(lower, instr->arg1), ConvertedSlot(lower, instr->arg2, INTEGER, 0));
+        break;
+    case TAC_STORE_INDEX:
+        Emit3(lower, BC_STOREINDEX, Slot(lower, instr->result), ConvertedSlot(lower, instr->arg1, INTEGER, 0),
+              ConvertedSlot(lower, instr->arg2, function->vars[instr->result.value.id].elementType, 1));
+        break;
+    case TAC_NEWSTACK:
+        Emit3(lower, BC_NEWSTACK, slot, 0, 0);
+        break;
+    case TAC_PUSH:
+        Emit3(lower, BC_PUSH, Slot(lower, instr->arg1),
+              ConvertedSlot(lower, instr->arg2, function->vars[instr->arg1.value.id].elementType, 0), 0);
+        break;
+    case TAC_POP:
+    case TAC_PEEK:
+    case TAC_STACKSIZE:
+        LowerStackRead(lower, instr);
+        break;
+    case TAC_CONCAT:
+    case TAC_STREQ:
+        Emit3(lower, instr->op == TAC_CONCAT ? BC_CONCAT : BC_STREQ, slot, Slot(lower, instr->arg1),
+              Slot(lower, instr->arg2));
+        break;
+    case TAC_LABEL:
+        lower->labelTargets[instr->result.value.id] = lower->out->count;
+        lower->lastLabel = lower->out->count;
+        break;
+    case TAC_GOTO:
+        EmitGoto(lower, instr->result.value.id);
+        break;
+    case TAC_IF:
+    case TAC_IFFALSE:
+        EmitJump(lower, instr->op == TAC_IF ? BC_JUMPIF : BC_JUMPIFNOT, ConvertedSlot(lower, instr->arg1, INTEGER, 0),
+                 instr->result.value.id);
+        break;
+    case TAC_PARAM:
+        LowerParam(lower, index);
+        break;
+    case TAC_CALL:
+        LowerCall(lower, index);
+        break;
+    case TAC_RETURN:
+        if (instr->arg1.kind == TAC_OPERAND_NONE) {
+            Emit3(lower, BC_RETURN, IntConstant(lower, 0), 0, 0);
+        } else {
+            DataType type = function->returnType == FLOAT ? FLOAT : INTEGER;
+            Emit3(lower, BC_RETURN, ConvertedSlot(lower, instr->arg1, type, 0), 0, 0);
+        }
+        break;
+    case TAC_VECLOOP:
+        // The VM has no vector registers, so the scalar loop after it runs every iteration
+        StoreSlot(lower, IntConstant(lower, 0), INTEGER, slot, INTEGER);
+        break;
+    case TAC_VECREDUCE:
+        StoreSlot(lower, Slot(lower, instr->arg1), OperandType(function, instr->arg1), slot,
+                  function->vars[result].type);
+        break;
+    case TAC_CHECKBOUNDS:
+        // Element accesses stay checked here, since bytecode may come back from the cache, and the
+        // loop a guard covers does nothing visible before the access that fails in its place
+        break;
+    case TAC_PHI:
+        fprintf(stderr, "Error: %s is still in SSA form and cannot be lowered to bytecode\n", function->name);
+        exit(EXIT_FAILURE);
+    }
+    return 1;
+}
+
+/**
+ * @brief Gives every variable a frame slot, sharing slots between variables never live at the same time
+ *
+ * The parameters keep the slots the caller writes the arguments to, and
+ * the scratch and far slots come right after them, so all of those stay
+ * within reach of every instruction. The other variables are packed by a
+ * linear scan over their live intervals: a slot is handed on once the
+ * interval holding it has ended, so a long function needs about as many
+ * slots as it has values live at once rather than one per temporary. A
+ * variable read and one written by the same instruction may share a slot,
+ * since every instruction reads its operands before it writes.
+ *
+ * @return The number of slots before the constants
+ */
+static int AssignSlots(Lowering* lower) {
+    TACFunction* function = lower->function;
+    Liveness liveness = ComputeLiveness(function);
+    int* order = CheckedMalloc((function->varCount + 1) * sizeof(int));
+    int* slotEnds = CheckedMalloc((function->varCount + 1) * sizeof(int));
+    int first = function->paramCount + SCRATCH_SLOTS + FAR_SLOTS;
+    int slotCount = 0;
+    int count = 0;
+
+    for (int v = 0; v < function->varCount; v++) {
+        const LiveInterval* interval = &liveness.intervals[v];
+        if (v < function->paramCount) {
+            lower->slots[v] = v;
+        } else if (interval->rangeCount == 0) {
+            // Never read or written, so never lowered either
+            lower->slots[v] = 0;
+        } else {
+            // Insertion sort by start; variables mostly come in order already
+            int i = count++;
+            for (; i > 0 && IntervalStart(&liveness.intervals[order[i - 1]]) > IntervalStart(interval); i--) {
+                order[i] = order[i - 1];
+            }
+            order[i] = v;
+        }
+    }
+
+    for (int k = 0; k < count; k++) {
+        const LiveInterval* interval = &liveness.intervals[order[k]];
+        int s = 0;
+        while (s < slotCount && slotEnds[s] > IntervalStart(interval)) {
+            s++;
+        }
+        if (s == slotCount) {
+            slotCount++;
+        }
+        slotEnds[s] = IntervalEnd(interval);
+        lower->slots[order[k]] = first + s;
+    }
+
+    free(order);
+    free(slotEnds);
+    FreeLiveness(&liveness);
+    return first + slotCount;
+}
+
+static BytecodeFunction LowerFunction(TACProgram* program, TACFunction* function, ZaraString** strings) {
+    BytecodeFunction out;
+    memset(&out, 0, sizeof(BytecodeFunction));
+    out.name = function->name;
+    out.source = function;
+    out.paramCount = function->paramCount;
+
+    // Arguments are written to the parameters by an operand byte, and the scratch and far slots follow them
+    if (function->paramCount + SCRATCH_SLOTS + FAR_SLOTS > BC_MAX_SLOTS) {
+        fprintf(stderr, "Error: %s has more parameters than bytecode can pass\n", function->name);
+        exit(EXIT_FAILURE);
+    }
+
+    Lowering lower = {program, &out, function, NULL, {NULL, 0, 0}, NULL, 0, 0, NULL, -1, -1, strings};
+    lower.slots = CheckedMalloc((function->varCount + 1) * sizeof(int));
+    lower.scratch = function->paramCount;
+    lower.far = lower.scratch + SCRATCH_SLOTS;
+    out.varCount = AssignSlots(&lower);
+    if (out.varCount > BC_MAX_FRAME) {
+        fprintf(stderr, "Error: %s needs more than %d bytecode slots\n", function->name, BC_MAX_FRAME);
+        exit(EXIT_FAILURE);
+    }
+    lower.labelTargets = CheckedMalloc((function->labelCount + 1) * sizeof(int));
+    for (int l = 0; l < function->labelCount; l++) {
+        lower.labelTargets[l] = -1;
+    }
+    lower.useCounts = CheckedCalloc(function->varCount + 1, sizeof(int));
+    for (int i = 0; i < function->count; i++) {
+        for (int k = 0; k < TACUseCount(&function->code[i]); k++) {
+            TACOperand* use = TACUseAt(&function->code[i], k);
+            if (use->kind == TAC_OPERAND_VAR) {
+                lower.useCounts[use->value.id]++;
+            }
+        }
+    }
+
+    for (int i = 0; i < function->count;) {
+        i += LowerInstruction(&lower, i);
+    }
+    int lastOp = lower.last >= 0 ? (int)BC_OP(out.code[lower.last]) : -1;
+    int fallsOff = lastOp != BC_RETURN && lastOp != BC_MOVEJ;
+    for (int l = 0; l < function->labelCount; l++) {
+        fallsOff |= lower.labelTargets[l] == out.count;
+    }
+    if (fallsOff) {
+        Emit3(&lower, BC_RETURN, IntConstant(&lower, 0), 0, 0);
+    }
+    out.frameSize = out.varCount + out.constantCount;
+
+    for (int f = 0; f < lower.jumpFixups.count; f += 2) {
+        int index = lower.jumpFixups.items[f];
+        int target = lower.labelTargets[lower.jumpFixups.items[f + 1]];
+        if (BytecodeWords(out.code[index]) == 2 && target >= 0) {
+            out.code[index + 1] = (BytecodeInstr)(target - (index + 2));
+            continue;
+        }
+        int offset = target - (index + 1);
+        if (target < 0 || offset < INT16_MIN || offset > INT16_MAX) {
+            fprintf(stderr, "Error: jump in %s is out of bytecode range\n", function->name);
+            exit(EXIT_FAILURE);
+        }
+        out.code[index] = (out.code[index] & 0xffff) | (BytecodeInstr)(offset & 0xffff) << 16;
+    }
+
+    free(lower.slots);
+    free(lower.labelTargets);
+    free(lower.useCounts);
+    IntListFree(&lower.jumpFixups);
+    return out;
+}
+
+/**
+ * @brief Lowers a program to register-based bytecode for the interpreter
+ *
+ * Variables get slots of the frame, shared between those never live at the
+ * same time, and the constants a function uses get slots after them, so
+ * every operand is a slot index. Slots past what an operand byte can name
+ * are moved in and out with loadfar and storefar. Types are
+ * resolved here: arithmetic picks its integer or float form, conversions
+ * become instructions of their own, and print becomes one instruction per
+ * argument. The program must be out of SSA form.
+ *
+ * The pairs that dominate loops are lowered as superinstructions: adding a
+ * small constant, an integer comparison with the branch on it, and the last
+ * copy of a loop body with the jump back to the header.
+ *
+ * @param program The program, whose function indices the calls use
+ * @return The bytecode, to be freed with FreeBytecodeProgram
+ */
+BytecodeProgram LowerProgram(TACProgram* program) {
+    BytecodeProgram bytecode;
+    bytecode.functionCount = program->functionCount;
+    bytecode.functions = CheckedCalloc(program->functionCount + 1, sizeof(BytecodeFunction));
+    bytecode.mainFunction = -1;
+    bytecode.image = NULL;
+    bytecode.imageSize = 0;
+
+    if (program->functionCount > UINT16_MAX) {
+        fprintf(stderr, "Error: too many functions for bytecode\n");
+        exit(EXIT_FAILURE);
+    }
+    // Every literal is made once, with its hash, and shared by the functions using it
+    bytecode.stringCount = program->stringCount;
+    bytecode.strings = CheckedCalloc(program->stringCount + 1, sizeof(ZaraString*));
+    for (int s = 0; s < program->stringCount; s++) {
+        bytecode.strings[s] = zara_new_string(program->strings[s], strlen(program->strings[s]));
+    }
+    for (int f = 0; f < program->functionCount; f++) {
+        bytecode.functions[f] = LowerFunction(program, &program->functions[f], bytecode.strings);
+        if (strcmp(program->functions[f].name, "main") == 0) {
+            bytecode.mainFunction = f;
+        }
+    }
+    return bytecode;
+}
+
+void FreeBytecodeProgram(BytecodeProgram* program) {
+    if (program->image != NULL) {
+        munmap(program->image, program->imageSize);
+        program->image = NULL;
+    } else {
+        for (int f = 0; f < program->functionCount; f++) {
+            free(program->functions[f].code);
+            free(program->functions[f].constants);
+            free(program->functions[f].stringConstants);
+        }
+        for (int s = 0; s < program->stringCount; s++) {
+            free(program->strings[s]);
+        }
+    }
+    free(program->strings);
+    program->strings = NULL;
+    program->stringCount = 0;
+    free(program->functions);
+    program->functions = NULL;
+    program->functionCount = 0;
+}
+
+static void PrintSlot(const BytecodeFunction* function, int slot) {
+    int scratch = function->paramCount;
+    if (slot < scratch && function->source != NULL) {
+        printf(" %s", function->source->vars[slot].name);
+    } else if (slot >= scratch && slot < scratch + SCRATCH_SLOTS + FAR_SLOTS) {
+        printf(" s%d", slot - scratch);
+    } else if (slot < function->varCount) {
+        printf(" r%d", slot);
+    } else {
+        printf(" k%d", slot - function->varCount);
+    }
+}
+
+void PrintBytecode(const BytecodeProgram* program) {
+    for (int f = 0; f < program->functionCount; f++) {
+        const BytecodeFunction* function = &program->functions[f];
+        printf("%s: %d slots, %d constants\n", function->name, function->frameSize,
+               function->constantCount);
+        for (int i = 0; i < function->count; i += BytecodeWords(function->code[i])) {
+            BytecodeInstr instr = function->code[i];
+            int op = BC_OP(instr);
+            printf("  %4d  %-10s", i, opcodeNames[op]);
+            switch (op) {
+            case BC_JUMP:
+                printf(" %d", i + 1 + BC_SBX(instr));
+                break;
+            case BC_JUMPIF:
+            case BC_JUMPIFNOT:
+                PrintSlot(function, BC_A(instr));
+                printf(" %d", i + 1 + BC_SBX(instr));
+                break;
+            case BC_CALL:
+                PrintSlot(function, BC_A(instr));
+                printf(" %s", program->functions[BC_BX(instr)].name);
+                break;
+            case BC_ARG:
+                PrintSlot(function, BC_A(instr));
+                printf(" #%d", BC_B(instr));
+                break;
+            case BC_RETURN:
+            case BC_PRINTI:
+            case BC_PRINTF:
+            case BC_PRINTS:
+            case BC_PRINTA:
+            case BC_PRINTK:
+                PrintSlot(function, BC_A(instr));
+                break;
+            case BC_LOADFAR:
+            case BC_STOREFAR:
+                PrintSlot(function, BC_A(instr));
+                PrintSlot(function, BC_BX(instr));
+                break;
+            case BC_PRINTEND:
+                break;
+            case BC_ADDIK:
+                PrintSlot(function, BC_A(instr));
+                PrintSlot(function, BC_B(instr));
+                printf(" %d", BC_SC(instr));
+                break;
+            case BC_JLTI:
+            case BC_JLEI:
+            case BC_JGTI:
+            case BC_JGEI:
+            case BC_JEQI:
+            case BC_JNEI:
+                PrintSlot(function, BC_A(instr));
+                PrintSlot(function, BC_B(instr));
+                printf(" %d", i + 2 + (int32_t)function->code[i + 1]);
+                break;
+            case BC_MOVEJ:
+                PrintSlot(function, BC_A(instr));
+                PrintSlot(function, BC_B(instr));
+                printf(" %d", i + 2 + (int32_t)function->code[i + 1]);
+                break;
+            case BC_MOVE:
+            case BC_ITOF:
+            case BC_FTOI:
+            case BC_NEWARRAY:
+                PrintSlot(function, BC_A(instr));
+                PrintSlot(function, BC_B(instr));
+                break;
+            default:
+                PrintSlot(function, BC_A(instr));
+                PrintSlot(function, BC_B(instr));
+                PrintSlot(function, BC_C(instr));
+                break;
+            }
+            printf("\n");
+        }
+    }
+}
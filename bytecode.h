@@ -0,0 +1,139 @@
+#ifndef bytecode_h
+#define bytecode_h
+
+#include <stdint.h>
+
+#include "runtime.h"
+#include "tac.h"
+#include "util.h"
+
+// An instruction is one or two 32-bit words. The first holds the opcode in the
+// low byte, then the operands A, B and C a byte each. Operands name slots of the
+// function's frame, except that jumps keep a signed 16-bit offset from the next
+// instruction in B and C together, and calls the function index there. Slots
+// past the first BC_MAX_SLOTS are only reached by loadfar and storefar, which
+// take theirs in Bx. movej and the compare-and-jump superinstructions are
+// followed by a second word, a signed 32-bit offset from the word after it, so
+// code is walked with BytecodeWords rather than one word at a time.
+typedef uint32_t BytecodeInstr;
+
+#define BC_OP(instr) ((instr) & 0xff)
+#define BC_A(instr) (((instr) >> 8) & 0xff)
+#define BC_B(instr) (((instr) >> 16) & 0xff)
+#define BC_C(instr) ((instr) >> 24)
+#define BC_BX(instr) ((instr) >> 16)
+#define BC_SBX(instr) ((int32_t)(instr) >> 16)
+#define BC_SC(instr) ((int32_t)(instr) >> 24)
+
+#define BC_MAX_SLOTS 256
+#define BC_MAX_FRAME 65536
+
+typedef enum {
+    BC_MOVE,           // A = B
+    BC_ITOF,           // A = (float)B
+    BC_FTOI,           // A = (int)B
+    BC_LOADFAR,        // A = slot Bx
+    BC_STOREFAR,       // slot Bx = A
+    BC_ADDI,           // A = B + C
+    BC_SUBI,
+    BC_MULI,
+    BC_DIVI,
+    BC_MODI,
+    BC_ADDF,
+    BC_SUBF,
+    BC_MULF,
+    BC_DIVF,
+    BC_LTI,            // A = B < C
+    BC_LEI,
+    BC_GTI,
+    BC_GEI,
+    BC_EQI,
+    BC_NEI,
+    BC_LTF,
+    BC_LEF,
+    BC_GTF,
+    BC_GEF,
+    BC_EQF,
+    BC_NEF,
+    BC_NEWARRAY,       // A = new array of B elements
+    BC_LOADINDEX,      // A = B[C]
+    BC_STOREINDEX,     // A[B] = C
+    BC_NEWSTACK,       // A = new empty stack
+    BC_PUSH,           // push B onto stack A
+    BC_POP,            // A = pop stack B
+    BC_PEEK,           // A = top of stack B
+    BC_STACKSIZE,      // A = number of elements on stack B
+    BC_CONCAT,         // A = string B joined with string C
+    BC_STREQ,          // A = 1 if strings B and C are equal
+    BC_JUMP,           // pc += sBx
+    BC_JUMPIF,         // if A, pc += sBx
+    BC_JUMPIFNOT,      // if !A, pc += sBx
+    BC_ARG,            // argument B of the next call = A
+    BC_CALL,           // A = call function Bx
+    BC_RETURN,         // return A
+    BC_PRINTI,         // print A as an integer
+    BC_PRINTF,
+    BC_PRINTS,
+    BC_PRINTA,         // print array A, of floats if B
+    BC_PRINTK,         // print stack A, of floats if B
+    BC_PRINTEND,       // end the printed line
+
+    // Superinstructions for the commonest pairs in loops. The jumping ones take
+    // a second word with the offset from the word after it
+    BC_ADDIK,          // A = B + sC, a signed 8-bit immediate
+    BC_MOVEJ,          // A = B, then pc += next word
+    BC_JLTI,           // if A < B, pc += next word
+    BC_JLEI,
+    BC_JGTI,
+    BC_JGEI,
+    BC_JEQI,
+    BC_JNEI,
+    BC_OPCODE_COUNT
+} BytecodeOpcode;
+
+typedef union {
+    int32_t i;
+    float f;
+    void* p;
+} VMValue;
+
+typedef struct {
+    const char* name;
+    TACFunction* source; // NULL when loaded from the cache
+
+    BytecodeInstr* code;
+    int count;
+    int capacity;
+
+    // Frame: the parameters, scratch slots, the slots variables share, then the constants,
+    // copied in on every call
+    VMValue* constants;
+    unsigned char* stringConstants; // Constant -> whether it points at a string literal
+    int constantCount;
+    int paramCount;
+    int varCount;       // Slots before the constants
+    int frameSize;
+} BytecodeFunction;
+
+typedef struct {
+    BytecodeFunction* functions;
+    int functionCount;
+    int mainFunction;  // Index of main, -1 if there is none
+
+    // String id -> the literal the constants point at, NULL when loaded from the cache
+    ZaraString** strings;
+    int stringCount;
+
+    // The mapped cache file the code and constants point into, NULL if they were lowered here
+    void* image;
+    size_t imageSize;
+} BytecodeProgram;
+
+BytecodeProgram LowerProgram(TACProgram* program);
+void FreeBytecodeProgram(BytecodeProgram* program);
+const char* BytecodeOpcodeName(int op);
+int BytecodeWords(BytecodeInstr instr);
+void PrintBytecode(const BytecodeProgram* program);
+int RunBytecode(const BytecodeProgram* program);
+
+#endif
@@ -0,0 +1,371 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#define CACHE_MAGIC "ZARABC\0"
+
+// Identifies the compiler release, so a newer compiler never reads what an older one cached. Bump
+// it whenever some program would lower or optimize to different bytecode, and with every bump of
+// CACHE_FORMAT_VERSION; unlike the build time, it stays the same when the same sources are rebuilt
+#define COMPILER_VERSION 3
+
+/*
+ * A cache file is one bytecode program laid out so it can be mapped and run
+ * in place: the header, a record per function, then the names, instructions
+ * and constants the records point at by offset. Constants that are strings
+ * hold the offset of their literal in the file, laid out as a ZaraString,
+ * until they are loaded.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t functionCount;
+    int32_t mainFunction;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t size;
+    uint64_t checksum;  // Of everything after the header
+} CacheHeader;
+
+typedef struct {
+    uint32_t name;
+    uint32_t code;
+    uint32_t count;
+    uint32_t constants;       // 8-byte aligned
+    uint32_t stringConstants;
+    uint32_t constantCount;
+    uint32_t paramCount;
+    uint32_t varCount;
+    uint32_t frameSize;
+    uint32_t reserved;
+} CacheFunction;
+
+typedef struct {
+    unsigned char* bytes;
+    size_t size;
+    size_t capacity;
+} ImageBuffer;
+
+static size_t Append(ImageBuffer* image, const void* bytes, size_t size, size_t align) {
+    while (image->size % align != 0) {
+        Append(image, "", 1, 1);
+    }
+    if (image->size + size > image->capacity) {
+        image->capacity = (image->size + size) * 2;
+        image->bytes = CheckedRealloc(image->bytes, image->capacity);
+    }
+    if (size > 0) {
+        memcpy(image->bytes + image->size, bytes, size);
+    }
+    image->size += size;
+    return image->size - size;
+}
+
+static unsigned long long Checksum(const unsigned char* bytes, size_t size) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static unsigned long long HashBytes(unsigned long long hash, const char* bytes) {
+    for (; *bytes != '\0'; bytes++) {
+        hash = (hash ^ (unsigned char)*bytes) * 0x100000001b3ULL;
+    }
+    // Keep the end of one string from running into the next
+    return (hash ^ 0xff) * 0x100000001b3ULL;
+}
+
+/**
+ * @brief Hashes what decides the compiled program: the source, the compiler and the flags it was run with
+ *
+ * @param source The source text
+ * @param flags The options that change the generated code, spelled out
+ * @return The key of the program's cache file (64-bit FNV-1a)
+ */
+unsigned long long CacheKey(const char* source, const char* flags) {
+    char version[32];
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+
+    snprintf(version, sizeof(version), "%d.%d", CACHE_FORMAT_VERSION, COMPILER_VERSION);
+    hash = HashBytes(hash, version);
+    hash = HashBytes(hash, flags);
+    return HashBytes(hash, source);
+}
+
+/**
+ * @brief Returns the cache directory, creating it if needed
+ *
+ * $ZARA_CACHE_DIR if it is set, otherwise zara under $XDG_CACHE_HOME or
+ * ~/.cache.
+ *
+ * @return The directory, or NULL if it cannot be created
+ */
+const char* CacheDirectory(void) {
+    static char path[4096];
+    const char* configured = getenv("ZARA_CACHE_DIR");
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    if (configured != NULL && configured[0] != '\0') {
+        snprintf(path, sizeof(path), "%s", configured);
+    } else if (xdg != NULL && xdg[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/zara", xdg);
+    } else if (home != NULL && home[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/.cache/zara", home);
+    } else {
+        return NULL;
+    }
+
+    // Create each missing directory along the path
+    for (char* slash = strchr(path + 1, '/');; slash = strchr(slash + 1, '/')) {
+        if (slash != NULL) {
+            *slash = '\0';
+        }
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            return NULL;
+        }
+        if (slash == NULL) {
+            break;
+        }
+        *slash = '/';
+    }
+    return path;
+}
+
+static void CachePath(char* path, size_t size, const char* directory, unsigned long long key) {
+    snprintf(path, size, "%s/%016llx.zbc", directory, key);
+}
+
+static int InImage(uint64_t offset, uint64_t length, uint64_t size) {
+    return offset <= size && length <= size - offset;
+}
+
+/**
+ * @brief Checks that the instructions of a function are known and their jumps, calls and far slots land somewhere
+ */
+static int ValidCode(const BytecodeInstr* code, uint32_t count, uint32_t frameSize, uint32_t functionCount) {
+    for (uint32_t i = 0; i < count; i += BytecodeWords(code[i])) {
+        int op = BC_OP(code[i]);
+        int64_t target = i;
+        if (op >= BC_OPCODE_COUNT || i + BytecodeWords(code[i]) > count) {
+            return 0;
+        }
+        if (op == BC_JUMP || op == BC_JUMPIF || op == BC_JUMPIFNOT) {
+            target = (int64_t)i + 1 + BC_SBX(code[i]);
+        } else if (BytecodeWords(code[i]) == 2) {
+            target = (int64_t)i + 2 + (int32_t)code[i + 1];
+        } else if (op == BC_CALL && BC_BX(code[i]) >= functionCount) {
+            return 0;
+        } else if ((op == BC_LOADFAR || op == BC_STOREFAR) && BC_BX(code[i]) >= frameSize) {
+            return 0;
+        }
+        if (target < 0 || target >= count) {
+            return 0;
+        }
+    }
+    return count > 0;
+}
+
+/**
+ * @brief Checks that every record of a mapped cache file stays inside it
+ */
+static int ValidImage(const unsigned char* image, size_t size, unsigned long long key) {
+    const CacheHeader* header = (const CacheHeader*)image;
+
+    if (size < sizeof(CacheHeader) || memcmp(header->magic, CACHE_MAGIC, 8) != 0 ||
+        header->version != CACHE_FORMAT_VERSION || header->key != key || header->size != size ||
+        !InImage(sizeof(CacheHeader), (uint64_t)header->functionCount * sizeof(CacheFunction), size) ||
+        header->mainFunction >= (int32_t)header->functionCount ||
+        header->checksum != Checksum(image + sizeof(CacheHeader), size - sizeof(CacheHeader))) {
+        return 0;
+    }
+
+    const CacheFunction* functions = (const CacheFunction*)(image + sizeof(CacheHeader));
+    for (uint32_t f = 0; f < header->functionCount; f++) {
+        const CacheFunction* function = &functions[f];
+        if (!InImage(function->code, (uint64_t)function->count * sizeof(BytecodeInstr), size) ||
+            !InImage(function->constants, (uint64_t)function->constantCount * sizeof(VMValue), size) ||
+            !InImage(function->stringConstants, function->constantCount, size) || function->name >= size ||
+            memchr(image + function->name, '\0', size - function->name) == NULL || function->code % 4 != 0 ||
+            function->constants % 8 != 0 || function->frameSize > BC_MAX_FRAME ||
+            function->paramCount > function->varCount ||
+            function->varCount + function->constantCount > function->frameSize ||
+            !ValidCode((const BytecodeInstr*)(image + function->code), function->count, function->frameSize,
+                       header->functionCount)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Checks that a string literal lies whole in an image, with the hash of its text
+ */
+static int ValidString(const unsigned char* image, size_t size, uint64_t offset) {
+    if (offset % 8 != 0 || !InImage(offset, sizeof(ZaraString), size)) {
+        return 0;
+    }
+
+    const ZaraString* string = (const ZaraString*)(image + offset);
+    return string->length >= 0 && string->buffer == NULL &&
+           InImage(offset + sizeof(ZaraString), (uint64_t)string->length + 1, size) &&
+           string->text[string->length] == '\0' && string->hash == zara_string_hash(string->text, string->length);
+}
+
+/**
+ * @brief Maps the cached bytecode for a key, if there is any
+ *
+ * The file is mapped privately and the program runs straight out of the
+ * mapping: only the string constants are rewritten, from offsets to
+ * addresses, so only the pages holding constants are ever copied.
+ *
+ * @param directory The cache directory
+ * @param key The key from CacheKey
+ * @param program Receives the program, to be freed with FreeBytecodeProgram
+ * @return Whether a valid cache file was found
+ */
+int LoadCachedBytecode(const char* directory, unsigned long long key, BytecodeProgram* program) {
+    char path[4200];
+    struct stat status;
+
+    CachePath(path, sizeof(path), directory, key);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &status) != 0 || status.st_size < (off_t)sizeof(CacheHeader)) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = status.st_size;
+    unsigned char* image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return 0;
+    }
+    if (!ValidImage(image, size, key)) {
+        munmap(image, size);
+        return 0;
+    }
+
+    const CacheHeader* header = (const CacheHeader*)image;
+    const CacheFunction* records = (const CacheFunction*)(image + sizeof(CacheHeader));
+    program->functionCount = header->functionCount;
+    program->mainFunction = header->mainFunction;
+    program->functions = CheckedCalloc(header->functionCount + 1, sizeof(BytecodeFunction));
+    program->image = image;
+    program->imageSize = size;
+    program->strings = NULL;
+    program->stringCount = 0;
+
+    for (uint32_t f = 0; f < header->functionCount; f++) {
+        const CacheFunction* record = &records[f];
+        BytecodeFunction* function = &program->functions[f];
+        function->name = (const char*)image + record->name;
+        function->source = NULL;
+        function->code = (BytecodeInstr*)(image + record->code);
+        function->count = record->count;
+        function->capacity = record->count;
+        function->constants = (VMValue*)(image + record->constants);
+        function->stringConstants = image + record->stringConstants;
+        function->constantCount = record->constantCount;
+        function->paramCount = record->paramCount;
+        function->varCount = record->varCount;
+        function->frameSize = record->frameSize;
+
+        for (int k = 0; k < function->constantCount; k++) {
+            if (function->stringConstants[k]) {
+                uint64_t offset = (uint64_t)(uintptr_t)function->constants[k].p;
+                if (!ValidString(image, size, offset)) {
+                    FreeBytecodeProgram(program);
+                    return 0;
+                }
+                function->constants[k].p = image + offset;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Writes a lowered program to the cache under a key
+ *
+ * The file is written under a temporary name and renamed into place, so a
+ * reader never sees half of one. Failing to write the cache is not an error.
+ *
+ * @param directory The cache directory
+ * @param key The key from CacheKey
+ * @param program The program, as LowerProgram returned it
+ */
+void StoreCachedBytecode(const char* directory, unsigned long long key, const BytecodeProgram* program) {
+    ImageBuffer image = {NULL, 0, 0};
+    CacheHeader header;
+    CacheFunction* records = CheckedCalloc(program->functionCount + 1, sizeof(CacheFunction));
+
+    memset(&header, 0, sizeof(CacheHeader));
+    Append(&image, &header, sizeof(CacheHeader), 8);
+    size_t recordStart = Append(&image, records, program->functionCount * sizeof(CacheFunction), 8);
+
+    for (int f = 0; f < program->functionCount; f++) {
+        const BytecodeFunction* function = &program->functions[f];
+        CacheFunction* record = &records[f];
+        record->name = Append(&image, function->name, strlen(function->name) + 1, 1);
+        record->code = Append(&image, function->code, function->count * sizeof(BytecodeInstr), 4);
+        record->count = function->count;
+        record->stringConstants = Append(&image, function->stringConstants, function->constantCount, 1);
+        record->constantCount = function->constantCount;
+        record->paramCount = function->paramCount;
+        record->varCount = function->varCount;
+        record->frameSize = function->frameSize;
+
+        // The literals first, so the constants can hold their offsets
+        VMValue* constants = CheckedMalloc((function->constantCount + 1) * sizeof(VMValue));
+        for (int k = 0; k < function->constantCount; k++) {
+            constants[k] = function->constants[k];
+            if (function->stringConstants[k]) {
+                const ZaraString* string = function->constants[k].p;
+                constants[k].p = (void*)(uintptr_t)Append(&image, string, sizeof(ZaraString) + string->length + 1, 8);
+            }
+        }
+        record->constants = Append(&image, constants, function->constantCount * sizeof(VMValue), 8);
+        free(constants);
+    }
+
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.version = CACHE_FORMAT_VERSION;
+    header.functionCount = program->functionCount;
+    header.mainFunction = program->mainFunction;
+    header.key = key;
+    header.size = image.size;
+    memcpy(image.bytes + recordStart, records, program->functionCount * sizeof(CacheFunction));
+    header.checksum = Checksum(image.bytes + sizeof(CacheHeader), image.size - sizeof(CacheHeader));
+    memcpy(image.bytes, &header, sizeof(CacheHeader));
+
+    char path[4200];
+    char temporary[4300];
+    CachePath(path, sizeof(path), directory, key);
+    snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long)getpid());
+    FILE* out = fopen(temporary, "wb");
+    if (out != NULL) {
+        int written = fwrite(image.bytes, 1, image.size, out) == image.size;
+        if (fclose(out) == 0 && written) {
+            rename(temporary, path);
+        } else {
+            remove(temporary);
+        }
+    }
+
+    free(image.bytes);
+    free(records);
+}
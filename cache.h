@@ -0,0 +1,14 @@
+#ifndef cache_h
+#define cache_h
+
+#include "bytecode.h"
+
+// Bumped whenever the layout of a cache file or the meaning of the bytecode changes
+#define CACHE_FORMAT_VERSION 5
+
+unsigned long long CacheKey(const char* source, const char* flags);
+const char* CacheDirectory(void);
+int LoadCachedBytecode(const char* directory, unsigned long long key, BytecodeProgram* program);
+void StoreCachedBytecode(const char* directory, unsigned long long key, const BytecodeProgram* program);
+
+#endif
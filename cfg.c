@@ -0,0 +1,588 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+
+/**
+ * @brief Adds an edge between two blocks, ignoring duplicates
+ *
+ * A conditional branch to the block that also follows it by fallthrough
+ * would otherwise produce two parallel edges.
+ *
+ * @param cfg The graph to modify
+ * @param from The source block
+ * @param to The target block
+ */
+static void AddEdge(CFG* cfg, int from, int to) {
+    if (to < 0 || IntListContains(&cfg->blocks[from].succs, to)) {
+        return;
+    }
+    IntListPush(&cfg->blocks[from].succs, to);
+    IntListPush(&cfg->blocks[to].preds, from);
+}
+
+/**
+ * @brief Numbers the reachable blocks in reverse postorder
+ *
+ * Uses an explicit stack so that deeply nested functions cannot overflow the
+ * C stack.
+ *
+ * @param cfg The graph to number
+ */
+static void ComputeReversePostorder(CFG* cfg) {
+    int n = cfg->blockCount;
+    int* visited = CheckedCalloc(n, sizeof(int));
+    int* stack = CheckedMalloc(n * sizeof(int));
+    int* nextSucc = CheckedCalloc(n, sizeof(int));
+    int* post = CheckedMalloc(n * sizeof(int));
+    int postCount = 0;
+    int top = 0;
+
+    stack[top++] = 0;
+    visited[0] = 1;
+
+    while (top > 0) {
+        int b = stack[top - 1];
+        BasicBlock* block = &cfg->blocks[b];
+
+        if (nextSucc[b] < block->succs.count) {
+            int s = block->succs.items[nextSucc[b]++];
+            if (!visited[s]) {
+                visited[s] = 1;
+                stack[top++] = s;
+            }
+        } else {
+            post[postCount++] = b;
+            top--;
+        }
+    }
+
+    cfg->rpo = CheckedMalloc(n * sizeof(int));
+    cfg->rpoCount = postCount;
+    for (int i = 0; i < postCount; i++) {
+        int b = post[postCount - 1 - i];
+        cfg->rpo[i] = b;
+        cfg->blocks[b].rpoIndex = i;
+    }
+
+    free(visited);
+    free(stack);
+    free(nextSucc);
+    free(post);
+}
+
+/**
+ * @brief Partitions a function's TAC into basic blocks and links them
+ *
+ * A block starts at the first instruction, at every label, and after every
+ * jump or return. Block 0 is always the entry block. The returned graph
+ * already carries predecessor and successor lists and a reverse postorder;
+ * dominators and loops are computed by the functions below.
+ *
+ * @param function The function to partition
+ * @return The control-flow graph of the function
+ */
+CFG BuildCFG(TACFunction* function) {
+    CFG cfg;
+    memset(&cfg, 0, sizeof(CFG));
+    cfg.function = function;
+
+    int n = function->count;
+    char* leader = CheckedCalloc(n + 1, sizeof(char));
+    leader[0] = 1;
+    for (int i = 0; i < n; i++) {
+        if (function->code[i].op == TAC_LABEL) {
+            leader[i] = 1;
+        }
+        if (EndsBlock(function->code[i].op)) {
+            leader[i + 1] = 1;
+        }
+    }
+
+    int count = 0;
+    for (int i = 0; i < n || (i == 0 && n == 0); i++) {
+        count += leader[i];
+    }
+
+    cfg.blocks = CheckedCalloc(count, sizeof(BasicBlock));
+    cfg.blockCount = count;
+    cfg.blockOf = CheckedMalloc((n + 1) * sizeof(int));
+    cfg.labelBlock = CheckedMalloc((function->labelCount + 1) * sizeof(int));
+    for (int i = 0; i < function->labelCount; i++) {
+        cfg.labelBlock[i] = -1;
+    }
+
+    int b = -1;
+    for (int i = 0; i < n || (i == 0 && n == 0); i++) {
+        if (leader[i]) {
+            b++;
+            cfg.blocks[b].start = i;
+            if (b > 0) {
+                cfg.blocks[b - 1].end = i;
+            }
+        }
+        cfg.blockOf[i] = b;
+        if (i < n && function->code[i].op == TAC_LABEL) {
+            cfg.labelBlock[function->code[i].result.value.id] = b;
+        }
+    }
+    cfg.blocks[count - 1].end = n;
+    free(leader);
+
+    for (int i = 0; i < count; i++) {
+        BasicBlock* block = &cfg.blocks[i];
+        block->rpoIndex = -1;
+        block->idom = -1;
+        block->domChild = -1;
+        block->domSibling = -1;
+        block->loop = -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        BasicBlock* block = &cfg.blocks[i];
+        int fallthrough = i + 1 < count ? i + 1 : -1;
+
+        if (block->end == block->start) {
+            AddEdge(&cfg, i, fallthrough);
+            continue;
+        }
+
+        TACInstruction* last = &function->code[block->end - 1];
+        switch (last->op) {
+        case TAC_GOTO:
+            AddEdge(&cfg, i, cfg.labelBlock[last->result.value.id]);
+            break;
+        case TAC_IF:
+        case TAC_IFFALSE:
+            AddEdge(&cfg, i, cfg.labelBlock[last->result.value.id]);
+            AddEdge(&cfg, i, fallthrough);
+            break;
+        case TAC_RETURN:
+            break;
+        default:
+            AddEdge(&cfg, i, fallthrough);
+            break;
+        }
+    }
+
+    ComputeReversePostorder(&cfg);
+    return cfg;
+}
+
+/**
+ * @brief Releases everything owned by a control-flow graph
+ *
+ * @param cfg The graph to free
+ */
+void FreeCFG(CFG* cfg) {
+    for (int i = 0; i < cfg->blockCount; i++) {
+        IntListFree(&cfg->blocks[i].preds);
+        IntListFree(&cfg->blocks[i].succs);
+        IntListFree(&cfg->blocks[i].frontier);
+    }
+    for (int i = 0; i < cfg->loopCount; i++) {
+        IntListFree(&cfg->loops[i].blocks);
+        IntListFree(&cfg->loops[i].latches);
+    }
+    free(cfg->blocks);
+    free(cfg->rpo);
+    free(cfg->blockOf);
+    free(cfg->labelBlock);
+    free(cfg->loops);
+    memset(cfg, 0, sizeof(CFG));
+}
+
+/**
+ * @brief Walks two blocks up the dominator tree until they meet
+ *
+ * @param cfg The graph being analyzed
+ * @param doms The dominators computed so far
+ * @param b1 The first block
+ * @param b2 The second block
+ * @return The nearest common dominator found so far
+ */
+static int Intersect(const CFG* cfg, const int* doms, int b1, int b2) {
+    while (b1 != b2) {
+        while (cfg->blocks[b1].rpoIndex > cfg->blocks[b2].rpoIndex) {
+            b1 = doms[b1];
+        }
+        while (cfg->blocks[b2].rpoIndex > cfg->blocks[b1].rpoIndex) {
+            b2 = doms[b2];
+        }
+    }
+    return b1;
+}
+
+/**
+ * @brief Computes immediate dominators and the dominator tree
+ *
+ * Implements the iterative algorithm of Cooper, Harvey and Kennedy ("A
+ * Simple, Fast Dominance Algorithm"): blocks are visited in reverse
+ * postorder and each one's dominator is the intersection of its processed
+ * predecessors' dominators. Reducible graphs converge in two passes. The
+ * tree is then numbered in pre- and postorder so Dominates runs in O(1).
+ *
+ * @param cfg The graph to analyze
+ */
+void ComputeDominators(CFG* cfg) {
+    int n = cfg->blockCount;
+    int* doms = CheckedMalloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        doms[i] = -1;
+    }
+    doms[0] = 0;
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int r = 1; r < cfg->rpoCount; r++) {
+            int b = cfg->rpo[r];
+            BasicBlock* block = &cfg->blocks[b];
+            int newIdom = -1;
+
+            for (int i = 0; i < block->preds.count; i++) {
+                int p = block->preds.items[i];
+                if (doms[p] == -1) {
+                    continue;
+                }
+                newIdom = newIdom == -1 ? p : Intersect(cfg, doms, p, newIdom);
+            }
+
+            if (doms[b] != newIdom) {
+                doms[b] = newIdom;
+                changed = 1;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        cfg->blocks[i].idom = i == 0 ? -1 : doms[i];
+        cfg->blocks[i].domChild = -1;
+        cfg->blocks[i].domSibling = -1;
+    }
+    free(doms);
+
+    // Link children in reverse so each child list ends up in reverse postorder
+    for (int r = cfg->rpoCount - 1; r > 0; r--) {
+        int b = cfg->rpo[r];
+        int parent = cfg->blocks[b].idom;
+        cfg->blocks[b].domSibling = cfg->blocks[parent].domChild;
+        cfg->blocks[parent].domChild = b;
+    }
+
+    int* stack = CheckedMalloc(n * sizeof(int));
+    int* entered = CheckedCalloc(n, sizeof(int));
+    int top = 0;
+    int pre = 0;
+    int post = 0;
+
+    for (int i = 0; i < n; i++) {
+        cfg->blocks[i].domPre = -1;
+        cfg->blocks[i].domPost = -1;
+    }
+
+    stack[top++] = 0;
+    while (top > 0) {
+        int b = stack[top - 1];
+        if (!entered[b]) {
+            entered[b] = 1;
+            cfg->blocks[b].domPre = pre++;
+            for (int c = cfg->blocks[b].domChild; c != -1; c = cfg->blocks[c].domSibling) {
+                stack[top++] = c;
+            }
+        } else {
+            cfg->blocks[b].domPost = post++;
+            top--;
+        }
+    }
+
+    free(stack);
+    free(entered);
+}
+
+/**
+ * @brief Computes the dominance frontier of every block
+ *
+ * For each join point, walks up from every predecessor to the join point's
+ * immediate dominator and adds the join point to the frontier of each block
+ * passed (Cooper, Harvey and Kennedy). A block is appended at most once
+ * per frontier since the runs for one join point are consecutive.
+ *
+ * @param cfg The graph to analyze; ComputeDominators must have run
+ */
+void ComputeDominanceFrontiers(CFG* cfg) {
+    for (int r = 0; r < cfg->rpoCount; r++) {
+        int b = cfg->rpo[r];
+        BasicBlock* block = &cfg->blocks[b];
+
+        if (block->preds.count < 2) {
+            continue;
+        }
+
+        for (int i = 0; i < block->preds.count; i++) {
+            int runner = block->preds.items[i];
+            if (!IsReachable(cfg, runner)) {
+                continue;
+            }
+
+            while (runner != -1 && runner != block->idom) {
+                IntList* frontier = &cfg->blocks[runner].frontier;
+                if (frontier->count == 0 || frontier->items[frontier->count - 1] != b) {
+                    IntListPush(frontier, b);
+                }
+                runner = cfg->blocks[runner].idom;
+            }
+        }
+    }
+}
+
+static int CompareLoopSize(const void* a, const void* b) {
+    const Loop* la = (const Loop*)a;
+    const Loop* lb = (const Loop*)b;
+    if (la->blocks.count != lb->blocks.count) {
+        return lb->blocks.count - la->blocks.count;
+    }
+    return la->header - lb->header;
+}
+
+/**
+ * @brief Finds the natural loops of a function and their nesting
+ *
+ * A back edge is an edge whose target dominates its source. All back edges
+ * into one header form a single loop, whose body is found by walking
+ * predecessors backwards from the latches until the header is reached.
+ * Loops are stored outermost first, and every block records the innermost
+ * loop containing it and its loop depth.
+ *
+ * @param cfg The graph to analyze; ComputeDominators must have run
+ */
+void FindNaturalLoops(CFG* cfg) {
+    int n = cfg->blockCount;
+    int* headerLoop = CheckedMalloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        headerLoop[i] = -1;
+    }
+
+    int capacity = 0;
+    cfg->loops = NULL;
+    cfg->loopCount = 0;
+
+    for (int r = 0; r < cfg->rpoCount; r++) {
+        int t = cfg->rpo[r];
+        BasicBlock* block = &cfg->blocks[t];
+
+        for (int i = 0; i < block->succs.count; i++) {
+            int h = block->succs.items[i];
+            if (!Dominates(cfg, h, t)) {
+                continue;
+            }
+
+            if (headerLoop[h] == -1) {
+                if (cfg->loopCount == capacity) {
+                    capacity = capacity == 0 ? 4 : capacity * 2;
+                    cfg->loops = CheckedRealloc(cfg->loops, capacity * sizeof(Loop));
+                }
+                Loop* loop = &cfg->loops[cfg->loopCount];
+                memset(loop, 0, sizeof(Loop));
+                loop->header = h;
+                loop->parent = -1;
+                headerLoop[h] = cfg->loopCount++;
+            }
+            IntListPush(&cfg->loops[headerLoop[h]].latches, t);
+        }
+    }
+
+    int* mark = CheckedMalloc(n * sizeof(int));
+    int* stack = CheckedMalloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        mark[i] = -1;
+    }
+
+    for (int l = 0; l < cfg->loopCount; l++) {
+        Loop* loop = &cfg->loops[l];
+        int top = 0;
+
+        mark[loop->header] = l;
+        IntListPush(&loop->blocks, loop->header);
+
+        for (int i = 0; i < loop->latches.count; i++) {
+            int latch = loop->latches.items[i];
+            if (mark[latch] != l) {
+                mark[latch] = l;
+                stack[top++] = latch;
+            }
+        }
+
+        while (top > 0) {
+            int b = stack[--top];
+            IntListPush(&loop->blocks, b);
+
+            BasicBlock* block = &cfg->blocks[b];
+            for (int i = 0; i < block->preds.count; i++) {
+                int p = block->preds.items[i];
+                if (mark[p] != l && IsReachable(cfg, p)) {
+                    mark[p] = l;
+                    stack[top++] = p;
+                }
+            }
+        }
+    }
+    free(mark);
+    free(stack);
+    free(headerLoop);
+
+    // Outer loops are strictly larger than the loops nested in them
+    if (cfg->loopCount > 1) {
+        qsort(cfg->loops, cfg->loopCount, sizeof(Loop), CompareLoopSize);
+    }
+
+    for (int l = 0; l < cfg->loopCount; l++) {
+        Loop* loop = &cfg->loops[l];
+        loop->parent = cfg->blocks[loop->header].loop;
+        loop->depth = loop->parent == -1 ? 1 : cfg->loops[loop->parent].depth + 1;
+
+        for (int i = 0; i < loop->blocks.count; i++) {
+            int b = loop->blocks.items[i];
+            cfg->blocks[b].loop = l;
+            cfg->blocks[b].loopDepth = loop->depth;
+        }
+    }
+}
+
+/**
+ * @brief Builds the control-flow graph of a function and runs every analysis on it
+ *
+ * @param function The function to analyze
+ * @return The graph with dominators, dominance frontiers and loops filled in
+ */
+CFG AnalyzeCFG(TACFunction* function) {
+    CFG cfg = BuildCFG(function);
+    ComputeDominators(&cfg);
+    ComputeDominanceFrontiers(&cfg);
+    FindNaturalLoops(&cfg);
+    return cfg;
+}
+
+/**
+ * @brief Checks whether block a dominates block b
+ *
+ * @param cfg The graph; ComputeDominators must have run
+ * @param a The candidate dominator
+ * @param b The dominated block
+ * @return 1 if every path from the entry to b passes through a, 0 otherwise
+ */
+int Dominates(const CFG* cfg, int a, int b) {
+    const BasicBlock* ba = &cfg->blocks[a];
+    const BasicBlock* bb = &cfg->blocks[b];
+    if (ba->domPre < 0 || bb->domPre < 0) {
+        return 0;
+    }
+    return ba->domPre <= bb->domPre && bb->domPost <= ba->domPost;
+}
+
+int IsReachable(const CFG* cfg, int block) {
+    return cfg->blocks[block].rpoIndex >= 0;
+}
+
+/**
+ * @brief Returns the label that starts a block
+ *
+ * @param cfg The graph
+ * @param block The block
+ * @return The label id, or -1 if the block is entered only by fallthrough
+ */
+int BlockLabel(const CFG* cfg, int block) {
+    const BasicBlock* b = &cfg->blocks[block];
+    if (b->start < b->end && cfg->function->code[b->start].op == TAC_LABEL) {
+        return cfg->function->code[b->start].result.value.id;
+    }
+    return -1;
+}
+
+/**
+ * @brief Checks whether a block lies inside a loop
+ *
+ * @param cfg The graph; FindNaturalLoops must have run
+ * @param loop The loop
+ * @param block The block
+ * @return 1 if the block is in the loop or a loop nested in it, 0 otherwise
+ */
+int LoopContains(const CFG* cfg, int loop, int block) {
+    for (int l = cfg->blocks[block].loop; l != -1; l = cfg->loops[l].parent) {
+        if (l == loop) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Deletes every block that cannot be reached from the entry
+ *
+ * @param function The function to clean up
+ * @return The number of instructions removed
+ */
+int RemoveUnreachableBlocks(TACFunction* function) {
+    CFG cfg = BuildCFG(function);
+    int removed = 0;
+
+    for (int b = 0; b < cfg.blockCount; b++) {
+        if (IsReachable(&cfg, b)) {
+            continue;
+        }
+        for (int i = cfg.blocks[b].start; i < cfg.blocks[b].end; i++) {
+            MakeNop(&function->code[i]);
+            removed++;
+        }
+    }
+    FreeCFG(&cfg);
+
+    if (removed > 0) {
+        RemoveNops(function);
+    }
+    return removed;
+}
+
+static void PrintBlockList(const char* title, const IntList* list) {
+    printf("%s", title);
+    for (int i = 0; i < list->count; i++) {
+        printf(" B%d", list->items[i]);
+    }
+}
+
+/**
+ * @brief Prints the blocks, dominators, frontiers and loops of a graph
+ *
+ * @param cfg The graph to print
+ */
+void PrintCFG(const CFG* cfg) {
+    printf("CFG for function %s:\n", cfg->function->name);
+
+    for (int i = 0; i < cfg->blockCount; i++) {
+        const BasicBlock* block = &cfg->blocks[i];
+        printf("  B%d [%d, %d)", i, block->start, block->end);
+        if (!IsReachable(cfg, i)) {
+            printf(" unreachable\n");
+            continue;
+        }
+        PrintBlockList(" preds:", &block->preds);
+        PrintBlockList(" succs:", &block->succs);
+        if (block->idom >= 0) {
+            printf(" idom: B%d", block->idom);
+        }
+        PrintBlockList(" DF:", &block->frontier);
+        if (block->loopDepth > 0) {
+            printf(" loop depth: %d", block->loopDepth);
+        }
+        printf("\n");
+    }
+
+    for (int l = 0; l < cfg->loopCount; l++) {
+        const Loop* loop = &cfg->loops[l];
+        printf("  loop %d: header B%d, depth %d", l, loop->header, loop->depth);
+        PrintBlockList(", blocks:", &loop->blocks);
+        PrintBlockList(", latches:", &loop->latches);
+        printf("\n");
+    }
+}
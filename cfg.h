@@ -0,0 +1,62 @@
+#ifndef cfg_h
+#define cfg_h
+
+#include "tac.h"
+#include "util.h"
+
+typedef struct {
+    int start;          // Index of the first instruction of the block
+    int end;            // One past the index of the last instruction
+    IntList preds;
+    IntList succs;
+
+    int rpoIndex;       // Position in reverse postorder, -1 if unreachable
+    int idom;           // Immediate dominator, -1 for the entry and unreachable blocks
+    int domChild;       // First child in the dominator tree
+    int domSibling;     // Next sibling in the dominator tree
+    int domPre;         // Dominator tree preorder number
+    int domPost;        // Dominator tree postorder number
+    IntList frontier;
+
+    int loop;           // Innermost loop containing the block, -1 if none
+    int loopDepth;
+} BasicBlock;
+
+typedef struct {
+    int header;
+    int parent;         // Enclosing loop, -1 for an outermost loop
+    int depth;          // 1 for an outermost loop
+    IntList blocks;     // Every block in the loop body, header included
+    IntList latches;    // Sources of the back edges into the header
+} Loop;
+
+typedef struct {
+    TACFunction* function;
+
+    BasicBlock* blocks;
+    int blockCount;
+
+    int* rpo;           // Reachable blocks in reverse postorder
+    int rpoCount;
+
+    int* blockOf;       // Instruction index -> block
+    int* labelBlock;    // Label id -> block, -1 if the label is not placed
+
+    Loop* loops;
+    int loopCount;
+} CFG;
+
+CFG BuildCFG(TACFunction* function);
+void FreeCFG(CFG* cfg);
+void ComputeDominators(CFG* cfg);
+void ComputeDominanceFrontiers(CFG* cfg);
+void FindNaturalLoops(CFG* cfg);
+CFG AnalyzeCFG(TACFunction* function);
+int Dominates(const CFG* cfg, int a, int b);
+int IsReachable(const CFG* cfg, int block);
+int BlockLabel(const CFG* cfg, int block);
+int LoopContains(const CFG* cfg, int loop, int block);
+int RemoveUnreachableBlocks(TACFunction* function);
+void PrintCFG(const CFG* cfg);
+
+#endif
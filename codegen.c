@@ -0,0 +1,1934 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "codegen.h"
+#include "isel.h"
+#include "liveness.h"
+#include "optimize.h"
+#include "reg.h"
+#include "runtime.h"
+#include "schedule.h"
+
+#define MAX_INT_ARGS 6
+#define MAX_FLOAT_ARGS 8
+
+// The register each entry of the allocator's table stands for
+static const int machineRegisters[NUM_REGISTERS] = {
+    REG_RCX, REG_RSI, REG_RDI, REG_R8, REG_R9, REG_R10,
+    REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15,
+    REG_XMM0, REG_XMM1, REG_XMM2, REG_XMM3, REG_XMM4, REG_XMM5, REG_XMM6,
+    REG_XMM7, REG_XMM8, REG_XMM9, REG_XMM10, REG_XMM11, REG_XMM12, REG_XMM13,
+};
+
+static const int intArgRegisters[MAX_INT_ARGS] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
+
+typedef struct {
+    MachineOperand from;
+    MachineOperand to;
+    int isFloat;
+} PendingMove;
+
+typedef struct {
+    PendingMove* moves;
+    int count;
+    int capacity;
+} MoveList;
+
+typedef struct {
+    TACFunction* function;
+    const Liveness* liveness;
+    const Selection* selection; // Instructions computed by the trees of later ones; NULL at -O0
+    MachineProgram* program;
+    MachineFunction* out;
+    int optLevel;
+
+    int* labels;            // TAC label -> machine label
+    int epilogue;           // Label of the shared epilogue
+    int boundsLabel;        // Label of the out-of-bounds handler, -1 until an index is checked
+    int emptyLabel;         // Label of the empty-stack handler, -1 until a stack is popped or peeked at
+
+    int pushed[NUM_INT_REGISTERS]; // Callee-saved registers the prologue pushes, in order
+    int pushedCount;
+    int saveSlot[REG_XMM15 + 1];   // Caller-saved register -> frame slot it is kept in across calls, -1 if unused
+    int reductionBase;      // Frame slot of the first value vector loops leave for vecreduce
+
+    IntList stubs;          // Taken branches needing moves, as triples: stub label, block, target label
+    IntList growths;        // Pushes onto a full stack, as triples: stub label, push, label to return to
+    MoveList moves;
+} CodeGen;
+
+static int IsCallerSaved(int reg) {
+    return IS_XMM(reg) || reg == REG_RCX || reg == REG_RSI || reg == REG_RDI ||
+           reg == REG_R8 || reg == REG_R9 || reg == REG_R10;
+}
+
+static int IsFloatVar(const CodeGen* gen, int var) {
+    return gen->function->vars[var].type == FLOAT;
+}
+
+/**
+ * @brief Returns the operand size a value of a type is moved with
+ *
+ * Integers are 32 bits; strings, arrays and stacks are pointers.
+ */
+static int TypeSize(DataType type) {
+    return type == STRING || type == ARRAY || type == STACK ? 8 : 4;
+}
+
+/**
+ * @brief Returns the rbp-relative frame slot with a given number
+ *
+ * Slots sit below the saved rbp and the callee-saved registers the
+ * prologue pushes: spill slots first, then the caller-saved registers'
+ * save slots.
+ */
+static MachineOperand FrameSlot(const CodeGen* gen, int slot) {
+    return MemOperand(REG_RBP, -8LL * (gen->pushedCount + 1 + slot));
+}
+
+/**
+ * @brief Returns where a variable lives at a position, as the allocator left it
+ *
+ * @return A register, a frame slot, or no operand if the variable has no location
+ */
+static MachineOperand Location(const CodeGen* gen, int var, int position) {
+    int piece = variable_at(var, position);
+
+    if (piece < 0) {
+        return NoMachineOperand();
+    }
+    if (variables[piece].is_spilled) {
+        return FrameSlot(gen, variables[piece].spill_slot);
+    }
+    if (variables[piece].register_num < 0) {
+        return NoMachineOperand();
+    }
+    return RegOperand(machineRegisters[variables[piece].register_num]);
+}
+
+static int FloatConstant(CodeGen* gen, float value) {
+    return AddConstant(gen->program, &value, sizeof(float), 4);
+}
+
+/**
+ * @brief Returns the read-only data holding a string literal, laid out as a ZaraString with its hash
+ */
+static int StringConstant(CodeGen* gen, int id) {
+    const char* text = gen->function->program->strings[id];
+    int length = strlen(text);
+    ZaraString* literal = zara_new_string(text, length);
+    int constant = AddConstant(gen->program, literal, sizeof(ZaraString) + length + 1, 8);
+
+    free(literal);
+    return constant;
+}
+
+static int RuntimeSymbol(CodeGen* gen, const char* name) {
+    return AddMachineSymbol(gen->program, name, 0);
+}
+
+static void EmitOp(CodeGen* gen, X86Opcode op, int size, MachineOperand src, MachineOperand dst) {
+    EmitMachine(gen->out, op, size, src, dst);
+}
+
+/**
+ * @brief Copies an integer or pointer, going through rax when both sides are in memory
+ */
+static void Move(CodeGen* gen, int size, MachineOperand src, MachineOperand dst) {
+    if (dst.kind == MOP_NONE || SameMachineOperand(src, dst)) {
+        return;
+    }
+    if (src.kind == MOP_MEM && dst.kind == MOP_MEM) {
+        EmitOp(gen, X86_MOV, size, src, RegOperand(REG_RAX));
+        src = RegOperand(REG_RAX);
+    }
+    EmitOp(gen, X86_MOV, size, src, dst);
+}
+
+/**
+ * @brief Copies a float, going through xmm14 when both sides are in memory
+ */
+static void MoveFloat(CodeGen* gen, MachineOperand src, MachineOperand dst) {
+    if (dst.kind == MOP_NONE || SameMachineOperand(src, dst)) {
+        return;
+    }
+    if (src.kind == MOP_MEM && dst.kind == MOP_MEM) {
+        EmitOp(gen, X86_MOVSS, 4, src, RegOperand(REG_XMM14));
+        src = RegOperand(REG_XMM14);
+    }
+    EmitOp(gen, X86_MOVSS, 4, src, dst);
+}
+
+/**
+ * @brief Returns the operand an instruction reads a TAC operand through
+ *
+ * Variables are read where they live at the instruction; float literals
+ * come from read-only data and strings as the address of their ZaraString.
+ */
+static MachineOperand Source(CodeGen* gen, TACOperand operand, int index) {
+    switch (operand.kind) {
+    case TAC_OPERAND_VAR:
+        return Location(gen, operand.value.id, USE_POSITION(index));
+    case TAC_OPERAND_INT:
+        return ImmOperand(operand.value.intValue);
+    case TAC_OPERAND_FLOAT:
+        return RipOperand(FloatConstant(gen, operand.value.floatValue));
+    case TAC_OPERAND_STRING:
+        return RipOperand(StringConstant(gen, operand.value.id));
+    default:
+        return ImmOperand(0);
+    }
+}
+
+/**
+ * @brief Returns an operand holding a TAC operand as a float, converting into a scratch register if needed
+ */
+static MachineOperand FloatSource(CodeGen* gen, TACOperand operand, int index, int scratch) {
+    if (OperandType(gen->function, operand) == FLOAT) {
+        return Source(gen, operand, index);
+    }
+    if (operand.kind == TAC_OPERAND_INT) {
+        return RipOperand(FloatConstant(gen, (float)operand.value.intValue));
+    }
+    EmitOp(gen, X86_CVTSI2SS, 4, Source(gen, operand, index), RegOperand(scratch));
+    return RegOperand(scratch);
+}
+
+/**
+ * @brief Returns an operand holding a TAC operand as an integer, truncating a float into a scratch register
+ */
+static MachineOperand IntSource(CodeGen* gen, TACOperand operand, int index, int scratch) {
+    if (OperandType(gen->function, operand) != FLOAT) {
+        return Source(gen, operand, index);
+    }
+    if (operand.kind == TAC_OPERAND_FLOAT) {
+        return ImmOperand((int)operand.value.floatValue);
+    }
+    EmitOp(gen, X86_CVTTSS2SI, 4, Source(gen, operand, index), RegOperand(scratch));
+    return RegOperand(scratch);
+}
+
+/**
+ * @brief Writes the value of a TAC operand to a location, converting it to the location's type
+ */
+static void GenerateCopy(CodeGen* gen, TACOperand operand, int index, DataType type, MachineOperand dst) {
+    DataType from = OperandType(gen->function, operand);
+
+    if (dst.kind == MOP_NONE) {
+        return;
+    }
+    if (type == FLOAT) {
+        MoveFloat(gen, FloatSource(gen, operand, index, dst.kind == MOP_REG ? dst.reg : REG_XMM14), dst);
+    } else if (from == FLOAT) {
+        Move(gen, 4, IntSource(gen, operand, index, dst.kind == MOP_REG ? dst.reg : REG_RAX), dst);
+    } else if (operand.kind == TAC_OPERAND_STRING) {
+        MachineOperand reg = dst.kind == MOP_REG ? dst : RegOperand(REG_RAX);
+        EmitOp(gen, X86_LEA, 8, Source(gen, operand, index), reg);
+        Move(gen, 8, reg, dst);
+    } else {
+        Move(gen, TypeSize(type), Source(gen, operand, index), dst);
+    }
+}
+
+/**
+ * @brief Writes a value held in a register or memory, of a given type, to a location of another type
+ */
+static void StoreConverted(CodeGen* gen, MachineOperand value, DataType from, DataType to, MachineOperand dst) {
+    if (dst.kind == MOP_NONE) {
+        return;
+    }
+    if (to == FLOAT && from != FLOAT) {
+        MachineOperand reg = dst.kind == MOP_REG ? dst : RegOperand(REG_XMM14);
+        EmitOp(gen, X86_CVTSI2SS, 4, value, reg);
+        MoveFloat(gen, reg, dst);
+    } else if (to == FLOAT) {
+        MoveFloat(gen, value, dst);
+    } else if (from == FLOAT) {
+        MachineOperand reg = dst.kind == MOP_REG ? dst : RegOperand(REG_RAX);
+        EmitOp(gen, X86_CVTTSS2SI, 4, value, reg);
+        Move(gen, 4, reg, dst);
+    } else {
+        Move(gen, TypeSize(to), value, dst);
+    }
+}
+
+static void AddMove(MoveList* list, MachineOperand from, MachineOperand to, int isFloat) {
+    if (from.kind == MOP_NONE || to.kind == MOP_NONE || SameMachineOperand(from, to)) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        list->moves = CheckedRealloc(list->moves, list->capacity * sizeof(PendingMove));
+    }
+    list->moves[list->count].from = from;
+    list->moves[list->count].to = to;
+    list->moves[list->count].isFloat = isFloat;
+    list->count++;
+}
+
+static int IsPendingSource(const MoveList* list, MachineOperand location) {
+    for (int m = 0; m < list->count; m++) {
+        if (SameMachineOperand(list->moves[m].from, location)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Emits a set of moves that all happen at once, then empties the set
+ *
+ * A move is emitted once nothing still to be moved reads its destination.
+ * When every destination is still to be read the moves form a cycle, which
+ * is broken by parking one destination's value in r11 or xmm15.
+ */
+static void ResolveMoves(CodeGen* gen, MoveList* list) {
+    while (list->count > 0) {
+        int ready = -1;
+        for (int m = 0; m < list->count && ready < 0; m++) {
+            if (!IsPendingSource(list, list->moves[m].to)) {
+                ready = m;
+            }
+        }
+
+        if (ready < 0) {
+            PendingMove blocked = list->moves[0];
+            MachineOperand scratch = RegOperand(blocked.isFloat ? REG_XMM15 : REG_R11);
+            if (blocked.isFloat) {
+                MoveFloat(gen, blocked.to, scratch);
+            } else {
+                Move(gen, 8, blocked.to, scratch);
+            }
+            for (int m = 0; m < list->count; m++) {
+                if (SameMachineOperand(list->moves[m].from, blocked.to)) {
+                    list->moves[m].from = scratch;
+                }
+            }
+            continue;
+        }
+
+        PendingMove move = list->moves[ready];
+        list->moves[ready] = list->moves[--list->count];
+        if (move.isFloat) {
+            MoveFloat(gen, move.from, move.to);
+        } else {
+            Move(gen, 8, move.from, move.to);
+        }
+    }
+}
+
+/**
+ * @brief Collects the moves an edge needs where a variable live across it changes location
+ */
+static void CollectEdgeMoves(CodeGen* gen, int pred, int succ) {
+    const CFG* cfg = &gen->liveness->cfg;
+    const Bitset* live = &gen->liveness->liveIn[succ];
+    int from = DEF_POSITION(cfg->blocks[pred].end - 1);
+    int to = USE_POSITION(cfg->blocks[succ].start);
+
+    for (int v = BitsetNext(live, 0); v >= 0; v = BitsetNext(live, v + 1)) {
+        AddMove(&gen->moves, Location(gen, v, from), Location(gen, v, to), IsFloatVar(gen, v));
+    }
+}
+
+static void GenerateEdgeMoves(CodeGen* gen, int pred, int succ) {
+    CollectEdgeMoves(gen, pred, succ);
+    ResolveMoves(gen, &gen->moves);
+}
+
+/**
+ * @brief Emits the moves for variables the allocator split right before an instruction
+ *
+ * Pieces are split at even positions, so a value changes location between
+ * two instructions. Splits at a block start are left to the edge moves.
+ */
+static void GenerateSplitMoves(CodeGen* gen, int index) {
+    int position = USE_POSITION(index);
+
+    for (int i = 0; i < num_variables; i++) {
+        const Variable* piece = &variables[i];
+        if (piece->next_split < 0 || variables[piece->next_split].live_range_start != position) {
+            continue;
+        }
+        if (!IntervalCovers(&gen->liveness->intervals[piece->id], position)) {
+            continue;
+        }
+        AddMove(&gen->moves, Location(gen, piece->id, position - 1), Location(gen, piece->id, position),
+                IsFloatVar(gen, piece->id));
+    }
+    ResolveMoves(gen, &gen->moves);
+}
+
+/**
+ * @brief Stores the caller-saved registers holding values that outlive a call
+ *
+ * @param index The call, whose own result is not saved
+ * @param saved Receives the registers stored, for RestoreRegisters
+ */
+static void SaveRegisters(CodeGen* gen, int index, IntList* saved) {
+    int result = TACDefinedVar(&gen->function->code[index]);
+
+    for (int v = 0; v < gen->liveness->varCount; v++) {
+        if (v == result || !IntervalCovers(&gen->liveness->intervals[v], DEF_POSITION(index))) {
+            continue;
+        }
+        MachineOperand location = Location(gen, v, DEF_POSITION(index));
+        if (location.kind != MOP_REG || !IsCallerSaved(location.reg)) {
+            continue;
+        }
+        IntListPush(saved, location.reg);
+        EmitOp(gen, IS_XMM(location.reg) ? X86_MOVSS : X86_MOV, IS_XMM(location.reg) ? 4 : 8, location,
+              FrameSlot(gen, gen->saveSlot[location.reg]));
+    }
+}
+
+static void RestoreRegisters(CodeGen* gen, IntList* saved) {
+    for (int i = 0; i < saved->count; i++) {
+        int reg = saved->items[i];
+        EmitOp(gen, IS_XMM(reg) ? X86_MOVSS : X86_MOV, IS_XMM(reg) ? 4 : 8, FrameSlot(gen, gen->saveSlot[reg]),
+              RegOperand(reg));
+    }
+    IntListFree(saved);
+}
+
+static void CallSymbol(CodeGen* gen, int symbol) {
+    EmitOp(gen, X86_CALL, 0, SymbolRef(symbol), NoMachineOperand());
+}
+
+static void AdjustStack(CodeGen* gen, X86Opcode op, int bytes) {
+    if (bytes > 0) {
+        EmitOp(gen, op, 8, ImmOperand(bytes), RegOperand(REG_RSP));
+    }
+}
+
+/**
+ * @brief Restores the callee-saved registers and the caller's frame, leaving the return address on top
+ */
+static void ReleaseFrame(CodeGen* gen) {
+    if (gen->pushedCount > 0) {
+        EmitOp(gen, X86_LEA, 8, MemOperand(REG_RBP, -8LL * gen->pushedCount), RegOperand(REG_RSP));
+    } else {
+        EmitOp(gen, X86_MOV, 8, RegOperand(REG_RBP), RegOperand(REG_RSP));
+    }
+    for (int i = gen->pushedCount - 1; i >= 0; i--) {
+        EmitOp(gen, X86_POP, 8, NoMachineOperand(), RegOperand(gen->pushed[i]));
+    }
+    EmitOp(gen, X86_POP, 8, NoMachineOperand(), RegOperand(REG_RBP));
+}
+
+static void GenerateIntBinary(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    MachineOperand a = Source(gen, instr->arg1, index);
+    MachineOperand b = Source(gen, instr->arg2, index);
+
+    if (instr->op == TAC_DIV || instr->op == TAC_MOD) {
+        Move(gen, 4, a, RegOperand(REG_RAX));
+        EmitOp(gen, X86_CDQ, 4, NoMachineOperand(), NoMachineOperand());
+        if (b.kind == MOP_IMM) {
+            Move(gen, 4, b, RegOperand(REG_R11));
+            b = RegOperand(REG_R11);
+        }
+        EmitOp(gen, X86_IDIV, 4, b, NoMachineOperand());
+        Move(gen, 4, RegOperand(instr->op == TAC_DIV ? REG_RAX : REG_RDX), dst);
+        return;
+    }
+
+    X86Opcode op = instr->op == TAC_ADD ? X86_ADD : (instr->op == TAC_SUB ? X86_SUB : X86_IMUL);
+    if (op != X86_SUB && SameMachineOperand(dst, b)) {
+        MachineOperand swap = a;
+        a = b;
+        b = swap;
+    }
+    MachineOperand work = dst.kind == MOP_REG && !SameMachineOperand(dst, b) ? dst : RegOperand(REG_RAX);
+    Move(gen, 4, a, work);
+    EmitOp(gen, op, 4, b, work);
+    Move(gen, 4, work, dst);
+}
+
+static void GenerateFloatBinary(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    static const X86Opcode ops[] = {X86_ADDSS, X86_SUBSS, X86_MULSS, X86_DIVSS};
+
+    if (instr->op == TAC_MOD) {
+        fprintf(stderr, "Error: %% is not defined for floats in %s\n", gen->function->name);
+        exit(EXIT_FAILURE);
+    }
+
+    MachineOperand b = FloatSource(gen, instr->arg2, index, REG_XMM15);
+    int floatResult = gen->function->vars[instr->result.value.id].type == FLOAT;
+    MachineOperand work = floatResult && dst.kind == MOP_REG && !SameMachineOperand(dst, b) ? dst
+                                                                                            : RegOperand(REG_XMM14);
+    MoveFloat(gen, FloatSource(gen, instr->arg1, index, work.reg), work);
+    EmitOp(gen, ops[instr->op - TAC_ADD], 4, b, work);
+    StoreConverted(gen, work, FLOAT, gen->function->vars[instr->result.value.id].type, dst);
+}
+
+static void GenerateComparison(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    static const ConditionCode intConditions[] = {COND_L, COND_LE, COND_G, COND_GE, COND_E, COND_NE};
+    TACFunction* function = gen->function;
+    MachineOperand al = RegOperand(REG_RAX);
+
+    if (OperandType(function, instr->arg1) == FLOAT || OperandType(function, instr->arg2) == FLOAT) {
+        // ucomiss sets the flags like an unsigned compare, and unordered
+        // operands set ZF, PF and CF together; with the operands swapped for
+        // < and <=, "above" conditions are false for NaN as they should be
+        int swap = instr->op == TAC_LT || instr->op == TAC_LE;
+        TACOperand left = swap ? instr->arg2 : instr->arg1;
+        TACOperand right = swap ? instr->arg1 : instr->arg2;
+        MachineOperand b = FloatSource(gen, right, index, REG_XMM15);
+        MoveFloat(gen, FloatSource(gen, left, index, REG_XMM14), RegOperand(REG_XMM14));
+        EmitOp(gen, X86_UCOMISS, 4, b, RegOperand(REG_XMM14));
+
+        if (instr->op == TAC_EQ || instr->op == TAC_NE) {
+            int eq = instr->op == TAC_EQ;
+            EmitCondition(gen->out, X86_SETCC, eq ? COND_E : COND_NE, al);
+            EmitCondition(gen->out, X86_SETCC, eq ? COND_NP : COND_P, RegOperand(REG_RDX));
+            EmitOp(gen, eq ? X86_AND : X86_OR, 1, RegOperand(REG_RDX), al);
+        } else {
+            ConditionCode cond = instr->op == TAC_LT || instr->op == TAC_GT ? COND_A : COND_AE;
+            EmitCondition(gen->out, X86_SETCC, cond, al);
+        }
+    } else {
+        int size = TypeSize(OperandType(function, instr->arg1));
+        MachineOperand a = Source(gen, instr->arg1, index);
+        MachineOperand b = Source(gen, instr->arg2, index);
+        if (a.kind == MOP_IMM || (a.kind == MOP_MEM && b.kind == MOP_MEM)) {
+            Move(gen, size, a, al);
+            a = al;
+        }
+        EmitOp(gen, X86_CMP, size, b, a);
+        EmitCondition(gen->out, X86_SETCC, intConditions[instr->op - TAC_LT], al);
+    }
+
+    MachineOperand work = dst.kind == MOP_REG ? dst : al;
+    EmitOp(gen, X86_MOVZB, 4, al, work);
+    Move(gen, 4, work, dst);
+}
+
+static int BoundsLabel(CodeGen* gen) {
+    if (gen->boundsLabel < 0) {
+        gen->boundsLabel = NewMachineLabel(gen->out);
+    }
+    return gen->boundsLabel;
+}
+
+/**
+ * @brief Checks an index against the length of an array and returns the address of the element
+ *
+ * An array points at its length, stored in 8 bytes, followed by its
+ * 4-byte elements. The base goes through r11 and the index through rax
+ * when they are not in registers already. An access known to be in range
+ * skips the check.
+ */
+static MachineOperand ElementAddress(CodeGen* gen, TACOperand array, TACOperand position, int checked,
+                                     int index) {
+    MachineOperand base = Source(gen, array, index);
+
+    if (base.kind != MOP_REG) {
+        Move(gen, 8, base, RegOperand(REG_R11));
+        base = RegOperand(REG_R11);
+    }
+
+    if (position.kind == TAC_OPERAND_INT) {
+        int k = position.value.intValue;
+        if (!checked) {
+            return MemOperand(base.reg, 8 + 4LL * k);
+        }
+        if (k < 0) {
+            EmitOp(gen, X86_JMP, 0, LabelRef(BoundsLabel(gen)), NoMachineOperand());
+        } else {
+            EmitOp(gen, X86_CMP, 8, ImmOperand(k), MemOperand(base.reg, 0));
+            EmitCondition(gen->out, X86_JCC, COND_BE, LabelRef(BoundsLabel(gen)));
+        }
+        return MemOperand(base.reg, 8 + 4LL * k);
+    }
+
+    // Sign-extended, so a negative index compares as a huge unsigned one
+    EmitOp(gen, X86_MOVSXD, 8, IntSource(gen, position, index, REG_RAX), RegOperand(REG_RAX));
+    if (checked) {
+        EmitOp(gen, X86_CMP, 8, MemOperand(base.reg, 0), RegOperand(REG_RAX));
+        EmitCondition(gen->out, X86_JCC, COND_AE, LabelRef(BoundsLabel(gen)));
+    }
+    return IndexedOperand(base.reg, REG_RAX, 4, 8);
+}
+
+static void GenerateLoadIndex(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    MachineOperand address = ElementAddress(gen, instr->arg1, instr->arg2, !instr->inBounds, index);
+
+    if (gen->function->vars[instr->result.value.id].type == FLOAT) {
+        MachineOperand work = dst.kind == MOP_REG ? dst : RegOperand(REG_XMM14);
+        EmitOp(gen, X86_MOVSS, 4, address, work);
+        MoveFloat(gen, work, dst);
+    } else {
+        MachineOperand work = dst.kind == MOP_REG ? dst : RegOperand(REG_RDX);
+        EmitOp(gen, X86_MOV, 4, address, work);
+        Move(gen, 4, work, dst);
+    }
+}
+
+/**
+ * @brief Stores a value as an element of an array, converted to the array's element type
+ */
+static void GenerateStoreIndex(CodeGen* gen, const TACInstruction* instr, int index) {
+    MachineOperand address = ElementAddress(gen, instr->result, instr->arg1, !instr->inBounds, index);
+    int isConstant = instr->arg2.kind == TAC_OPERAND_INT || instr->arg2.kind == TAC_OPERAND_FLOAT;
+
+    if (gen->function->vars[instr->result.value.id].elementType == FLOAT) {
+        if (isConstant) {
+            float f = instr->arg2.kind == TAC_OPERAND_FLOAT ? instr->arg2.value.floatValue
+                                                            : (float)instr->arg2.value.intValue;
+            int bits;
+            memcpy(&bits, &f, sizeof(int));
+            EmitOp(gen, X86_MOV, 4, ImmOperand(bits), address);
+            return;
+        }
+        MachineOperand value = FloatSource(gen, instr->arg2, index, REG_XMM14);
+        if (value.kind != MOP_REG) {
+            MoveFloat(gen, value, RegOperand(REG_XMM14));
+            value = RegOperand(REG_XMM14);
+        }
+        EmitOp(gen, X86_MOVSS, 4, value, address);
+    } else {
+        MachineOperand value = IntSource(gen, instr->arg2, index, REG_RDX);
+        if (value.kind == MOP_MEM) {
+            Move(gen, 4, value, RegOperand(REG_RDX));
+            value = RegOperand(REG_RDX);
+        }
+        EmitOp(gen, X86_MOV, 4, value, address);
+    }
+}
+
+#define VECTOR_LANES 4
+
+// xmm registers a vector loop may take, those it need not save first
+static const int vectorRegisters[16] = {
+    REG_XMM15, REG_XMM14, REG_XMM0, REG_XMM1, REG_XMM2, REG_XMM3, REG_XMM4, REG_XMM5,
+    REG_XMM6, REG_XMM7, REG_XMM8, REG_XMM9, REG_XMM10, REG_XMM11, REG_XMM12, REG_XMM13,
+};
+
+// The registers the code of a vector loop works in
+typedef struct {
+    const TACVectorLoop* plan;
+    int* opRegister;        // Op -> the xmm register holding its lanes
+    int* first;             // Arithmetic op -> the op its lanes start as
+    int* second;            // Arithmetic op -> the op then combined into them
+    int* accumulator;       // Reduction -> the xmm register it is summed in
+    int* base;              // Operand -> the register holding it, if it is an array the loop reads or writes
+    int borrowed[NUM_INT_REGISTERS]; // Registers pushed to hold the arrays that live in memory
+    int borrowedCount;
+    int saved[16];          // xmm registers kept on the stack while the loop has them
+    int savedCount;
+} VectorCode;
+
+static int IsArithmetic(TACVectorOpKind kind) {
+    return kind == VEC_ADD || kind == VEC_SUB || kind == VEC_MUL || kind == VEC_DIV;
+}
+
+/**
+ * @brief Takes the first xmm register that neither holds an operand nor is taken already
+ *
+ * @return The register, or -1 if there is none
+ */
+static int TakeVectorRegister(const char* busy, char* taken) {
+    for (int i = 0; i < 16; i++) {
+        int reg = vectorRegisters[i];
+        if (!busy[reg] && !taken[reg]) {
+            taken[reg] = 1;
+            return reg;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Picks the registers of a vector loop, leaving alone those holding its operands
+ *
+ * Splats and accumulators keep a register for the whole loop; other ops
+ * free theirs after their last use, and arithmetic works in place in the
+ * register of an op that dies there. Arrays that live in memory borrow a
+ * general-purpose register, pushed and popped around the loop.
+ *
+ * @return 1 if there are registers enough, 0 if the loop must be left to the scalar code
+ */
+static int AssignVectorRegisters(CodeGen* gen, const TACInstruction* instr, int index, VectorCode* code) {
+    const TACVectorLoop* plan = code->plan;
+    char busy[REG_XMM15 + 1] = {0};
+    char taken[REG_XMM15 + 1] = {0};
+    char everTaken[REG_XMM15 + 1] = {0};
+    int* lastUse = CheckedMalloc((plan->opCount + 1) * sizeof(int));
+    int ok = 1;
+
+    for (int k = 0; k < instr->phiCount; k++) {
+        MachineOperand value = Source(gen, instr->phiArgs[k].value, index);
+        code->base[k] = -1;
+        if (value.kind == MOP_REG) {
+            busy[value.reg] = 1;
+        }
+    }
+    for (int i = 0; i < plan->opCount && ok; i++) {
+        const TACVectorOp* op = &plan->ops[i];
+        if ((op->kind != VEC_LOAD && op->kind != VEC_STORE) || code->base[op->a] >= 0) {
+            continue;
+        }
+        MachineOperand array = Source(gen, instr->phiArgs[op->a].value, index);
+        if (array.kind == MOP_REG) {
+            code->base[op->a] = array.reg;
+            continue;
+        }
+        ok = 0;
+        for (int r = 0; r < NUM_INT_REGISTERS && !ok; r++) {
+            int reg = machineRegisters[r];
+            if (!busy[reg] && !taken[reg]) {
+                taken[reg] = 1;
+                code->base[op->a] = reg;
+                code->borrowed[code->borrowedCount++] = reg;
+                ok = 1;
+            }
+        }
+    }
+
+    for (int i = 0; i < plan->opCount; i++) {
+        const TACVectorOp* op = &plan->ops[i];
+        lastUse[i] = -1;
+        code->opRegister[i] = -1;
+        if (op->kind == VEC_CONVERT) {
+            lastUse[op->a] = i;
+        } else if (IsArithmetic(op->kind)) {
+            lastUse[op->a] = i;
+            lastUse[op->b] = i;
+        } else if (op->kind == VEC_STORE || op->kind == VEC_REDUCE) {
+            lastUse[op->b] = i;
+        }
+    }
+
+    // Live the whole loop
+    for (int i = 0; i < plan->opCount && ok; i++) {
+        if (plan->ops[i].kind == VEC_SPLAT) {
+            code->opRegister[i] = TakeVectorRegister(busy, taken);
+            ok = code->opRegister[i] >= 0;
+        }
+    }
+    for (int r = 0; r < plan->reductionCount && ok; r++) {
+        code->accumulator[r] = TakeVectorRegister(busy, taken);
+        ok = code->accumulator[r] >= 0;
+    }
+    for (int reg = REG_XMM0; reg <= REG_XMM15; reg++) {
+        everTaken[reg] = taken[reg];
+    }
+
+    for (int i = 0; i < plan->opCount && ok; i++) {
+        const TACVectorOp* op = &plan->ops[i];
+        int dies[2] = {-1, -1};
+
+        if (op->kind == VEC_CONVERT) {
+            dies[0] = op->a;
+        } else if (IsArithmetic(op->kind)) {
+            int a = op->a;
+            int b = op->b;
+            // Commutative, so work in b's register when only b dies here
+            int canSwap = op->kind == VEC_ADD || op->kind == VEC_MUL;
+            if (canSwap && (lastUse[a] != i || plan->ops[a].kind == VEC_SPLAT) &&
+                lastUse[b] == i && plan->ops[b].kind != VEC_SPLAT) {
+                a = op->b;
+                b = op->a;
+            }
+            code->first[i] = a;
+            code->second[i] = b;
+            dies[0] = a;
+            dies[1] = b != a ? b : -1;
+        } else if (op->kind == VEC_STORE || op->kind == VEC_REDUCE) {
+            dies[1] = op->b;
+        }
+        if (dies[0] >= 0 && (lastUse[dies[0]] != i || plan->ops[dies[0]].kind == VEC_SPLAT)) {
+            dies[0] = -1;
+        }
+        if (dies[1] >= 0 && (lastUse[dies[1]] != i || plan->ops[dies[1]].kind == VEC_SPLAT)) {
+            dies[1] = -1;
+        }
+
+        if (op->kind == VEC_LOAD || op->kind == VEC_CONVERT || IsArithmetic(op->kind)) {
+            if (dies[0] >= 0) {
+                code->opRegister[i] = code->opRegister[dies[0]];
+                dies[0] = -1;
+            } else {
+                code->opRegister[i] = TakeVectorRegister(busy, taken);
+                ok = code->opRegister[i] >= 0;
+            }
+        }
+        for (int d = 0; d < 2; d++) {
+            if (dies[d] >= 0) {
+                taken[code->opRegister[dies[d]]] = 0;
+            }
+        }
+        if (code->opRegister[i] >= 0) {
+            everTaken[code->opRegister[i]] = 1;
+            if (lastUse[i] < 0 && op->kind != VEC_SPLAT) {
+                taken[code->opRegister[i]] = 0;
+            }
+        }
+    }
+
+    for (int reg = REG_XMM0; reg <= REG_XMM13; reg++) {
+        if (everTaken[reg]) {
+            code->saved[code->savedCount++] = reg;
+        }
+    }
+    free(lastUse);
+    return ok;
+}
+
+/**
+ * @brief Puts the 32 bits of an operand of a vector loop in eax
+ *
+ * @param isFloat Whether the bits are wanted as a float, converting an integer constant
+ */
+static void LoadLaneBits(CodeGen* gen, TACOperand operand, int index, int isFloat) {
+    if (operand.kind == TAC_OPERAND_FLOAT || (isFloat && operand.kind == TAC_OPERAND_INT)) {
+        float f = operand.kind == TAC_OPERAND_FLOAT ? operand.value.floatValue : (float)operand.value.intValue;
+        int bits;
+        memcpy(&bits, &f, sizeof(int));
+        Move(gen, 4, ImmOperand(bits), RegOperand(REG_RAX));
+        return;
+    }
+
+    MachineOperand value = Source(gen, operand, index);
+    if (value.kind == MOP_NONE) {
+        value = ImmOperand(0);
+    }
+    if (value.kind == MOP_REG && IS_XMM(value.reg)) {
+        EmitOp(gen, X86_MOVD, 4, value, RegOperand(REG_RAX));
+    } else {
+        Move(gen, 4, value, RegOperand(REG_RAX));
+    }
+}
+
+/**
+ * @brief Puts an integer operand of a vector loop in a register, sign-extended to 64 bits
+ */
+static void LoadCounter(CodeGen* gen, TACOperand operand, int index, int reg) {
+    MachineOperand value = Source(gen, operand, index);
+
+    if (value.kind == MOP_IMM || value.kind == MOP_NONE) {
+        EmitOp(gen, X86_MOV, 8, value.kind == MOP_IMM ? value : ImmOperand(0), RegOperand(reg));
+    } else {
+        EmitOp(gen, X86_MOVSXD, 8, value, RegOperand(reg));
+    }
+}
+
+/**
+ * @brief Checks that every vector iteration stays inside its arrays and that no store overlaps another access
+ *
+ * rax holds the first value of the counter and rdx the first it does not
+ * reach; anything failing jumps to the scalar loop, which runs the
+ * iterations one at a time and reports a bad index as it would have.
+ */
+static void CheckVectorAccesses(CodeGen* gen, const TACInstruction* instr, const VectorCode* code, int skip) {
+    const TACVectorLoop* plan = code->plan;
+
+    for (int k = 0; k < instr->phiCount; k++) {
+        int low = 0;
+        int high = 0;
+        int seen = 0;
+        for (int i = 0; i < plan->opCount; i++) {
+            const TACVectorOp* op = &plan->ops[i];
+            if ((op->kind == VEC_LOAD || op->kind == VEC_STORE) && op->a == k) {
+                low = seen && low < op->offset ? low : op->offset;
+                high = seen && high > op->offset ? high : op->offset;
+                seen = 1;
+            }
+        }
+        if (!seen) {
+            continue;
+        }
+        MachineOperand first = RegOperand(REG_RAX);
+        MachineOperand last = RegOperand(REG_RDX);
+        if (low != 0) {
+            EmitOp(gen, X86_LEA, 8, MemOperand(REG_RAX, low), RegOperand(REG_R11));
+            first = RegOperand(REG_R11);
+        }
+        EmitOp(gen, X86_CMP, 8, ImmOperand(0), first);
+        EmitCondition(gen->out, X86_JCC, COND_L, LabelRef(skip));
+        if (high != 0) {
+            EmitOp(gen, X86_LEA, 8, MemOperand(REG_RDX, high), RegOperand(REG_R11));
+            last = RegOperand(REG_R11);
+        }
+        EmitOp(gen, X86_CMP, 8, MemOperand(code->base[k], 0), last);
+        EmitCondition(gen->out, X86_JCC, COND_G, LabelRef(skip));
+    }
+
+    // Two names for one array only matter if the lanes they touch differ
+    for (int s = 0; s < plan->opCount; s++) {
+        const TACVectorOp* store = &plan->ops[s];
+        if (store->kind != VEC_STORE) {
+            continue;
+        }
+        for (int i = 0; i < plan->opCount; i++) {
+            const TACVectorOp* op = &plan->ops[i];
+            if ((op->kind == VEC_LOAD || op->kind == VEC_STORE) && op->a != store->a &&
+                op->offset != store->offset && code->base[op->a] != code->base[store->a]) {
+                EmitOp(gen, X86_CMP, 8, RegOperand(code->base[op->a]), RegOperand(code->base[store->a]));
+                EmitCondition(gen->out, X86_JCC, COND_E, LabelRef(skip));
+            }
+        }
+    }
+}
+
+/**
+ * @brief Generates one vector iteration, four lanes of the scalar loop at once
+ */
+static void GenerateVectorBody(CodeGen* gen, const VectorCode* code) {
+    const TACVectorLoop* plan = code->plan;
+
+    for (int i = 0; i < plan->opCount; i++) {
+        const TACVectorOp* op = &plan->ops[i];
+        MachineOperand reg = RegOperand(code->opRegister[i]);
+
+        switch (op->kind) {
+        case VEC_LOAD:
+            EmitOp(gen, X86_MOVUPS, 16, IndexedOperand(code->base[op->a], REG_RAX, 4, 8 + 4LL * op->offset), reg);
+            break;
+        case VEC_STORE:
+            EmitOp(gen, X86_MOVUPS, 16, RegOperand(code->opRegister[op->b]),
+                   IndexedOperand(code->base[op->a], REG_RAX, 4, 8 + 4LL * op->offset));
+            break;
+        case VEC_CONVERT:
+            EmitOp(gen, X86_CVTDQ2PS, 16, RegOperand(code->opRegister[op->a]), reg);
+            break;
+        case VEC_ADD:
+        case VEC_SUB:
+        case VEC_MUL:
+        case VEC_DIV: {
+            // Integer division never gets here
+            static const X86Opcode intOps[] = {X86_PADDD, X86_PSUBD, X86_PMULLD, X86_PMULLD};
+            static const X86Opcode floatOps[] = {X86_ADDPS, X86_SUBPS, X86_MULPS, X86_DIVPS};
+            int which = op->kind - VEC_ADD;
+            if (code->opRegister[code->first[i]] != code->opRegister[i]) {
+                EmitOp(gen, X86_MOVUPS, 16, RegOperand(code->opRegister[code->first[i]]), reg);
+            }
+            EmitOp(gen, op->isFloat ? floatOps[which] : intOps[which], 16,
+                   RegOperand(code->opRegister[code->second[i]]), reg);
+            break;
+        }
+        case VEC_REDUCE: {
+            const TACReduction* reduction = &plan->reductions[op->a];
+            MachineOperand lanes = RegOperand(code->opRegister[op->b]);
+            MachineOperand sum = RegOperand(code->accumulator[op->a]);
+            if (!op->isFloat) {
+                EmitOp(gen, reduction->subtract ? X86_PSUBD : X86_PADDD, 16, lanes, sum);
+                break;
+            }
+            // One lane at a time, in the order the scalar loop adds them, so the rounding is the same
+            EmitOp(gen, X86_MOVUPS, 16, lanes, MemOperand(REG_RSP, 0));
+            for (int lane = 0; lane < VECTOR_LANES; lane++) {
+                EmitOp(gen, reduction->subtract ? X86_SUBSS : X86_ADDSS, 4, MemOperand(REG_RSP, 4 * lane), sum);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Returns whether the CPU the compiler runs on has SSE4.1, which pmulld needs
+ *
+ * Build with -DZARA_NO_SSE41 for programs that must also run on older CPUs.
+ */
+static int HasSSE41(void) {
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(ZARA_NO_SSE41)
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1) != 0;
+#else
+    return 0;
+#endif
+}
+
+static int MultipliesIntLanes(const TACVectorLoop* plan) {
+    for (int i = 0; i < plan->opCount; i++) {
+        if (plan->ops[i].kind == VEC_MUL && !plan->ops[i].isFloat) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Generates a vector loop, leaving in the result how many iterations it ran
+ *
+ * The loop runs while four more iterations fit before the bound, with the
+ * counter in rax and its end in rdx. It only starts if every access stays
+ * in bounds and no store can reach what another access reads; otherwise,
+ * or if there are too few registers, or it multiplies integers and the
+ * CPU lacks pmulld, it runs no iterations and the scalar loop after it
+ * does all the work. Reductions leave their value in
+ * a frame slot for the vecreduce instructions that follow.
+ */
+static void GenerateVectorLoop(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    const TACVectorLoop* plan = &gen->function->vectorLoops[instr->arg1.value.intValue];
+    int skip = NewMachineLabel(gen->out);
+    int done = NewMachineLabel(gen->out);
+    VectorCode code;
+
+    code.plan = plan;
+    code.opRegister = CheckedMalloc((plan->opCount + 1) * sizeof(int));
+    code.first = CheckedMalloc((plan->opCount + 1) * sizeof(int));
+    code.second = CheckedMalloc((plan->opCount + 1) * sizeof(int));
+    code.accumulator = CheckedMalloc((plan->reductionCount + 1) * sizeof(int));
+    code.base = CheckedMalloc((instr->phiCount + 1) * sizeof(int));
+    code.borrowedCount = 0;
+    code.savedCount = 0;
+
+    int feasible = (!MultipliesIntLanes(plan) || HasSSE41()) && AssignVectorRegisters(gen, instr, index, &code);
+    if (!feasible) {
+        EmitOp(gen, X86_JMP, 0, LabelRef(skip), NoMachineOperand());
+    } else {
+        int area = 16 * (1 + code.savedCount);
+
+        for (int i = 0; i < code.borrowedCount; i++) {
+            EmitOp(gen, X86_PUSH, 8, RegOperand(code.borrowed[i]), NoMachineOperand());
+        }
+        AdjustStack(gen, X86_SUB, area);
+        for (int i = 0; i < code.savedCount; i++) {
+            EmitOp(gen, X86_MOVUPS, 16, RegOperand(code.saved[i]), MemOperand(REG_RSP, 16 * (i + 1)));
+        }
+        for (int i = 0; i < code.borrowedCount; i++) {
+            for (int k = 0; k < instr->phiCount; k++) {
+                if (code.base[k] == code.borrowed[i]) {
+                    Move(gen, 8, Source(gen, instr->phiArgs[k].value, index), RegOperand(code.borrowed[i]));
+                }
+            }
+        }
+
+        // rdx = the counter's first value past the last whole vector
+        LoadCounter(gen, instr->phiArgs[0].value, index, REG_RAX);
+        LoadCounter(gen, instr->phiArgs[1].value, index, REG_RDX);
+        EmitOp(gen, X86_SUB, 8, RegOperand(REG_RAX), RegOperand(REG_RDX));
+        if (plan->inclusive) {
+            EmitOp(gen, X86_ADD, 8, ImmOperand(1), RegOperand(REG_RDX));
+        }
+        EmitOp(gen, X86_AND, 8, ImmOperand(-VECTOR_LANES), RegOperand(REG_RDX));
+        EmitOp(gen, X86_CMP, 8, ImmOperand(0), RegOperand(REG_RDX));
+        EmitCondition(gen->out, X86_JCC, COND_LE, LabelRef(skip));
+        EmitOp(gen, X86_ADD, 8, RegOperand(REG_RAX), RegOperand(REG_RDX));
+        CheckVectorAccesses(gen, instr, &code, skip);
+
+        for (int i = 0; i < plan->opCount; i++) {
+            const TACVectorOp* op = &plan->ops[i];
+            if (op->kind == VEC_SPLAT) {
+                MachineOperand reg = RegOperand(code.opRegister[i]);
+                LoadLaneBits(gen, instr->phiArgs[op->a].value, index, op->isFloat);
+                EmitOp(gen, X86_MOVD, 4, RegOperand(REG_RAX), reg);
+                EmitOp(gen, X86_PUNPCKLDQ, 16, reg, reg);
+                EmitOp(gen, X86_PUNPCKLQDQ, 16, reg, reg);
+            }
+        }
+        // Integer sums start from zero and take the first value at the end; float ones start from it
+        for (int r = 0; r < plan->reductionCount; r++) {
+            const TACReduction* reduction = &plan->reductions[r];
+            if (reduction->isFloat) {
+                LoadLaneBits(gen, instr->phiArgs[reduction->operand].value, index, 1);
+            } else {
+                Move(gen, 4, ImmOperand(0), RegOperand(REG_RAX));
+            }
+            EmitOp(gen, X86_MOVD, 4, RegOperand(REG_RAX), RegOperand(code.accumulator[r]));
+        }
+        // Loading the operands went through rax
+        LoadCounter(gen, instr->phiArgs[0].value, index, REG_RAX);
+
+        int loop = NewMachineLabel(gen->out);
+        EmitMachineLabel(gen->out, loop);
+        GenerateVectorBody(gen, &code);
+        EmitOp(gen, X86_ADD, 8, ImmOperand(VECTOR_LANES), RegOperand(REG_RAX));
+        EmitOp(gen, X86_CMP, 8, RegOperand(REG_RDX), RegOperand(REG_RAX));
+        EmitCondition(gen->out, X86_JCC, COND_L, LabelRef(loop));
+
+        // rdx = the iterations run
+        LoadCounter(gen, instr->phiArgs[0].value, index, REG_R11);
+        EmitOp(gen, X86_SUB, 8, RegOperand(REG_R11), RegOperand(REG_RDX));
+        for (int r = 0; r < plan->reductionCount; r++) {
+            const TACReduction* reduction = &plan->reductions[r];
+            MachineOperand slot = FrameSlot(gen, gen->reductionBase + reduction->slot);
+            MachineOperand sum = RegOperand(code.accumulator[r]);
+            if (reduction->isFloat) {
+                EmitOp(gen, X86_MOVSS, 4, sum, slot);
+                continue;
+            }
+            EmitOp(gen, X86_MOVUPS, 16, sum, MemOperand(REG_RSP, 0));
+            LoadLaneBits(gen, instr->phiArgs[reduction->operand].value, index, 0);
+            for (int lane = 0; lane < VECTOR_LANES; lane++) {
+                EmitOp(gen, X86_ADD, 4, MemOperand(REG_RSP, 4 * lane), RegOperand(REG_RAX));
+            }
+            Move(gen, 4, RegOperand(REG_RAX), slot);
+        }
+        EmitOp(gen, X86_JMP, 0, LabelRef(done), NoMachineOperand());
+    }
+
+    EmitMachineLabel(gen->out, skip);
+    for (int r = 0; r < plan->reductionCount; r++) {
+        const TACReduction* reduction = &plan->reductions[r];
+        LoadLaneBits(gen, instr->phiArgs[reduction->operand].value, index, reduction->isFloat);
+        Move(gen, 4, RegOperand(REG_RAX), FrameSlot(gen, gen->reductionBase + reduction->slot));
+    }
+    Move(gen, 4, ImmOperand(0), RegOperand(REG_RDX));
+
+    EmitMachineLabel(gen->out, done);
+    if (feasible) {
+        for (int i = 0; i < code.savedCount; i++) {
+            EmitOp(gen, X86_MOVUPS, 16, MemOperand(REG_RSP, 16 * (i + 1)), RegOperand(code.saved[i]));
+        }
+        AdjustStack(gen, X86_ADD, 16 * (1 + code.savedCount));
+        for (int i = code.borrowedCount - 1; i >= 0; i--) {
+            EmitOp(gen, X86_POP, 8, NoMachineOperand(), RegOperand(code.borrowed[i]));
+        }
+    }
+    free(code.opRegister);
+    free(code.first);
+    free(code.second);
+    free(code.accumulator);
+    free(code.base);
+    Move(gen, 4, RegOperand(REG_RDX), dst);
+}
+
+/**
+ * @brief Generates the bounds guard of a loop
+ *
+ * When the counter starts below its bound, the lowest element the loop
+ * touches is the first value plus the low offset and the highest the bound
+ * plus the high offset, less one; both go through the same handler as an
+ * element access that fails. The arithmetic is 64-bit, so it cannot wrap.
+ */
+static void GenerateCheckBounds(CodeGen* gen, const TACInstruction* instr, int index) {
+    int low = instr->arg1.value.intValue;
+    int high = instr->arg2.value.intValue;
+    int done = NewMachineLabel(gen->out);
+    MachineOperand base = Source(gen, instr->phiArgs[0].value, index);
+
+    if (base.kind != MOP_REG) {
+        Move(gen, 8, base, RegOperand(REG_R11));
+        base = RegOperand(REG_R11);
+    }
+    LoadCounter(gen, instr->phiArgs[1].value, index, REG_RAX);
+    LoadCounter(gen, instr->phiArgs[2].value, index, REG_RDX);
+    EmitOp(gen, X86_CMP, 8, RegOperand(REG_RDX), RegOperand(REG_RAX));
+    EmitCondition(gen->out, X86_JCC, COND_GE, LabelRef(done));
+
+    if (low != 0) {
+        EmitOp(gen, X86_LEA, 8, MemOperand(REG_RAX, low), RegOperand(REG_RAX));
+    }
+    EmitOp(gen, X86_CMP, 8, ImmOperand(0), RegOperand(REG_RAX));
+    EmitCondition(gen->out, X86_JCC, COND_L, LabelRef(BoundsLabel(gen)));
+    if (high != 0) {
+        EmitOp(gen, X86_LEA, 8, MemOperand(REG_RDX, high), RegOperand(REG_RDX));
+    }
+    EmitOp(gen, X86_CMP, 8, MemOperand(base.reg, 0), RegOperand(REG_RDX));
+    EmitCondition(gen->out, X86_JCC, COND_G, LabelRef(BoundsLabel(gen)));
+    EmitMachineLabel(gen->out, done);
+}
+
+static void GenerateNewArray(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    IntList saved = {NULL, 0, 0};
+
+    SaveRegisters(gen, index, &saved);
+    Move(gen, 4, IntSource(gen, instr->arg1, index, REG_RAX), RegOperand(REG_RDI));
+    CallSymbol(gen, RuntimeSymbol(gen, "zara_new_array"));
+    RestoreRegisters(gen, &saved);
+    Move(gen, 8, RegOperand(REG_RAX), dst);
+}
+
+static void GenerateNewStack(CodeGen* gen, int index, MachineOperand dst) {
+    IntList saved = {NULL, 0, 0};
+
+    SaveRegisters(gen, index, &saved);
+    CallSymbol(gen, RuntimeSymbol(gen, "zara_new_stack"));
+    RestoreRegisters(gen, &saved);
+    Move(gen, 8, RegOperand(REG_RAX), dst);
+}
+
+static int EmptyLabel(CodeGen* gen) {
+    if (gen->emptyLabel < 0) {
+        gen->emptyLabel = NewMachineLabel(gen->out);
+    }
+    return gen->emptyLabel;
+}
+
+static DataType ElementType(const CodeGen* gen, TACOperand collection) {
+    return gen->function->vars[collection.value.id].elementType;
+}
+
+/**
+ * @brief Returns the register holding a stack, going through r11 when it is not in one already
+ *
+ * A stack points at its size, at offset 0, its capacity, at 4, and its
+ * elements pointer, at 8 (ZaraStack in runtime.h).
+ */
+static MachineOperand StackBase(CodeGen* gen, TACOperand stack, int index) {
+    MachineOperand base = Source(gen, stack, index);
+
+    if (base.kind != MOP_REG) {
+        Move(gen, 8, base, RegOperand(REG_R11));
+        base = RegOperand(REG_R11);
+    }
+    return base;
+}
+
+/**
+ * @brief Pushes a value onto a stack, with no call unless the stack is full
+ *
+ * The size is compared with the capacity; when there is room, the value is
+ * stored as an element of the stack's type right after the top and the
+ * size goes up by one. A full stack branches to a stub at the end of the
+ * function that calls the runtime to grow it and push the value.
+ */
+static void GeneratePush(CodeGen* gen, const TACInstruction* instr, int index) {
+    int grow = NewMachineLabel(gen->out);
+    int done = NewMachineLabel(gen->out);
+    MachineOperand base = StackBase(gen, instr->arg1, index);
+    MachineOperand slot = IndexedOperand(REG_RDX, REG_RAX, 4, 0);
+
+    EmitOp(gen, X86_MOV, 4, MemOperand(base.reg, 0), RegOperand(REG_RAX));
+    EmitOp(gen, X86_CMP, 4, MemOperand(base.reg, 4), RegOperand(REG_RAX));
+    EmitCondition(gen->out, X86_JCC, COND_E, LabelRef(grow));
+    EmitOp(gen, X86_ADD, 4, ImmOperand(1), MemOperand(base.reg, 0));
+    EmitOp(gen, X86_MOV, 8, MemOperand(base.reg, 8), RegOperand(REG_RDX));
+
+    if (ElementType(gen, instr->arg1) == FLOAT) {
+        MachineOperand value = FloatSource(gen, instr->arg2, index, REG_XMM14);
+        if (value.kind != MOP_REG) {
+            MoveFloat(gen, value, RegOperand(REG_XMM14));
+            value = RegOperand(REG_XMM14);
+        }
+        EmitOp(gen, X86_MOVSS, 4, value, slot);
+    } else {
+        MachineOperand value = Source(gen, instr->arg2, index);
+        if (OperandType(gen->function, instr->arg2) == FLOAT || value.kind == MOP_MEM) {
+            // rax is free once the element's address is taken
+            EmitOp(gen, X86_LEA, 8, slot, RegOperand(REG_RDX));
+            slot = MemOperand(REG_RDX, 0);
+            value = IntSource(gen, instr->arg2, index, REG_RAX);
+            if (value.kind == MOP_MEM) {
+                Move(gen, 4, value, RegOperand(REG_RAX));
+                value = RegOperand(REG_RAX);
+            }
+        }
+        EmitOp(gen, X86_MOV, 4, value, slot);
+    }
+    EmitMachineLabel(gen->out, done);
+
+    IntListPush(&gen->growths, grow);
+    IntListPush(&gen->growths, index);
+    IntListPush(&gen->growths, done);
+}
+
+/**
+ * @brief Generates the slow path of a push, which calls the runtime to grow the stack and push the value
+ */
+static void GenerateGrowth(CodeGen* gen, int index, int done) {
+    const TACInstruction* instr = &gen->function->code[index];
+    IntList saved = {NULL, 0, 0};
+
+    SaveRegisters(gen, index, &saved);
+    // The stack goes through r11, since the value may be in rdi
+    Move(gen, 8, Source(gen, instr->arg1, index), RegOperand(REG_R11));
+    if (ElementType(gen, instr->arg1) == FLOAT) {
+        MoveFloat(gen, FloatSource(gen, instr->arg2, index, REG_XMM0), RegOperand(REG_XMM0));
+        Move(gen, 8, RegOperand(REG_R11), RegOperand(REG_RDI));
+        CallSymbol(gen, RuntimeSymbol(gen, "zara_stack_push_float"));
+    } else {
+        Move(gen, 4, IntSource(gen, instr->arg2, index, REG_RSI), RegOperand(REG_RSI));
+        Move(gen, 8, RegOperand(REG_R11), RegOperand(REG_RDI));
+        CallSymbol(gen, RuntimeSymbol(gen, "zara_stack_push_int"));
+    }
+    RestoreRegisters(gen, &saved);
+    EmitOp(gen, X86_JMP, 0, LabelRef(done), NoMachineOperand());
+}
+
+/**
+ * @brief Pops the top element of a stack, or reads it without popping it for peek
+ *
+ * An empty stack goes to the handler shared by every pop and peek of the
+ * function.
+ */
+static void GeneratePop(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    MachineOperand base = StackBase(gen, instr->arg1, index);
+    MachineOperand element;
+
+    EmitOp(gen, X86_MOV, 4, MemOperand(base.reg, 0), RegOperand(REG_RAX));
+    if (instr->op == TAC_POP) {
+        EmitOp(gen, X86_SUB, 4, ImmOperand(1), RegOperand(REG_RAX));
+        EmitCondition(gen->out, X86_JCC, COND_L, LabelRef(EmptyLabel(gen)));
+        EmitOp(gen, X86_MOV, 4, RegOperand(REG_RAX), MemOperand(base.reg, 0));
+        element = IndexedOperand(REG_RDX, REG_RAX, 4, 0);
+    } else {
+        EmitOp(gen, X86_TEST, 4, RegOperand(REG_RAX), RegOperand(REG_RAX));
+        EmitCondition(gen->out, X86_JCC, COND_E, LabelRef(EmptyLabel(gen)));
+        element = IndexedOperand(REG_RDX, REG_RAX, 4, -4);
+    }
+    EmitOp(gen, X86_MOV, 8, MemOperand(base.reg, 8), RegOperand(REG_RDX));
+
+    if (dst.kind != MOP_NONE) {
+        StoreConverted(gen, element, ElementType(gen, instr->arg1),
+                       gen->function->vars[instr->result.value.id].type, dst);
+    }
+}
+
+/**
+ * @brief Joins or compares two strings with a runtime call
+ *
+ * The right string is loaded first, into rsi, so that loading the left one
+ * through rax cannot overwrite it.
+ */
+static void GenerateStringCall(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    int concat = instr->op == TAC_CONCAT;
+    IntList saved = {NULL, 0, 0};
+
+    SaveRegisters(gen, index, &saved);
+    GenerateCopy(gen, instr->arg1, index, STRING, RegOperand(REG_RAX));
+    GenerateCopy(gen, instr->arg2, index, STRING, RegOperand(REG_RSI));
+    Move(gen, 8, RegOperand(REG_RAX), RegOperand(REG_RDI));
+    CallSymbol(gen, RuntimeSymbol(gen, concat ? "zara_string_concat" : "zara_string_equals"));
+    RestoreRegisters(gen, &saved);
+    Move(gen, concat ? 8 : 4, RegOperand(REG_RAX), dst);
+}
+
+/**
+ * @brief Pushes an argument, 8 bytes whatever its type, for the call that follows
+ */
+static void GenerateParam(CodeGen* gen, const TACInstruction* instr, int index) {
+    MachineOperand value = Source(gen, instr->arg1, index);
+
+    if (instr->arg1.kind == TAC_OPERAND_FLOAT) {
+        float f = instr->arg1.value.floatValue;
+        int bits;
+        memcpy(&bits, &f, sizeof(int));
+        value = ImmOperand(bits);
+    } else if (instr->arg1.kind == TAC_OPERAND_STRING) {
+        EmitOp(gen, X86_LEA, 8, value, RegOperand(REG_RAX));
+        value = RegOperand(REG_RAX);
+    } else if (value.kind == MOP_REG && IS_XMM(value.reg)) {
+        EmitOp(gen, X86_MOVD, 4, value, RegOperand(REG_RAX));
+        value = RegOperand(REG_RAX);
+    }
+    EmitOp(gen, X86_PUSH, 8, value, NoMachineOperand());
+}
+
+/**
+ * @brief Prints the arguments of a call to print, one runtime call per argument
+ *
+ * The arguments are already on the stack; an odd count is padded so every
+ * call is made with the stack 16-byte aligned.
+ */
+static void GeneratePrint(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    int argc = instr->arg2.value.intValue;
+    int pad = argc % 2 == 1 ? 8 : 0;
+    IntList saved = {NULL, 0, 0};
+
+    SaveRegisters(gen, index, &saved);
+    AdjustStack(gen, X86_SUB, pad);
+    for (int k = 0; k < argc; k++) {
+        TACOperand arg = gen->function->code[index - argc + k].arg1;
+        MachineOperand slot = MemOperand(REG_RSP, 8LL * (argc - 1 - k) + pad);
+        switch (OperandType(gen->function, arg)) {
+        case FLOAT:
+            EmitOp(gen, X86_MOVSS, 4, slot, RegOperand(REG_XMM0));
+            CallSymbol(gen, RuntimeSymbol(gen, "zara_print_float"));
+            break;
+        case STRING:
+            EmitOp(gen, X86_MOV, 8, slot, RegOperand(REG_RDI));
+            CallSymbol(gen, RuntimeSymbol(gen, "zara_print_string"));
+            break;
+        case ARRAY:
+            EmitOp(gen, X86_MOV, 8, slot, RegOperand(REG_RDI));
+            CallSymbol(gen, RuntimeSymbol(gen, ElementType(gen, arg) == FLOAT ? "zara_print_float_array" : "zara_print_array"));
+            break;
+        case STACK:
+            EmitOp(gen, X86_MOV, 8, slot, RegOperand(REG_RDI));
+            CallSymbol(gen, RuntimeSymbol(gen, ElementType(gen, arg) == FLOAT ? "zara_print_float_stack" : "zara_print_stack"));
+            break;
+        default:
+            EmitOp(gen, X86_MOV, 4, slot, RegOperand(REG_RDI));
+            CallSymbol(gen, RuntimeSymbol(gen, "zara_print_int"));
+            break;
+        }
+    }
+    CallSymbol(gen, RuntimeSymbol(gen, "zara_print_end"));
+    AdjustStack(gen, X86_ADD, 8 * argc + pad);
+    RestoreRegisters(gen, &saved);
+    Move(gen, 4, ImmOperand(0), dst);
+}
+
+/**
+ * @brief Returns whether an argument of a call goes in a register, counting it against the registers of its class
+ */
+static int TakeArgumentRegister(DataType type, int* ints, int* floats) {
+    if (type == FLOAT) {
+        return (*floats)++ < MAX_FLOAT_ARGS;
+    }
+    return (*ints)++ < MAX_INT_ARGS;
+}
+
+/**
+ * @brief Returns the type of the parameter an argument of a call is passed for
+ */
+static DataType ArgumentType(const CodeGen* gen, int index, TACFunction* callee, int k) {
+    int argc = gen->function->code[index].arg2.value.intValue;
+    DataType argType = OperandType(gen->function, gen->function->code[index - argc + k].arg1);
+    return callee != NULL && k < callee->paramCount ? callee->vars[k].type : argType;
+}
+
+/**
+ * @brief Counts the arguments of a call that do not fit in the argument registers
+ */
+static int StackArgumentCount(const CodeGen* gen, int index, TACFunction* callee) {
+    int argc = gen->function->code[index].arg2.value.intValue;
+    int ints = 0;
+    int floats = 0;
+    int count = 0;
+
+    for (int k = 0; k < argc; k++) {
+        if (!TakeArgumentRegister(ArgumentType(gen, index, callee, k), &ints, &floats)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Loads the pushed arguments of a call into the argument registers
+ *
+ * Each argument is converted to the type of the parameter it is passed
+ * for, when the callee is a function of the program. Arguments left over
+ * once the registers run out are copied in order to 8-byte slots below
+ * the pushed ones, padded so the call is made with rsp 16-byte aligned.
+ *
+ * @return The size of that area in bytes, which the caller releases after the call
+ */
+static int LoadArguments(CodeGen* gen, int index, TACFunction* callee) {
+    int argc = gen->function->code[index].arg2.value.intValue;
+    int stacked = StackArgumentCount(gen, index, callee);
+    int area = stacked == 0 ? 0 : 8 * stacked + ((argc + stacked) % 2 == 1 ? 8 : 0);
+    int ints = 0;
+    int floats = 0;
+
+    AdjustStack(gen, X86_SUB, area);
+    stacked = 0;
+    for (int k = 0; k < argc; k++) {
+        DataType argType = OperandType(gen->function, gen->function->code[index - argc + k].arg1);
+        DataType paramType = ArgumentType(gen, index, callee, k);
+        MachineOperand slot = MemOperand(REG_RSP, area + 8LL * (argc - 1 - k));
+        int inRegister = TakeArgumentRegister(paramType, &ints, &floats);
+        MachineOperand to;
+
+        if (paramType == FLOAT) {
+            to = RegOperand(inRegister ? REG_XMM0 + floats - 1 : REG_XMM15);
+            EmitOp(gen, argType == FLOAT ? X86_MOVSS : X86_CVTSI2SS, 4, slot, to);
+        } else {
+            to = RegOperand(inRegister ? intArgRegisters[ints - 1] : REG_RAX);
+            if (argType == FLOAT) {
+                EmitOp(gen, X86_CVTTSS2SI, 4, slot, to);
+            } else {
+                EmitOp(gen, X86_MOV, 8, slot, to);
+            }
+        }
+        if (!inRegister) {
+            MachineOperand outgoing = MemOperand(REG_RSP, 8LL * stacked++);
+            if (paramType == FLOAT) {
+                MoveFloat(gen, to, outgoing);
+            } else {
+                Move(gen, 8, to, outgoing);
+            }
+        }
+    }
+    return area;
+}
+
+/**
+ * @brief Generates a call, saving the caller-saved registers that hold live values around it
+ *
+ * A call in tail position to a function returning the same type becomes
+ * a jump once the frame is released, when optimizing.
+ */
+static void GenerateCall(CodeGen* gen, const TACInstruction* instr, int index, MachineOperand dst) {
+    TACFunction* function = gen->function;
+    const char* name = function->program->strings[instr->arg1.value.id];
+    TACFunction* callee = LookUpTACFunction(function->program, name);
+    int argc = instr->arg2.value.intValue;
+    int result = TACDefinedVar(instr);
+    IntList saved = {NULL, 0, 0};
+
+    if (callee == NULL && strcmp(name, "print") == 0) {
+        GeneratePrint(gen, instr, index, dst);
+        return;
+    }
+
+    int symbol = AddMachineSymbol(gen->program, name, callee != NULL);
+    int tail = gen->optLevel > 0 && callee != NULL && IsTailCall(function, index) &&
+               callee->returnType == function->returnType && function->vars[result].type == function->returnType &&
+               StackArgumentCount(gen, index, callee) == 0;
+
+    if (!tail) {
+        SaveRegisters(gen, index, &saved);
+    }
+    int area = LoadArguments(gen, index, callee);
+    if (area == 0) {
+        AdjustStack(gen, X86_ADD, 8 * argc);
+    }
+    if (tail) {
+        ReleaseFrame(gen);
+        EmitOp(gen, X86_JMP, 0, SymbolRef(symbol), NoMachineOperand());
+        return;
+    }
+    CallSymbol(gen, symbol);
+    if (area > 0) {
+        // The pushed arguments stay below the outgoing ones until the callee returns
+        AdjustStack(gen, X86_ADD, 8 * argc + area);
+    }
+
+    DataType returned = callee != NULL ? callee->returnType : (result >= 0 ? function->vars[result].type : INTEGER);
+    MachineOperand value = RegOperand(REG_RAX);
+    if (returned == FLOAT) {
+        // xmm0 may be restored for another value before the result is stored
+        value = RegOperand(REG_XMM15);
+        MoveFloat(gen, RegOperand(REG_XMM0), value);
+    }
+    RestoreRegisters(gen, &saved);
+    if (result >= 0) {
+        StoreConverted(gen, value, returned, function->vars[result].type, dst);
+    }
+}
+
+static void GenerateReturn(CodeGen* gen, const TACInstruction* instr, int index) {
+    DataType type = gen->function->returnType;
+
+    if (instr->arg1.kind == TAC_OPERAND_NONE) {
+        Move(gen, 4, ImmOperand(0), RegOperand(REG_RAX));
+    } else {
+        GenerateCopy(gen, instr->arg1, index, type, RegOperand(type == FLOAT ? REG_XMM0 : REG_RAX));
+    }
+    if (index != gen->function->count - 1) {
+        EmitOp(gen, X86_JMP, 0, LabelRef(gen->epilogue), NoMachineOperand());
+    }
+}
+
+static void GenerateInstruction(CodeGen* gen, int index) {
+    TACFunction* function = gen->function;
+    const TACInstruction* instr = &function->code[index];
+    int result = TACDefinedVar(instr);
+    MachineOperand dst = result >= 0 ? Location(gen, result, DEF_POSITION(index)) : NoMachineOperand();
+
+    if (result >= 0 && dst.kind == MOP_NONE && !HasSideEffects(instr)) {
+        return;
+    }
+
+    switch (instr->op) {
+    case TAC_NOP:
+        break;
+    case TAC_ASSIGN:
+        GenerateCopy(gen, instr->arg1, index, function->vars[result].type, dst);
+        break;
+    case TAC_ADD:
+    case TAC_SUB:
+    case TAC_MUL:
+    case TAC_DIV:
+    case TAC_MOD: {
+        DataType a = OperandType(function, instr->arg1);
+        DataType b = OperandType(function, instr->arg2);
+        if (a == STRING || a == ARRAY || a == STACK || b == STRING || b == ARRAY || b == STACK) {
+            fprintf(stderr, "Error: arithmetic on a string, array or stack in %s is not supported\n",
+                    function->name);
+            exit(EXIT_FAILURE);
+        }
+        if (a == FLOAT || b == FLOAT) {
+            GenerateFloatBinary(gen, instr, index, dst);
+        } else if (function->vars[result].type == FLOAT) {
+            GenerateIntBinary(gen, instr, index, RegOperand(REG_RAX));
+            StoreConverted(gen, RegOperand(REG_RAX), INTEGER, FLOAT, dst);
+        } else {
+            GenerateIntBinary(gen, instr, index, dst);
+        }
+        break;
+    }
+    case TAC_LT:
+    case TAC_LE:
+    case TAC_GT:
+    case TAC_GE:
+    case TAC_EQ:
+    case TAC_NE:
+        GenerateComparison(gen, instr, index, dst);
+        break;
+    case TAC_NEWARRAY:
+        GenerateNewArray(gen, instr, index, dst);
+        break;
+    case TAC_LOAD_INDEX:
+        GenerateLoadIndex(gen, instr, index, dst);
+        break;
+    case TAC_STORE_INDEX:
+        GenerateStoreIndex(gen, instr, index);
+        break;
+    case TAC_NEWSTACK:
+        GenerateNewStack(gen, index, dst);
+        break;
+    case TAC_PUSH:
+        GeneratePush(gen, instr, index);
+        break;
+    case TAC_POP:
+    case TAC_PEEK:
+        GeneratePop(gen, instr, index, dst);
+        break;
+    case TAC_STACKSIZE:
+        Move(gen, 4, MemOperand(StackBase(gen, instr->arg1, index).reg, 0), dst);
+        break;
+    case TAC_CONCAT:
+    case TAC_STREQ:
+        GenerateStringCall(gen, instr, index, dst);
+        break;
+    case TAC_VECLOOP:
+        GenerateVectorLoop(gen, instr, index, dst);
+        break;
+    case TAC_CHECKBOUNDS:
+        GenerateCheckBounds(gen, instr, index);
+        break;
+    case TAC_VECREDUCE: {
+        MachineOperand slot = FrameSlot(gen, gen->reductionBase + instr->arg2.value.intValue);
+        if (function->vars[result].type == FLOAT) {
+            MoveFloat(gen, slot, dst);
+        } else {
+            Move(gen, 4, slot, dst);
+        }
+        break;
+    }
+    case TAC_LABEL:
+        EmitMachineLabel(gen->out, gen->labels[instr->result.value.id]);
+        break;
+    case TAC_PARAM:
+        GenerateParam(gen, instr, index);
+        break;
+    case TAC_CALL:
+        GenerateCall(gen, instr, index, dst);
+        break;
+    case TAC_RETURN:
+        GenerateReturn(gen, instr, index);
+        break;
+    default:
+        fprintf(stderr, "Error: cannot generate code for %s in %s\n", OpcodeSymbol(instr->op), function->name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int HasTree(const CodeGen* gen, int index) {
+    return gen->selection != NULL && gen->selection->hasTree[index];
+}
+
+static int IsFolded(const CodeGen* gen, int index) {
+    return gen->selection != NULL && gen->selection->root[index] >= 0;
+}
+
+/**
+ * @brief Generates a root together with the instructions folded into it, by tiling their tree
+ *
+ * @return For a branch, the condition under which its operand is nonzero
+ */
+static ConditionCode GenerateTree(CodeGen* gen, int index) {
+    const TACInstruction* instr = &gen->function->code[index];
+    int result = TACDefinedVar(instr);
+    MachineOperand dst = result >= 0 ? Location(gen, result, DEF_POSITION(index)) : NoMachineOperand();
+
+    if (result >= 0 && dst.kind == MOP_NONE && !HasSideEffects(instr)) {
+        return COND_NE;
+    }
+
+    IselTree tree = BuildIselTree(gen->selection, gen->function, index);
+    for (int l = 0; l < tree.leafCount; l++) {
+        tree.leafOperands[l] = Location(gen, tree.leafVars[l], USE_POSITION(index));
+        // Never live, so any value will do
+        if (tree.leafOperands[l].kind == MOP_NONE) {
+            tree.leafOperands[l] = ImmOperand(0);
+        }
+    }
+    ConditionCode cond = TileIselTree(&tree, gen->out, &gen->boundsLabel, dst);
+    FreeIselTree(&tree);
+    return cond;
+}
+
+/**
+ * @brief Generates the branch ending a block along with the moves its edges need
+ *
+ * Moves for a fall-through edge go after the conditional jump; a taken
+ * edge that needs moves jumps to a stub at the end of the function that
+ * makes them and then jumps on.
+ */
+static void GenerateBranch(CodeGen* gen, int block, int index) {
+    const TACInstruction* instr = &gen->function->code[index];
+    const CFG* cfg = &gen->liveness->cfg;
+    int target = instr->result.value.id;
+    int targetBlock = cfg->labelBlock[target];
+
+    if (instr->op == TAC_GOTO) {
+        GenerateEdgeMoves(gen, block, targetBlock);
+        EmitOp(gen, X86_JMP, 0, LabelRef(gen->labels[target]), NoMachineOperand());
+        return;
+    }
+
+    ConditionCode taken = COND_NE;
+    if (HasTree(gen, index)) {
+        taken = GenerateTree(gen, index);
+    } else {
+        MachineOperand condition = IntSource(gen, instr->arg1, index, REG_RAX);
+        if (condition.kind == MOP_IMM) {
+            Move(gen, 4, condition, RegOperand(REG_RAX));
+            condition = RegOperand(REG_RAX);
+        }
+        EmitOp(gen, X86_CMP, 4, ImmOperand(0), condition);
+    }
+    // Condition codes come in pairs, each the negation of the other
+    if (instr->op == TAC_IFFALSE) {
+        taken ^= 1;
+    }
+
+    int jumpTo = gen->labels[target];
+    CollectEdgeMoves(gen, block, targetBlock);
+    if (gen->moves.count > 0) {
+        gen->moves.count = 0;
+        jumpTo = NewMachineLabel(gen->out);
+        IntListPush(&gen->stubs, jumpTo);
+        IntListPush(&gen->stubs, block);
+        IntListPush(&gen->stubs, target);
+    }
+    EmitCondition(gen->out, X86_JCC, taken, LabelRef(jumpTo));
+
+    if (block + 1 < cfg->blockCount) {
+        GenerateEdgeMoves(gen, block, block + 1);
+    }
+}
+
+/**
+ * @brief Decides which registers the prologue saves and lays out the frame
+ *
+ * @return The number of bytes of slots below the pushed registers
+ */
+static int LayOutFrame(CodeGen* gen) {
+    char used[NUM_REGISTERS] = {0}; // Bit 0: holds a value, bit 1: holds one across a call
+    int slots = num_spill_slots;
+
+    for (int i = 0; i < num_variables; i++) {
+        if (!variables[i].is_spilled && variables[i].register_num >= 0) {
+            used[variables[i].register_num] |= 1;
+        }
+    }
+    // Only registers holding a value across some call need a save slot
+    for (int c = 0; c < gen->liveness->calls.count; c++) {
+        int call = gen->liveness->calls.items[c];
+        int result = TACDefinedVar(&gen->function->code[call]);
+        for (int v = 0; v < gen->liveness->varCount; v++) {
+            int piece = variable_at(v, DEF_POSITION(call));
+            if (v != result && piece >= 0 && !variables[piece].is_spilled && variables[piece].register_num >= 0 &&
+                IntervalCovers(&gen->liveness->intervals[v], DEF_POSITION(call))) {
+                used[variables[piece].register_num] |= 2;
+            }
+        }
+    }
+
+    gen->pushedCount = 0;
+    for (int reg = 0; reg <= REG_XMM15; reg++) {
+        gen->saveSlot[reg] = -1;
+    }
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (!used[r]) {
+            continue;
+        }
+        if (registers[r].callee_saved) {
+            gen->pushed[gen->pushedCount++] = machineRegisters[r];
+        } else if (used[r] & 2) {
+            gen->saveSlot[machineRegisters[r]] = slots++;
+        }
+    }
+
+    gen->reductionBase = slots;
+    slots += gen->function->reductionSlots;
+
+    // rsp is 16-byte aligned after pushing rbp, and must be again once the frame is set up
+    if ((gen->pushedCount + slots) % 2 == 1) {
+        slots++;
+    }
+    return 8 * slots;
+}
+
+/**
+ * @brief Generates the machine code of a function from its allocated TAC
+ *
+ * The caller has run liveness and register allocation; every variable is
+ * read and written where the allocator put it at that instruction.
+ */
+static void GenerateFunction(CodeGen* gen) {
+    TACFunction* function = gen->function;
+    const CFG* cfg = &gen->liveness->cfg;
+    MachineFunction* out = gen->out;
+
+    gen->labels = CheckedMalloc((function->labelCount + 1) * sizeof(int));
+    for (int l = 0; l < function->labelCount; l++) {
+        gen->labels[l] = NewMachineLabel(out);
+    }
+    gen->epilogue = NewMachineLabel(out);
+    gen->boundsLabel = -1;
+    gen->emptyLabel = -1;
+
+    int frameSize = LayOutFrame(gen);
+    EmitOp(gen, X86_PUSH, 8, RegOperand(REG_RBP), NoMachineOperand());
+    EmitOp(gen, X86_MOV, 8, RegOperand(REG_RSP), RegOperand(REG_RBP));
+    for (int i = 0; i < gen->pushedCount; i++) {
+        EmitOp(gen, X86_PUSH, 8, RegOperand(gen->pushed[i]), NoMachineOperand());
+    }
+    AdjustStack(gen, X86_SUB, frameSize);
+
+    // Parameters arrive in the argument registers of the System V ABI, then above the return address
+    int ints = 0;
+    int floats = 0;
+    int stacked = 0;
+    for (int p = 0; p < function->paramCount; p++) {
+        MachineOperand to = NoMachineOperand();
+        MachineOperand from;
+        int isFloat = IsFloatVar(gen, p);
+        if (IntervalCovers(&gen->liveness->intervals[p], USE_POSITION(0))) {
+            to = Location(gen, p, USE_POSITION(0));
+        }
+        if (TakeArgumentRegister(isFloat ? FLOAT : INTEGER, &ints, &floats)) {
+            from = RegOperand(isFloat ? REG_XMM0 + floats - 1 : intArgRegisters[ints - 1]);
+        } else {
+            from = MemOperand(REG_RBP, 16 + 8LL * stacked++);
+        }
+        AddMove(&gen->moves, from, to, isFloat);
+    }
+    ResolveMoves(gen, &gen->moves);
+
+    for (int b = 0; b < cfg->blockCount; b++) {
+        const BasicBlock* block = &cfg->blocks[b];
+        if (!IsReachable(cfg, b)) {
+            continue;
+        }
+        for (int i = block->start; i < block->end; i++) {
+            TACOpcode op = function->code[i].op;
+            if (i > block->start) {
+                GenerateSplitMoves(gen, i);
+            }
+            if (IsBranchOp(op)) {
+                GenerateBranch(gen, b, i);
+            } else if (HasTree(gen, i)) {
+                GenerateTree(gen, i);
+            } else if (!IsFolded(gen, i)) {
+                GenerateInstruction(gen, i);
+            }
+        }
+        TACOpcode last = function->code[block->end - 1].op;
+        if (!IsBranchOp(last) && last != TAC_RETURN && b + 1 < cfg->blockCount) {
+            GenerateEdgeMoves(gen, b, b + 1);
+        }
+    }
+
+    // Falling off the end returns 0
+    TACOpcode last = function->count > 0 ? function->code[function->count - 1].op : TAC_NOP;
+    if (last != TAC_RETURN && last != TAC_GOTO) {
+        Move(gen, 4, ImmOperand(0), RegOperand(REG_RAX));
+    }
+    EmitMachineLabel(out, gen->epilogue);
+    ReleaseFrame(gen);
+    EmitOp(gen, X86_RET, 0, NoMachineOperand(), NoMachineOperand());
+
+    for (int s = 0; s < gen->stubs.count; s += 3) {
+        int target = gen->stubs.items[s + 2];
+        EmitMachineLabel(out, gen->stubs.items[s]);
+        GenerateEdgeMoves(gen, gen->stubs.items[s + 1], cfg->labelBlock[target]);
+        EmitOp(gen, X86_JMP, 0, LabelRef(gen->labels[target]), NoMachineOperand());
+    }
+
+    for (int g = 0; g < gen->growths.count; g += 3) {
+        EmitMachineLabel(out, gen->growths.items[g]);
+        GenerateGrowth(gen, gen->growths.items[g + 1], gen->growths.items[g + 2]);
+    }
+
+    if (gen->boundsLabel >= 0) {
+        EmitMachineLabel(out, gen->boundsLabel);
+        CallSymbol(gen, RuntimeSymbol(gen, "zara_bounds_error"));
+    }
+    if (gen->emptyLabel >= 0) {
+        EmitMachineLabel(out, gen->emptyLabel);
+        CallSymbol(gen, RuntimeSymbol(gen, "zara_stack_empty_error"));
+    }
+
+    free(gen->labels);
+    IntListFree(&gen->stubs);
+    IntListFree(&gen->growths);
+}
+
+/**
+ * @brief Translates a program to x86-64 machine instructions for the System V ABI
+ *
+ * Each function gets live intervals and registers (linear scan, or graph
+ * coloring at -O2), then its instructions are selected one by one, or a
+ * tree at a time when optimizing. The functions of the program must be
+ * out of SSA form.
+ *
+ * @param program The program to translate
+ * @param optLevel The optimization level it was compiled at
+ * @return The machine program, to be released with FreeMachineProgram
+ */
+MachineProgram GenerateProgram(TACProgram* program, int optLevel) {
+    MachineProgram machine;
+    CodeGen gen;
+
+    memset(&machine, 0, sizeof(MachineProgram));
+    machine.functions = CheckedCalloc(program->functionCount + 1, sizeof(MachineFunction));
+
+    // Name every function first, so calls to ones further down are known to be local
+    for (int f = 0; f < program->functionCount; f++) {
+        machine.functions[f].symbol = AddMachineSymbol(&machine, program->functions[f].name, 1);
+    }
+    machine.functionCount = program->functionCount;
+
+    for (int f = 0; f < program->functionCount; f++) {
+        TACFunction* function = &program->functions[f];
+        Selection selection;
+        Liveness liveness;
+
+        if (optLevel > 0) {
+            selection = SelectTrees(function);
+            liveness = ComputeFoldedLiveness(function, selection.root);
+            if (optLevel >= 2 && ScheduleBlocks(&liveness, &selection) > 0) {
+                FreeLiveness(&liveness);
+                FreeSelection(&selection);
+                selection = SelectTrees(function);
+                liveness = ComputeFoldedLiveness(function, selection.root);
+            }
+        } else {
+            liveness = ComputeLiveness(function);
+        }
+
+        add_live_intervals(&liveness);
+        if (optLevel >= 2) {
+            coloring_allocation();
+        } else {
+            register_allocation();
+        }
+
+        memset(&gen, 0, sizeof(CodeGen));
+        gen.function = function;
+        gen.liveness = &liveness;
+        gen.selection = optLevel > 0 ? &selection : NULL;
+        gen.program = &machine;
+        gen.out = &machine.functions[f];
+        gen.optLevel = optLevel;
+        GenerateFunction(&gen);
+        if (optLevel > 0) {
+            RunPeephole(gen.out);
+        }
+
+        free(gen.moves.moves);
+        reset_variables();
+        FreeLiveness(&liveness);
+        if (optLevel > 0) {
+            FreeSelection(&selection);
+        }
+    }
+    return machine;
+}
@@ -0,0 +1,9 @@
+#ifndef codegen_h
+#define codegen_h
+
+#include "tac.h"
+#include "x86.h"
+
+MachineProgram GenerateProgram(TACProgram* program, int optLevel);
+
+#endif
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimize.h"
+#include "cfg.h"
+#include "ssa.h"
+
+/**
+ * @brief Finds arrays whose contents can never be observed
+ *
+ * An array created in this function that is only ever written to, and never
+ * read, copied, passed or returned, has stores nobody can see.
+ *
+ * @param function The function, in SSA form
+ * @param chains Its def-use chains
+ * @return A flag per variable, set for write-only arrays; the caller frees it
+ */
+static char* FindWriteOnlyArrays(TACFunction* function, DefUseChains* chains) {
+    char* writeOnly = CheckedCalloc(function->varCount, sizeof(char));
+
+    for (int v = 0; v < function->varCount; v++) {
+        int def = chains->def[v];
+        if (def < 0 || function->code[def].op != TAC_NEWARRAY) {
+            continue;
+        }
+
+        writeOnly[v] = 1;
+        IntList* uses = &chains->uses[v];
+        for (int u = 0; u < uses->count && writeOnly[v]; u++) {
+            TACInstruction* use = &function->code[uses->items[u]];
+            int storesInto = use->op == TAC_STORE_INDEX && use->result.kind == TAC_OPERAND_VAR &&
+                             use->result.value.id == v &&
+                             !(use->arg1.kind == TAC_OPERAND_VAR && use->arg1.value.id == v) &&
+                             !(use->arg2.kind == TAC_OPERAND_VAR && use->arg2.value.id == v);
+            if (!storesInto) {
+                writeOnly[v] = 0;
+            }
+        }
+    }
+
+    return writeOnly;
+}
+
+/**
+ * @brief Checks whether an instruction must be kept whatever its result is used for
+ */
+static int IsCritical(const TACInstruction* instr, const char* writeOnly) {
+    if (instr->op == TAC_STORE_INDEX && instr->result.kind == TAC_OPERAND_VAR) {
+        return !writeOnly[instr->result.value.id];
+    }
+    return HasSideEffects(instr);
+}
+
+/**
+ * @brief Removes jumps to the label that immediately follows them
+ *
+ * A jump over other labels is kept when its target starts with phis: the
+ * block would reach the target only through the empty blocks in between,
+ * and the phis name it as a predecessor.
+ *
+ * @return The number of jumps removed
+ */
+static int RemoveJumpsToNext(TACFunction* function) {
+    int removed = 0;
+
+    for (int i = 0; i + 1 < function->count; i++) {
+        TACInstruction* instr = &function->code[i];
+        if (instr->op != TAC_GOTO) {
+            continue;
+        }
+        int end = i + 1;
+        while (end < function->count && function->code[end].op == TAC_LABEL) {
+            end++;
+        }
+        int hasPhis = end < function->count && function->code[end].op == TAC_PHI;
+        for (int j = i + 1; j < end && (j == i + 1 || !hasPhis); j++) {
+            if (function->code[j].result.value.id == instr->result.value.id) {
+                MakeNop(instr);
+                removed++;
+                break;
+            }
+        }
+    }
+
+    return removed;
+}
+
+/**
+ * @brief Removes dead code from a function with a mark-and-sweep over def-use chains
+ *
+ * Instructions with side effects (stores, calls, branches, returns and
+ * divisions that may trap) are marked live, and liveness then flows
+ * backwards from each live instruction to the definitions of its operands.
+ * Everything left unmarked is swept: temporaries nobody reads, assignments
+ * to variables that are never read again, and stores into arrays that are
+ * never read. Unreachable blocks and jumps to the next instruction go too.
+ *
+ * @param function The function to optimize; converted to SSA if needed
+ * @return The number of instructions removed
+ */
+int RunDCE(TACFunction* function) {
+    BuildSSA(function);
+
+    int removed = RemoveUnreachableBlocks(function);
+    DefUseChains chains = BuildDefUseChains(function);
+    char* writeOnly = FindWriteOnlyArrays(function, &chains);
+    char* live = CheckedCalloc(function->count, sizeof(char));
+    IntList worklist = {0};
+
+    for (int i = 0; i < function->count; i++) {
+        if (IsCritical(&function->code[i], writeOnly)) {
+            live[i] = 1;
+            IntListPush(&worklist, i);
+        }
+    }
+
+    while (worklist.count > 0) {
+        TACInstruction* instr = &function->code[worklist.items[--worklist.count]];
+        for (int k = 0; k < TACUseCount(instr); k++) {
+            TACOperand* use = TACUseAt(instr, k);
+            if (use->kind != TAC_OPERAND_VAR) {
+                continue;
+            }
+            int def = chains.def[use->value.id];
+            if (def >= 0 && !live[def]) {
+                live[def] = 1;
+                IntListPush(&worklist, def);
+            }
+        }
+    }
+
+    for (int i = 0; i < function->count; i++) {
+        if (!live[i] && function->code[i].op != TAC_NOP) {
+            MakeNop(&function->code[i]);
+            removed++;
+        }
+    }
+
+    removed += RemoveJumpsToNext(function);
+    RemoveNops(function);
+
+    FreeDefUseChains(&chains);
+    free(writeOnly);
+    free(live);
+    IntListFree(&worklist);
+
+    return removed;
+}
+
+/**
+ * @brief Removes every function that cannot be called, directly or indirectly, from main
+ *
+ * Does nothing if the program has no main function, since then there is
+ * no known entry point to start from.
+ *
+ * @param program The program to prune
+ * @return The number of functions removed
+ */
+int RemoveUnusedFunctions(TACProgram* program) {
+    int entry = -1;
+    for (int i = 0; i < program->functionCount; i++) {
+        if (strcmp(program->functions[i].name, "main") == 0) {
+            entry = i;
+        }
+    }
+    if (entry < 0) {
+        return 0;
+    }
+
+    char* reached = CheckedCalloc(program->functionCount, sizeof(char));
+    IntList worklist = {0};
+    reached[entry] = 1;
+    IntListPush(&worklist, entry);
+
+    while (worklist.count > 0) {
+        TACFunction* caller = &program->functions[worklist.items[--worklist.count]];
+        for (int i = 0; i < caller->count; i++) {
+            if (caller->code[i].op != TAC_CALL) {
+                continue;
+            }
+            TACFunction* callee = LookUpTACFunction(program, program->strings[caller->code[i].arg1.value.id]);
+            int c = callee != NULL ? (int)(callee - program->functions) : -1;
+            if (c >= 0 && !reached[c]) {
+                reached[c] = 1;
+                IntListPush(&worklist, c);
+            }
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < program->functionCount; i++) {
+        if (reached[i]) {
+            program->functions[kept++] = program->functions[i];
+        } else {
+            FreeTACFunction(&program->functions[i]);
+        }
+    }
+    int removed = program->functionCount - kept;
+    program->functionCount = kept;
+
+    free(reached);
+    IntListFree(&worklist);
+
+    return removed;
+}
@@ -0,0 +1,515 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "x86.h"
+
+// Operands of a byte instruction that are byte registers
+#define BYTE_RM 1
+#define BYTE_REG 2
+
+typedef struct {
+    const MachineProgram* program;
+    MachineCode* code;
+
+    int ripField;       // Offset of the RIP-relative displacement of the instruction being encoded, -1 if none
+    int ripSymbol;
+    long long ripAddend;
+
+    int* labelOffsets;  // Label of the current function -> offset, -1 until placed
+    IntList labelFixups; // Pairs of field offset and label, patched once the function is done
+    IntList callFixups; // Pairs of field offset and symbol of a function in the program
+} Encoder;
+
+static void EmitByte(Encoder* e, int byte) {
+    MachineCode* code = e->code;
+    if (code->textSize == code->textCapacity) {
+        code->textCapacity = code->textCapacity == 0 ? 4096 : code->textCapacity * 2;
+        code->text = CheckedRealloc(code->text, code->textCapacity);
+    }
+    code->text[code->textSize++] = (unsigned char)byte;
+}
+
+static void EmitInt32(Encoder* e, long long value) {
+    for (int i = 0; i < 4; i++) {
+        EmitByte(e, (int)((value >> (8 * i)) & 0xff));
+    }
+}
+
+static void PatchInt32(MachineCode* code, int offset, long long value) {
+    for (int i = 0; i < 4; i++) {
+        code->text[offset + i] = (unsigned char)((value >> (8 * i)) & 0xff);
+    }
+}
+
+static void AddRelocation(MachineCode* code, int offset, int symbol, RelocationKind kind, long long addend) {
+    if (code->relocationCount == code->relocationCapacity) {
+        code->relocationCapacity = code->relocationCapacity == 0 ? 16 : code->relocationCapacity * 2;
+        code->relocations = CheckedRealloc(code->relocations, code->relocationCapacity * sizeof(MachineRelocation));
+    }
+    MachineRelocation* relocation = &code->relocations[code->relocationCount++];
+    relocation->offset = offset;
+    relocation->symbol = symbol;
+    relocation->kind = kind;
+    relocation->addend = addend;
+}
+
+static int FitsInt8(long long value) {
+    return value >= -128 && value <= 127;
+}
+
+// Registers and xmm registers both number 0 to 15 in the encoding
+static int RegNumber(int reg) {
+    return IS_XMM(reg) ? reg - REG_XMM0 : reg;
+}
+
+/**
+ * @brief Emits an optional mandatory prefix, a REX prefix if one is needed, and the opcode
+ *
+ * @param prefix 0x66 or 0xf3 for SSE instructions, 0 for none
+ * @param wide Whether the operation is 64 bits (REX.W)
+ * @param reg Register in the ModRM reg field
+ * @param rm Register or memory operand in the ModRM rm field
+ * @param byteRegs Which operands are byte registers (BYTE_RM, BYTE_REG), since spl to dil need a REX prefix
+ */
+static void EmitPrefixes(Encoder* e, int prefix, int wide, int reg, MachineOperand rm, int byteRegs,
+                         const unsigned char* opcode, int opcodeLength) {
+    int rex = wide ? 0x48 : 0x40;
+
+    if (prefix != 0) {
+        EmitByte(e, prefix);
+    }
+    if (reg >= 8) {
+        rex |= 0x04;
+    }
+    if (rm.kind == MOP_REG && RegNumber(rm.reg) >= 8) {
+        rex |= 0x01;
+    }
+    if (rm.kind == MOP_MEM && rm.reg != REG_RIP && rm.reg >= 8) {
+        rex |= 0x01;
+    }
+    if (rm.kind == MOP_MEM && rm.index >= 8) {
+        rex |= 0x02;
+    }
+    int needsRex = ((byteRegs & BYTE_REG) && reg >= 4 && reg < 8) ||
+                   ((byteRegs & BYTE_RM) && rm.kind == MOP_REG && rm.reg >= 4 && rm.reg < 8);
+    if (rex != 0x40 || needsRex) {
+        EmitByte(e, rex);
+    }
+    for (int i = 0; i < opcodeLength; i++) {
+        EmitByte(e, opcode[i]);
+    }
+}
+
+/**
+ * @brief Emits the ModRM byte, and the SIB byte and displacement a memory operand needs
+ */
+static void EmitModRM(Encoder* e, int reg, MachineOperand rm) {
+    reg &= 7;
+    if (rm.kind == MOP_REG) {
+        EmitByte(e, 0xc0 | (reg << 3) | (RegNumber(rm.reg) & 7));
+        return;
+    }
+
+    if (rm.reg == REG_RIP) {
+        EmitByte(e, (reg << 3) | 5);
+        e->ripField = e->code->textSize;
+        e->ripSymbol = rm.symbol;
+        e->ripAddend = rm.value;
+        EmitInt32(e, 0);
+        return;
+    }
+
+    int base = rm.reg & 7;
+    int mod;
+    // rbp and r13 as a base always take a displacement
+    if (rm.value == 0 && base != 5) {
+        mod = 0;
+    } else if (FitsInt8(rm.value)) {
+        mod = 1;
+    } else {
+        mod = 2;
+    }
+
+    if (rm.index >= 0 || base == 4) {
+        int scale = rm.index < 0 ? 0 : (rm.scale == 8 ? 3 : (rm.scale == 4 ? 2 : (rm.scale == 2 ? 1 : 0)));
+        int index = rm.index < 0 ? 4 : (rm.index & 7);
+        EmitByte(e, (mod << 6) | (reg << 3) | 4);
+        EmitByte(e, (scale << 6) | (index << 3) | base);
+    } else {
+        EmitByte(e, (mod << 6) | (reg << 3) | base);
+    }
+
+    if (mod == 1) {
+        EmitByte(e, (int)(rm.value & 0xff));
+    } else if (mod == 2) {
+        EmitInt32(e, rm.value);
+    }
+}
+
+/**
+ * @brief Encodes a full ModRM-form instruction: prefixes, opcode and operands
+ */
+static void EmitRM(Encoder* e, int prefix, int wide, const unsigned char* opcode, int opcodeLength, int reg,
+                   MachineOperand rm, int byteRegs) {
+    EmitPrefixes(e, prefix, wide, reg, rm, byteRegs, opcode, opcodeLength);
+    EmitModRM(e, reg, rm);
+}
+
+static void EmitRM1(Encoder* e, int wide, int opcode, int reg, MachineOperand rm, int byteRegs) {
+    unsigned char bytes[] = {(unsigned char)opcode};
+    EmitRM(e, 0, wide, bytes, 1, reg, rm, byteRegs);
+}
+
+static void EmitRM2(Encoder* e, int prefix, int wide, int opcode, int reg, MachineOperand rm) {
+    unsigned char bytes[] = {0x0f, (unsigned char)opcode};
+    EmitRM(e, prefix, wide, bytes, 2, reg, rm, 0);
+}
+
+static void Unencodable(const MachineProgram* program, const MachineFunction* function, const MachineInstr* instr) {
+    fprintf(stderr, "Error: cannot encode instruction in %s: ", program->symbols[function->symbol].name);
+    PrintMachineInstr(stderr, program, function, instr);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Encodes add, or, and, sub, xor and cmp, which share one layout
+ */
+static void EncodeArithmetic(Encoder* e, int group, const MachineInstr* instr) {
+    int wide = instr->size == 8;
+    int byteOp = instr->size == 1;
+
+    if (instr->src.kind == MOP_IMM) {
+        if (byteOp) {
+            EmitRM1(e, 0, 0x80, group, instr->dst, BYTE_RM);
+            EmitByte(e, (int)(instr->src.value & 0xff));
+        } else if (FitsInt8(instr->src.value)) {
+            EmitRM1(e, wide, 0x83, group, instr->dst, 0);
+            EmitByte(e, (int)(instr->src.value & 0xff));
+        } else {
+            EmitRM1(e, wide, 0x81, group, instr->dst, 0);
+            EmitInt32(e, instr->src.value);
+        }
+    } else if (instr->src.kind == MOP_REG) {
+        EmitRM1(e, wide, group * 8 + (byteOp ? 0 : 1), RegNumber(instr->src.reg), instr->dst,
+               byteOp ? BYTE_RM | BYTE_REG : 0);
+    } else {
+        EmitRM1(e, wide, group * 8 + (byteOp ? 2 : 3), RegNumber(instr->dst.reg), instr->src,
+               byteOp ? BYTE_RM | BYTE_REG : 0);
+    }
+}
+
+/**
+ * @brief Emits a 32-bit jump or call displacement, resolving it now or recording what it refers to
+ */
+static void EmitTarget(Encoder* e, MachineOperand target) {
+    int field = e->code->textSize;
+
+    EmitInt32(e, 0);
+    if (target.kind == MOP_LABEL) {
+        IntListPush(&e->labelFixups, field);
+        IntListPush(&e->labelFixups, target.symbol);
+    } else if (e->program->symbols[target.symbol].defined) {
+        IntListPush(&e->callFixups, field);
+        IntListPush(&e->callFixups, target.symbol);
+    } else {
+        AddRelocation(e->code, field, target.symbol, RELOC_PLT32, -4);
+    }
+}
+
+static void EncodeInstruction(Encoder* e, const MachineFunction* function, const MachineInstr* instr) {
+    static const int arithmeticGroups[] = {
+        [X86_ADD] = 0, [X86_OR] = 1, [X86_AND] = 4, [X86_SUB] = 5, [X86_XOR] = 6, [X86_CMP] = 7,
+    };
+    static const int packedIntOpcodes[] = {
+        [X86_PUNPCKLDQ] = 0x62, [X86_PUNPCKLQDQ] = 0x6c, [X86_PADDD] = 0xfe, [X86_PSUBD] = 0xfa,
+    };
+    static const int packedFloatOpcodes[] = {
+        [X86_ADDPS] = 0x58, [X86_SUBPS] = 0x5c, [X86_MULPS] = 0x59, [X86_DIVPS] = 0x5e, [X86_CVTDQ2PS] = 0x5b,
+    };
+    MachineOperand src = instr->src;
+    MachineOperand dst = instr->dst;
+    int wide = instr->size == 8;
+
+    switch (instr->op) {
+    case X86_LABEL:
+        e->labelOffsets[src.symbol] = e->code->textSize;
+        break;
+    case X86_MOV:
+        if (instr->size == 1) {
+            Unencodable(e->program, function, instr);
+        }
+        if (src.kind == MOP_IMM && dst.kind == MOP_REG && !wide) {
+            if (dst.reg >= 8) {
+                EmitByte(e, 0x41);
+            }
+            EmitByte(e, 0xb8 + (dst.reg & 7));
+            EmitInt32(e, src.value);
+        } else if (src.kind == MOP_IMM) {
+            EmitRM1(e, wide, 0xc7, 0, dst, 0);
+            EmitInt32(e, src.value);
+        } else if (src.kind == MOP_REG) {
+            EmitRM1(e, wide, 0x89, src.reg, dst, 0);
+        } else {
+            EmitRM1(e, wide, 0x8b, dst.reg, src, 0);
+        }
+        break;
+    case X86_MOVZB:
+        EmitRM(e, 0, 0, (const unsigned char[]){0x0f, 0xb6}, 2, dst.reg, src, BYTE_RM);
+        break;
+    case X86_MOVSXD:
+        EmitRM1(e, 1, 0x63, dst.reg, src, 0);
+        break;
+    case X86_LEA:
+        EmitRM1(e, wide, 0x8d, dst.reg, src, 0);
+        break;
+    case X86_ADD:
+    case X86_SUB:
+    case X86_AND:
+    case X86_OR:
+    case X86_XOR:
+    case X86_CMP:
+        EncodeArithmetic(e, arithmeticGroups[instr->op], instr);
+        break;
+    case X86_IMUL:
+        if (src.kind == MOP_IMM) {
+            EmitRM1(e, wide, FitsInt8(src.value) ? 0x6b : 0x69, dst.reg, dst, 0);
+            if (FitsInt8(src.value)) {
+                EmitByte(e, (int)(src.value & 0xff));
+            } else {
+                EmitInt32(e, src.value);
+            }
+        } else {
+            EmitRM2(e, 0, wide, 0xaf, dst.reg, src);
+        }
+        break;
+    case X86_CDQ:
+        if (wide) {
+            EmitByte(e, 0x48);
+        }
+        EmitByte(e, 0x99);
+        break;
+    case X86_IDIV:
+        EmitRM1(e, wide, 0xf7, 7, src, 0);
+        break;
+    case X86_TEST:
+        if (src.kind == MOP_IMM) {
+            EmitRM1(e, wide, 0xf7, 0, dst, 0);
+            EmitInt32(e, src.value);
+        } else {
+            EmitRM1(e, wide, 0x85, src.reg, dst, 0);
+        }
+        break;
+    case X86_SETCC:
+        EmitRM(e, 0, 0, (const unsigned char[]){0x0f, (unsigned char)(0x90 + instr->cond)}, 2, 0, dst, BYTE_RM);
+        break;
+    case X86_JMP:
+        EmitByte(e, 0xe9);
+        EmitTarget(e, src);
+        break;
+    case X86_JCC:
+        EmitByte(e, 0x0f);
+        EmitByte(e, 0x80 + instr->cond);
+        EmitTarget(e, src);
+        break;
+    case X86_CALL:
+        EmitByte(e, 0xe8);
+        EmitTarget(e, src);
+        break;
+    case X86_RET:
+        EmitByte(e, 0xc3);
+        break;
+    case X86_PUSH:
+        if (src.kind == MOP_REG) {
+            if (src.reg >= 8) {
+                EmitByte(e, 0x41);
+            }
+            EmitByte(e, 0x50 + (src.reg & 7));
+        } else if (src.kind == MOP_IMM && FitsInt8(src.value)) {
+            EmitByte(e, 0x6a);
+            EmitByte(e, (int)(src.value & 0xff));
+        } else if (src.kind == MOP_IMM) {
+            EmitByte(e, 0x68);
+            EmitInt32(e, src.value);
+        } else {
+            EmitRM1(e, 0, 0xff, 6, src, 0);
+        }
+        break;
+    case X86_POP:
+        if (dst.reg >= 8) {
+            EmitByte(e, 0x41);
+        }
+        EmitByte(e, 0x58 + (dst.reg & 7));
+        break;
+    case X86_MOVSS:
+        if (dst.kind == MOP_MEM) {
+            EmitRM2(e, 0xf3, 0, 0x11, RegNumber(src.reg), dst);
+        } else {
+            EmitRM2(e, 0xf3, 0, 0x10, RegNumber(dst.reg), src);
+        }
+        break;
+    case X86_MOVD:
+        if (src.kind == MOP_REG && IS_XMM(src.reg)) {
+            EmitRM2(e, 0x66, wide, 0x7e, RegNumber(src.reg), dst);
+        } else {
+            EmitRM2(e, 0x66, wide, 0x6e, RegNumber(dst.reg), src);
+        }
+        break;
+    case X86_ADDSS:
+        EmitRM2(e, 0xf3, 0, 0x58, RegNumber(dst.reg), src);
+        break;
+    case X86_MULSS:
+        EmitRM2(e, 0xf3, 0, 0x59, RegNumber(dst.reg), src);
+        break;
+    case X86_SUBSS:
+        EmitRM2(e, 0xf3, 0, 0x5c, RegNumber(dst.reg), src);
+        break;
+    case X86_DIVSS:
+        EmitRM2(e, 0xf3, 0, 0x5e, RegNumber(dst.reg), src);
+        break;
+    case X86_UCOMISS:
+        EmitRM2(e, 0, 0, 0x2e, RegNumber(dst.reg), src);
+        break;
+    case X86_CVTSI2SS:
+        EmitRM2(e, 0xf3, wide, 0x2a, RegNumber(dst.reg), src);
+        break;
+    case X86_CVTTSS2SI:
+        EmitRM2(e, 0xf3, wide, 0x2c, dst.reg, src);
+        break;
+    case X86_MOVUPS:
+        if (dst.kind == MOP_MEM) {
+            EmitRM2(e, 0, 0, 0x11, RegNumber(src.reg), dst);
+        } else {
+            EmitRM2(e, 0, 0, 0x10, RegNumber(dst.reg), src);
+        }
+        break;
+    case X86_PUNPCKLDQ:
+    case X86_PUNPCKLQDQ:
+    case X86_PADDD:
+    case X86_PSUBD:
+        EmitRM2(e, 0x66, 0, packedIntOpcodes[instr->op], RegNumber(dst.reg), src);
+        break;
+    case X86_PMULLD:
+        EmitRM(e, 0x66, 0, (const unsigned char[]){0x0f, 0x38, 0x40}, 3, RegNumber(dst.reg), src, 0);
+        break;
+    case X86_ADDPS:
+    case X86_SUBPS:
+    case X86_MULPS:
+    case X86_DIVPS:
+    case X86_CVTDQ2PS:
+        EmitRM2(e, 0, 0, packedFloatOpcodes[instr->op], RegNumber(dst.reg), src);
+        break;
+    }
+}
+
+/**
+ * @brief Lays out the constants of a program in one read-only data section
+ */
+static void LayOutConstants(const MachineProgram* program, MachineCode* code) {
+    int size = 0;
+
+    for (int s = 0; s < program->symbolCount; s++) {
+        const MachineSymbol* symbol = &program->symbols[s];
+        if (symbol->data == NULL) {
+            continue;
+        }
+        int align = symbol->align > 0 ? symbol->align : 1;
+        size = (size + align - 1) / align * align;
+        code->symbolOffsets[s] = size;
+        size += symbol->dataSize;
+    }
+
+    code->rodataSize = size;
+    code->rodata = CheckedCalloc(size + 1, 1);
+    for (int s = 0; s < program->symbolCount; s++) {
+        const MachineSymbol* symbol = &program->symbols[s];
+        if (symbol->data != NULL) {
+            memcpy(code->rodata + code->symbolOffsets[s], symbol->data, symbol->dataSize);
+        }
+    }
+}
+
+/**
+ * @brief Encodes a whole program into x86-64 machine code
+ *
+ * Functions are placed one after another in the text, each aligned to 16
+ * bytes. Jumps within a function and calls between functions of the
+ * program are resolved here; references to constants and to functions
+ * outside the program are left as relocations, for an object file writer
+ * or a loader to fill in. Jumps always take a 32-bit displacement.
+ *
+ * @param program The program to encode
+ * @return The encoded program, to be released with FreeMachineCode
+ */
+MachineCode EncodeProgram(const MachineProgram* program) {
+    MachineCode code;
+    Encoder e;
+
+    memset(&code, 0, sizeof(MachineCode));
+    memset(&e, 0, sizeof(Encoder));
+    e.program = program;
+    e.code = &code;
+
+    code.symbolOffsets = CheckedMalloc((program->symbolCount + 1) * sizeof(int));
+    for (int s = 0; s < program->symbolCount; s++) {
+        code.symbolOffsets[s] = -1;
+    }
+    LayOutConstants(program, &code);
+
+    for (int f = 0; f < program->functionCount; f++) {
+        const MachineFunction* function = &program->functions[f];
+
+        while (code.textSize % 16 != 0) {
+            EmitByte(&e, 0xcc);
+        }
+        code.symbolOffsets[function->symbol] = code.textSize;
+
+        e.labelOffsets = CheckedRealloc(e.labelOffsets, (function->labelCount + 1) * sizeof(int));
+        for (int l = 0; l < function->labelCount; l++) {
+            e.labelOffsets[l] = -1;
+        }
+        e.labelFixups.count = 0;
+
+        for (int i = 0; i < function->count; i++) {
+            e.ripField = -1;
+            EncodeInstruction(&e, function, &function->code[i]);
+            if (e.ripField >= 0) {
+                // RIP-relative operands count from the end of the instruction, past any immediate
+                AddRelocation(&code, e.ripField, e.ripSymbol, RELOC_PC32, e.ripAddend - (code.textSize - e.ripField));
+            }
+        }
+
+        for (int k = 0; k < e.labelFixups.count; k += 2) {
+            int field = e.labelFixups.items[k];
+            int target = e.labelOffsets[e.labelFixups.items[k + 1]];
+            if (target < 0) {
+                fprintf(stderr, "Error: jump to a label never placed in %s\n", program->symbols[function->symbol].name);
+                exit(EXIT_FAILURE);
+            }
+            PatchInt32(&code, field, target - (field + 4));
+        }
+    }
+
+    for (int k = 0; k < e.callFixups.count; k += 2) {
+        int field = e.callFixups.items[k];
+        int target = code.symbolOffsets[e.callFixups.items[k + 1]];
+        if (target < 0) {
+            fprintf(stderr, "Error: call to %s, which has no code\n", program->symbols[e.callFixups.items[k + 1]].name);
+            exit(EXIT_FAILURE);
+        }
+        PatchInt32(&code, field, target - (field + 4));
+    }
+
+    free(e.labelOffsets);
+    IntListFree(&e.labelFixups);
+    IntListFree(&e.callFixups);
+    return code;
+}
+
+void FreeMachineCode(MachineCode* code) {
+    free(code->text);
+    free(code->rodata);
+    free(code->symbolOffsets);
+    free(code->relocations);
+    memset(code, 0, sizeof(MachineCode));
+}
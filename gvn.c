@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimize.h"
+#include "cfg.h"
+#include "ssa.h"
+
+#define GVN_BUCKETS 1024
+
+typedef struct {
+    TACOpcode op;
+    DataType type;
+    TACOperand a;
+    TACOperand b;
+    int instr;         // Defining instruction, used to compare phi arguments
+    int memory;        // Memory version a load reads, 0 for other expressions
+    int value;         // Variable holding the value of the expression
+    int next;          // Next entry in the same bucket
+    unsigned hash;
+} ValueEntry;
+
+typedef struct {
+    TACFunction* function;
+    CFG cfg;
+    TACOperand* leader;    // Variable -> value it was found equal to
+    int buckets[GVN_BUCKETS];
+    ValueEntry* entries;   // Used as a stack so scopes can be popped
+    int entryCount;
+    int entryCapacity;
+    int memoryVersion;     // Bumped by every store or call, keys array loads
+} GVNState;
+
+/**
+ * @brief Follows the leader chain of an operand to the value that represents it
+ */
+static TACOperand Leader(GVNState* state, TACOperand operand) {
+    while (operand.kind == TAC_OPERAND_VAR) {
+        TACOperand next = state->leader[operand.value.id];
+        if (next.kind == TAC_OPERAND_VAR && next.value.id == operand.value.id) {
+            break;
+        }
+        operand = next;
+    }
+    return operand;
+}
+
+static unsigned HashOperand(TACOperand operand) {
+    unsigned bits = 0;
+    if (operand.kind == TAC_OPERAND_FLOAT) {
+        memcpy(&bits, &operand.value.floatValue, sizeof(float));
+    } else if (operand.kind != TAC_OPERAND_NONE) {
+        bits = (unsigned)operand.value.id;
+    }
+    return bits * 2654435761u + (unsigned)operand.kind;
+}
+
+/**
+ * @brief Orders two operands so that equal commutative expressions get equal keys
+ */
+static int OperandLess(TACOperand a, TACOperand b) {
+    if (a.kind != b.kind) {
+        return a.kind < b.kind;
+    }
+    if (a.kind == TAC_OPERAND_FLOAT) {
+        return a.value.floatValue < b.value.floatValue;
+    }
+    return a.value.id < b.value.id;
+}
+
+/**
+ * @brief Rewrites a binary expression into a canonical form
+ *
+ * Operands of commutative operators are sorted, and "greater" comparisons
+ * are turned into "less" comparisons with swapped operands, so that
+ * a + b and b + a, or a > b and b < a, receive the same value number.
+ */
+static void Canonicalize(TACOpcode* op, TACOperand* a, TACOperand* b) {
+    TACOperand tmp;
+
+    switch (*op) {
+    case TAC_GT:
+    case TAC_GE:
+        *op = *op == TAC_GT ? TAC_LT : TAC_LE;
+        tmp = *a;
+        *a = *b;
+        *b = tmp;
+        break;
+    case TAC_ADD:
+    case TAC_MUL:
+    case TAC_EQ:
+    case TAC_NE:
+        if (OperandLess(*b, *a)) {
+            tmp = *a;
+            *a = *b;
+            *b = tmp;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Checks whether two phis merge the same values from the same predecessors
+ */
+static int SamePhiArgs(GVNState* state, const TACInstruction* x, const TACInstruction* y) {
+    if (x->phiCount != y->phiCount) {
+        return 0;
+    }
+    for (int i = 0; i < x->phiCount; i++) {
+        int found = 0;
+        for (int j = 0; j < y->phiCount && !found; j++) {
+            if (x->phiArgs[i].pred == y->phiArgs[j].pred) {
+                found = SameOperand(Leader(state, x->phiArgs[i].value), Leader(state, y->phiArgs[j].value));
+                if (!found) {
+                    return 0;
+                }
+            }
+        }
+        if (!found) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Looks up an expression, adding it to the table if it is new
+ *
+ * @param state The pass state
+ * @param key The expression; its value field names the variable that defines it
+ * @return The variable already holding the expression's value, or key->value if there is none
+ */
+static int LookUpOrInsert(GVNState* state, ValueEntry key) {
+    TACFunction* function = state->function;
+
+    key.hash = (unsigned)key.op * 31u + (unsigned)key.type;
+    key.hash = key.hash * 131u + HashOperand(key.a);
+    key.hash = key.hash * 131u + HashOperand(key.b);
+    key.hash = key.hash * 131u + (unsigned)key.memory;
+    if (key.op == TAC_PHI) {
+        const TACInstruction* phi = &function->code[key.instr];
+        for (int k = 0; k < phi->phiCount; k++) {
+            key.hash += HashOperand(Leader(state, phi->phiArgs[k].value)) * (unsigned)(phi->phiArgs[k].pred + 1);
+        }
+    }
+
+    int bucket = key.hash % GVN_BUCKETS;
+    for (int e = state->buckets[bucket]; e >= 0; e = state->entries[e].next) {
+        ValueEntry* entry = &state->entries[e];
+        if (entry->hash != key.hash || entry->op != key.op || entry->type != key.type ||
+            entry->memory != key.memory || !SameOperand(entry->a, key.a) || !SameOperand(entry->b, key.b)) {
+            continue;
+        }
+        if (key.op == TAC_PHI && !SamePhiArgs(state, &function->code[entry->instr], &function->code[key.instr])) {
+            continue;
+        }
+        return entry->value;
+    }
+
+    if (state->entryCount == state->entryCapacity) {
+        state->entryCapacity = state->entryCapacity == 0 ? 64 : state->entryCapacity * 2;
+        state->entries = CheckedRealloc(state->entries, state->entryCapacity * sizeof(ValueEntry));
+    }
+    key.next = state->buckets[bucket];
+    state->buckets[bucket] = state->entryCount;
+    state->entries[state->entryCount++] = key;
+    return key.value;
+}
+
+/**
+ * @brief Drops the table entries added since a scope was entered
+ *
+ * Entries are pushed at the head of their bucket, so removing them in
+ * reverse order only ever unlinks bucket heads.
+ */
+static void PopScope(GVNState* state, int mark) {
+    while (state->entryCount > mark) {
+        ValueEntry* entry = &state->entries[--state->entryCount];
+        state->buckets[entry->hash % GVN_BUCKETS] = entry->next;
+    }
+}
+
+/**
+ * @brief Simplifies algebraic identities on integers such as x + 0 and x * 1
+ *
+ * @return 1 if the expression reduces to the operand stored in result
+ */
+static int Simplify(TACOpcode op, TACOperand a, TACOperand b, TACOperand* result) {
+    int aZero = a.kind == TAC_OPERAND_INT && a.value.intValue == 0;
+    int bZero = b.kind == TAC_OPERAND_INT && b.value.intValue == 0;
+    int aOne = a.kind == TAC_OPERAND_INT && a.value.intValue == 1;
+    int bOne = b.kind == TAC_OPERAND_INT && b.value.intValue == 1;
+
+    switch (op) {
+    case TAC_ADD:
+        if (aZero) {
+            *result = b;
+            return 1;
+        }
+        if (bZero) {
+            *result = a;
+            return 1;
+        }
+        return 0;
+    case TAC_SUB:
+        if (bZero) {
+            *result = a;
+            return 1;
+        }
+        if (SameOperand(a, b)) {
+            *result = IntOperand(0);
+            return 1;
+        }
+        return 0;
+    case TAC_MUL:
+        if (aOne) {
+            *result = b;
+            return 1;
+        }
+        if (bOne) {
+            *result = a;
+            return 1;
+        }
+        if (aZero || bZero) {
+            *result = IntOperand(0);
+            return 1;
+        }
+        return 0;
+    case TAC_DIV:
+        if (bOne) {
+            *result = a;
+            return 1;
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Assigns value numbers to the definitions in one block
+ *
+ * A definition found equal to an earlier one has its leader set and its
+ * instruction deleted; the table only holds definitions from blocks that
+ * dominate this one, so every leader is available wherever it is used.
+ *
+ * @return The number of instructions made redundant
+ */
+static int NumberBlock(GVNState* state, int b) {
+    TACFunction* function = state->function;
+    BasicBlock* block = &state->cfg.blocks[b];
+    int removed = 0;
+
+    // Array loads are only numbered within a block, between stores
+    state->memoryVersion++;
+
+    for (int i = block->start; i < block->end; i++) {
+        TACInstruction* instr = &function->code[i];
+        int def = TACDefinedVar(instr);
+        DataType type = def >= 0 ? function->vars[def].type : INTEGER;
+        int numeric = type == INTEGER || type == FLOAT;
+
+        if (instr->op == TAC_STORE_INDEX || instr->op == TAC_CALL || instr->op == TAC_VECLOOP) {
+            state->memoryVersion++;
+        }
+        if (def < 0 || (instr->op != TAC_PHI && instr->op != TAC_ASSIGN &&
+                        instr->op != TAC_LOAD_INDEX && !IsBinaryOp(instr->op))) {
+            continue;
+        }
+
+        TACOperand same = VarOperand(def);
+        ValueEntry key;
+        memset(&key, 0, sizeof(ValueEntry));
+        key.type = type;
+        key.instr = i;
+        key.value = def;
+
+        if (instr->op == TAC_PHI) {
+            // A phi whose arguments all carry one value is just that value
+            TACOperand only = NoOperand();
+            int meaningful = 1;
+            for (int k = 0; k < instr->phiCount && meaningful; k++) {
+                TACOperand arg = Leader(state, instr->phiArgs[k].value);
+                if (arg.kind == TAC_OPERAND_VAR && arg.value.id == def) {
+                    continue;
+                }
+                if (only.kind == TAC_OPERAND_NONE) {
+                    only = arg;
+                } else if (!SameOperand(only, arg)) {
+                    meaningful = 0;
+                }
+            }
+            if (meaningful && only.kind != TAC_OPERAND_NONE && (only.kind == TAC_OPERAND_VAR || numeric)) {
+                same = only;
+            } else {
+                key.op = TAC_PHI;
+                key.a = IntOperand(b);
+                same = VarOperand(LookUpOrInsert(state, key));
+            }
+        } else if (instr->op == TAC_ASSIGN) {
+            TACOperand source = Leader(state, instr->arg1);
+            if (OperandType(function, source) == type && (source.kind == TAC_OPERAND_VAR || numeric || type == STRING)) {
+                same = source;
+            } else {
+                // A converting copy is a unary expression of its own
+                key.op = TAC_ASSIGN;
+                key.a = source;
+                same = VarOperand(LookUpOrInsert(state, key));
+            }
+        } else if (instr->op == TAC_LOAD_INDEX) {
+            key.op = TAC_LOAD_INDEX;
+            key.a = Leader(state, instr->arg1);
+            key.b = Leader(state, instr->arg2);
+            key.memory = state->memoryVersion;
+            same = VarOperand(LookUpOrInsert(state, key));
+        } else {
+            TACOpcode op = instr->op;
+            TACOperand a = Leader(state, instr->arg1);
+            TACOperand b2 = Leader(state, instr->arg2);
+            TACOperand folded;
+
+            int integer = OperandType(function, a) == INTEGER && OperandType(function, b2) == INTEGER;
+            if (FoldBinary(op, a, b2, &folded) && OperandType(function, folded) == type) {
+                same = folded;
+            } else if (integer && type == INTEGER && Simplify(op, a, b2, &folded)) {
+                same = folded;
+            } else {
+                Canonicalize(&op, &a, &b2);
+                key.op = op;
+                key.a = a;
+                key.b = b2;
+                same = VarOperand(LookUpOrInsert(state, key));
+            }
+        }
+
+        if (same.kind != TAC_OPERAND_VAR || same.value.id != def) {
+            state->leader[def] = same;
+            MakeNop(instr);
+            removed++;
+        }
+    }
+
+    return removed;
+}
+
+/**
+ * @brief Removes redundant computations with dominator-based value numbering
+ *
+ * Walks the dominator tree keeping a scoped hash table of the expressions
+ * available at each block, keyed on the opcode and the value numbers of
+ * the operands (in canonical order for commutative operators). An
+ * expression computed in a dominating block is reused instead of being
+ * recomputed, copies are propagated, phis that merge one value are
+ * removed and constant operands are folded. Array loads are only reused
+ * within a block when no store or call comes between them.
+ *
+ * @param function The function to optimize; converted to SSA if needed
+ * @return The number of instructions removed
+ */
+int RunGVN(TACFunction* function) {
+    BuildSSA(function);
+
+    GVNState state;
+    memset(&state, 0, sizeof(GVNState));
+    state.function = function;
+    state.cfg = AnalyzeCFG(function);
+    for (int i = 0; i < GVN_BUCKETS; i++) {
+        state.buckets[i] = -1;
+    }
+
+    state.leader = CheckedMalloc(function->varCount * sizeof(TACOperand));
+    for (int v = 0; v < function->varCount; v++) {
+        state.leader[v] = VarOperand(v);
+    }
+
+    // Each stack entry is a block, or ~block to leave its scope
+    IntList stack = {0};
+    IntList marks = {0};
+    int removed = 0;
+
+    IntListPush(&stack, 0);
+    while (stack.count > 0) {
+        int b = stack.items[--stack.count];
+        if (b < 0) {
+            PopScope(&state, marks.items[--marks.count]);
+            continue;
+        }
+
+        IntListPush(&marks, state.entryCount);
+        IntListPush(&stack, ~b);
+        removed += NumberBlock(&state, b);
+        for (int c = state.cfg.blocks[b].domChild; c >= 0; c = state.cfg.blocks[c].domSibling) {
+            IntListPush(&stack, c);
+        }
+    }
+
+    // Point every remaining use at the leader of its value
+    for (int i = 0; i < function->count; i++) {
+        TACInstruction* instr = &function->code[i];
+        for (int k = 0; k < TACUseCount(instr); k++) {
+            TACOperand* use = TACUseAt(instr, k);
+            if (use->kind == TAC_OPERAND_VAR) {
+                *use = Leader(&state, *use);
+            }
+        }
+    }
+    RemoveNops(function);
+
+    FreeCFG(&state.cfg);
+    free(state.leader);
+    free(state.entries);
+    IntListFree(&stack);
+    IntListFree(&marks);
+
+    return removed;
+}
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimize.h"
+
+#define INLINE_SMALL_SIZE 12        // Callees this small are always worth inlining
+#define INLINE_SINGLE_CALL_SIZE 120 // Limit for a callee with only one call site
+#define INLINE_CALLER_LIMIT 2000    // No caller is grown past this size
+#define INLINE_MIN_BUDGET 200       // Growth allowed for the whole program, at least
+
+typedef struct {
+    TACProgram* program;
+    IntList* callees;      // Function -> indices of the functions it calls
+    int* callSites;        // Function -> number of calls to it in the program
+    char* recursive;       // Function -> whether it can end up calling itself
+    IntList order;         // Functions with every callee before its callers
+
+    // Tarjan's strongly connected components
+    int* index;
+    int* lowLink;
+    char* onStack;
+    IntList stack;
+    int counter;
+} CallGraph;
+
+/**
+ * @brief Counts the instructions of a function that turn into code
+ */
+static int FunctionSize(const TACFunction* function) {
+    int size = 0;
+    for (int i = 0; i < function->count; i++) {
+        if (function->code[i].op != TAC_NOP && function->code[i].op != TAC_LABEL) {
+            size++;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Returns the index of the function a call instruction calls
+ *
+ * @return The index, or -1 for a built-in such as print
+ */
+static int CalleeIndex(TACProgram* program, const TACInstruction* call) {
+    TACFunction* callee = LookUpTACFunction(program, program->strings[call->arg1.value.id]);
+    return callee != NULL ? (int)(callee - program->functions) : -1;
+}
+
+/**
+ * @brief Visits a function in Tarjan's algorithm, appending finished components to the order
+ */
+static void StrongConnect(CallGraph* graph, int f) {
+    graph->index[f] = graph->lowLink[f] = graph->counter++;
+    IntListPush(&graph->stack, f);
+    graph->onStack[f] = 1;
+
+    for (int i = 0; i < graph->callees[f].count; i++) {
+        int g = graph->callees[f].items[i];
+        if (g == f) {
+            graph->recursive[f] = 1;
+        }
+        if (graph->index[g] < 0) {
+            StrongConnect(graph, g);
+            if (graph->lowLink[g] < graph->lowLink[f]) {
+                graph->lowLink[f] = graph->lowLink[g];
+            }
+        } else if (graph->onStack[g] && graph->index[g] < graph->lowLink[f]) {
+            graph->lowLink[f] = graph->index[g];
+        }
+    }
+
+    if (graph->lowLink[f] != graph->index[f]) {
+        return;
+    }
+
+    // f is the root of a component; functions sharing one call each other
+    int first = graph->stack.count - 1;
+    while (graph->stack.items[first] != f) {
+        first--;
+    }
+    for (int i = first; i < graph->stack.count; i++) {
+        int g = graph->stack.items[i];
+        graph->onStack[g] = 0;
+        if (graph->stack.count - first > 1) {
+            graph->recursive[g] = 1;
+        }
+        IntListPush(&graph->order, g);
+    }
+    graph->stack.count = first;
+}
+
+/**
+ * @brief Builds the call graph of a program and orders its functions bottom-up
+ */
+static CallGraph BuildCallGraph(TACProgram* program) {
+    CallGraph graph;
+    int n = program->functionCount;
+
+    memset(&graph, 0, sizeof(CallGraph));
+    graph.program = program;
+    graph.callees = CheckedCalloc(n, sizeof(IntList));
+    graph.callSites = CheckedCalloc(n, sizeof(int));
+    graph.recursive = CheckedCalloc(n, sizeof(char));
+    graph.index = CheckedMalloc(n * sizeof(int));
+    graph.lowLink = CheckedMalloc(n * sizeof(int));
+    graph.onStack = CheckedCalloc(n, sizeof(char));
+
+    for (int f = 0; f < n; f++) {
+        TACFunction* function = &program->functions[f];
+        graph.index[f] = -1;
+        for (int i = 0; i < function->count; i++) {
+            if (function->code[i].op != TAC_CALL) {
+                continue;
+            }
+            int g = CalleeIndex(program, &function->code[i]);
+            if (g < 0) {
+                continue;
+            }
+            graph.callSites[g]++;
+            if (!IntListContains(&graph.callees[f], g)) {
+                IntListPush(&graph.callees[f], g);
+            }
+        }
+    }
+
+    for (int f = 0; f < n; f++) {
+        if (graph.index[f] < 0) {
+            StrongConnect(&graph, f);
+        }
+    }
+
+    return graph;
+}
+
+static void FreeCallGraph(CallGraph* graph) {
+    for (int f = 0; f < graph->program->functionCount; f++) {
+        IntListFree(&graph->callees[f]);
+    }
+    free(graph->callees);
+    free(graph->callSites);
+    free(graph->recursive);
+    free(graph->index);
+    free(graph->lowLink);
+    free(graph->onStack);
+    IntListFree(&graph->stack);
+    IntListFree(&graph->order);
+}
+
+/**
+ * @brief Replaces a call with a copy of the callee's body
+ *
+ * The callee's variables and labels are given fresh counterparts in the
+ * caller, each parameter becomes a copy of its argument, and every return
+ * becomes an assignment to the call's result followed by a jump past the
+ * inlined body.
+ *
+ * @param caller The function containing the call
+ * @param callIndex The index of the call instruction
+ * @param callee The function being called
+ * @return 1 if the call was inlined, 0 if its arguments were not where expected
+ */
+static int InlineCall(TACFunction* caller, int callIndex, const TACFunction* callee) {
+    TACInstruction* call = &caller->code[callIndex];
+    int argc = call->arg2.value.intValue;
+    int first = callIndex - argc;
+    TACOperand result = call->result;
+
+    if (argc != callee->paramCount || first < 0) {
+        return 0;
+    }
+    for (int i = first; i < callIndex; i++) {
+        if (caller->code[i].op != TAC_PARAM) {
+            return 0;
+        }
+    }
+
+    int* varMap = CheckedMalloc((callee->varCount + 1) * sizeof(int));
+    int* labelMap = CheckedMalloc((callee->labelCount + 1) * sizeof(int));
+    for (int v = 0; v < callee->varCount; v++) {
+        char name[MAX_NAME_LENGTH];
+        snprintf(name, sizeof(name), "%.*s_%.*s", MAX_NAME_LENGTH / 2 - 1, callee->name,
+                 MAX_NAME_LENGTH / 2 - 1, callee->vars[v].name);
+        varMap[v] = AddTACVariable(caller, name, callee->vars[v].type);
+        caller->vars[varMap[v]].elementType = callee->vars[v].elementType;
+        caller->vars[varMap[v]].isTemp = callee->vars[v].isTemp;
+    }
+    for (int l = 0; l < callee->labelCount; l++) {
+        labelMap[l] = NewLabel(caller);
+    }
+    int done = NewLabel(caller);
+
+    TACInstruction* code = CheckedMalloc((2 * callee->count + argc + 1) * sizeof(TACInstruction));
+    int n = 0;
+
+    for (int k = 0; k < argc; k++) {
+        memset(&code[n], 0, sizeof(TACInstruction));
+        code[n].op = TAC_ASSIGN;
+        code[n].arg1 = caller->code[first + k].arg1;
+        code[n++].result = VarOperand(varMap[k]);
+    }
+
+    for (int i = 0; i < callee->count; i++) {
+        TACInstruction instr = callee->code[i];
+        TACOperand* slots[3] = {&instr.arg1, &instr.arg2, &instr.result};
+
+        if (instr.op == TAC_NOP) {
+            continue;
+        }
+        for (int s = 0; s < 3; s++) {
+            if (slots[s]->kind == TAC_OPERAND_VAR) {
+                slots[s]->value.id = varMap[slots[s]->value.id];
+            } else if (slots[s]->kind == TAC_OPERAND_LABEL) {
+                slots[s]->value.id = labelMap[slots[s]->value.id];
+            }
+        }
+
+        if (instr.op == TAC_RETURN) {
+            if (result.kind == TAC_OPERAND_VAR && instr.arg1.kind != TAC_OPERAND_NONE) {
+                memset(&code[n], 0, sizeof(TACInstruction));
+                code[n].op = TAC_ASSIGN;
+                code[n].arg1 = instr.arg1;
+                code[n++].result = result;
+            }
+            memset(&instr, 0, sizeof(TACInstruction));
+            instr.op = TAC_GOTO;
+            instr.result = LabelOperand(done);
+        }
+        code[n++] = instr;
+    }
+
+    memset(&code[n], 0, sizeof(TACInstruction));
+    code[n].op = TAC_LABEL;
+    code[n++].result = LabelOperand(done);
+
+    for (int i = first; i <= callIndex; i++) {
+        MakeNop(&caller->code[i]);
+    }
+    InsertInstructions(caller, first, code, n);
+
+    free(code);
+    free(varMap);
+    free(labelMap);
+    return 1;
+}
+
+/**
+ * @brief Inlines calls to small and single-use functions, bottom-up over the call graph
+ *
+ * Functions are visited callees first, so a function is inlined only after
+ * its own calls have been. A callee is inlined when it is tiny, or when
+ * this is its only call site and it is not too large; recursive functions
+ * are never inlined. The program may grow by at most half its size (and
+ * at least INLINE_MIN_BUDGET instructions), and no caller past
+ * INLINE_CALLER_LIMIT. Callees left with no calls are removed later as
+ * unreachable. Must run before the functions are put in SSA form.
+ *
+ * @param program The program to optimize
+ * @return The number of calls inlined
+ */
+int InlineFunctions(TACProgram* program) {
+    CallGraph graph = BuildCallGraph(program);
+    int* size = CheckedMalloc(program->functionCount * sizeof(int));
+    int total = 0;
+    int inlined = 0;
+
+    for (int f = 0; f < program->functionCount; f++) {
+        size[f] = FunctionSize(&program->functions[f]);
+        total += size[f];
+    }
+    int budget = total / 2 > INLINE_MIN_BUDGET ? total / 2 : INLINE_MIN_BUDGET;
+
+    for (int o = 0; o < graph.order.count; o++) {
+        int f = graph.order.items[o];
+        TACFunction* caller = &program->functions[f];
+        if (caller->isSSA) {
+            continue;
+        }
+
+        for (int i = 0; i < caller->count; i++) {
+            if (caller->code[i].op != TAC_CALL) {
+                continue;
+            }
+            int g = CalleeIndex(program, &caller->code[i]);
+            if (g < 0 || g == f || graph.recursive[g] || program->functions[g].isSSA) {
+                continue;
+            }
+
+            int cost = size[g];
+            int worthIt = cost <= INLINE_SMALL_SIZE || (graph.callSites[g] == 1 && cost <= INLINE_SINGLE_CALL_SIZE);
+            if (!worthIt || cost > budget || size[f] + cost > INLINE_CALLER_LIMIT) {
+                continue;
+            }
+
+            int argc = caller->code[i].arg2.value.intValue;
+            if (InlineCall(caller, i, &program->functions[g])) {
+                size[f] += cost;
+                budget -= cost;
+                graph.callSites[g]--;
+                inlined++;
+                // Resume after the inlined body: argc params and the call became the copy
+                i = i - argc - 1;
+            }
+        }
+        RemoveNops(caller);
+    }
+
+    free(size);
+    FreeCallGraph(&graph);
+    return inlined;
+}
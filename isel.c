@@ -0,0 +1,953 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isel.h"
+
+// Registers a tree computes in, besides its destination. The allocator never hands them out.
+#define SCRATCH_REGISTERS 3
+static const int scratchRegisters[SCRATCH_REGISTERS] = {REG_RAX, REG_RDX, REG_R11};
+
+#define INFINITE_COST 0x3fffffff
+
+typedef enum {
+    ISEL_VAR,
+    ISEL_CONST,
+    ISEL_ADD,
+    ISEL_SUB,
+    ISEL_MUL,
+    ISEL_LOAD,      // Array element: array, index
+    ISEL_CMP,
+    ISEL_SET,       // Root: its value goes to the destination
+    ISEL_STORE,     // Root: array, index, value
+} IselOp;
+
+typedef enum {
+    NT_none,
+#define NONTERMINAL(name) NT_##name,
+#define RULE(name, nonterminal, op, kid0, kid1, kid2, cost, condition, action)
+#define CHAIN(name, nonterminal, from, cost, action)
+#include "isel.def"
+#undef NONTERMINAL
+#undef RULE
+#undef CHAIN
+    NT_COUNT
+} Nonterminal;
+
+typedef enum {
+#define NONTERMINAL(name)
+#define RULE(name, nonterminal, op, kid0, kid1, kid2, cost, condition, action) RULE_##name,
+#define CHAIN(name, nonterminal, from, cost, action) RULE_##name,
+#include "isel.def"
+#undef NONTERMINAL
+#undef RULE
+#undef CHAIN
+    RULE_COUNT
+} RuleId;
+
+struct IselNode {
+    IselOp op;
+    int kids[3];
+    int kidCount;
+    int order[3];           // The kids in the order they are evaluated
+    int size;               // Bytes of the value: 8 for an array, 4 otherwise
+    int var;                // ISEL_VAR: the variable
+    int leaf;               // ISEL_VAR: its index in the tree's leaves
+    long long value;        // ISEL_CONST: the constant
+    ConditionCode cond;     // ISEL_CMP: the condition that holds when the comparison is true
+    X86Opcode arith;        // ISEL_ADD, ISEL_SUB, ISEL_MUL: the instruction
+    int inBounds;           // ISEL_LOAD, ISEL_STORE: the index is known to be in range, so is not checked
+
+    int need;               // Scratch registers evaluating it may take at once, at worst
+    int hold;               // Scratch registers its value may keep
+    int cost[NT_COUNT];     // Cheapest cost of deriving each nonterminal, INFINITE_COST if none does
+    int rule[NT_COUNT];     // The rule giving that cost
+};
+
+typedef struct {
+    IselTree* tree;
+    MachineFunction* out;
+    int* boundsLabel;
+    MachineOperand dst;
+    int pool[SCRATCH_REGISTERS + 1];
+    int poolCount;
+    char owned[REG_R15 + 1]; // Register -> whether a value of the tree is in it
+} Tiler;
+
+typedef int (*IselCondition)(const Tiler* tiler, const IselNode* node);
+typedef MachineOperand (*IselAction)(Tiler* tiler, const IselNode* node, const MachineOperand* kids);
+
+typedef struct {
+    const char* name;
+    Nonterminal nonterminal;
+    IselOp op;
+    Nonterminal kids[3];
+    Nonterminal from;       // Chain rules: the nonterminal this one is made from; NT_none for the others
+    int cost;
+    IselCondition condition;
+    IselAction action;
+} IselRule;
+
+static const IselRule rules[RULE_COUNT];
+
+static int IsIntOperand(TACFunction* function, TACOperand operand) {
+    return (operand.kind == TAC_OPERAND_VAR || operand.kind == TAC_OPERAND_INT) &&
+           OperandType(function, operand) == INTEGER;
+}
+
+static int HasIntResult(TACFunction* function, const TACInstruction* instr) {
+    return instr->result.kind == TAC_OPERAND_VAR && function->vars[instr->result.value.id].type == INTEGER;
+}
+
+/**
+ * @brief Checks whether an instruction can be computed inside the tree of a later one
+ *
+ * Trees cover integer arithmetic, comparisons and element loads; division
+ * needs rax and rdx, which the trees compute in.
+ */
+static int IsFoldable(TACFunction* function, const TACInstruction* instr) {
+    switch (instr->op) {
+    case TAC_ADD:
+    case TAC_SUB:
+    case TAC_MUL:
+    case TAC_LT:
+    case TAC_LE:
+    case TAC_GT:
+    case TAC_GE:
+    case TAC_EQ:
+    case TAC_NE:
+        return HasIntResult(function, instr) && IsIntOperand(function, instr->arg1) &&
+               IsIntOperand(function, instr->arg2);
+    case TAC_LOAD_INDEX:
+        return HasIntResult(function, instr) && instr->arg1.kind == TAC_OPERAND_VAR &&
+               OperandType(function, instr->arg1) == ARRAY && IsIntOperand(function, instr->arg2);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Finds the operands of an instruction a tree may compute, as a mask of TACUseAt slots
+ */
+static int TreeSlots(TACFunction* function, const TACInstruction* instr) {
+    switch (instr->op) {
+    case TAC_LOAD_INDEX:
+        return IsFoldable(function, instr) ? 2 : 0;
+    case TAC_ASSIGN:
+        return HasIntResult(function, instr) && IsIntOperand(function, instr->arg1) ? 1 : 0;
+    case TAC_STORE_INDEX:
+        return instr->result.kind == TAC_OPERAND_VAR && OperandType(function, instr->result) == ARRAY &&
+               function->vars[instr->result.value.id].elementType == INTEGER &&
+               IsIntOperand(function, instr->arg1) && IsIntOperand(function, instr->arg2) ? 6 : 0;
+    case TAC_IF:
+    case TAC_IFFALSE:
+        return IsIntOperand(function, instr->arg1) ? 1 : 0;
+    default:
+        return IsFoldable(function, instr) ? 3 : 0;
+    }
+}
+
+/**
+ * @brief Checks whether an instruction computes the same value if it runs later, just before another
+ *
+ * Nothing in between may redefine what it reads, end the block, call out
+ * (which would keep its operands alive across the call), use a stack in a
+ * way that may call out or fail, or, for a load, store to an array, as a
+ * vector loop may, or go unchecked, as it may because the load has checked
+ * the same element.
+ */
+static int CanDelay(TACFunction* function, int from, int to) {
+    TACInstruction* instr = &function->code[from];
+
+    for (int j = from + 1; j < to; j++) {
+        TACInstruction* other = &function->code[j];
+        switch (other->op) {
+        case TAC_LABEL:
+        case TAC_GOTO:
+        case TAC_IF:
+        case TAC_IFFALSE:
+        case TAC_RETURN:
+        case TAC_CALL:
+        case TAC_NEWARRAY:
+        case TAC_CHECKBOUNDS:
+        case TAC_NEWSTACK:
+        case TAC_PUSH:
+        case TAC_POP:
+        case TAC_PEEK:
+        case TAC_CONCAT:
+        case TAC_STREQ:
+            return 0;
+        case TAC_LOAD_INDEX:
+            if (instr->op == TAC_LOAD_INDEX && other->inBounds && !instr->inBounds) {
+                return 0;
+            }
+            break;
+        case TAC_STORE_INDEX:
+        case TAC_VECLOOP:
+            if (instr->op == TAC_LOAD_INDEX) {
+                return 0;
+            }
+            break;
+        default:
+            break;
+        }
+
+        int def = TACDefinedVar(other);
+        for (int k = 0; def >= 0 && k < TACUseCount(instr); k++) {
+            TACOperand* use = TACUseAt(instr, k);
+            if (use->kind == TAC_OPERAND_VAR && use->value.id == def) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Folds an instruction into a tree, unless the tree would then need more scratch registers than there are
+ */
+static void TryFold(Selection* selection, TACFunction* function, int instr, int root) {
+    char hadTree = selection->hasTree[root];
+
+    selection->root[instr] = root;
+    selection->hasTree[root] = 1;
+
+    IselTree tree = BuildIselTree(selection, function, root);
+    int need = tree.nodes[tree.nodeCount - 1].need;
+    FreeIselTree(&tree);
+
+    if (need > SCRATCH_REGISTERS) {
+        selection->root[instr] = -1;
+        selection->hasTree[root] = hadTree;
+    }
+}
+
+/**
+ * @brief Decides which instructions of a function are computed inside the trees of later ones
+ *
+ * A temporary defined once and read once, later in the same block, is
+ * folded into the instruction reading it when its operands still hold
+ * the same values there. Instructions are visited last to first, so a
+ * folded instruction's own operands join the tree of its root in turn.
+ *
+ * @param function The function, out of SSA form
+ * @return The selection, to be released with FreeSelection
+ */
+Selection SelectTrees(TACFunction* function) {
+    Selection selection;
+    int* defs = CheckedCalloc(function->varCount + 1, sizeof(int));
+    int* uses = CheckedCalloc(function->varCount + 1, sizeof(int));
+
+    selection.count = function->count;
+    selection.root = CheckedMalloc((function->count + 1) * sizeof(int));
+    selection.hasTree = CheckedCalloc(function->count + 1, sizeof(char));
+    selection.definition = CheckedMalloc((function->varCount + 1) * sizeof(int));
+    for (int v = 0; v < function->varCount; v++) {
+        selection.definition[v] = -1;
+    }
+
+    for (int i = 0; i < function->count; i++) {
+        TACInstruction* instr = &function->code[i];
+        selection.root[i] = -1;
+        int def = TACDefinedVar(instr);
+        if (def >= 0) {
+            defs[def]++;
+            selection.definition[def] = i;
+        }
+        for (int k = 0; k < TACUseCount(instr); k++) {
+            TACOperand* use = TACUseAt(instr, k);
+            if (use->kind == TAC_OPERAND_VAR) {
+                uses[use->value.id]++;
+            }
+        }
+    }
+    // Parameters are defined on entry as well
+    for (int v = 0; v < function->varCount; v++) {
+        if (defs[v] != 1 || v < function->paramCount) {
+            selection.definition[v] = -1;
+        }
+    }
+
+    for (int u = function->count - 1; u >= 0; u--) {
+        TACInstruction* instr = &function->code[u];
+        int root = selection.root[u] >= 0 ? selection.root[u] : u;
+        int slots = TreeSlots(function, instr);
+
+        for (int k = 0; k < TACUseCount(instr); k++) {
+            TACOperand* use = TACUseAt(instr, k);
+            if (!(slots & (1 << k)) || use->kind != TAC_OPERAND_VAR) {
+                continue;
+            }
+            int def = selection.definition[use->value.id];
+            if (def < 0 || def >= u || uses[use->value.id] != 1 || !IsFoldable(function, &function->code[def]) ||
+                !CanDelay(function, def, root)) {
+                continue;
+            }
+            TryFold(&selection, function, def, root);
+        }
+    }
+
+    free(defs);
+    free(uses);
+    return selection;
+}
+
+void FreeSelection(Selection* selection) {
+    free(selection->root);
+    free(selection->hasTree);
+    free(selection->definition);
+}
+
+typedef struct {
+    IselTree* tree;
+    const Selection* selection;
+    TACFunction* function;
+    int root;
+    IntList leafNodes;      // Leaf -> its node
+} TreeBuilder;
+
+/**
+ * @brief Works out how many scratch registers a node may need, and the order to evaluate its kids in
+ *
+ * The worst case is every variable read from memory into a register. Kids
+ * go in decreasing order of the registers they need beyond those their
+ * value keeps, as Sethi and Ullman order them.
+ */
+static void Measure(IselTree* tree, IselNode* node) {
+    static const int holds[] = {
+        [ISEL_VAR] = 1, [ISEL_CONST] = 1, [ISEL_ADD] = 1, [ISEL_SUB] = 1, [ISEL_MUL] = 1,
+        [ISEL_LOAD] = 2, [ISEL_CMP] = 1, [ISEL_SET] = 0, [ISEL_STORE] = 0,
+    };
+    int peak = node->kidCount == 0 ? 1 : 0;
+    int held = 0;
+
+    for (int k = 0; k < node->kidCount; k++) {
+        node->order[k] = k;
+    }
+    for (int k = 1; k < node->kidCount; k++) {
+        for (int j = k; j > 0; j--) {
+            const IselNode* a = &tree->nodes[node->kids[node->order[j - 1]]];
+            const IselNode* b = &tree->nodes[node->kids[node->order[j]]];
+            if (a->need - a->hold >= b->need - b->hold) {
+                break;
+            }
+            int swap = node->order[j];
+            node->order[j] = node->order[j - 1];
+            node->order[j - 1] = swap;
+        }
+    }
+    for (int k = 0; k < node->kidCount; k++) {
+        const IselNode* kid = &tree->nodes[node->kids[node->order[k]]];
+        if (held + kid->need > peak) {
+            peak = held + kid->need;
+        }
+        held += kid->hold;
+    }
+
+    node->hold = holds[node->op];
+    node->need = peak > node->hold ? peak : node->hold;
+}
+
+static int AddNode(TreeBuilder* builder, IselOp op, int kidCount, int kid0, int kid1, int kid2) {
+    IselTree* tree = builder->tree;
+
+    if (tree->nodeCount == tree->nodeCapacity) {
+        tree->nodeCapacity = tree->nodeCapacity == 0 ? 16 : tree->nodeCapacity * 2;
+        tree->nodes = CheckedRealloc(tree->nodes, tree->nodeCapacity * sizeof(IselNode));
+    }
+    IselNode* node = &tree->nodes[tree->nodeCount];
+    memset(node, 0, sizeof(IselNode));
+    node->op = op;
+    node->kidCount = kidCount;
+    node->kids[0] = kid0;
+    node->kids[1] = kid1;
+    node->kids[2] = kid2;
+    node->size = 4;
+    node->var = -1;
+    node->leaf = -1;
+    Measure(tree, node);
+    return tree->nodeCount++;
+}
+
+static int BuildExpression(TreeBuilder* builder, int index);
+
+/**
+ * @brief Builds the node for an operand: the tree of the instruction folded into it, or a leaf
+ */
+static int BuildOperand(TreeBuilder* builder, TACOperand operand) {
+    IselTree* tree = builder->tree;
+
+    if (operand.kind == TAC_OPERAND_INT) {
+        int node = AddNode(builder, ISEL_CONST, 0, -1, -1, -1);
+        tree->nodes[node].value = operand.value.intValue;
+        return node;
+    }
+
+    int var = operand.value.id;
+    int def = builder->selection->definition[var];
+    if (def >= 0 && builder->selection->root[def] == builder->root) {
+        return BuildExpression(builder, def);
+    }
+
+    // A variable read twice is one node, which makes the tree a DAG
+    for (int l = 0; l < tree->leafCount; l++) {
+        if (tree->leafVars[l] == var) {
+            return builder->leafNodes.items[l];
+        }
+    }
+
+    int node = AddNode(builder, ISEL_VAR, 0, -1, -1, -1);
+    DataType type = builder->function->vars[var].type;
+    tree->nodes[node].var = var;
+    tree->nodes[node].leaf = tree->leafCount;
+    tree->nodes[node].size = type == ARRAY || type == STACK || type == STRING ? 8 : 4;
+    tree->leafVars = CheckedRealloc(tree->leafVars, (tree->leafCount + 1) * sizeof(int));
+    tree->leafVars[tree->leafCount++] = var;
+    IntListPush(&builder->leafNodes, node);
+    return node;
+}
+
+static int BuildExpression(TreeBuilder* builder, int index) {
+    static const ConditionCode conditions[] = {COND_L, COND_LE, COND_G, COND_GE, COND_E, COND_NE};
+    const TACInstruction* instr = &builder->function->code[index];
+    int a = BuildOperand(builder, instr->arg1);
+    int b = BuildOperand(builder, instr->arg2);
+    int node;
+
+    switch (instr->op) {
+    case TAC_ADD:
+        node = AddNode(builder, ISEL_ADD, 2, a, b, -1);
+        builder->tree->nodes[node].arith = X86_ADD;
+        break;
+    case TAC_SUB:
+        node = AddNode(builder, ISEL_SUB, 2, a, b, -1);
+        builder->tree->nodes[node].arith = X86_SUB;
+        break;
+    case TAC_MUL:
+        node = AddNode(builder, ISEL_MUL, 2, a, b, -1);
+        builder->tree->nodes[node].arith = X86_IMUL;
+        break;
+    case TAC_LOAD_INDEX:
+        node = AddNode(builder, ISEL_LOAD, 2, a, b, -1);
+        builder->tree->nodes[node].inBounds = instr->inBounds;
+        break;
+    default:
+        node = AddNode(builder, ISEL_CMP, 2, a, b, -1);
+        builder->tree->nodes[node].cond = conditions[instr->op - TAC_LT];
+        break;
+    }
+    return node;
+}
+
+/**
+ * @brief Builds the tree of a root and the instructions folded into it
+ *
+ * @param selection The folding decisions for the function
+ * @param function The function
+ * @param root The root instruction
+ * @return The tree, to be released with FreeIselTree
+ */
+IselTree BuildIselTree(const Selection* selection, TACFunction* function, int root) {
+    IselTree tree;
+    TreeBuilder builder = {&tree, selection, function, root, {NULL, 0, 0}};
+    const TACInstruction* instr = &function->code[root];
+
+    memset(&tree, 0, sizeof(IselTree));
+    switch (instr->op) {
+    case TAC_STORE_INDEX: {
+        int array = BuildOperand(&builder, instr->result);
+        int position = BuildOperand(&builder, instr->arg1);
+        int value = BuildOperand(&builder, instr->arg2);
+        int node = AddNode(&builder, ISEL_STORE, 3, array, position, value);
+        tree.nodes[node].inBounds = instr->inBounds;
+        break;
+    }
+    case TAC_IF:
+    case TAC_IFFALSE:
+        tree.branch = 1;
+        BuildOperand(&builder, instr->arg1);
+        break;
+    case TAC_ASSIGN:
+        AddNode(&builder, ISEL_SET, 1, BuildOperand(&builder, instr->arg1), -1, -1);
+        break;
+    default:
+        AddNode(&builder, ISEL_SET, 1, BuildExpression(&builder, root), -1, -1);
+        break;
+    }
+
+    tree.leafOperands = CheckedCalloc(tree.leafCount + 1, sizeof(MachineOperand));
+    IntListFree(&builder.leafNodes);
+    return tree;
+}
+
+void FreeIselTree(IselTree* tree) {
+    free(tree->nodes);
+    free(tree->leafVars);
+    free(tree->leafOperands);
+}
+
+static int Acquire(Tiler* tiler) {
+    for (int p = 0; p < tiler->poolCount; p++) {
+        if (!tiler->owned[tiler->pool[p]]) {
+            tiler->owned[tiler->pool[p]] = 1;
+            return tiler->pool[p];
+        }
+    }
+    fprintf(stderr, "Error: instruction selection ran out of scratch registers\n");
+    exit(EXIT_FAILURE);
+}
+
+static int IsOwned(const Tiler* tiler, int reg) {
+    return reg >= 0 && reg <= REG_R15 && tiler->owned[reg];
+}
+
+static int ReadsRegister(MachineOperand operand, int reg) {
+    return (operand.kind == MOP_REG && operand.reg == reg) ||
+           (operand.kind == MOP_MEM && (operand.reg == reg || operand.index == reg));
+}
+
+/**
+ * @brief Picks the register to compute a new value from an operand in: one of the tree's own in it, or a free one
+ */
+static int WorkRegister(Tiler* tiler, MachineOperand from) {
+    if ((from.kind == MOP_REG || from.kind == MOP_MEM) && IsOwned(tiler, from.reg)) {
+        return from.reg;
+    }
+    if (from.kind == MOP_MEM && IsOwned(tiler, from.index)) {
+        return from.index;
+    }
+    return Acquire(tiler);
+}
+
+/**
+ * @brief Gives back the tree's registers in an operand a tile has consumed, except those its result still uses
+ */
+static void Release(Tiler* tiler, MachineOperand operand, MachineOperand result) {
+    int regs[2] = {-1, -1};
+
+    if (operand.kind == MOP_REG) {
+        regs[0] = operand.reg;
+    } else if (operand.kind == MOP_MEM) {
+        regs[0] = operand.reg;
+        regs[1] = operand.index;
+    }
+    for (int r = 0; r < 2; r++) {
+        if (IsOwned(tiler, regs[r]) && !ReadsRegister(result, regs[r])) {
+            tiler->owned[regs[r]] = 0;
+        }
+    }
+}
+
+static void EmitTile(Tiler* tiler, X86Opcode op, int size, MachineOperand src, MachineOperand dst) {
+    EmitMachine(tiler->out, op, size, src, dst);
+}
+
+static const IselNode* Kid(const Tiler* tiler, const IselNode* node, int k) {
+    return &tiler->tree->nodes[node->kids[k]];
+}
+
+static int InRegister(const Tiler* tiler, const IselNode* node) {
+    return tiler->tree->leafOperands[node->leaf].kind == MOP_REG;
+}
+
+static int IsDestination(const Tiler* tiler, const IselNode* node) {
+    return tiler->dst.kind != MOP_NONE && SameMachineOperand(tiler->tree->leafOperands[node->leaf], tiler->dst);
+}
+
+static int IsRegisterDestination(const Tiler* tiler, const IselNode* node) {
+    (void)node;
+    return tiler->dst.kind == MOP_REG;
+}
+
+static int IsIndexScale(const Tiler* tiler, const IselNode* node) {
+    long long scale = Kid(tiler, node, 1)->value;
+    return scale == 2 || scale == 4 || scale == 8;
+}
+
+static int IsSelfScale(const Tiler* tiler, const IselNode* node) {
+    long long factor = Kid(tiler, node, 1)->value;
+    return factor == 2 || factor == 3 || factor == 5 || factor == 9;
+}
+
+static int SameLeaf(const Tiler* tiler, int a, int b) {
+    const IselNode* x = &tiler->tree->nodes[a];
+    const IselNode* y = &tiler->tree->nodes[b];
+    return a == b || (x->op == ISEL_CONST && y->op == ISEL_CONST && x->value == y->value);
+}
+
+/**
+ * @brief Checks that a store writes back to the element its value was loaded from
+ */
+static int IsSameElement(const Tiler* tiler, const IselNode* node) {
+    const IselNode* update = Kid(tiler, node, 2);
+    const IselRule* rule = &rules[update->rule[NT_rmw]];
+    const IselNode* load = Kid(tiler, update, rule->kids[0] == NT_elem ? 0 : 1);
+
+    return SameLeaf(tiler, load->kids[0], node->kids[0]) && SameLeaf(tiler, load->kids[1], node->kids[1]);
+}
+
+static MachineOperand UseVariable(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)kids;
+    return tiler->tree->leafOperands[node->leaf];
+}
+
+static MachineOperand UseNothing(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)tiler;
+    (void)node;
+    (void)kids;
+    return NoMachineOperand();
+}
+
+static MachineOperand UseConstant(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)tiler;
+    (void)kids;
+    return ImmOperand(node->value);
+}
+
+static MachineOperand UseSame(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)tiler;
+    (void)node;
+    return kids[0];
+}
+
+/**
+ * @brief Adds a constant to an address, wrapping it to 32 bits like the 32-bit lea it ends up in
+ */
+static MachineOperand Displace(MachineOperand address, long long offset) {
+    if (address.kind == MOP_REG) {
+        address = MemOperand(address.reg, 0);
+    }
+    address.value = (int)(unsigned int)(address.value + offset);
+    return address;
+}
+
+static MachineOperand AddressPlusConstant(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)tiler;
+    (void)node;
+    return kids[0].kind == MOP_IMM ? Displace(kids[1], kids[0].value) : Displace(kids[0], kids[1].value);
+}
+
+static MachineOperand AddressMinusConstant(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)tiler;
+    (void)node;
+    return Displace(kids[0], -kids[1].value);
+}
+
+static MachineOperand AddressBaseIndex(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)tiler;
+    (void)node;
+    return IndexedOperand(kids[0].reg, kids[1].reg, 1, 0);
+}
+
+static MachineOperand AddressBaseScaled(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)tiler;
+    (void)node;
+    MachineOperand scaled = kids[0].kind == MOP_MEM ? kids[0] : kids[1];
+    MachineOperand base = kids[0].kind == MOP_MEM ? kids[1] : kids[0];
+    scaled.reg = base.reg;
+    return scaled;
+}
+
+static MachineOperand ScaledIndex(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)tiler;
+    (void)node;
+    return IndexedOperand(-1, kids[0].reg, (int)kids[1].value, 0);
+}
+
+static MachineOperand SelfScaledAddress(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)tiler;
+    (void)node;
+    return IndexedOperand(kids[0].reg, kids[0].reg, (int)kids[1].value - 1, 0);
+}
+
+static MachineOperand Arithmetic(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    EmitTile(tiler, node->arith, 4, kids[1], kids[0]);
+    return kids[0];
+}
+
+static MachineOperand ArithmeticSwapped(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    EmitTile(tiler, node->arith, 4, kids[0], kids[1]);
+    return kids[1];
+}
+
+/**
+ * @brief Applies an operation to its first operand where it is, the destination or an array element
+ */
+static MachineOperand Update(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    EmitTile(tiler, node->arith, 4, kids[1], kids[0]);
+    return NoMachineOperand();
+}
+
+static MachineOperand UpdateSwapped(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    EmitTile(tiler, node->arith, 4, kids[0], kids[1]);
+    return NoMachineOperand();
+}
+
+/**
+ * @brief Checks an index against the length of an array and returns the element as a memory operand
+ *
+ * The same check code generation makes: the index sign-extended, so a
+ * negative one compares as a huge unsigned one. An index known to be in
+ * range is only sign-extended.
+ */
+static MachineOperand ElementOperand(Tiler* tiler, const IselNode* node, MachineOperand base,
+                                     MachineOperand position) {
+    if (node->inBounds) {
+        if (position.kind == MOP_IMM) {
+            return MemOperand(base.reg, 8 + 4 * position.value);
+        }
+        MachineOperand index = RegOperand(WorkRegister(tiler, position));
+        EmitTile(tiler, X86_MOVSXD, 8, position, index);
+        return IndexedOperand(base.reg, index.reg, 4, 8);
+    }
+
+    if (*tiler->boundsLabel < 0) {
+        *tiler->boundsLabel = NewMachineLabel(tiler->out);
+    }
+    MachineOperand bounds = LabelRef(*tiler->boundsLabel);
+
+    if (position.kind == MOP_IMM) {
+        if (position.value < 0) {
+            EmitTile(tiler, X86_JMP, 0, bounds, NoMachineOperand());
+        } else {
+            EmitTile(tiler, X86_CMP, 8, position, MemOperand(base.reg, 0));
+            EmitCondition(tiler->out, X86_JCC, COND_BE, bounds);
+        }
+        return MemOperand(base.reg, 8 + 4 * position.value);
+    }
+
+    MachineOperand index = RegOperand(WorkRegister(tiler, position));
+    EmitTile(tiler, X86_MOVSXD, 8, position, index);
+    EmitTile(tiler, X86_CMP, 8, MemOperand(base.reg, 0), index);
+    EmitCondition(tiler->out, X86_JCC, COND_AE, bounds);
+    return IndexedOperand(base.reg, index.reg, 4, 8);
+}
+
+static MachineOperand CheckedElement(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    return ElementOperand(tiler, node, kids[0], kids[1]);
+}
+
+static MachineOperand StoreElement(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    EmitTile(tiler, X86_MOV, 4, kids[2], ElementOperand(tiler, node, kids[0], kids[1]));
+    return NoMachineOperand();
+}
+
+static MachineOperand Compare(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    EmitTile(tiler, X86_CMP, 4, kids[1], kids[0]);
+    return ImmOperand(node->cond);
+}
+
+/**
+ * @brief Compares with the operands the other way round, so the condition tests them swapped
+ */
+static MachineOperand CompareSwapped(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    static const ConditionCode swapped[] = {
+        [COND_L] = COND_G, [COND_LE] = COND_GE, [COND_G] = COND_L, [COND_GE] = COND_LE,
+        [COND_E] = COND_E, [COND_NE] = COND_NE,
+    };
+    EmitTile(tiler, X86_CMP, 4, kids[0], kids[1]);
+    return ImmOperand(swapped[node->cond]);
+}
+
+static MachineOperand TestNonZero(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)node;
+    EmitTile(tiler, X86_CMP, 4, ImmOperand(0), kids[0]);
+    return ImmOperand(COND_NE);
+}
+
+static MachineOperand SetFromFlags(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)node;
+    MachineOperand reg = RegOperand(Acquire(tiler));
+    EmitCondition(tiler->out, X86_SETCC, (ConditionCode)kids[0].value, reg);
+    EmitTile(tiler, X86_MOVZB, 4, reg, reg);
+    return reg;
+}
+
+static MachineOperand LoadScratch(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    if (kids[0].kind == MOP_REG && IsOwned(tiler, kids[0].reg)) {
+        return kids[0];
+    }
+    MachineOperand reg = RegOperand(WorkRegister(tiler, kids[0]));
+    EmitTile(tiler, X86_MOV, node->size, kids[0], reg);
+    return reg;
+}
+
+static MachineOperand LoadAddress(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)node;
+    MachineOperand reg = RegOperand(WorkRegister(tiler, kids[0]));
+    EmitTile(tiler, X86_LEA, 4, kids[0], reg);
+    return reg;
+}
+
+static MachineOperand SetDestination(Tiler* tiler, const IselNode* node, const MachineOperand* kids) {
+    (void)node;
+    MachineOperand value = kids[0];
+
+    if (tiler->dst.kind == MOP_NONE || SameMachineOperand(value, tiler->dst)) {
+        return NoMachineOperand();
+    }
+    if (value.kind == MOP_MEM && tiler->dst.kind == MOP_MEM) {
+        MachineOperand reg = RegOperand(WorkRegister(tiler, value));
+        EmitTile(tiler, X86_MOV, 4, value, reg);
+        value = reg;
+    }
+    EmitTile(tiler, X86_MOV, 4, value, tiler->dst);
+    return NoMachineOperand();
+}
+
+static const IselRule rules[RULE_COUNT] = {
+#define NONTERMINAL(name)
+#define RULE(name, nonterminal, op, kid0, kid1, kid2, cost, condition, action) \
+    {#name, NT_##nonterminal, ISEL_##op, {NT_##kid0, NT_##kid1, NT_##kid2}, NT_none, cost, condition, action},
+#define CHAIN(name, nonterminal, from, cost, action) \
+    {#name, NT_##nonterminal, ISEL_VAR, {NT_none, NT_none, NT_none}, NT_##from, cost, NULL, action},
+#include "isel.def"
+#undef NONTERMINAL
+#undef RULE
+#undef CHAIN
+};
+
+/**
+ * @brief Records a rule for a node if it derives its nonterminal more cheaply than any rule so far
+ *
+ * @return Whether the rule was recorded
+ */
+static int TryRule(const Tiler* tiler, IselNode* node, RuleId id) {
+    const IselRule* rule = &rules[id];
+    int cost = rule->cost;
+
+    if (rule->from != NT_none) {
+        if (node->cost[rule->from] >= INFINITE_COST) {
+            return 0;
+        }
+        cost += node->cost[rule->from];
+    }
+    for (int k = 0; k < 3; k++) {
+        if (rule->kids[k] == NT_none) {
+            continue;
+        }
+        int kidCost = tiler->tree->nodes[node->kids[k]].cost[rule->kids[k]];
+        if (kidCost >= INFINITE_COST) {
+            return 0;
+        }
+        cost += kidCost;
+    }
+
+    if (cost >= node->cost[rule->nonterminal] || (rule->condition != NULL && !rule->condition(tiler, node))) {
+        return 0;
+    }
+    node->cost[rule->nonterminal] = cost;
+    node->rule[rule->nonterminal] = id;
+    return 1;
+}
+
+/**
+ * @brief Finds the cheapest rule deriving each nonterminal at a node whose kids are labeled already
+ *
+ * The matching code is expanded from isel.def. Chain rules are applied
+ * until no cost falls; costs only ever fall, so that ends.
+ */
+static void Label(Tiler* tiler, IselNode* node) {
+    int changed = 1;
+
+    for (int nt = 0; nt < NT_COUNT; nt++) {
+        node->cost[nt] = INFINITE_COST;
+        node->rule[nt] = -1;
+    }
+
+#define NONTERMINAL(name)
+#define RULE(name, nonterminal, opcode, kid0, kid1, kid2, cost, condition, action) \
+    if (node->op == ISEL_##opcode) {                                               \
+        TryRule(tiler, node, RULE_##name);                                         \
+    }
+#define CHAIN(name, nonterminal, from, cost, action)
+#include "isel.def"
+#undef RULE
+#undef CHAIN
+
+    while (changed) {
+        changed = 0;
+#define RULE(name, nonterminal, op, kid0, kid1, kid2, cost, condition, action)
+#define CHAIN(name, nonterminal, from, cost, action) changed |= TryRule(tiler, node, RULE_##name);
+#include "isel.def"
+#undef NONTERMINAL
+#undef RULE
+#undef CHAIN
+    }
+}
+
+/**
+ * @brief Emits the code of the rule chosen for a nonterminal at a node, kids first
+ *
+ * @return The operand the nonterminal's value is in
+ */
+static MachineOperand Reduce(Tiler* tiler, int index, Nonterminal nt) {
+    const IselNode* node = &tiler->tree->nodes[index];
+    const IselRule* rule = &rules[node->rule[nt]];
+    MachineOperand kids[3] = {NoMachineOperand(), NoMachineOperand(), NoMachineOperand()};
+
+    if (rule->from != NT_none) {
+        kids[0] = Reduce(tiler, index, rule->from);
+    } else {
+        for (int k = 0; k < node->kidCount; k++) {
+            int kid = node->order[k];
+            if (rule->kids[kid] != NT_none) {
+                kids[kid] = Reduce(tiler, node->kids[kid], rule->kids[kid]);
+            }
+        }
+    }
+
+    MachineOperand result = rule->action(tiler, node, kids);
+    for (int k = 0; k < 3; k++) {
+        Release(tiler, kids[k], result);
+    }
+    return result;
+}
+
+/**
+ * @brief Emits the cheapest code covering a tree
+ *
+ * Every node is labeled bottom-up with the cheapest rule for each
+ * nonterminal, in one pass over the nodes, then the rules chosen for the
+ * root's goal are reduced top-down, emitting code kids first.
+ *
+ * @param tree The tree, with the locations of its leaves filled in
+ * @param out The function to emit into
+ * @param boundsLabel Label of the out-of-bounds handler, made here if it is -1 and an index is checked
+ * @param dst Where the root's value goes; no operand for stores and branches
+ * @return For a branch, the condition under which the tree's value is nonzero
+ */
+ConditionCode TileIselTree(IselTree* tree, MachineFunction* out, int* boundsLabel, MachineOperand dst) {
+    Tiler tiler;
+    Nonterminal goal = tree->branch ? NT_flags : NT_stmt;
+    int top = tree->nodeCount - 1;
+
+    memset(&tiler, 0, sizeof(Tiler));
+    tiler.tree = tree;
+    tiler.out = out;
+    tiler.boundsLabel = boundsLabel;
+    tiler.dst = dst;
+
+    // The destination doubles as a scratch register when no leaf reads it
+    int dstFree = dst.kind == MOP_REG && dst.reg <= REG_R15;
+    for (int l = 0; l < tree->leafCount && dstFree; l++) {
+        dstFree = !ReadsRegister(tree->leafOperands[l], dst.reg);
+    }
+    if (dstFree) {
+        tiler.pool[tiler.poolCount++] = dst.reg;
+    }
+    for (int s = 0; s < SCRATCH_REGISTERS; s++) {
+        tiler.pool[tiler.poolCount++] = scratchRegisters[s];
+    }
+
+    for (int n = 0; n < tree->nodeCount; n++) {
+        Label(&tiler, &tree->nodes[n]);
+    }
+    if (tree->nodes[top].cost[goal] >= INFINITE_COST) {
+        fprintf(stderr, "Error: no instruction pattern covers an expression tree\n");
+        exit(EXIT_FAILURE);
+    }
+
+    MachineOperand result = Reduce(&tiler, top, goal);
+    return tree->branch ? (ConditionCode)result.value : COND_NE;
+}
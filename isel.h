@@ -0,0 +1,39 @@
+#ifndef isel_h
+#define isel_h
+
+#include "tac.h"
+#include "x86.h"
+
+// Which TAC instructions are folded into the code of a later instruction in
+// their block. A folded instruction gets no code of its own and its result
+// no location; the root of its tree computes it on the way to its own result.
+typedef struct {
+    int* root;          // Instruction -> the root of the tree it is folded into, -1 if it has its own code
+    char* hasTree;      // Instruction -> whether instructions are folded into it
+    int* definition;    // Variable -> the one instruction defining it, -1 if there are several or none
+    int count;
+} Selection;
+
+typedef struct IselNode IselNode;
+
+// The expression tree of one root, with a node per operation and one per
+// variable read, shared wherever the variable is read again, so it is a DAG
+typedef struct {
+    IselNode* nodes;    // Kids before their parents; the last node is the top
+    int nodeCount;
+    int nodeCapacity;
+    int branch;         // Whether the root is a conditional jump, which only needs the flags
+
+    int* leafVars;      // The variables the tree reads
+    MachineOperand* leafOperands; // Where each of them is at the root, filled in by the caller
+    int leafCount;
+} IselTree;
+
+Selection SelectTrees(TACFunction* function);
+void FreeSelection(Selection* selection);
+
+IselTree BuildIselTree(const Selection* selection, TACFunction* function, int root);
+ConditionCode TileIselTree(IselTree* tree, MachineFunction* out, int* boundsLabel, MachineOperand dst);
+void FreeIselTree(IselTree* tree);
+
+#endif
@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "optimize.h"
+#include "cfg.h"
+#include "ssa.h"
+
+#define MAX_SIMULATED_TRIPS (1 << 24)
+
+typedef struct {
+    int iv;            // Basic induction variable being multiplied
+    TACOperand factor; // Loop-invariant factor it is multiplied by
+    int value;         // Header phi of the reduced variable, equal to iv * factor
+    int next;          // Its value on the next iteration
+} ReducedVariable;
+
+/**
+ * @brief Checks whether an operand is defined outside a loop, so cannot change inside it
+ */
+int IsLoopInvariant(const CFG* cfg, const DefUseChains* chains, int loop, TACOperand operand) {
+    if (operand.kind != TAC_OPERAND_VAR) {
+        return 1;
+    }
+    int def = chains->def[operand.value.id];
+    return def < 0 || !LoopContains(cfg, loop, cfg->blockOf[def]);
+}
+
+/**
+ * @brief Returns the single latch of a loop
+ *
+ * @return The latch block, or -1 if the loop has several back edges
+ */
+int SingleLatch(const CFG* cfg, int loop) {
+    const Loop* l = &cfg->loops[loop];
+    return l->latches.count == 1 ? l->latches.items[0] : -1;
+}
+
+/**
+ * @brief Finds the basic induction variables of a loop
+ *
+ * A basic induction variable is a header phi taking one value from the
+ * preheader and, from the single latch, its own value plus or minus a
+ * constant: the i of for (int i = 0; i < n; i = i + 1).
+ *
+ * @param function The function, in SSA form
+ * @param cfg Its analyzed graph
+ * @param chains Its def-use chains
+ * @param loop The loop
+ * @param count Receives the number of variables found
+ * @return The induction variables; the caller frees the array
+ */
+InductionVariable* FindInductionVariables(TACFunction* function, const CFG* cfg, const DefUseChains* chains,
+                                          int loop, int* count) {
+    const BasicBlock* header = &cfg->blocks[cfg->loops[loop].header];
+    int latch = SingleLatch(cfg, loop);
+    InductionVariable* ivs = CheckedMalloc((header->end - header->start + 1) * sizeof(InductionVariable));
+    *count = 0;
+
+    if (latch < 0 || header->preds.count != 2) {
+        return ivs;
+    }
+    int latchLabel = BlockLabel(cfg, latch);
+
+    for (int i = header->start; i < header->end; i++) {
+        TACInstruction* phi = &function->code[i];
+        if (phi->op != TAC_PHI || phi->phiCount != 2 || function->vars[phi->result.value.id].type != INTEGER) {
+            continue;
+        }
+
+        int back = phi->phiArgs[0].pred == latchLabel ? 0 : 1;
+        TACOperand next = phi->phiArgs[back].value;
+        if (phi->phiArgs[back].pred != latchLabel || next.kind != TAC_OPERAND_VAR) {
+            continue;
+        }
+
+        int def = chains->def[next.value.id];
+        if (def < 0 || !LoopContains(cfg, loop, cfg->blockOf[def])) {
+            continue;
+        }
+
+        TACInstruction* update = &function->code[def];
+        int var = phi->result.value.id;
+        int isVar1 = update->arg1.kind == TAC_OPERAND_VAR && update->arg1.value.id == var;
+        int isVar2 = update->arg2.kind == TAC_OPERAND_VAR && update->arg2.value.id == var;
+        int step;
+
+        if (update->op == TAC_ADD && isVar1 && update->arg2.kind == TAC_OPERAND_INT) {
+            step = update->arg2.value.intValue;
+        } else if (update->op == TAC_ADD && isVar2 && update->arg1.kind == TAC_OPERAND_INT) {
+            step = update->arg1.value.intValue;
+        } else if (update->op == TAC_SUB && isVar1 && update->arg2.kind == TAC_OPERAND_INT &&
+                   update->arg2.value.intValue != INT_MIN) {
+            step = -update->arg2.value.intValue;
+        } else {
+            continue;
+        }
+
+        InductionVariable* iv = &ivs[(*count)++];
+        iv->var = var;
+        iv->next = next.value.id;
+        iv->phiIndex = i;
+        iv->nextIndex = def;
+        iv->init = phi->phiArgs[1 - back].value;
+        iv->step = step;
+    }
+
+    return ivs;
+}
+
+/**
+ * @brief Finds the test that decides whether a loop runs another iteration
+ *
+ * The loop must leave from a single block, the header or the latch, through
+ * a conditional branch on a comparison between an induction variable and a
+ * loop-invariant bound.
+ *
+ * @param function The function, in SSA form
+ * @param cfg Its analyzed graph
+ * @param chains Its def-use chains
+ * @param loop The loop
+ * @param ivs The loop's induction variables
+ * @param ivCount The number of induction variables
+ * @param exit Receives the test
+ * @return 1 if the loop has such a test, 0 otherwise
+ */
+int FindLoopExit(TACFunction* function, const CFG* cfg, const DefUseChains* chains, int loop,
+                 const InductionVariable* ivs, int ivCount, LoopExit* exit) {
+    const Loop* l = &cfg->loops[loop];
+    int exiting = -1;
+
+    for (int i = 0; i < l->blocks.count; i++) {
+        const BasicBlock* block = &cfg->blocks[l->blocks.items[i]];
+        for (int j = 0; j < block->succs.count; j++) {
+            if (!LoopContains(cfg, loop, block->succs.items[j])) {
+                if (exiting >= 0 && exiting != l->blocks.items[i]) {
+                    return 0;
+                }
+                exiting = l->blocks.items[i];
+            }
+        }
+    }
+    if (exiting < 0 || (exiting != l->header && exiting != SingleLatch(cfg, loop))) {
+        return 0;
+    }
+
+    const BasicBlock* block = &cfg->blocks[exiting];
+    TACInstruction* branch = &function->code[block->end - 1];
+    if ((branch->op != TAC_IF && branch->op != TAC_IFFALSE) || branch->arg1.kind != TAC_OPERAND_VAR) {
+        return 0;
+    }
+
+    int compare = chains->def[branch->arg1.value.id];
+    if (compare < 0 || !IsComparisonOp(function->code[compare].op)) {
+        return 0;
+    }
+    TACInstruction* test = &function->code[compare];
+
+    for (int k = 0; k < ivCount; k++) {
+        for (int side = 0; side < 2; side++) {
+            TACOperand ivSide = side == 0 ? test->arg1 : test->arg2;
+            TACOperand other = side == 0 ? test->arg2 : test->arg1;
+            if (ivSide.kind != TAC_OPERAND_VAR || !IsLoopInvariant(cfg, chains, loop, other) ||
+                OperandType(function, other) != INTEGER) {
+                continue;
+            }
+            if (ivSide.value.id != ivs[k].var && ivSide.value.id != ivs[k].next) {
+                continue;
+            }
+
+            int targetInLoop = LoopContains(cfg, loop, cfg->labelBlock[branch->result.value.id]);
+            exit->block = exiting;
+            exit->branch = block->end - 1;
+            exit->compare = compare;
+            exit->iv = k;
+            exit->usesNext = ivSide.value.id == ivs[k].next;
+            exit->ivOnLeft = side == 0;
+            exit->bound = other;
+            exit->continueIfTrue = targetInLoop == (branch->op == TAC_IF);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Counts how many times a loop takes its back edge
+ *
+ * The count is found by stepping the induction variable through the exit
+ * test with the same wrap-around arithmetic as the generated code, so
+ * it is exact for any constant start, step and bound.
+ *
+ * @param exit The loop's exit test
+ * @param iv The induction variable it compares
+ * @param limit The largest count worth knowing
+ * @return The number of back edges taken, or -1 if it is unknown or above the limit
+ */
+long ConstantTripCount(TACFunction* function, const LoopExit* exit, const InductionVariable* iv, long limit) {
+    if (iv->init.kind != TAC_OPERAND_INT || exit->bound.kind != TAC_OPERAND_INT) {
+        return -1;
+    }
+
+    TACOpcode op = function->code[exit->compare].op;
+    TACOperand value = iv->init;
+    TACOperand step = IntOperand(iv->step);
+
+    for (long trips = 0; trips <= limit; trips++) {
+        TACOperand tested = value;
+        TACOperand result;
+        if (exit->usesNext) {
+            FoldBinary(TAC_ADD, value, step, &tested);
+        }
+        if (exit->ivOnLeft) {
+            FoldBinary(op, tested, exit->bound, &result);
+        } else {
+            FoldBinary(op, exit->bound, tested, &result);
+        }
+        if ((result.value.intValue != 0) != exit->continueIfTrue) {
+            return trips;
+        }
+        FoldBinary(TAC_ADD, value, step, &value);
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Makes a multiplication by an induction variable into a running sum
+ *
+ * For t = i * k, a new variable s = i * k is started in the preheader and
+ * advanced by step * k wherever i is advanced, and the multiplication
+ * becomes the copy t = s. Several multiplications by the same i and k
+ * share one new variable.
+ */
+static void ReduceMultiplication(TACFunction* function, const CFG* cfg, int loop, int preheader,
+                                 const InductionVariable* iv, TACOperand factor, int mul,
+                                 ReducedVariable* reduced) {
+    TACInstruction before[2];
+    int beforeCount = 0;
+    TACOperand start;
+    TACOperand delta;
+
+    memset(before, 0, sizeof(before));
+    if (!FoldBinary(TAC_MUL, iv->init, factor, &start)) {
+        start = VarOperand(NewTemp(function, INTEGER));
+        before[beforeCount].op = TAC_MUL;
+        before[beforeCount].arg1 = iv->init;
+        before[beforeCount].arg2 = factor;
+        before[beforeCount++].result = start;
+    }
+    if (!FoldBinary(TAC_MUL, IntOperand(iv->step), factor, &delta)) {
+        delta = VarOperand(NewTemp(function, INTEGER));
+        before[beforeCount].op = TAC_MUL;
+        before[beforeCount].arg1 = factor;
+        before[beforeCount].arg2 = IntOperand(iv->step);
+        before[beforeCount++].result = delta;
+    }
+
+    reduced->iv = iv->var;
+    reduced->factor = factor;
+    reduced->value = NewTemp(function, INTEGER);
+    reduced->next = NewTemp(function, INTEGER);
+
+    TACInstruction phi;
+    memset(&phi, 0, sizeof(TACInstruction));
+    phi.op = TAC_PHI;
+    phi.result = VarOperand(reduced->value);
+    phi.phiCount = 2;
+    phi.phiArgs = CheckedMalloc(2 * sizeof(TACPhiArg));
+    phi.phiArgs[0].value = start;
+    phi.phiArgs[0].pred = BlockLabel(cfg, preheader);
+    phi.phiArgs[1].value = VarOperand(reduced->next);
+    phi.phiArgs[1].pred = BlockLabel(cfg, SingleLatch(cfg, loop));
+
+    TACInstruction advance;
+    memset(&advance, 0, sizeof(TACInstruction));
+    advance.op = TAC_ADD;
+    advance.arg1 = VarOperand(reduced->value);
+    advance.arg2 = delta;
+    advance.result = VarOperand(reduced->next);
+
+    TACOperand product = function->code[mul].result;
+    MakeNop(&function->code[mul]);
+    function->code[mul].op = TAC_ASSIGN;
+    function->code[mul].arg1 = VarOperand(reduced->value);
+    function->code[mul].result = product;
+
+    // Insert from the highest index down so the lower indices stay valid
+    int header = cfg->loops[loop].header;
+    int phiAt = cfg->blocks[header].start + (function->code[cfg->blocks[header].start].op == TAC_LABEL);
+    int advanceAt = iv->nextIndex + 1;
+    int preAt = PreheaderInsertIndex(function, cfg, preheader);
+    int at[3] = {advanceAt, phiAt, preAt};
+    const TACInstruction* what[3] = {&advance, &phi, before};
+    int n[3] = {1, 1, beforeCount};
+
+    for (int round = 0; round < 3; round++) {
+        int best = -1;
+        for (int k = 0; k < 3; k++) {
+            if (n[k] >= 0 && (best < 0 || at[k] > at[best])) {
+                best = k;
+            }
+        }
+        InsertInstructions(function, at[best], what[best], n[best]);
+        n[best] = -1;
+    }
+}
+
+/**
+ * @brief Finds one multiplication of an induction variable by an invariant in a loop and reduces it
+ *
+ * @return 1 if a multiplication was reduced, 0 if none is left
+ */
+static int ReduceOne(TACFunction* function, ReducedVariable** reduced, int* reducedCount) {
+    CFG cfg = AnalyzeCFG(function);
+    DefUseChains chains = BuildDefUseChains(function);
+    int done = 0;
+
+    for (int l = cfg.loopCount - 1; l >= 0 && !done; l--) {
+        int preheader = FindPreheader(&cfg, l);
+        int ivCount;
+        InductionVariable* ivs = FindInductionVariables(function, &cfg, &chains, l, &ivCount);
+
+        for (int b = 0; b < cfg.loops[l].blocks.count && preheader >= 0 && !done; b++) {
+            const BasicBlock* block = &cfg.blocks[cfg.loops[l].blocks.items[b]];
+            for (int i = block->start; i < block->end && !done; i++) {
+                TACInstruction* instr = &function->code[i];
+                if (instr->op != TAC_MUL || function->vars[instr->result.value.id].type != INTEGER) {
+                    continue;
+                }
+
+                for (int k = 0; k < ivCount && !done; k++) {
+                    TACOperand factor;
+                    if (instr->arg1.kind == TAC_OPERAND_VAR && instr->arg1.value.id == ivs[k].var) {
+                        factor = instr->arg2;
+                    } else if (instr->arg2.kind == TAC_OPERAND_VAR && instr->arg2.value.id == ivs[k].var) {
+                        factor = instr->arg1;
+                    } else {
+                        continue;
+                    }
+                    if (!IsLoopInvariant(&cfg, &chains, l, factor) || OperandType(function, factor) != INTEGER ||
+                        !IsLoopInvariant(&cfg, &chains, l, ivs[k].init)) {
+                        continue;
+                    }
+
+                    for (int r = 0; r < *reducedCount && !done; r++) {
+                        if ((*reduced)[r].iv == ivs[k].var && SameOperand((*reduced)[r].factor, factor)) {
+                            TACOperand product = instr->result;
+                            MakeNop(instr);
+                            instr->op = TAC_ASSIGN;
+                            instr->arg1 = VarOperand((*reduced)[r].value);
+                            instr->result = product;
+                            done = 1;
+                        }
+                    }
+                    if (!done) {
+                        *reduced = CheckedRealloc(*reduced, (*reducedCount + 1) * sizeof(ReducedVariable));
+                        ReduceMultiplication(function, &cfg, l, preheader, &ivs[k], factor, i,
+                                             &(*reduced)[(*reducedCount)++]);
+                        done = 1;
+                    }
+                }
+            }
+        }
+        free(ivs);
+    }
+
+    FreeCFG(&cfg);
+    FreeDefUseChains(&chains);
+    return done;
+}
+
+/**
+ * @brief Checks that a variable is read only by the listed instructions
+ */
+static int OnlyUsedBy(const DefUseChains* chains, int var, int a, int b) {
+    const IntList* uses = &chains->uses[var];
+    for (int i = 0; i < uses->count; i++) {
+        if (uses->items[i] != a && uses->items[i] != b) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Rewrites a loop's exit test in terms of a reduced variable (linear-function test replacement)
+ *
+ * When the only remaining uses of i are its own update and the exit test
+ * i < n, and s = i * k was introduced for a constant k > 0, the test
+ * becomes s < n * k, after which i is dead. It is only done when no value
+ * of i or s the loop can reach overflows, so both tests agree exactly.
+ *
+ * @return 1 if the test was replaced
+ */
+static int ReplaceExitTest(TACFunction* function, const CFG* cfg, const DefUseChains* chains, int loop,
+                           const ReducedVariable* reduced, int reducedCount) {
+    int ivCount;
+    InductionVariable* ivs = FindInductionVariables(function, cfg, chains, loop, &ivCount);
+    LoopExit exit;
+    int replaced = 0;
+
+    if (FindLoopExit(function, cfg, chains, loop, ivs, ivCount, &exit)) {
+        const InductionVariable* iv = &ivs[exit.iv];
+        long trips = ConstantTripCount(function, &exit, iv, MAX_SIMULATED_TRIPS);
+
+        for (int r = 0; r < reducedCount && trips >= 0 && !replaced; r++) {
+            if (reduced[r].iv != iv->var || reduced[r].factor.kind != TAC_OPERAND_INT ||
+                reduced[r].factor.value.intValue <= 0) {
+                continue;
+            }
+            if (!OnlyUsedBy(chains, iv->var, iv->nextIndex, exit.compare) ||
+                !OnlyUsedBy(chains, iv->next, iv->phiIndex, exit.compare)) {
+                continue;
+            }
+
+            long long k = reduced[r].factor.value.intValue;
+            long long first = iv->init.value.intValue;
+            long long last = first + (long long)(trips + 1) * iv->step;
+            long long bound = exit.bound.value.intValue;
+            int fits = first * k >= INT_MIN && first * k <= INT_MAX && last * k >= INT_MIN &&
+                       last * k <= INT_MAX && bound * k >= INT_MIN && bound * k <= INT_MAX &&
+                       last >= INT_MIN && last <= INT_MAX;
+            if (!fits) {
+                continue;
+            }
+
+            TACInstruction* test = &function->code[exit.compare];
+            TACOperand value = VarOperand(exit.usesNext ? reduced[r].next : reduced[r].value);
+            TACOperand scaled = IntOperand((int)(bound * k));
+            test->arg1 = exit.ivOnLeft ? value : scaled;
+            test->arg2 = exit.ivOnLeft ? scaled : value;
+            replaced = 1;
+        }
+    }
+
+    free(ivs);
+    return replaced;
+}
+
+/**
+ * @brief Strength-reduces multiplications by induction variables and replaces exit tests
+ *
+ * Every t = i * k inside a loop, where i is a basic induction variable and
+ * k is loop-invariant, is replaced by a new variable that is advanced by
+ * addition alongside i. When that leaves i used only by the exit test, the
+ * test is rewritten in terms of the new variable so i can be deleted.
+ *
+ * @param function The function to optimize; converted to SSA if needed
+ * @return The number of multiplications and tests rewritten
+ */
+int RunStrengthReduction(TACFunction* function) {
+    InsertPreheaders(function);
+
+    ReducedVariable* reduced = NULL;
+    int reducedCount = 0;
+    int changes = 0;
+
+    while (ReduceOne(function, &reduced, &reducedCount)) {
+        changes++;
+    }
+
+    if (reducedCount > 0) {
+        CFG cfg = AnalyzeCFG(function);
+        DefUseChains chains = BuildDefUseChains(function);
+        for (int l = 0; l < cfg.loopCount; l++) {
+            changes += ReplaceExitTest(function, &cfg, &chains, l, reduced, reducedCount);
+        }
+        FreeCFG(&cfg);
+        FreeDefUseChains(&chains);
+    }
+
+    free(reduced);
+    return changes;
+}
@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "jit.h"
+#include "runtime.h"
+
+// Size of a thunk: jmp *0(%rip) followed by the 8-byte address to jump to
+#define THUNK_SIZE 16
+
+typedef struct {
+    const char* name;
+    void* address;
+} RuntimeHelper;
+
+static const RuntimeHelper helpers[] = {
+    {"zara_print_int", (void*)zara_print_int},
+    {"zara_print_float", (void*)zara_print_float},
+    {"zara_print_string", (void*)zara_print_string},
+    {"zara_print_array", (void*)zara_print_array},
+    {"zara_print_float_array", (void*)zara_print_float_array},
+    {"zara_print_end", (void*)zara_print_end},
+    {"zara_new_array", (void*)zara_new_array},
+    {"zara_bounds_error", (void*)zara_bounds_error},
+    {"zara_print_stack", (void*)zara_print_stack},
+    {"zara_print_float_stack", (void*)zara_print_float_stack},
+    {"zara_new_stack", (void*)zara_new_stack},
+    {"zara_stack_push_int", (void*)zara_stack_push_int},
+    {"zara_stack_push_float", (void*)zara_stack_push_float},
+    {"zara_stack_empty_error", (void*)zara_stack_empty_error},
+    {"zara_string_concat", (void*)zara_string_concat},
+    {"zara_string_equals", (void*)zara_string_equals},
+};
+
+static void* FindHelper(const char* name) {
+    for (size_t i = 0; i < sizeof(helpers) / sizeof(helpers[0]); i++) {
+        if (strcmp(helpers[i].name, name) == 0) {
+            return helpers[i].address;
+        }
+    }
+    fprintf(stderr, "Error: call to undefined function %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static size_t PageAlign(size_t size, size_t page) {
+    return (size + page - 1) / page * page;
+}
+
+static void Protect(void* start, size_t size, int protection) {
+    if (size > 0 && mprotect(start, size, protection) != 0) {
+        perror("Error protecting JIT memory");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Loads an encoded program into memory and calls its main function
+ *
+ * The text is copied into a fresh writable mapping, followed by a thunk for
+ * every runtime helper the program calls, since the helpers in the compiler
+ * may be further than a rel32 call can reach. Read-only data gets pages of
+ * its own. Once the relocations are applied the text and thunks become
+ * read and execute, and the data read only, so no page is ever writable and
+ * executable at the same time.
+ *
+ * @param program The program, for its symbols
+ * @param code The program encoded by EncodeProgram
+ * @return The value main returned
+ */
+int RunJIT(const MachineProgram* program, const MachineCode* code) {
+    int entrySymbol = -1;
+    for (int s = 0; s < program->symbolCount; s++) {
+        if (program->symbols[s].defined && program->symbols[s].data == NULL &&
+            strcmp(program->symbols[s].name, "main") == 0) {
+            entrySymbol = s;
+        }
+    }
+    if (entrySymbol < 0) {
+        fprintf(stderr, "Error: program has no main function to run\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Every undefined symbol gets a thunk slot, whether or not a relocation uses it
+    int* thunks = CheckedMalloc((program->symbolCount + 1) * sizeof(int));
+    int thunkCount = 0;
+    for (int s = 0; s < program->symbolCount; s++) {
+        thunks[s] = !program->symbols[s].defined && program->symbols[s].data == NULL ? thunkCount++ : -1;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t thunkStart = (code->textSize + THUNK_SIZE - 1) / THUNK_SIZE * THUNK_SIZE;
+    size_t textPages = PageAlign(thunkStart + thunkCount * THUNK_SIZE, page);
+    size_t dataPages = PageAlign(code->rodataSize, page);
+    unsigned char* memory = mmap(NULL, textPages + dataPages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                                 -1, 0);
+    if (memory == MAP_FAILED) {
+        perror("Error mapping JIT memory");
+        exit(EXIT_FAILURE);
+    }
+    unsigned char* rodata = memory + textPages;
+
+    memcpy(memory, code->text, code->textSize);
+    memset(memory + code->textSize, 0xcc, textPages - code->textSize);
+    memcpy(rodata, code->rodata, code->rodataSize);
+    for (int s = 0; s < program->symbolCount; s++) {
+        if (thunks[s] >= 0) {
+            unsigned char* thunk = memory + thunkStart + thunks[s] * THUNK_SIZE;
+            uint64_t address = (uint64_t)(uintptr_t)FindHelper(program->symbols[s].name);
+            memcpy(thunk, (const unsigned char[]){0xff, 0x25, 0, 0, 0, 0}, 6);
+            memcpy(thunk + 6, &address, sizeof(address));
+        }
+    }
+
+    for (int r = 0; r < code->relocationCount; r++) {
+        const MachineRelocation* relocation = &code->relocations[r];
+        unsigned char* target = relocation->kind == RELOC_PC32
+                                    ? rodata + code->symbolOffsets[relocation->symbol]
+                                    : memory + thunkStart + thunks[relocation->symbol] * THUNK_SIZE;
+        int32_t value = (int32_t)(target + relocation->addend - (memory + relocation->offset));
+        memcpy(memory + relocation->offset, &value, sizeof(value));
+    }
+
+    Protect(memory, textPages, PROT_READ | PROT_EXEC);
+    Protect(rodata, dataPages, PROT_READ);
+
+    int (*entry)(void) = (int (*)(void))(void*)(memory + code->symbolOffsets[entrySymbol]);
+    int result = entry();
+    fflush(stdout);
+
+    munmap(memory, textPages + dataPages);
+    free(thunks);
+    return result;
+}
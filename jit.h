@@ -0,0 +1,8 @@
+#ifndef jit_h
+#define jit_h
+
+#include "x86.h"
+
+int RunJIT(const MachineProgram* program, const MachineCode* code);
+
+#endif
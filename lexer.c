@@ -4,6 +4,7 @@
 #include <ctype.h>
 
 #include "lexer.h"
+#include "util.h"
 
 /**
  * @brief Initializes a lexer with the given source string
@@ -31,7 +32,8 @@ void AddToken(TokenType type, const char* lexeme) {
         return;
     }
     tokens[tokenCount].type = type;
-    strncpy(tokens[tokenCount].lexeme, lexeme, MAX_TOKENS);
+    tokens[tokenCount].lexeme = CheckedMalloc(strlen(lexeme) + 1);
+    strcpy(tokens[tokenCount].lexeme, lexeme);
     tokenCount++;
 }
 
@@ -53,13 +55,21 @@ int IsKeyword(const char* str, TokenType* type) {
         return 1;
     }
     if(strcmp(str, "float") == 0) {
-        *type = TOKEN_INT;
+        *type = TOKEN_FLOAT;
         return 1;
     }
     if(strcmp(str, "string") == 0) {
         *type = TOKEN_STRING;
         return 1;
     }
+    if(strcmp(str, "array") == 0) {
+        *type = TOKEN_ARRAY;
+        return 1;
+    }
+    if(strcmp(str, "stack") == 0) {
+        *type = TOKEN_STACK;
+        return 1;
+    }
     if(strcmp(str, "if") == 0) {
         *type = TOKEN_IF;
         return 1;
@@ -89,6 +99,33 @@ int IsKeyword(const char* str, TokenType* type) {
     
 }
 
+/**
+ * @brief Builds a token whose lexeme is a heap copy of part of the source
+ *
+ * @param type The type of the token
+ * @param text The start of the lexeme
+ * @param length The number of characters in the lexeme
+ * @return The new token
+ */
+static Token MakeToken(TokenType type, const char* text, int length) {
+    Token token;
+    token.type = type;
+    token.lexeme = CheckedMalloc(length + 1);
+    memcpy(token.lexeme, text, length);
+    token.lexeme[length] = '\0';
+    return token;
+}
+
+/**
+ * @brief Releases the lexeme of a token
+ *
+ * @param token The token to free
+ */
+void FreeToken(Token* token) {
+    free(token->lexeme);
+    token->lexeme = NULL;
+}
+
 /**
  * @brief Get the next token from the lexer's source string
  * 
@@ -101,10 +138,6 @@ int IsKeyword(const char* str, TokenType* type) {
  */
 Token GetNextToken(Lexer* lexer) {
 
-    Token token;
-    token.type = TOKEN_UNKNOWN;
-    token.lexeme[0] = '\0';
-
     while(lexer->source[lexer->position] != '\0') {
         char current = lexer->source[lexer->position];
 
@@ -120,17 +153,9 @@ Token GetNextToken(Lexer* lexer) {
                 lexer->position++;
             }
 
-            int length = lexer->position - start;
-            strncpy(token.lexeme, lexer->source + start, length);
-            token.lexeme[length] = '\0';
-            
-            if(IsKeyword(token.lexeme, &token.type)) {
-                return token;
-            }
-            else {
-                token.type = TOKEN_IDENTIFIER;
-                return token;
-            }
+            Token token = MakeToken(TOKEN_IDENTIFIER, lexer->source + start, lexer->position - start);
+            IsKeyword(token.lexeme, &token.type);
+            return token;
         }
 
         if(isdigit(current)) {
@@ -143,11 +168,8 @@ Token GetNextToken(Lexer* lexer) {
                 }
                 lexer->position++;
             }
-            int length = lexer->position - start;
-            strncpy(token.lexeme, lexer->source + start, length);
-            token.lexeme[length] = '\0';
-            token.type = hasDot ? TOKEN_FLOAT : TOKEN_NUMBER;
-            return token;
+            // Float literals keep their '.' in the lexeme
+            return MakeToken(TOKEN_NUMBER, lexer->source + start, lexer->position - start);
         }
 
         if (current == '\"') {
@@ -156,10 +178,7 @@ Token GetNextToken(Lexer* lexer) {
             while (lexer->source[lexer->position] != '\"' && lexer->source[lexer->position] != '\0') {
                 lexer->position++;
             }
-            int length = lexer->position - start;
-            strncpy(token.lexeme, lexer->source + start, length);
-            token.lexeme[length] = '\0';
-            token.type = TOKEN_STRING_LITERAL;
+            Token token = MakeToken(TOKEN_STRING_LITERAL, lexer->source + start, lexer->position - start);
             if (lexer->source[lexer->position] == '\"') {
                 lexer->position++; // Skip closing quote
             }
@@ -172,35 +191,20 @@ Token GetNextToken(Lexer* lexer) {
             // Handle two-character operators
             if ((current == '=' || current == '!' || current == '<' || current == '>') && lexer->source[lexer->position] == '=') {
                 lexer->position++;
-                int length = lexer->position - start;
-                strncpy(token.lexeme, lexer->source + start, length);
-                token.lexeme[length] = '\0';
-                token.type = TOKEN_OPERATOR;
-                return token;
-            } else {
-                token.lexeme[0] = current;
-                token.lexeme[1] = '\0';
-                token.type = TOKEN_OPERATOR;
-                return token;
             }
+            return MakeToken(TOKEN_OPERATOR, lexer->source + start, lexer->position - start);
         }
 
-        if (strchr("();{},", current)) {
-            token.lexeme[0] = current;
-            token.lexeme[1] = '\0';
-            token.type = TOKEN_SEPARATOR;
+        if (strchr("();{},[]", current)) {
             lexer->position++;
-            return token;
+            return MakeToken(TOKEN_SEPARATOR, lexer->source + lexer->position - 1, 1);
         }
 
         lexer->position++;
-        token.type = TOKEN_UNKNOWN;
-        return token;
+        return MakeToken(TOKEN_UNKNOWN, "", 0);
     }
 
-    token.type = TOKEN_EOF;
-    strcpy(token.lexeme, "EOF");
-    return token;
+    return MakeToken(TOKEN_EOF, "EOF", 3);
 }
 
 void Tokenize(char* line) {
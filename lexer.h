@@ -6,6 +6,8 @@ typedef enum {
     TOKEN_INT,
     TOKEN_FLOAT,
     TOKEN_STRING,
+    TOKEN_ARRAY,
+    TOKEN_STACK,
     TOKEN_IF,
     TOKEN_ELSE,
     TOKEN_FOR,
@@ -23,7 +25,7 @@ typedef enum {
 typedef struct 
 {
     TokenType type;
-    char lexeme[MAX_NAME_LENGTH];
+    char* lexeme; // Heap-allocated; released with FreeToken
 
 } Token;
 
@@ -35,6 +37,7 @@ typedef struct
 
 Lexer InitLexer(const char* source);
 Token GetNextToken(Lexer* lexer);
+void FreeToken(Token* token);
 int IsKeyword(const char* str, TokenType* type);
 void Tokenize(char* line);
 void AddToken(TokenType type, const char* lexeme);
\ No newline at end of file
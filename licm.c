@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimize.h"
+#include "cfg.h"
+#include "ssa.h"
+
+/**
+ * @brief Returns the preheader of a loop, if it already has one
+ *
+ * A preheader is the single block outside the loop that enters the header,
+ * and whose only successor is the header.
+ *
+ * @return The preheader block, or -1 if the loop needs one
+ */
+int FindPreheader(const CFG* cfg, int loop) {
+    const BasicBlock* header = &cfg->blocks[cfg->loops[loop].header];
+    int preheader = -1;
+
+    for (int i = 0; i < header->preds.count; i++) {
+        int pred = header->preds.items[i];
+        if (LoopContains(cfg, loop, pred)) {
+            continue;
+        }
+        if (preheader >= 0) {
+            return -1;
+        }
+        preheader = pred;
+    }
+
+    if (preheader < 0 || cfg->blocks[preheader].succs.count != 1) {
+        return -1;
+    }
+    return preheader;
+}
+
+/**
+ * @brief Returns where code that must run once before a loop goes in its preheader
+ *
+ * That is just before the preheader's jump to the header, or at its end if
+ * it falls through into the header.
+ *
+ * @return The instruction index to insert at
+ */
+int PreheaderInsertIndex(const TACFunction* function, const CFG* cfg, int preheader) {
+    const BasicBlock* pre = &cfg->blocks[preheader];
+    if (pre->end > pre->start && IsBranchOp(function->code[pre->end - 1].op)) {
+        return pre->end - 1;
+    }
+    return pre->end;
+}
+
+/**
+ * @brief Gives a loop a preheader by inserting an empty block in front of its header
+ *
+ * Every edge entering the loop from outside is redirected to the new block.
+ * When several such edges carry different values into a header phi, the
+ * values are first merged by a phi in the preheader.
+ *
+ * @param function The function, in SSA form
+ * @param cfg The analyzed graph of the function; stale once this returns
+ * @param loop The loop
+ */
+static void InsertPreheader(TACFunction* function, const CFG* cfg, int loop) {
+    int header = cfg->loops[loop].header;
+    const BasicBlock* block = &cfg->blocks[header];
+    int headerLabel = BlockLabel(cfg, header);
+    int label = NewLabel(function);
+
+    IntList outside = {0};
+    for (int i = 0; i < block->preds.count; i++) {
+        if (!LoopContains(cfg, loop, block->preds.items[i])) {
+            IntListPush(&outside, BlockLabel(cfg, block->preds.items[i]));
+        }
+    }
+
+    // Send the jumps from outside the loop to the preheader instead
+    for (int i = 0; i < block->preds.count; i++) {
+        int pred = block->preds.items[i];
+        const BasicBlock* predBlock = &cfg->blocks[pred];
+        if (LoopContains(cfg, loop, pred) || predBlock->end == predBlock->start) {
+            continue;
+        }
+        TACInstruction* last = &function->code[predBlock->end - 1];
+        if (IsBranchOp(last->op) && last->result.value.id == headerLabel) {
+            last->result = LabelOperand(label);
+        }
+    }
+
+    TACInstruction* code = CheckedMalloc((2 + (block->end - block->start)) * sizeof(TACInstruction));
+    int n = 0;
+
+    // A latch laid out just above the header must now jump over the preheader
+    int above = header - 1;
+    if (above >= 0 && LoopContains(cfg, loop, above) && IntListContains(&block->preds, above)) {
+        const BasicBlock* aboveBlock = &cfg->blocks[above];
+        TACOpcode op = aboveBlock->end > aboveBlock->start ? function->code[aboveBlock->end - 1].op : TAC_NOP;
+        if (op != TAC_GOTO && op != TAC_RETURN) {
+            memset(&code[n], 0, sizeof(TACInstruction));
+            code[n].op = TAC_GOTO;
+            code[n++].result = LabelOperand(headerLabel);
+        }
+    }
+
+    memset(&code[n], 0, sizeof(TACInstruction));
+    code[n].op = TAC_LABEL;
+    code[n++].result = LabelOperand(label);
+
+    for (int i = block->start; i < block->end; i++) {
+        TACInstruction* phi = &function->code[i];
+        if (phi->op != TAC_PHI) {
+            continue;
+        }
+
+        int first = -1;
+        int merged = 0;
+        for (int k = 0; k < phi->phiCount; k++) {
+            if (IntListContains(&outside, phi->phiArgs[k].pred)) {
+                if (first < 0) {
+                    first = k;
+                }
+                merged++;
+            }
+        }
+        if (first < 0) {
+            continue;
+        }
+        if (merged == 1) {
+            phi->phiArgs[first].pred = label;
+            continue;
+        }
+
+        // Several values enter from outside: merge them in the preheader first
+        int var = phi->result.value.id;
+        char name[MAX_NAME_LENGTH];
+        snprintf(name, sizeof(name), "%.*s_ph%d", MAX_NAME_LENGTH - 16, function->vars[var].name, label);
+        int id = AddTACVariable(function, name, function->vars[var].type);
+        function->vars[id].elementType = function->vars[var].elementType;
+        function->vars[id].isTemp = function->vars[var].isTemp;
+        function->vars[id].origin = function->vars[var].origin;
+
+        TACInstruction* mergePhi = &code[n++];
+        memset(mergePhi, 0, sizeof(TACInstruction));
+        mergePhi->op = TAC_PHI;
+        mergePhi->result = VarOperand(id);
+        mergePhi->phiArgs = CheckedMalloc(merged * sizeof(TACPhiArg));
+
+        int kept = 0;
+        for (int k = 0; k < phi->phiCount; k++) {
+            if (IntListContains(&outside, phi->phiArgs[k].pred)) {
+                mergePhi->phiArgs[mergePhi->phiCount++] = phi->phiArgs[k];
+            } else {
+                phi->phiArgs[kept++] = phi->phiArgs[k];
+            }
+        }
+        phi->phiArgs[kept].value = VarOperand(id);
+        phi->phiArgs[kept].pred = label;
+        phi->phiCount = kept + 1;
+    }
+
+    InsertInstructions(function, block->start, code, n);
+
+    free(code);
+    IntListFree(&outside);
+}
+
+/**
+ * @brief Makes sure every loop of a function has a preheader
+ *
+ * Passes that move code out of loops or set up values before them need a
+ * single place to put it that runs exactly once before the loop is entered.
+ *
+ * @param function The function; converted to SSA if needed
+ */
+void InsertPreheaders(TACFunction* function) {
+    BuildSSA(function);
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        CFG cfg = AnalyzeCFG(function);
+        for (int l = 0; l < cfg.loopCount && !changed; l++) {
+            if (FindPreheader(&cfg, l) < 0) {
+                InsertPreheader(function, &cfg, l);
+                changed = 1;
+            }
+        }
+        FreeCFG(&cfg);
+    }
+}
+
+/**
+ * @brief Checks whether an operand keeps the same value on every iteration of a loop
+ */
+static int IsInvariantOperand(const CFG* cfg, int loop, const DefUseChains* chains,
+                              const char* hoisted, TACOperand operand) {
+    if (operand.kind != TAC_OPERAND_VAR) {
+        return 1;
+    }
+    int def = chains->def[operand.value.id];
+    return def < 0 || hoisted[def] || !LoopContains(cfg, loop, cfg->blockOf[def]);
+}
+
+/**
+ * @brief Checks whether a block runs on every iteration that leaves the loop
+ *
+ * Instructions that may fault can only be hoisted from such blocks, since
+ * otherwise the hoisted copy could run when the original never would.
+ */
+static int RunsOnEveryExit(const CFG* cfg, int loop, int block) {
+    const Loop* l = &cfg->loops[loop];
+    for (int i = 0; i < l->blocks.count; i++) {
+        const BasicBlock* b = &cfg->blocks[l->blocks.items[i]];
+        for (int j = 0; j < b->succs.count; j++) {
+            if (!LoopContains(cfg, loop, b->succs.items[j]) && !Dominates(cfg, block, l->blocks.items[i])) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Moves the invariant computations of one loop into its preheader
+ *
+ * An instruction is invariant when every operand is a constant, is defined
+ * outside the loop, or is defined by an instruction already found
+ * invariant. Blocks are scanned in reverse postorder so definitions are
+ * seen before their uses. Array loads count only if nothing in the loop
+ * can write memory, that is, the loop contains no stores and no calls,
+ * whose callee may store into the same array.
+ *
+ * @return The number of instructions hoisted
+ */
+static int HoistLoop(TACFunction* function, const CFG* cfg, int loop, int preheader) {
+    const Loop* l = &cfg->loops[loop];
+    DefUseChains chains = BuildDefUseChains(function);
+    char* hoisted = CheckedCalloc(function->count, sizeof(char));
+    int writesMemory = 0;
+
+    int* blocks = CheckedMalloc(l->blocks.count * sizeof(int));
+    for (int i = 0; i < l->blocks.count; i++) {
+        blocks[i] = l->blocks.items[i];
+        for (int j = cfg->blocks[blocks[i]].start; j < cfg->blocks[blocks[i]].end; j++) {
+            TACOpcode op = function->code[j].op;
+            if (op == TAC_STORE_INDEX || op == TAC_CALL) {
+                writesMemory = 1;
+            }
+        }
+    }
+    // Insertion sort by reverse postorder; loops are small
+    for (int i = 1; i < l->blocks.count; i++) {
+        int b = blocks[i];
+        int j = i - 1;
+        while (j >= 0 && cfg->blocks[blocks[j]].rpoIndex > cfg->blocks[b].rpoIndex) {
+            blocks[j + 1] = blocks[j];
+            j--;
+        }
+        blocks[j + 1] = b;
+    }
+
+    IntList moved = {0};
+    for (int i = 0; i < l->blocks.count; i++) {
+        const BasicBlock* block = &cfg->blocks[blocks[i]];
+        int alwaysRuns = -1;
+
+        for (int j = block->start; j < block->end; j++) {
+            TACInstruction* instr = &function->code[j];
+            int def = TACDefinedVar(instr);
+            if (def < 0 || instr->op == TAC_PHI || instr->op == TAC_CALL || instr->op == TAC_NEWARRAY ||
+                instr->op == TAC_NEWSTACK) {
+                continue;
+            }
+
+            if (HasSideEffects(instr) || instr->op == TAC_LOAD_INDEX) {
+                // May fault: only safe if the loop has no stores and the block always runs
+                if (instr->op != TAC_LOAD_INDEX || writesMemory) {
+                    continue;
+                }
+                if (alwaysRuns < 0) {
+                    alwaysRuns = RunsOnEveryExit(cfg, loop, blocks[i]);
+                }
+                if (!alwaysRuns) {
+                    continue;
+                }
+            }
+
+            int invariant = 1;
+            for (int k = 0; k < TACUseCount(instr) && invariant; k++) {
+                invariant = IsInvariantOperand(cfg, loop, &chains, hoisted, *TACUseAt(instr, k));
+            }
+            if (invariant) {
+                hoisted[j] = 1;
+                IntListPush(&moved, j);
+            }
+        }
+    }
+
+    if (moved.count > 0) {
+        TACInstruction* code = CheckedMalloc(moved.count * sizeof(TACInstruction));
+        for (int i = 0; i < moved.count; i++) {
+            code[i] = function->code[moved.items[i]];
+            function->code[moved.items[i]].phiArgs = NULL;
+            MakeNop(&function->code[moved.items[i]]);
+        }
+
+        InsertInstructions(function, PreheaderInsertIndex(function, cfg, preheader), code, moved.count);
+        free(code);
+    }
+
+    int count = moved.count;
+    FreeDefUseChains(&chains);
+    free(hoisted);
+    free(blocks);
+    IntListFree(&moved);
+    return count;
+}
+
+/**
+ * @brief Hoists loop-invariant computations out of every loop of a function
+ *
+ * Each natural loop is first given a preheader. Loops are then processed
+ * innermost first, so an expression hoisted out of an inner loop can be
+ * hoisted again out of the loops that enclose it. Calls and allocations
+ * are never moved, and loads stay put in loops that store or call.
+ *
+ * @param function The function to optimize; converted to SSA if needed
+ * @return The number of instructions hoisted
+ */
+int RunLICM(TACFunction* function) {
+    InsertPreheaders(function);
+
+    // Loops are identified by their header label, which survives code motion
+    CFG cfg = AnalyzeCFG(function);
+    IntList headers = {0};
+    for (int l = cfg.loopCount - 1; l >= 0; l--) {
+        IntListPush(&headers, BlockLabel(&cfg, cfg.loops[l].header));
+    }
+    FreeCFG(&cfg);
+
+    int hoisted = 0;
+    for (int h = 0; h < headers.count; h++) {
+        cfg = AnalyzeCFG(function);
+        int header = cfg.labelBlock[headers.items[h]];
+        for (int l = 0; l < cfg.loopCount; l++) {
+            if (cfg.loops[l].header != header) {
+                continue;
+            }
+            int preheader = FindPreheader(&cfg, l);
+            if (preheader >= 0) {
+                hoisted += HoistLoop(function, &cfg, l, preheader);
+            }
+            break;
+        }
+        FreeCFG(&cfg);
+        RemoveNops(function);
+    }
+
+    IntListFree(&headers);
+    return hoisted;
+}
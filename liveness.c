@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "liveness.h"
+
+/**
+ * @brief Collects the variables a block reads before writing them, and those it writes
+ */
+static void LocalSets(const Liveness* liveness, int b, Bitset* gen, Bitset* kill) {
+    TACFunction* function = liveness->function;
+    const BasicBlock* block = &liveness->cfg.blocks[b];
+
+    for (int i = block->start; i < block->end; i++) {
+        TACInstruction* instr = &function->code[i];
+        for (int k = 0; k < TACUseCount(instr); k++) {
+            TACOperand* use = TACUseAt(instr, k);
+            if (use->kind == TAC_OPERAND_VAR && !BitsetContains(kill, use->value.id)) {
+                BitsetAdd(gen, use->value.id);
+            }
+        }
+        int def = TACDefinedVar(instr);
+        if (def >= 0) {
+            BitsetAdd(kill, def);
+        }
+    }
+}
+
+/**
+ * @brief Solves live-in and live-out sets for every block
+ *
+ * Blocks start on the worklist in postorder, which lets most values reach
+ * their definitions in one sweep; a block is queued again only when the
+ * live-in set of one of its successors grows. Sets are unioned a word at
+ * a time, 64 variables per operation.
+ */
+static void SolveDataflow(Liveness* liveness) {
+    CFG* cfg = &liveness->cfg;
+    int n = cfg->blockCount;
+    Bitset* gen = CheckedMalloc(n * sizeof(Bitset));
+    Bitset* kill = CheckedMalloc(n * sizeof(Bitset));
+    int* worklist = CheckedMalloc(n * sizeof(int));
+    char* queued = CheckedCalloc(n, sizeof(char));
+    Bitset scratch = NewBitset(liveness->varCount);
+    int head = 0;
+    int count = 0;
+
+    for (int b = 0; b < n; b++) {
+        gen[b] = NewBitset(liveness->varCount);
+        kill[b] = NewBitset(liveness->varCount);
+        LocalSets(liveness, b, &gen[b], &kill[b]);
+        BitsetCopy(&liveness->liveIn[b], &gen[b]);
+    }
+
+    // Reverse of reverse postorder first, then any unreachable blocks
+    for (int r = cfg->rpoCount - 1; r >= 0; r--) {
+        worklist[count++] = cfg->rpo[r];
+        queued[cfg->rpo[r]] = 1;
+    }
+    for (int b = n - 1; b >= 0; b--) {
+        if (!queued[b]) {
+            worklist[count++] = b;
+            queued[b] = 1;
+        }
+    }
+
+    while (count > 0) {
+        int b = worklist[head];
+        head = (head + 1) % n;
+        count--;
+        queued[b] = 0;
+
+        BasicBlock* block = &cfg->blocks[b];
+        for (int s = 0; s < block->succs.count; s++) {
+            BitsetUnion(&liveness->liveOut[b], &liveness->liveIn[block->succs.items[s]]);
+        }
+
+        // in = gen | (out - kill)
+        BitsetCopy(&scratch, &liveness->liveOut[b]);
+        BitsetDifference(&scratch, &kill[b]);
+        if (!BitsetUnion(&liveness->liveIn[b], &scratch)) {
+            continue;
+        }
+        for (int p = 0; p < block->preds.count; p++) {
+            int pred = block->preds.items[p];
+            if (!queued[pred]) {
+                worklist[(head + count) % n] = pred;
+                count++;
+                queued[pred] = 1;
+            }
+        }
+    }
+
+    for (int b = 0; b < n; b++) {
+        FreeBitset(&gen[b]);
+        FreeBitset(&kill[b]);
+    }
+    FreeBitset(&scratch);
+    free(gen);
+    free(kill);
+    free(worklist);
+    free(queued);
+}
+
+/**
+ * @brief Adds [start, end) in front of an interval being built backwards
+ *
+ * Ranges are collected from the last position to the first, so the range
+ * added most recently is the lowest one; a new range either joins it or
+ * lies entirely before it.
+ */
+static void AddRange(LiveInterval* interval, int start, int end) {
+    if (interval->rangeCount > 0) {
+        LiveRange* lowest = &interval->ranges[interval->rangeCount - 1];
+        if (end >= lowest->start) {
+            if (start < lowest->start) {
+                lowest->start = start;
+            }
+            if (end > lowest->end) {
+                lowest->end = end;
+            }
+            return;
+        }
+    }
+    if (interval->rangeCount == interval->rangeCapacity) {
+        interval->rangeCapacity = interval->rangeCapacity == 0 ? 4 : interval->rangeCapacity * 2;
+        interval->ranges = CheckedRealloc(interval->ranges, interval->rangeCapacity * sizeof(LiveRange));
+    }
+    interval->ranges[interval->rangeCount].start = start;
+    interval->ranges[interval->rangeCount].end = end;
+    interval->rangeCount++;
+}
+
+/**
+ * @brief Starts the lowest range at a definition, or records a value nobody reads
+ */
+static void AddDefinition(LiveInterval* interval, int position) {
+    if (interval->rangeCount > 0) {
+        LiveRange* lowest = &interval->ranges[interval->rangeCount - 1];
+        if (lowest->start <= position && position < lowest->end) {
+            lowest->start = position;
+            return;
+        }
+    }
+    AddRange(interval, position, position + 1);
+}
+
+/**
+ * @brief Builds the live interval of every variable from the block live sets
+ *
+ * Blocks are walked last to first and instructions backwards within each,
+ * the way Wimmer and Franz build intervals: a variable live on exit covers
+ * the whole block until a definition cuts its range short, and every read
+ * extends a range back to the start of the block. A variable that is dead
+ * over part of the function is left with a hole there, which the allocator
+ * can fill with another variable.
+ */
+static void BuildIntervals(Liveness* liveness) {
+    TACFunction* function = liveness->function;
+    CFG* cfg = &liveness->cfg;
+    char* folded = CheckedCalloc(liveness->varCount + 1, sizeof(char));
+
+    // Temporaries passed from one folded instruction to another never leave the tree
+    for (int i = 0; i < function->count; i++) {
+        if (IsFoldedInstruction(liveness, i)) {
+            folded[TACDefinedVar(&function->code[i])] = 1;
+        }
+    }
+
+    for (int b = cfg->blockCount - 1; b >= 0; b--) {
+        BasicBlock* block = &cfg->blocks[b];
+        int blockStart = USE_POSITION(block->start);
+        int blockEnd = USE_POSITION(block->end);
+
+        for (int v = BitsetNext(&liveness->liveOut[b], 0); v >= 0; v = BitsetNext(&liveness->liveOut[b], v + 1)) {
+            AddRange(&liveness->intervals[v], blockStart, blockEnd);
+        }
+
+        for (int i = block->end - 1; i >= block->start; i--) {
+            TACInstruction* instr = &function->code[i];
+            if (IsFoldedInstruction(liveness, i)) {
+                continue;
+            }
+            int def = TACDefinedVar(instr);
+            if (def >= 0) {
+                AddDefinition(&liveness->intervals[def], DEF_POSITION(i));
+                IntListPush(&liveness->intervals[def].uses, DEF_POSITION(i));
+            }
+            // A root reads the operands of the instructions folded into it as well
+            for (int j = i; j >= 0; j = liveness->nextFolded[j]) {
+                TACInstruction* member = &function->code[j];
+                for (int k = 0; k < TACUseCount(member); k++) {
+                    TACOperand* use = TACUseAt(member, k);
+                    if (use->kind != TAC_OPERAND_VAR || folded[use->value.id]) {
+                        continue;
+                    }
+                    LiveInterval* interval = &liveness->intervals[use->value.id];
+                    AddRange(interval, blockStart, USE_POSITION(i) + 1);
+                    if (interval->uses.count == 0 ||
+                        interval->uses.items[interval->uses.count - 1] != USE_POSITION(i)) {
+                        IntListPush(&interval->uses, USE_POSITION(i));
+                    }
+                }
+            }
+        }
+    }
+    free(folded);
+
+    // Everything was collected backwards
+    for (int v = 0; v < liveness->varCount; v++) {
+        LiveInterval* interval = &liveness->intervals[v];
+        for (int lo = 0, hi = interval->rangeCount - 1; lo < hi; lo++, hi--) {
+            LiveRange range = interval->ranges[lo];
+            interval->ranges[lo] = interval->ranges[hi];
+            interval->ranges[hi] = range;
+        }
+        for (int lo = 0, hi = interval->uses.count - 1; lo < hi; lo++, hi--) {
+            int position = interval->uses.items[lo];
+            interval->uses.items[lo] = interval->uses.items[hi];
+            interval->uses.items[hi] = position;
+        }
+    }
+}
+
+/**
+ * @brief Marks the intervals that are live across a call
+ *
+ * A value the call does not produce but that is live just after the call
+ * was written has to survive it, so it cannot stay in a register the
+ * callee may clobber.
+ */
+static void MarkCallCrossings(Liveness* liveness) {
+    for (int c = 0; c < liveness->calls.count; c++) {
+        int call = liveness->calls.items[c];
+        int result = TACDefinedVar(&liveness->function->code[call]);
+        for (int v = 0; v < liveness->varCount; v++) {
+            if (v != result && IntervalCovers(&liveness->intervals[v], DEF_POSITION(call))) {
+                liveness->intervals[v].crossesCall = 1;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Computes block liveness and live intervals for a function
+ *
+ * The function must be out of SSA form. Positions follow USE_POSITION and
+ * DEF_POSITION, in the order the instructions are laid out.
+ *
+ * @param function The function to analyze
+ * @return The analysis, to be released with FreeLiveness
+ */
+Liveness ComputeLiveness(TACFunction* function) {
+    return ComputeFoldedLiveness(function, NULL);
+}
+
+/**
+ * @brief Computes liveness for code where some instructions are computed inside the tree of a later one
+ *
+ * A folded instruction reads its operands where its root does, and its
+ * result, which only the tree sees, gets no interval at all.
+ *
+ * @param function The function to analyze
+ * @param foldedInto Instruction -> the root it is folded into, -1 if none; NULL if nothing is folded
+ * @return The analysis, to be released with FreeLiveness
+ */
+Liveness ComputeFoldedLiveness(TACFunction* function, const int* foldedInto) {
+    Liveness liveness;
+
+    if (function->isSSA) {
+        fprintf(stderr, "Error: liveness of %s requested while it is in SSA form\n", function->name);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&liveness, 0, sizeof(Liveness));
+    liveness.function = function;
+    liveness.cfg = AnalyzeCFG(function);
+    liveness.varCount = function->varCount;
+    liveness.liveIn = CheckedMalloc(liveness.cfg.blockCount * sizeof(Bitset));
+    liveness.liveOut = CheckedMalloc(liveness.cfg.blockCount * sizeof(Bitset));
+    for (int b = 0; b < liveness.cfg.blockCount; b++) {
+        liveness.liveIn[b] = NewBitset(liveness.varCount);
+        liveness.liveOut[b] = NewBitset(liveness.varCount);
+    }
+    liveness.intervals = CheckedCalloc(liveness.varCount, sizeof(LiveInterval));
+    for (int v = 0; v < liveness.varCount; v++) {
+        liveness.intervals[v].var = v;
+    }
+    liveness.foldedInto = foldedInto;
+    liveness.nextFolded = CheckedMalloc((function->count + 1) * sizeof(int));
+    for (int i = 0; i < function->count; i++) {
+        liveness.nextFolded[i] = -1;
+    }
+    for (int i = function->count - 1; foldedInto != NULL && i >= 0; i--) {
+        if (foldedInto[i] >= 0) {
+            liveness.nextFolded[i] = liveness.nextFolded[foldedInto[i]];
+            liveness.nextFolded[foldedInto[i]] = i;
+        }
+    }
+    for (int i = 0; i < function->count; i++) {
+        // Arrays and stacks are allocated by a runtime call, which clobbers registers like any
+        // other, and so is a push that finds its stack full; strings are joined and compared by one
+        TACOpcode op = function->code[i].op;
+        if (op == TAC_CALL || op == TAC_NEWARRAY || op == TAC_NEWSTACK || op == TAC_PUSH || op == TAC_CONCAT ||
+            op == TAC_STREQ) {
+            IntListPush(&liveness.calls, i);
+        }
+    }
+
+    SolveDataflow(&liveness);
+    BuildIntervals(&liveness);
+    MarkCallCrossings(&liveness);
+    return liveness;
+}
+
+void FreeLiveness(Liveness* liveness) {
+    for (int b = 0; b < liveness->cfg.blockCount; b++) {
+        FreeBitset(&liveness->liveIn[b]);
+        FreeBitset(&liveness->liveOut[b]);
+    }
+    for (int v = 0; v < liveness->varCount; v++) {
+        free(liveness->intervals[v].ranges);
+        IntListFree(&liveness->intervals[v].uses);
+    }
+    free(liveness->liveIn);
+    free(liveness->liveOut);
+    free(liveness->intervals);
+    IntListFree(&liveness->calls);
+    free(liveness->nextFolded);
+    FreeCFG(&liveness->cfg);
+}
+
+/**
+ * @brief Checks whether an instruction is computed inside the tree of a later one rather than on its own
+ */
+int IsFoldedInstruction(const Liveness* liveness, int index) {
+    return liveness->foldedInto != NULL && liveness->foldedInto[index] >= 0;
+}
+
+/**
+ * @brief Returns the first position an interval covers, or -1 if it is empty
+ */
+int IntervalStart(const LiveInterval* interval) {
+    return interval->rangeCount > 0 ? interval->ranges[0].start : -1;
+}
+
+/**
+ * @brief Returns one past the last position an interval covers, or -1 if it is empty
+ */
+int IntervalEnd(const LiveInterval* interval) {
+    return interval->rangeCount > 0 ? interval->ranges[interval->rangeCount - 1].end : -1;
+}
+
+/**
+ * @brief Checks whether a variable is live at a position, holes excluded
+ */
+int IntervalCovers(const LiveInterval* interval, int position) {
+    int lo = 0;
+    int hi = interval->rangeCount - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (position < interval->ranges[mid].start) {
+            hi = mid - 1;
+        } else if (position >= interval->ranges[mid].end) {
+            lo = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the first position two intervals are both live at
+ *
+ * One interval may sit entirely in a hole of the other, in which case
+ * they do not intersect and can share a register.
+ *
+ * @return The position, or -1 if the intervals never overlap
+ */
+int IntervalsIntersect(const LiveInterval* a, const LiveInterval* b) {
+    int i = 0;
+    int j = 0;
+
+    while (i < a->rangeCount && j < b->rangeCount) {
+        const LiveRange* x = &a->ranges[i];
+        const LiveRange* y = &b->ranges[j];
+        if (x->end <= y->start) {
+            i++;
+        } else if (y->end <= x->start) {
+            j++;
+        } else {
+            return x->start > y->start ? x->start : y->start;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Finds the first use or definition of a variable at or after a position
+ *
+ * @return The position, or -1 if there is none
+ */
+int NextUseAfter(const LiveInterval* interval, int position) {
+    for (int u = 0; u < interval->uses.count; u++) {
+        if (interval->uses.items[u] >= position) {
+            return interval->uses.items[u];
+        }
+    }
+    return -1;
+}
+
+static void PrintVariableSet(const Liveness* liveness, const char* label, const Bitset* set) {
+    printf(" %s {", label);
+    int first = 1;
+    for (int v = BitsetNext(set, 0); v >= 0; v = BitsetNext(set, v + 1)) {
+        printf(first ? "%s" : ", %s", liveness->function->vars[v].name);
+        first = 0;
+    }
+    printf("}");
+}
+
+void PrintLiveness(const Liveness* liveness) {
+    printf("Liveness for function %s:\n", liveness->function->name);
+
+    for (int b = 0; b < liveness->cfg.blockCount; b++) {
+        printf("  B%d", b);
+        PrintVariableSet(liveness, "in:", &liveness->liveIn[b]);
+        PrintVariableSet(liveness, "out:", &liveness->liveOut[b]);
+        printf("\n");
+    }
+
+    for (int v = 0; v < liveness->varCount; v++) {
+        const LiveInterval* interval = &liveness->intervals[v];
+        if (interval->rangeCount == 0) {
+            continue;
+        }
+        printf("  %s:", liveness->function->vars[v].name);
+        for (int r = 0; r < interval->rangeCount; r++) {
+            printf(" [%d, %d)", interval->ranges[r].start, interval->ranges[r].end);
+        }
+        printf(" uses:");
+        for (int u = 0; u < interval->uses.count; u++) {
+            printf(" %d", interval->uses.items[u]);
+        }
+        if (interval->crossesCall) {
+            printf(" crosses call");
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef liveness_h
+#define liveness_h
+
+#include "tac.h"
+#include "cfg.h"
+#include "util.h"
+
+// Instruction i reads its operands at position 2i and writes its result at 2i + 1,
+// so a value dying at an instruction and one born there never overlap
+#define USE_POSITION(i) (2 * (i))
+#define DEF_POSITION(i) (2 * (i) + 1)
+
+typedef struct {
+    int start;          // First position covered
+    int end;            // One past the last position covered
+} LiveRange;
+
+typedef struct {
+    int var;
+    LiveRange* ranges;  // Sorted and disjoint; the gaps between them are lifetime holes
+    int rangeCount;
+    int rangeCapacity;
+    IntList uses;       // Positions the variable is read or written at, ascending
+    int crossesCall;    // Whether the value has to survive a call
+} LiveInterval;
+
+typedef struct {
+    TACFunction* function;
+    CFG cfg;
+    int varCount;
+
+    Bitset* liveIn;     // Block -> variables live on entry
+    Bitset* liveOut;    // Block -> variables live on exit
+
+    LiveInterval* intervals; // Variable -> its interval, with no ranges if it is never live
+    IntList calls;      // Indices of the calls, allocations, stack pushes and string operations, ascending
+
+    // Instructions folded into the tree of a later one read their operands
+    // there. Following nextFolded from a root visits the instructions folded
+    // into it; it is -1 everywhere when nothing is folded.
+    const int* foldedInto; // Instruction -> the root it is folded into, -1 if none; NULL if nothing is
+    int* nextFolded;
+} Liveness;
+
+Liveness ComputeLiveness(TACFunction* function);
+Liveness ComputeFoldedLiveness(TACFunction* function, const int* foldedInto);
+void FreeLiveness(Liveness* liveness);
+int IsFoldedInstruction(const Liveness* liveness, int index);
+
+int IntervalStart(const LiveInterval* interval);
+int IntervalEnd(const LiveInterval* interval);
+int IntervalCovers(const LiveInterval* interval, int position);
+int IntervalsIntersect(const LiveInterval* a, const LiveInterval* b);
+int NextUseAfter(const LiveInterval* interval, int position);
+
+void PrintLiveness(const Liveness* liveness);
+
+#endif
@@ -0,0 +1,202 @@
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+
+enum {
+    SECTION_NULL,
+    SECTION_TEXT,
+    SECTION_DATA,
+    SECTION_RODATA,
+    SECTION_RELA_TEXT,
+    SECTION_SYMTAB,
+    SECTION_STRTAB,
+    SECTION_SHSTRTAB,
+    SECTION_NOTE_STACK,
+    SECTION_COUNT,
+};
+
+// Symbol table entries before the first global one: the null symbol and one per section with contents
+#define LOCAL_SYMBOLS 4
+
+typedef struct {
+    char* bytes;
+    int size;
+    int capacity;
+} StringTable;
+
+static int AddString(StringTable* table, const char* text) {
+    int length = strlen(text) + 1;
+    int offset = table->size;
+
+    if (table->size + length > table->capacity) {
+        table->capacity = (table->size + length) * 2;
+        table->bytes = CheckedRealloc(table->bytes, table->capacity);
+    }
+    memcpy(table->bytes + table->size, text, length);
+    table->size += length;
+    return offset;
+}
+
+static long WriteAligned(FILE* out, long position, int align, const void* bytes, long size) {
+    static const char zeros[16] = {0};
+
+    while (position % align != 0) {
+        long pad = align - position % align;
+        fwrite(zeros, 1, pad < 16 ? pad : 16, out);
+        position += pad < 16 ? pad : 16;
+    }
+    if (size > 0) {
+        fwrite(bytes, 1, size, out);
+    }
+    return position;
+}
+
+static Elf64_Sym MakeSymbol(int name, int binding, int type, int section, long value, long size) {
+    Elf64_Sym symbol;
+    memset(&symbol, 0, sizeof(Elf64_Sym));
+    symbol.st_name = name;
+    symbol.st_info = ELF64_ST_INFO(binding, type);
+    symbol.st_shndx = section;
+    symbol.st_value = value;
+    symbol.st_size = size;
+    return symbol;
+}
+
+/**
+ * @brief Writes an encoded program as an ELF64 relocatable object file for x86-64
+ *
+ * The functions of the program become global symbols in .text, and the
+ * functions it calls but does not define become undefined symbols for the
+ * linker to resolve. Constants are reached through the .rodata section
+ * symbol. .data is always empty, since Zara has no global variables.
+ *
+ * @param out The file to write to, opened in binary mode
+ * @param program The program, for its symbols
+ * @param code The program encoded by EncodeProgram
+ */
+void WriteObject(FILE* out, const MachineProgram* program, const MachineCode* code) {
+    StringTable strtab = {NULL, 0, 0};
+    StringTable shstrtab = {NULL, 0, 0};
+    int* elfSymbol = CheckedMalloc((program->symbolCount + 1) * sizeof(int));
+    Elf64_Sym* symbols = CheckedCalloc(program->symbolCount + LOCAL_SYMBOLS, sizeof(Elf64_Sym));
+    int symbolCount = LOCAL_SYMBOLS;
+
+    AddString(&strtab, "");
+    symbols[SECTION_TEXT] = MakeSymbol(0, STB_LOCAL, STT_SECTION, SECTION_TEXT, 0, 0);
+    symbols[SECTION_DATA] = MakeSymbol(0, STB_LOCAL, STT_SECTION, SECTION_DATA, 0, 0);
+    symbols[SECTION_RODATA] = MakeSymbol(0, STB_LOCAL, STT_SECTION, SECTION_RODATA, 0, 0);
+
+    for (int f = 0; f < program->functionCount; f++) {
+        int s = program->functions[f].symbol;
+        int start = code->symbolOffsets[s];
+        int end = f + 1 < program->functionCount ? code->symbolOffsets[program->functions[f + 1].symbol]
+                                                   : code->textSize;
+        elfSymbol[s] = symbolCount;
+        symbols[symbolCount++] = MakeSymbol(AddString(&strtab, program->symbols[s].name), STB_GLOBAL, STT_FUNC,
+                                            SECTION_TEXT, start, end - start);
+    }
+    for (int s = 0; s < program->symbolCount; s++) {
+        if (program->symbols[s].data != NULL) {
+            elfSymbol[s] = SECTION_RODATA;
+        } else if (!program->symbols[s].defined) {
+            elfSymbol[s] = symbolCount;
+            symbols[symbolCount++] = MakeSymbol(AddString(&strtab, program->symbols[s].name), STB_GLOBAL,
+                                                STT_NOTYPE, SHN_UNDEF, 0, 0);
+        }
+    }
+
+    Elf64_Rela* relocations = CheckedCalloc(code->relocationCount + 1, sizeof(Elf64_Rela));
+    for (int r = 0; r < code->relocationCount; r++) {
+        const MachineRelocation* relocation = &code->relocations[r];
+        int type = relocation->kind == RELOC_PLT32 ? R_X86_64_PLT32 : R_X86_64_PC32;
+        long addend = relocation->addend;
+        if (program->symbols[relocation->symbol].data != NULL) {
+            addend += code->symbolOffsets[relocation->symbol];
+        }
+        relocations[r].r_offset = relocation->offset;
+        relocations[r].r_info = ELF64_R_INFO(elfSymbol[relocation->symbol], type);
+        relocations[r].r_addend = addend;
+    }
+
+    Elf64_Shdr sections[SECTION_COUNT];
+    memset(sections, 0, sizeof(sections));
+    AddString(&shstrtab, "");
+    sections[SECTION_TEXT].sh_name = AddString(&shstrtab, ".text");
+    sections[SECTION_DATA].sh_name = AddString(&shstrtab, ".data");
+    sections[SECTION_RODATA].sh_name = AddString(&shstrtab, ".rodata");
+    sections[SECTION_RELA_TEXT].sh_name = AddString(&shstrtab, ".rela.text");
+    sections[SECTION_SYMTAB].sh_name = AddString(&shstrtab, ".symtab");
+    sections[SECTION_STRTAB].sh_name = AddString(&shstrtab, ".strtab");
+    sections[SECTION_SHSTRTAB].sh_name = AddString(&shstrtab, ".shstrtab");
+    sections[SECTION_NOTE_STACK].sh_name = AddString(&shstrtab, ".note.GNU-stack");
+
+    struct {
+        int type;
+        long flags;
+        const void* bytes;
+        long size;
+        int align;
+        int entrySize;
+    } contents[SECTION_COUNT] = {
+        [SECTION_TEXT] = {SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, code->text, code->textSize, 16, 0},
+        [SECTION_DATA] = {SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, NULL, 0, 8, 0},
+        [SECTION_RODATA] = {SHT_PROGBITS, SHF_ALLOC, code->rodata, code->rodataSize, 8, 0},
+        [SECTION_RELA_TEXT] = {SHT_RELA, SHF_INFO_LINK, relocations, code->relocationCount * sizeof(Elf64_Rela), 8,
+                               sizeof(Elf64_Rela)},
+        [SECTION_SYMTAB] = {SHT_SYMTAB, 0, symbols, symbolCount * sizeof(Elf64_Sym), 8, sizeof(Elf64_Sym)},
+        [SECTION_STRTAB] = {SHT_STRTAB, 0, strtab.bytes, strtab.size, 1, 0},
+        [SECTION_SHSTRTAB] = {SHT_STRTAB, 0, shstrtab.bytes, shstrtab.size, 1, 0},
+        [SECTION_NOTE_STACK] = {SHT_PROGBITS, 0, NULL, 0, 1, 0},
+    };
+
+    Elf64_Ehdr header;
+    memset(&header, 0, sizeof(Elf64_Ehdr));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = SECTION_COUNT;
+    header.e_shstrndx = SECTION_SHSTRTAB;
+
+    // Section contents follow the header in order, then the section header table
+    long position = sizeof(Elf64_Ehdr);
+    for (int s = 1; s < SECTION_COUNT; s++) {
+        int align = contents[s].align;
+        position = (position + align - 1) / align * align;
+        sections[s].sh_type = contents[s].type;
+        sections[s].sh_flags = contents[s].flags;
+        sections[s].sh_offset = position;
+        sections[s].sh_size = contents[s].size;
+        sections[s].sh_addralign = align;
+        sections[s].sh_entsize = contents[s].entrySize;
+        position += contents[s].size;
+    }
+    sections[SECTION_RELA_TEXT].sh_link = SECTION_SYMTAB;
+    sections[SECTION_RELA_TEXT].sh_info = SECTION_TEXT;
+    sections[SECTION_SYMTAB].sh_link = SECTION_STRTAB;
+    sections[SECTION_SYMTAB].sh_info = LOCAL_SYMBOLS;
+    header.e_shoff = (position + 7) / 8 * 8;
+
+    fwrite(&header, sizeof(Elf64_Ehdr), 1, out);
+    position = sizeof(Elf64_Ehdr);
+    for (int s = 1; s < SECTION_COUNT; s++) {
+        position = WriteAligned(out, position, contents[s].align, contents[s].bytes, contents[s].size);
+        position += contents[s].size;
+    }
+    WriteAligned(out, position, 8, sections, sizeof(sections));
+
+    free(strtab.bytes);
+    free(shstrtab.bytes);
+    free(elfSymbol);
+    free(symbols);
+    free(relocations);
+}
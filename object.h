@@ -0,0 +1,10 @@
+#ifndef object_h
+#define object_h
+
+#include <stdio.h>
+
+#include "x86.h"
+
+void WriteObject(FILE* out, const MachineProgram* program, const MachineCode* code);
+
+#endif
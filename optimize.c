@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "optimize.h"
+#include "ssa.h"
+
+/**
+ * @brief Runs the optimization pipeline on a single function
+ *
+ * The scalar passes work on SSA form, so the function is converted into it
+ * first and translated back out once they are done. -O2 adds the loop
+ * passes, after which the scalar ones clean up what they leave. Bounds
+ * checks are removed last, once no pass can drop an access another one's
+ * check was found redundant with.
+ *
+ * @param function The function to optimize
+ * @param level The optimization level; 0 leaves the function untouched
+ */
+void OptimizeFunction(TACFunction* function, int level) {
+    if (level <= 0) {
+        return;
+    }
+
+    BuildSSA(function);
+    RunSCCP(function);
+    RunGVN(function);
+    RunLICM(function);
+    if (RunStrengthReduction(function) > 0) {
+        RunGVN(function);
+    }
+    RunDCE(function);
+
+    // Vectorized loops are left out of unrolling, so they go first
+    if (level >= 2) {
+        int changed = RunVectorize(function);
+        changed += RunUnroll(function, &unrollOptions);
+        if (changed > 0) {
+            RunSCCP(function);
+            RunGVN(function);
+            RunDCE(function);
+        }
+    }
+
+    RunBoundsCheckElimination(function);
+    DestroySSA(function);
+}
+
+/**
+ * @brief Runs the optimization pipeline on every function of a program
+ *
+ * Functions that main never calls are dropped first so no time is spent
+ * optimizing them. Tail recursion is turned into loops, which can leave
+ * a function no longer recursive and so open to inlining. Small functions
+ * are then inlined into their callers, after which the functions no
+ * longer called are dropped as well.
+ *
+ * @param program The program to optimize
+ * @param level The optimization level; 0 leaves the program untouched
+ */
+void OptimizeProgram(TACProgram* program, int level) {
+    if (level <= 0) {
+        return;
+    }
+
+    RemoveUnusedFunctions(program);
+    for (int i = 0; i < program->functionCount; i++) {
+        EliminateTailRecursion(&program->functions[i]);
+    }
+    if (InlineFunctions(program) > 0) {
+        RemoveUnusedFunctions(program);
+    }
+    for (int i = 0; i < program->functionCount; i++) {
+        OptimizeFunction(&program->functions[i], level);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef optimize_h
+#define optimize_h
+
+#include "tac.h"
+#include "cfg.h"
+#include "ssa.h"
+
+typedef struct {
+    int var;           // Variable defined by the header phi
+    int next;          // Variable carrying the value into the next iteration
+    int phiIndex;      // Index of the header phi
+    int nextIndex;     // Index of the instruction computing next
+    TACOperand init;   // Value on entry to the loop
+    int step;          // Constant added on every iteration
+} InductionVariable;
+
+typedef struct {
+    int block;          // Block ending with the exit branch
+    int branch;         // Index of the branch
+    int compare;        // Index of the comparison it tests
+    int iv;             // Induction variable compared, as an index into the loop's list
+    int usesNext;       // Whether the comparison reads the incremented value
+    int ivOnLeft;       // Whether the induction variable is the left operand
+    TACOperand bound;   // Loop-invariant operand it is compared with
+    int continueIfTrue; // Whether a true comparison runs another iteration
+} LoopExit;
+
+typedef struct {
+    int factor;         // Copies of the body per iteration of a partially unrolled loop, 1 to disable
+    int maxFullTrips;   // Largest trip count a loop is unrolled completely for
+    int maxSize;        // Largest number of instructions an unrolled loop may grow to
+} UnrollOptions;
+
+extern UnrollOptions unrollOptions;
+
+int FoldBinary(TACOpcode op, TACOperand a, TACOperand b, TACOperand* result);
+int RunSCCP(TACFunction* function);
+int RunGVN(TACFunction* function);
+int RunDCE(TACFunction* function);
+int RemoveUnusedFunctions(TACProgram* program);
+int InlineFunctions(TACProgram* program);
+int IsTailCall(const TACFunction* function, int index);
+int EliminateTailRecursion(TACFunction* function);
+int FindPreheader(const CFG* cfg, int loop);
+void InsertPreheaders(TACFunction* function);
+int PreheaderInsertIndex(const TACFunction* function, const CFG* cfg, int preheader);
+int RunLICM(TACFunction* function);
+
+int IsLoopInvariant(const CFG* cfg, const DefUseChains* chains, int loop, TACOperand operand);
+int SingleLatch(const CFG* cfg, int loop);
+InductionVariable* FindInductionVariables(TACFunction* function, const CFG* cfg, const DefUseChains* chains,
+                                          int loop, int* count);
+int FindLoopExit(TACFunction* function, const CFG* cfg, const DefUseChains* chains, int loop,
+                 const InductionVariable* ivs, int ivCount, LoopExit* exit);
+long ConstantTripCount(TACFunction* function, const LoopExit* exit, const InductionVariable* iv, long limit);
+int RunStrengthReduction(TACFunction* function);
+int RunUnroll(TACFunction* function, const UnrollOptions* options);
+int RunVectorize(TACFunction* function);
+int IsVectorized(const TACFunction* function, int headerLabel);
+int RunBoundsCheckElimination(TACFunction* function);
+
+void OptimizeFunction(TACFunction* function, int level);
+void OptimizeProgram(TACProgram* program, int level);
+
+#endif
@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "util.h"
 
 /**
  * @brief Initializes a parser with a given source string
@@ -11,6 +12,8 @@ Parser InitParser(const char* source) {
     parser.lexer = InitLexer(source);
     parser.currentToken = GetNextToken(&parser.lexer);
     InitSymbolTable(&parser.symbolTable);
+    InitTACProgram(&parser.program);
+    parser.function = NULL;
     return parser;
 }
 
@@ -20,6 +23,7 @@ Parser InitParser(const char* source) {
  * @param parser The parser to Advance
  */
 void Advance(Parser* parser) {
+    FreeToken(&parser->currentToken);
     parser->currentToken = GetNextToken(&parser->lexer);
 }
 
@@ -36,26 +40,327 @@ int Match(Parser* parser, TokenType type) {
 }
 
 /**
- * @brief Checks if the current token matches the given type and advances
- *        the parser to the next token if it does. If the token does not
- *        Match, prints an error message containing the given message and
- *        exits the program.
+ * @brief Checks that the current token matches the given type. If the token
+ *        does not Match, prints an error message containing the given message
+ *        and exits the program.
+ *
+ * The token is not consumed: callers check its lexeme and then Advance, so
+ * that separators and operators sharing a token type are told apart.
  *
  * @param parser The parser instance
  * @param type The TokenType to Match
  * @param errorMsg An error message to print if the token does not Match
  */
 void Expect(Parser* parser, TokenType type, const char* errorMsg) {
-    if (parser->currentToken.type == type) {
-        Advance(parser);
-    } else {
+    if (parser->currentToken.type != type) {
         fprintf(stderr, "Error: %s. Found '%s'\n", errorMsg, parser->currentToken.lexeme);
         exit(EXIT_FAILURE);
     }
 }
 
-// void ParseExpression(Parser* parser);
-// void ParseStatement(Parser* parser);
+/**
+ * @brief Returns the token after the current one without consuming it
+ *
+ * @param parser The parser instance
+ * @return The next token in the source string, which the caller frees
+ */
+static Token PeekToken(Parser* parser) {
+    int saved = parser->lexer.position;
+    Token next = GetNextToken(&parser->lexer);
+    parser->lexer.position = saved;
+    return next;
+}
+
+/**
+ * @brief Checks if the current token is the given separator
+ *
+ * @param parser The parser instance
+ * @param lexeme The separator to Match
+ *
+ * @return 1 if the token is the separator, 0 if it is not
+ */
+static int MatchSeparator(Parser* parser, const char* lexeme) {
+    return Match(parser, TOKEN_SEPARATOR) && strcmp(parser->currentToken.lexeme, lexeme) == 0;
+}
+
+/**
+ * @brief Maps a type keyword token to the data type it declares
+ *
+ * @param parser The parser instance
+ * @param type Set to the declared type if the current token is a type keyword
+ *
+ * @return 1 if the current token is a type keyword, 0 if it is not
+ */
+static int MatchType(Parser* parser, DataType* type) {
+    switch (parser->currentToken.type) {
+    case TOKEN_INT:
+        *type = INTEGER;
+        return 1;
+    case TOKEN_FLOAT:
+        *type = FLOAT;
+        return 1;
+    case TOKEN_STRING:
+        *type = STRING;
+        return 1;
+    case TOKEN_ARRAY:
+        *type = ARRAY;
+        return 1;
+    case TOKEN_STACK:
+        *type = STACK;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Parses the element type an array or stack type may be followed by, as in 'array float'
+ *
+ * @param parser The parser instance
+ * @param type The type just parsed
+ * @param elementType Set to the element type if one is given
+ *
+ * @return 1 if an element type was given, 0 if it was not
+ */
+static int MatchElementType(Parser* parser, DataType type, DataType* elementType) {
+    if ((type != ARRAY && type != STACK) || !(Match(parser, TOKEN_INT) || Match(parser, TOKEN_FLOAT))) {
+        return 0;
+    }
+    MatchType(parser, elementType);
+    Advance(parser);
+    return 1;
+}
+
+/**
+ * @brief Checks that an array or stack value holds elements of the type it is used as
+ *
+ * Elements are stored as they are, with no tag, so ints cannot be read back
+ * as floats or floats as ints.
+ *
+ * @param parser The parser instance
+ * @param value The value being passed, returned or assigned
+ * @param elementType The element type it must have
+ * @param what What the value becomes, for the error message
+ */
+static void CheckElementType(Parser* parser, TACOperand value, DataType elementType, const char* what) {
+    TACFunction* function = parser->function;
+    DataType type = OperandType(function, value);
+
+    if (value.kind != TAC_OPERAND_VAR || (type != ARRAY && type != STACK)) {
+        return;
+    }
+    if (function->vars[value.value.id].elementType != elementType) {
+        fprintf(stderr, "Error: %s holds %s elements but is given %s of %s.\n", what,
+                elementType == FLOAT ? "float" : "int", type == ARRAY ? "an array" : "a stack",
+                elementType == FLOAT ? "ints" : "floats");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Looks up a variable of the function being parsed, exiting if it is not declared
+ *
+ * @param parser The parser instance
+ * @param name The name of the variable
+ *
+ * @return The TAC id of the variable
+ */
+static int LookUpDeclaredVariable(Parser* parser, const char* name) {
+    int id = LookUpTACVariable(parser->function, name);
+    if (id < 0) {
+        fprintf(stderr, "Error: Variable '%s' is not declared.\n", name);
+        exit(EXIT_FAILURE);
+    }
+    return id;
+}
+
+/**
+ * @brief Emits + or a comparison for equality on two strings
+ *
+ * + joins the strings, and == and != compare their text; a != b is emitted
+ * as a comparison of a streq b with 0.
+ *
+ * @param parser The parser instance
+ * @param op The operation to emit
+ * @param left The left operand
+ * @param right The right operand
+ *
+ * @return The temporary holding the result
+ */
+static TACOperand EmitStringBinary(Parser* parser, TACOpcode op, TACOperand left, TACOperand right) {
+    TACFunction* function = parser->function;
+
+    if (OperandType(function, left) != STRING || OperandType(function, right) != STRING ||
+        (op != TAC_ADD && op != TAC_EQ && op != TAC_NE)) {
+        fprintf(stderr, "Error: Strings can only be joined with + or compared with == and != to strings.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (op == TAC_ADD) {
+        TACOperand result = VarOperand(NewTemp(function, STRING));
+        Emit(function, TAC_CONCAT, left, right, result);
+        return result;
+    }
+
+    TACOperand equal = VarOperand(NewTemp(function, INTEGER));
+    Emit(function, TAC_STREQ, left, right, equal);
+    if (op == TAC_EQ) {
+        return equal;
+    }
+    TACOperand result = VarOperand(NewTemp(function, INTEGER));
+    Emit(function, TAC_EQ, equal, IntOperand(0), result);
+    return result;
+}
+
+/**
+ * @brief Emits a binary operation into a fresh temporary
+ *
+ * Comparisons produce an int; arithmetic produces a float if either side is a
+ * float and takes the type of its left operand otherwise. Operations on
+ * strings are left to EmitStringBinary.
+ *
+ * @param parser The parser instance
+ * @param op The operation to emit
+ * @param left The left operand
+ * @param right The right operand
+ *
+ * @return The temporary holding the result
+ */
+static TACOperand EmitBinary(Parser* parser, TACOpcode op, TACOperand left, TACOperand right) {
+    DataType leftType = OperandType(parser->function, left);
+    DataType rightType = OperandType(parser->function, right);
+    DataType type = leftType;
+
+    if (leftType == STRING || rightType == STRING) {
+        return EmitStringBinary(parser, op, left, right);
+    }
+    if (IsComparisonOp(op)) {
+        type = INTEGER;
+    } else if (leftType == FLOAT || rightType == FLOAT) {
+        type = FLOAT;
+    }
+
+    TACOperand result = VarOperand(NewTemp(parser->function, type));
+    Emit(parser->function, op, left, right, result);
+    return result;
+}
+
+/**
+ * @brief Emits a push of a value onto a stack
+ *
+ * The value is stored as an element of the stack's type, converted if it is
+ * of the other numeric type.
+ *
+ * @param parser The parser instance
+ * @param stack The stack
+ * @param value The value to push
+ */
+static void EmitPush(Parser* parser, TACOperand stack, TACOperand value) {
+    DataType type = OperandType(parser->function, value);
+
+    if (type != INTEGER && type != FLOAT) {
+        fprintf(stderr, "Error: Only ints and floats can be pushed onto a stack.\n");
+        exit(EXIT_FAILURE);
+    }
+    Emit(parser->function, TAC_PUSH, stack, value, NoOperand());
+}
+
+/**
+ * @brief Checks whether a call names one of the operations on a stack
+ */
+static int IsStackOperation(const char* name) {
+    return strcmp(name, "push") == 0 || strcmp(name, "pop") == 0 || strcmp(name, "peek") == 0 ||
+           strcmp(name, "size") == 0;
+}
+
+/**
+ * @brief Emits push, pop, peek or size on the stack passed as the first argument of a call
+ *
+ * pop and peek give a value of the stack's element type and size the number
+ * of elements; push takes the value to push as a second argument and gives
+ * nothing.
+ *
+ * @param parser The parser instance
+ * @param name The operation
+ * @param args The arguments of the call
+ * @param argCount The number of arguments
+ * @param wantResult 1 if the value of the call is used
+ *
+ * @return The temporary holding the result, or an empty operand if the value is not used
+ */
+static TACOperand EmitStackOperation(Parser* parser, const char* name, TACOperand* args, int argCount,
+                                     int wantResult) {
+    TACFunction* function = parser->function;
+    int isPush = strcmp(name, "push") == 0;
+
+    if (argCount != (isPush ? 2 : 1)) {
+        fprintf(stderr, "Error: %s takes %s.\n", name, isPush ? "a stack and a value" : "a stack");
+        exit(EXIT_FAILURE);
+    }
+    if (isPush) {
+        if (wantResult) {
+            fprintf(stderr, "Error: push does not give a value.\n");
+            exit(EXIT_FAILURE);
+        }
+        EmitPush(parser, args[0], args[1]);
+        return NoOperand();
+    }
+
+    TACOpcode op = strcmp(name, "pop") == 0 ? TAC_POP : (strcmp(name, "peek") == 0 ? TAC_PEEK : TAC_STACKSIZE);
+    TACOperand result = NoOperand();
+    if (wantResult) {
+        DataType type = op == TAC_STACKSIZE ? INTEGER : function->vars[args[0].value.id].elementType;
+        result = VarOperand(NewTemp(function, type));
+    }
+    Emit(function, op, args[0], NoOperand(), result);
+    return result;
+}
+
+/**
+ * @brief Checks every call against the definition of its callee, once all functions are parsed
+ *
+ * A call to a function defined further down is parsed before its callee is
+ * known, so its result is taken to be an int and its arguments go
+ * unchecked. Such a call must turn out to return an int, and its array and
+ * stack arguments must hold the element types of the parameters.
+ *
+ * @param parser The parser instance
+ */
+static void CheckCalls(Parser* parser) {
+    TACProgram* program = &parser->program;
+
+    for (int f = 0; f < program->functionCount; f++) {
+        TACFunction* function = &program->functions[f];
+        parser->function = function;
+        for (int i = 0; i < function->count; i++) {
+            TACInstruction* call = &function->code[i];
+            if (call->op != TAC_CALL) {
+                continue;
+            }
+            const char* name = program->strings[call->arg1.value.id];
+            TACFunction* callee = LookUpTACFunction(program, name);
+            if (callee == NULL) {
+                continue;
+            }
+
+            if (call->result.kind == TAC_OPERAND_VAR) {
+                TACVariable* result = &function->vars[call->result.value.id];
+                if (result->type != callee->returnType || result->elementType != callee->returnElementType) {
+                    fprintf(stderr, "Error: '%s' is used before it is defined, so its result is taken to be an int.\n",
+                            name);
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            int argCount = call->arg2.value.intValue;
+            for (int k = 0; k < argCount && k < callee->paramCount; k++) {
+                char what[MAX_NAME_LENGTH + 32];
+                snprintf(what, sizeof(what), "argument %d of '%s'", k + 1, name);
+                CheckElementType(parser, function->code[i - argCount + k].arg1, callee->vars[k].elementType, what);
+            }
+        }
+    }
+    parser->function = NULL;
+}
 
 /**
  * @brief Parses a Zara program
@@ -69,6 +374,8 @@ void ParseProgram(Parser* parser) {
     while (!Match(parser, TOKEN_EOF)) {
         ParseFunction(parser);
     }
+    FreeToken(&parser->currentToken);
+    CheckCalls(parser);
 }
 /**
  * @brief Parses a Zara function
@@ -82,18 +389,15 @@ void ParseProgram(Parser* parser) {
 void ParseFunction(Parser* parser) {
     
     DataType funcType;
-    if (Match(parser, TOKEN_INT)) {
-        funcType = INTEGER;
-    } else if (Match(parser, TOKEN_FLOAT)) {
-        funcType = FLOAT;
-    } else if (Match(parser, TOKEN_STRING)) {
-        funcType = STRING;
-    } else {
+    if (!MatchType(parser, &funcType)) {
         fprintf(stderr, "Error: Expected function return type.\n");
         exit(EXIT_FAILURE);
     }
     Advance(parser);
 
+    DataType returnElementType = INTEGER;
+    MatchElementType(parser, funcType, &returnElementType);
+
     if (!Match(parser, TOKEN_IDENTIFIER)) {
         fprintf(stderr, "Error: Expected function name.\n");
         exit(EXIT_FAILURE);
@@ -102,6 +406,12 @@ void ParseFunction(Parser* parser) {
     strcpy(funcName, parser->currentToken.lexeme);
     Advance(parser);
 
+    if (LookUpTACFunction(&parser->program, funcName) != NULL) {
+        fprintf(stderr, "Error: Function '%s' is already defined.\n", funcName);
+        exit(EXIT_FAILURE);
+    }
+    parser->function = AddTACFunction(&parser->program, funcName, funcType);
+    parser->function->returnElementType = returnElementType;
    
     Expect(parser, TOKEN_SEPARATOR, "Expected '(' after function name");
     if (strcmp(parser->currentToken.lexeme, "(") != 0) {
@@ -139,6 +449,18 @@ void ParseFunction(Parser* parser) {
     }
     Advance(parser);
 
+    // Falling off the end of a function returns a zero value
+    TACFunction* function = parser->function;
+    if (function->count == 0 || function->code[function->count - 1].op != TAC_RETURN) {
+        TACOperand value = NoOperand();
+        if (funcType == INTEGER) {
+            value = IntOperand(0);
+        } else if (funcType == FLOAT) {
+            value = FloatOperand(0.0f);
+        }
+        Emit(function, TAC_RETURN, value, NoOperand(), NoOperand());
+    }
+
     printf("Parsed function: %s\n", funcName);
 }
 
@@ -161,24 +483,22 @@ void ParseParameters(Parser* parser) {
 /**
  * @brief Parses a single parameter in a function definition
  *
- * This function parses the parameter's type and name, and adds it to the symbol table.
+ * This function parses the parameter's type and name, and adds it to the symbol table. An array
+ * or stack parameter may give its element type, as in 'stack float s', and holds ints otherwise.
  *
  * @param parser The parser instance
  */
 void ParseParameter(Parser* parser) {
     DataType paramType;
-    if (Match(parser, TOKEN_INT)) {
-        paramType = INTEGER;
-    } else if (Match(parser, TOKEN_FLOAT)) {
-        paramType = FLOAT;
-    } else if (Match(parser, TOKEN_STRING)) {
-        paramType = STRING;
-    } else {
+    if (!MatchType(parser, &paramType)) {
         fprintf(stderr, "Error: Expected parameter type.\n");
         exit(EXIT_FAILURE);
     }
     Advance(parser);
 
+    DataType elementType = INTEGER;
+    MatchElementType(parser, paramType, &elementType);
+
     if (!Match(parser, TOKEN_IDENTIFIER)) {
         fprintf(stderr, "Error: Expected parameter name.\n");
         exit(EXIT_FAILURE);
@@ -191,6 +511,11 @@ void ParseParameter(Parser* parser) {
         fprintf(stderr, "Error: Failed to add parameter '%s' to symbol table.\n", paramName);
         exit(EXIT_FAILURE);
     }
+
+    int id = AddTACVariable(parser->function, paramName, paramType);
+    parser->function->vars[id].elementType = elementType;
+    parser->function->vars[id].isParam = 1;
+    parser->function->paramCount++;
 }
 
 /**
@@ -204,7 +529,8 @@ void ParseParameter(Parser* parser) {
  */
 
 void ParseStatement(Parser* parser) {
-    if (Match(parser, TOKEN_INT) || Match(parser, TOKEN_FLOAT) || Match(parser, TOKEN_STRING)) {
+    if (Match(parser, TOKEN_INT) || Match(parser, TOKEN_FLOAT) || Match(parser, TOKEN_STRING) || Match(parser, TOKEN_ARRAY) ||
+        Match(parser, TOKEN_STACK)) {
         ParseDeclaration(parser);
     }
     else if (Match(parser, TOKEN_IF)) {
@@ -217,9 +543,10 @@ void ParseStatement(Parser* parser) {
         ParseDoWhileLoop(parser);
     }
     else if (Match(parser, TOKEN_IDENTIFIER)) {
-        Token nextToken = GetNextToken(&parser->lexer);
-        parser->lexer.position -= strlen(nextToken.lexeme);
-        if (strcmp(nextToken.lexeme, "(") == 0) {
+        Token nextToken = PeekToken(parser);
+        int isCall = strcmp(nextToken.lexeme, "(") == 0;
+        FreeToken(&nextToken);
+        if (isCall) {
             ParseFunctionCall(parser);
         }
         else {
@@ -248,25 +575,25 @@ void ParseStatement(Parser* parser) {
  *
  * This function parses a declaration statement, which consists of a type, a variable name, and
  * an optional initializer expression. The type must be one of the basic types (int, float, string),
- * and the variable name must be an identifier. The initializer expression is optional, and if it is
- * not present, the variable is initialized with a default value of 0.
+ * array or stack, and the variable name must be an identifier. The initializer expression is optional, and
+ * if it is not present, the variable is initialized with a default value of 0. Arrays may be
+ * initialized with a brace-enclosed list of expressions. A stack starts out empty, or holding
+ * the values of such a list pushed in order. 'array float a' and 'stack float s' give the
+ * element type; otherwise the elements are floats if the list has one.
  *
  * @param parser The parser instance
  */
 void ParseDeclaration(Parser* parser) {
     DataType declType;
-    if (Match(parser, TOKEN_INT)) {
-        declType = INTEGER;
-    } else if (Match(parser, TOKEN_FLOAT)) {
-        declType = FLOAT;
-    } else if (Match(parser, TOKEN_STRING)) {
-        declType = STRING;
-    } else {
+    if (!MatchType(parser, &declType)) {
         fprintf(stderr, "Error: Unknown declaration type.\n");
         exit(EXIT_FAILURE);
     }
     Advance(parser);
 
+    DataType elementType = INTEGER;
+    int typedElements = MatchElementType(parser, declType, &elementType);
+
     if (!Match(parser, TOKEN_IDENTIFIER)) {
         fprintf(stderr, "Error: Expected variable name in declaration.\n");
         exit(EXIT_FAILURE);
@@ -275,10 +602,25 @@ void ParseDeclaration(Parser* parser) {
     strcpy(varName, parser->currentToken.lexeme);
     Advance(parser);
 
-    void* value = NULL;
+    TACOperand value = NoOperand();
+    TACOperand* elements = NULL;
+    int elementCount = -1;
     if (Match(parser, TOKEN_OPERATOR) && strcmp(parser->currentToken.lexeme, "=") == 0) {
         Advance(parser);
-        ParseExpression(parser);
+        if ((declType == ARRAY || declType == STACK) && MatchSeparator(parser, "{")) {
+            Advance(parser);
+            elementCount = 0;
+            while (!MatchSeparator(parser, "}")) {
+                elements = CheckedRealloc(elements, (elementCount + 1) * sizeof(TACOperand));
+                elements[elementCount++] = ParseExpression(parser);
+                if (MatchSeparator(parser, ",")) {
+                    Advance(parser);
+                }
+            }
+            Advance(parser);
+        } else {
+            value = ParseExpression(parser);
+        }
     }
 
     Expect(parser, TOKEN_SEPARATOR, "Expected ';' after declaration");
@@ -293,6 +635,47 @@ void ParseDeclaration(Parser* parser) {
         exit(EXIT_FAILURE);
     }
 
+    TACFunction* function = parser->function;
+    int id = AddTACVariable(function, varName, declType);
+    TACOperand var = VarOperand(id);
+
+    if ((declType == ARRAY || declType == STACK) && value.kind == TAC_OPERAND_NONE) {
+        if (elementCount < 0) {
+            elementCount = 0;
+        }
+        function->vars[id].elementType = elementType;
+        for (int i = 0; i < elementCount && !typedElements; i++) {
+            if (OperandType(function, elements[i]) == FLOAT) {
+                function->vars[id].elementType = FLOAT;
+            }
+        }
+        if (declType == STACK) {
+            Emit(function, TAC_NEWSTACK, NoOperand(), NoOperand(), var);
+            for (int i = 0; i < elementCount; i++) {
+                EmitPush(parser, var, elements[i]);
+            }
+        } else {
+            Emit(function, TAC_NEWARRAY, IntOperand(elementCount), NoOperand(), var);
+            for (int i = 0; i < elementCount; i++) {
+                Emit(function, TAC_STORE_INDEX, IntOperand(i), elements[i], var);
+            }
+        }
+    } else {
+        if (value.kind == TAC_OPERAND_NONE) {
+            value = declType == FLOAT ? FloatOperand(0.0f) : IntOperand(0);
+            if (declType == STRING) {
+                value = StringOperand(InternString(&parser->program, ""));
+            }
+        } else if ((declType == ARRAY || declType == STACK) && value.kind == TAC_OPERAND_VAR) {
+            function->vars[id].elementType = typedElements ? elementType : function->vars[value.value.id].elementType;
+            char what[MAX_NAME_LENGTH + 32];
+            snprintf(what, sizeof(what), "'%s'", varName);
+            CheckElementType(parser, value, function->vars[id].elementType, what);
+        }
+        Emit(function, TAC_ASSIGN, value, NoOperand(), var);
+    }
+    free(elements);
+
     printf("Declared variable: %s\n", varName);
 }
 
@@ -308,10 +691,45 @@ void ParseDeclaration(Parser* parser) {
  * @param parser The parser instance
  */
 void ParseAssignment(Parser* parser) {
+    ParseAssignmentTarget(parser);
+
+    Expect(parser, TOKEN_SEPARATOR, "Expected ';' after assignment");
+    if (strcmp(parser->currentToken.lexeme, ";") != 0) {
+        fprintf(stderr, "Error: Expected ';' after assignment.\n");
+        exit(EXIT_FAILURE);
+    }
+    Advance(parser);
+}
+
+/**
+ * @brief Parses an assignment without its terminating ';'
+ *
+ * This is the part of an assignment shared by assignment statements and the
+ * increment clause of a for loop. The target is either a variable or an
+ * array element of the form name[index].
+ *
+ * @param parser The parser instance
+ */
+void ParseAssignmentTarget(Parser* parser) {
     char varName[50];
     strcpy(varName, parser->currentToken.lexeme);
+    int id = LookUpDeclaredVariable(parser, varName);
     Advance(parser);
 
+    TACOperand index = NoOperand();
+    int isElement = 0;
+    if (MatchSeparator(parser, "[")) {
+        Advance(parser);
+        index = ParseExpression(parser);
+        Expect(parser, TOKEN_SEPARATOR, "Expected ']' after array index");
+        if (strcmp(parser->currentToken.lexeme, "]") != 0) {
+            fprintf(stderr, "Error: Expected ']'.\n");
+            exit(EXIT_FAILURE);
+        }
+        Advance(parser);
+        isElement = 1;
+    }
+
     Expect(parser, TOKEN_OPERATOR, "Expected '=' in assignment");
     if (strcmp(parser->currentToken.lexeme, "=") != 0) {
         fprintf(stderr, "Error: Expected '=' in assignment.\n");
@@ -319,14 +737,16 @@ void ParseAssignment(Parser* parser) {
     }
     Advance(parser);
 
-    ParseExpression(parser);
+    TACOperand value = ParseExpression(parser);
 
-    Expect(parser, TOKEN_SEPARATOR, "Expected ';' after assignment");
-    if (strcmp(parser->currentToken.lexeme, ";") != 0) {
-        fprintf(stderr, "Error: Expected ';' after assignment.\n");
-        exit(EXIT_FAILURE);
+    if (isElement) {
+        Emit(parser->function, TAC_STORE_INDEX, index, value, VarOperand(id));
+    } else {
+        char what[MAX_NAME_LENGTH + 32];
+        snprintf(what, sizeof(what), "'%s'", varName);
+        CheckElementType(parser, value, parser->function->vars[id].elementType, what);
+        Emit(parser->function, TAC_ASSIGN, value, NoOperand(), VarOperand(id));
     }
-    Advance(parser);
 
     printf("Assigned to variable: %s\n", varName);
 }
@@ -356,7 +776,7 @@ void ParseIfStatement(Parser* parser) {
     }
     Advance(parser);
 
-    ParseExpression(parser);
+    TACOperand cond = ParseExpression(parser);
     Expect(parser, TOKEN_SEPARATOR, "Expected ')' after condition");
     if (strcmp(parser->currentToken.lexeme, ")") != 0) {
         fprintf(stderr, "Error: Expected ')'.\n");
@@ -364,11 +784,21 @@ void ParseIfStatement(Parser* parser) {
     }
     Advance(parser);
 
+    TACFunction* function = parser->function;
+    int labelElse = NewLabel(function);
+    Emit(function, TAC_IFFALSE, cond, NoOperand(), LabelOperand(labelElse));
+
     ParseStatement(parser);
 
     if (Match(parser, TOKEN_ELSE)) {
-        Advance(parser); 
+        Advance(parser);
+        int labelEnd = NewLabel(function);
+        Emit(function, TAC_GOTO, NoOperand(), NoOperand(), LabelOperand(labelEnd));
+        Emit(function, TAC_LABEL, NoOperand(), NoOperand(), LabelOperand(labelElse));
         ParseStatement(parser);
+        Emit(function, TAC_LABEL, NoOperand(), NoOperand(), LabelOperand(labelEnd));
+    } else {
+        Emit(function, TAC_LABEL, NoOperand(), NoOperand(), LabelOperand(labelElse));
     }
 
     printf("Parsed if statement.\n");
@@ -383,6 +813,9 @@ void ParseIfStatement(Parser* parser) {
  * The initialization, condition, and increment expressions are expected to be valid
  * expressions. The loop body is expected to be a valid statement.
  *
+ * The loop is lowered as a top-tested loop: the condition is checked at a
+ * label before every iteration and the increment runs at the end of the body.
+ *
  * @param parser The parser instance
  */
 void ParseForLoop(Parser* parser) {
@@ -402,10 +835,18 @@ void ParseForLoop(Parser* parser) {
 
     if (Match(parser, TOKEN_INT) || Match(parser, TOKEN_FLOAT) || Match(parser, TOKEN_STRING) || Match(parser, TOKEN_IDENTIFIER)) {
         ParseStatement(parser);
+    } else if (MatchSeparator(parser, ";")) {
+        Advance(parser);
     }
 
+    TACFunction* function = parser->function;
+    int labelCond = NewLabel(function);
+    int labelEnd = NewLabel(function);
+    Emit(function, TAC_LABEL, NoOperand(), NoOperand(), LabelOperand(labelCond));
+
     if (!Match(parser, TOKEN_SEPARATOR) || strcmp(parser->currentToken.lexeme, ";") != 0) {
-        ParseExpression(parser);
+        TACOperand cond = ParseExpression(parser);
+        Emit(function, TAC_IFFALSE, cond, NoOperand(), LabelOperand(labelEnd));
     }
     Expect(parser, TOKEN_SEPARATOR, "Expected ';' after for-loop condition");
     if (strcmp(parser->currentToken.lexeme, ";") != 0) {
@@ -414,9 +855,11 @@ void ParseForLoop(Parser* parser) {
     }
     Advance(parser);
 
+    int stepStart = function->count;
     if (!Match(parser, TOKEN_SEPARATOR) || strcmp(parser->currentToken.lexeme, ")") != 0) {
-        ParseAssignment(parser);
+        ParseAssignmentTarget(parser);
     }
+    int stepEnd = function->count;
 
     Expect(parser, TOKEN_SEPARATOR, "Expected ')' after for-loop increment");
     if (strcmp(parser->currentToken.lexeme, ")") != 0) {
@@ -427,6 +870,11 @@ void ParseForLoop(Parser* parser) {
 
     ParseStatement(parser);
 
+    // The increment was emitted before the body; move it after
+    MoveInstructionsToEnd(function, stepStart, stepEnd);
+    Emit(function, TAC_GOTO, NoOperand(), NoOperand(), LabelOperand(labelCond));
+    Emit(function, TAC_LABEL, NoOperand(), NoOperand(), LabelOperand(labelEnd));
+
     printf("Parsed for loop.\n");
 }
 
@@ -447,6 +895,10 @@ void ParseDoWhileLoop(Parser* parser) {
     }
     Advance(parser);
 
+    TACFunction* function = parser->function;
+    int labelBody = NewLabel(function);
+    Emit(function, TAC_LABEL, NoOperand(), NoOperand(), LabelOperand(labelBody));
+
     ParseStatement(parser);
 
     Expect(parser, TOKEN_WHILE, "Expected 'while' after 'do' loop body");
@@ -463,7 +915,8 @@ void ParseDoWhileLoop(Parser* parser) {
     }
     Advance(parser);
 
-    ParseExpression(parser);
+    TACOperand cond = ParseExpression(parser);
+    Emit(function, TAC_IF, cond, NoOperand(), LabelOperand(labelBody));
 
     Expect(parser, TOKEN_SEPARATOR, "Expected ')' after condition");
     if (strcmp(parser->currentToken.lexeme, ")") != 0) {
@@ -495,6 +948,35 @@ void ParseDoWhileLoop(Parser* parser) {
 void ParseFunctionCall(Parser* parser) {
     char funcName[50];
     strcpy(funcName, parser->currentToken.lexeme);
+
+    ParseCall(parser, 0);
+
+    Expect(parser, TOKEN_SEPARATOR, "Expected ';' after function call");
+    if (strcmp(parser->currentToken.lexeme, ";") != 0) {
+        fprintf(stderr, "Error: Expected ';' after function call.\n");
+        exit(EXIT_FAILURE);
+    }
+    Advance(parser);
+
+    printf("Parsed function call: %s\n", funcName);
+}
+
+/**
+ * @brief Parses a call and emits its TAC
+ *
+ * Every argument is evaluated before the first 'param' is emitted, so the
+ * params of a call always form one contiguous run right before the 'call'.
+ * push, pop, peek and size on a stack are not calls, and become the stack
+ * operations themselves.
+ *
+ * @param parser The parser instance
+ * @param wantResult 1 if the value of the call is used, 0 for a call statement
+ *
+ * @return The temporary holding the result, or an empty operand for a call statement
+ */
+TACOperand ParseCall(Parser* parser, int wantResult) {
+    char funcName[50];
+    strcpy(funcName, parser->currentToken.lexeme);
     Advance(parser);
 
     Expect(parser, TOKEN_SEPARATOR, "Expected '(' in function call");
@@ -504,11 +986,15 @@ void ParseFunctionCall(Parser* parser) {
     }
     Advance(parser);
 
+    TACOperand* args = NULL;
+    int argCount = 0;
     if (!Match(parser, TOKEN_SEPARATOR) || strcmp(parser->currentToken.lexeme, ")") != 0) {
-        ParseExpression(parser);
+        args = CheckedRealloc(args, (argCount + 1) * sizeof(TACOperand));
+        args[argCount++] = ParseExpression(parser);
         while (Match(parser, TOKEN_SEPARATOR) && strcmp(parser->currentToken.lexeme, ",") == 0) {
             Advance(parser); // Skip ','
-            ParseExpression(parser);
+            args = CheckedRealloc(args, (argCount + 1) * sizeof(TACOperand));
+            args[argCount++] = ParseExpression(parser);
         }
     }
 
@@ -519,14 +1005,33 @@ void ParseFunctionCall(Parser* parser) {
     }
     Advance(parser);
 
-    Expect(parser, TOKEN_SEPARATOR, "Expected ';' after function call");
-    if (strcmp(parser->currentToken.lexeme, ";") != 0) {
-        fprintf(stderr, "Error: Expected ';' after function call.\n");
-        exit(EXIT_FAILURE);
+    TACFunction* function = parser->function;
+    if (argCount > 0 && OperandType(function, args[0]) == STACK && IsStackOperation(funcName)) {
+        TACOperand result = EmitStackOperation(parser, funcName, args, argCount, wantResult);
+        free(args);
+        return result;
     }
-    Advance(parser);
 
-    printf("Parsed function call: %s\n", funcName);
+    TACFunction* callee = LookUpTACFunction(&parser->program, funcName);
+    for (int i = 0; i < argCount; i++) {
+        if (callee != NULL && i < callee->paramCount) {
+            char what[MAX_NAME_LENGTH + 32];
+            snprintf(what, sizeof(what), "argument %d of '%s'", i + 1, funcName);
+            CheckElementType(parser, args[i], callee->vars[i].elementType, what);
+        }
+        Emit(function, TAC_PARAM, args[i], NoOperand(), NoOperand());
+    }
+    free(args);
+
+    TACOperand result = NoOperand();
+    if (wantResult) {
+        int temp = NewTemp(function, callee != NULL ? callee->returnType : INTEGER);
+        function->vars[temp].elementType = callee != NULL ? callee->returnElementType : INTEGER;
+        result = VarOperand(temp);
+    }
+    Emit(function, TAC_CALL, FunctionOperand(InternString(&parser->program, funcName)), IntOperand(argCount), result);
+
+    return result;
 }
 
 /**
@@ -546,8 +1051,9 @@ void ParseReturnStatement(Parser* parser) {
     }
     Advance(parser);
 
+    TACOperand value = NoOperand();
     if (!Match(parser, TOKEN_SEPARATOR) || strcmp(parser->currentToken.lexeme, ";") != 0) {
-        ParseExpression(parser);
+        value = ParseExpression(parser);
     }
 
     Expect(parser, TOKEN_SEPARATOR, "Expected ';' after return statement");
@@ -557,23 +1063,68 @@ void ParseReturnStatement(Parser* parser) {
     }
     Advance(parser);
 
+    char what[MAX_NAME_LENGTH + 32];
+    snprintf(what, sizeof(what), "the result of '%s'", parser->function->name);
+    CheckElementType(parser, value, parser->function->returnElementType, what);
+    Emit(parser->function, TAC_RETURN, value, NoOperand(), NoOperand());
+
     printf("Parsed return statement.\n");
 }
 
 /**
  * @brief Parses an expression in a statement
  *
- * This function parses an expression, which consists of one or more terms separated by
- * '+' or '-' operators. Each term is parsed by calling ParseTerm.
+ * This function parses an expression, which is an arithmetic expression
+ * optionally compared against a second one with '<', '<=', '>', '>=', '=='
+ * or '!='. Comparisons evaluate to 1 or 0.
+ *
+ * @param parser The parser instance
+ *
+ * @return The operand holding the value of the expression
+ */
+TACOperand ParseExpression(Parser* parser) {
+    TACOperand left = ParseArithmetic(parser);
+
+    if (Match(parser, TOKEN_OPERATOR)) {
+        static const struct {
+            const char* lexeme;
+            TACOpcode op;
+        } comparisons[] = {
+            {"<", TAC_LT}, {"<=", TAC_LE}, {">", TAC_GT},
+            {">=", TAC_GE}, {"==", TAC_EQ}, {"!=", TAC_NE}
+        };
+
+        for (int i = 0; i < (int)(sizeof(comparisons) / sizeof(comparisons[0])); i++) {
+            if (strcmp(parser->currentToken.lexeme, comparisons[i].lexeme) == 0) {
+                Advance(parser); // Skip the comparison operator
+                TACOperand right = ParseArithmetic(parser);
+                return EmitBinary(parser, comparisons[i].op, left, right);
+            }
+        }
+    }
+
+    return left;
+}
+
+/**
+ * @brief Parses an arithmetic expression
+ *
+ * This function parses one or more terms separated by '+' or '-' operators.
+ * Each term is parsed by calling ParseTerm.
  *
  * @param parser The parser instance
+ *
+ * @return The operand holding the value of the expression
  */
-void ParseExpression(Parser* parser) {
-    ParseTerm(parser);
+TACOperand ParseArithmetic(Parser* parser) {
+    TACOperand left = ParseTerm(parser);
     while (Match(parser, TOKEN_OPERATOR) && (strcmp(parser->currentToken.lexeme, "+") == 0 || strcmp(parser->currentToken.lexeme, "-") == 0)) {
+        TACOpcode op = parser->currentToken.lexeme[0] == '+' ? TAC_ADD : TAC_SUB;
         Advance(parser); // Skip '+' or '-'
-        ParseTerm(parser);
+        TACOperand right = ParseTerm(parser);
+        left = EmitBinary(parser, op, left, right);
     }
+    return left;
 }
 
 /**
@@ -583,46 +1134,91 @@ void ParseExpression(Parser* parser) {
  * '*' or '/' or '%' operators. Each factor is parsed by calling ParseFactor.
  *
  * @param parser The parser instance
+ *
+ * @return The operand holding the value of the term
  */
-void ParseTerm(Parser* parser) {
-    ParseFactor(parser);
+TACOperand ParseTerm(Parser* parser) {
+    TACOperand left = ParseFactor(parser);
     while (Match(parser, TOKEN_OPERATOR) && (strcmp(parser->currentToken.lexeme, "*") == 0 || strcmp(parser->currentToken.lexeme, "/") == 0 || strcmp(parser->currentToken.lexeme, "%") == 0)) {
+        char symbol = parser->currentToken.lexeme[0];
+        TACOpcode op = symbol == '*' ? TAC_MUL : (symbol == '/' ? TAC_DIV : TAC_MOD);
         Advance(parser); // Skip '*', '/', '%'
-        ParseFactor(parser);
+        TACOperand right = ParseFactor(parser);
+        left = EmitBinary(parser, op, left, right);
     }
+    return left;
 }
 
 /**
  * @brief Parses a factor in an expression
  *
  * This function parses a factor, which consists of an expression enclosed in
- * parentheses, a variable name, a number, or a string literal. If the factor
- * is an expression enclosed in parentheses, ParseExpression is called to parse
- * the expression. If the factor is a variable name, it is parsed by calling
- * ParseIdentifier. If the factor is a number or a string literal, it is
- * parsed by calling ParseNumber or ParseStringLiteral, respectively.
+ * parentheses, a variable name, an array element, a function call, a number,
+ * or a string literal. Constants are returned as immediate operands rather
+ * than being copied into a temporary.
  *
  * @param parser The parser instance
+ *
+ * @return The operand holding the value of the factor
  */
-void ParseFactor(Parser* parser) {
+TACOperand ParseFactor(Parser* parser) {
     if (Match(parser, TOKEN_SEPARATOR) && strcmp(parser->currentToken.lexeme, "(") == 0) {
-        Advance(parser); 
-        ParseExpression(parser);
+        Advance(parser);
+        TACOperand value = ParseExpression(parser);
         Expect(parser, TOKEN_SEPARATOR, "Expected ')' after expression");
         if (strcmp(parser->currentToken.lexeme, ")") != 0) {
             fprintf(stderr, "Error: Expected ')'.\n");
             exit(EXIT_FAILURE);
         }
         Advance(parser);
+        return value;
     }
     else if (Match(parser, TOKEN_IDENTIFIER)) {
+        Token nextToken = PeekToken(parser);
+        int isCall = strcmp(nextToken.lexeme, "(") == 0;
+        FreeToken(&nextToken);
+        if (isCall) {
+            return ParseCall(parser, 1);
+        }
+
+        int id = LookUpDeclaredVariable(parser, parser->currentToken.lexeme);
         Advance(parser);
+
+        if (MatchSeparator(parser, "[")) {
+            Advance(parser);
+            TACOperand index = ParseExpression(parser);
+            Expect(parser, TOKEN_SEPARATOR, "Expected ']' after array index");
+            if (strcmp(parser->currentToken.lexeme, "]") != 0) {
+                fprintf(stderr, "Error: Expected ']'.\n");
+                exit(EXIT_FAILURE);
+            }
+            Advance(parser);
+
+            TACFunction* function = parser->function;
+            TACOperand element = VarOperand(NewTemp(function, function->vars[id].elementType));
+            Emit(function, TAC_LOAD_INDEX, VarOperand(id), index, element);
+            return element;
+        }
+
+        return VarOperand(id);
     }
-    else if (Match(parser, TOKEN_NUMBER) || Match(parser, TOKEN_FLOAT) || Match(parser, TOKEN_STRING_LITERAL)) {
+    else if (Match(parser, TOKEN_NUMBER)) {
+        TACOperand value;
+        if (strchr(parser->currentToken.lexeme, '.') != NULL) {
+            value = FloatOperand((float)atof(parser->currentToken.lexeme));
+        } else {
+            value = IntOperand(atoi(parser->currentToken.lexeme));
+        }
         Advance(parser);
+        return value;
+    }
+    else if (Match(parser, TOKEN_STRING_LITERAL)) {
+        TACOperand value = StringOperand(InternString(&parser->program, parser->currentToken.lexeme));
+        Advance(parser);
+        return value;
     }
     else {
         fprintf(stderr, "Error: Unexpected token '%s' in expression.\n", parser->currentToken.lexeme);
         exit(EXIT_FAILURE);
     }
-}
\ No newline at end of file
+}
@@ -5,11 +5,14 @@
 
 #include "lexer.h"
 #include "symbol.h"
+#include "tac.h"
 
 typedef struct {
     Lexer lexer;
     Token currentToken;
     SymbolTable symbolTable;
+    TACProgram program;
+    TACFunction* function;
 } Parser;
 
 
@@ -24,11 +27,14 @@ void ParseParameter(Parser* parser);
 void ParseStatement(Parser* parser);
 void ParseDeclaration(Parser* parser);
 void ParseAssignment(Parser* parser);
+void ParseAssignmentTarget(Parser* parser);
 void ParseIfStatement(Parser* parser);
 void ParseForLoop(Parser* parser);
 void ParseDoWhileLoop(Parser* parser);
 void ParseFunctionCall(Parser* parser);
 void ParseReturnStatement(Parser* parser);
-void ParseExpression(Parser* parser);
-void ParseTerm(Parser* parser);
-void ParseFactor(Parser* parser);
\ No newline at end of file
+TACOperand ParseCall(Parser* parser, int wantResult);
+TACOperand ParseExpression(Parser* parser);
+TACOperand ParseArithmetic(Parser* parser);
+TACOperand ParseTerm(Parser* parser);
+TACOperand ParseFactor(Parser* parser);
@@ -0,0 +1,743 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "x86.h"
+
+// A set of registers, one bit each, with the flags as one more
+typedef unsigned long long RegisterSet;
+
+#define REGISTER_BIT(reg) (1ULL << (reg))
+#define FLAGS_BIT (1ULL << (REG_RIP + 1))
+#define XMM_BITS (0xffffULL << REG_XMM0)
+
+// Registers a call reads its arguments from
+#define ARGUMENT_REGISTERS (REGISTER_BIT(REG_RDI) | REGISTER_BIT(REG_RSI) | REGISTER_BIT(REG_RDX) | \
+                            REGISTER_BIT(REG_RCX) | REGISTER_BIT(REG_R8) | REGISTER_BIT(REG_R9) | \
+                            (0xffULL << REG_XMM0))
+
+// Registers a call may leave anything in
+#define CALLER_SAVED (REGISTER_BIT(REG_RAX) | REGISTER_BIT(REG_RCX) | REGISTER_BIT(REG_RDX) | \
+                      REGISTER_BIT(REG_RSI) | REGISTER_BIT(REG_RDI) | REGISTER_BIT(REG_R8) | \
+                      REGISTER_BIT(REG_R9) | REGISTER_BIT(REG_R10) | REGISTER_BIT(REG_R11) | \
+                      XMM_BITS | FLAGS_BIT)
+
+// Registers the caller still looks at once a function returns
+#define RETURN_LIVE (REGISTER_BIT(REG_RAX) | REGISTER_BIT(REG_XMM0) | REGISTER_BIT(REG_RBX) | \
+                     REGISTER_BIT(REG_RSP) | REGISTER_BIT(REG_RBP) | REGISTER_BIT(REG_R12) | \
+                     REGISTER_BIT(REG_R13) | REGISTER_BIT(REG_R14) | REGISTER_BIT(REG_R15))
+
+// How many instructions a liveness query may look through before giving up and calling it live
+#define LIVENESS_BUDGET 256
+
+// The most instructions any rule looks at, so the window backs up this far after a rewrite
+#define MAX_WINDOW 4
+
+typedef struct {
+    MachineFunction* function;
+    int* labelIndex;   // Label -> the instruction defining it, -1 if none does
+    int* labelUses;    // Label -> the number of jumps to it
+} Peephole;
+
+typedef struct {
+    const char* name;
+    int window;        // The number of instructions the rule looks at
+    int (*apply)(Peephole* peephole, int at);
+} PeepholeRule;
+
+static void IndexLabels(Peephole* peephole) {
+    MachineFunction* function = peephole->function;
+
+    for (int l = 0; l < function->labelCount; l++) {
+        peephole->labelIndex[l] = -1;
+        peephole->labelUses[l] = 0;
+    }
+    for (int i = 0; i < function->count; i++) {
+        MachineInstr* instr = &function->code[i];
+        if (instr->op == X86_LABEL) {
+            peephole->labelIndex[instr->src.symbol] = i;
+        } else if ((instr->op == X86_JMP || instr->op == X86_JCC) && instr->src.kind == MOP_LABEL) {
+            peephole->labelUses[instr->src.symbol]++;
+        }
+    }
+}
+
+static void DeleteInstrs(Peephole* peephole, int at, int count) {
+    MachineFunction* function = peephole->function;
+
+    memmove(&function->code[at], &function->code[at + count],
+            (function->count - at - count) * sizeof(MachineInstr));
+    function->count -= count;
+}
+
+/**
+ * @brief Finds the first instruction at or after an index that is not a label
+ *
+ * @return Its index, or the instruction count if only labels follow
+ */
+static int SkipLabels(const MachineFunction* function, int at) {
+    while (at < function->count && function->code[at].op == X86_LABEL) {
+        at++;
+    }
+    return at;
+}
+
+/**
+ * @brief Checks whether a label is defined between an index and the next instruction that is not a label
+ */
+static int LabelFollows(const Peephole* peephole, int at, int label) {
+    int index = peephole->labelIndex[label];
+    return index >= at && index < SkipLabels(peephole->function, at);
+}
+
+/**
+ * @brief Gets the registers reading an operand touches: the register itself, or those forming an address
+ */
+static RegisterSet OperandRegisters(MachineOperand operand) {
+    RegisterSet set = 0;
+
+    if (operand.kind == MOP_REG) {
+        set |= REGISTER_BIT(operand.reg);
+    } else if (operand.kind == MOP_MEM) {
+        if (operand.reg != REG_RIP) {
+            set |= REGISTER_BIT(operand.reg);
+        }
+        if (operand.index >= 0) {
+            set |= REGISTER_BIT(operand.index);
+        }
+    }
+    return set;
+}
+
+/**
+ * @brief Gets the registers an operand written to changes
+ */
+static RegisterSet WrittenRegisters(MachineOperand operand) {
+    return operand.kind == MOP_REG ? REGISTER_BIT(operand.reg) : 0;
+}
+
+/**
+ * @brief Works out which registers and flags an instruction reads and writes
+ *
+ * Jumps, calls and returns are left to the caller, which follows them.
+ * Partial writes, like setcc to a byte register, count as reads too.
+ */
+static void InstrEffects(const MachineInstr* instr, RegisterSet* reads, RegisterSet* writes) {
+    RegisterSet src = OperandRegisters(instr->src);
+    RegisterSet dst = OperandRegisters(instr->dst);
+    RegisterSet address = instr->dst.kind == MOP_MEM ? dst : 0;
+
+    switch (instr->op) {
+    case X86_MOV:
+    case X86_MOVZB:
+    case X86_MOVSXD:
+    case X86_LEA:
+    case X86_MOVD:
+    case X86_CVTTSS2SI:
+    case X86_MOVUPS:
+    case X86_CVTDQ2PS:
+        *reads = src | address;
+        *writes = WrittenRegisters(instr->dst);
+        break;
+    case X86_MOVSS:
+    case X86_CVTSI2SS:
+        // Both keep the upper lanes of an xmm destination, except movss from memory
+        *reads = src | (instr->op == X86_CVTSI2SS || instr->src.kind == MOP_REG ? dst : address);
+        *writes = WrittenRegisters(instr->dst);
+        break;
+    case X86_ADD:
+    case X86_SUB:
+    case X86_IMUL:
+    case X86_AND:
+    case X86_OR:
+    case X86_XOR:
+        *reads = src | dst;
+        *writes = WrittenRegisters(instr->dst) | FLAGS_BIT;
+        break;
+    case X86_CMP:
+    case X86_TEST:
+    case X86_UCOMISS:
+        *reads = src | dst;
+        *writes = FLAGS_BIT;
+        break;
+    case X86_ADDSS:
+    case X86_SUBSS:
+    case X86_MULSS:
+    case X86_DIVSS:
+    case X86_PUNPCKLDQ:
+    case X86_PUNPCKLQDQ:
+    case X86_PADDD:
+    case X86_PSUBD:
+    case X86_PMULLD:
+    case X86_ADDPS:
+    case X86_SUBPS:
+    case X86_MULPS:
+    case X86_DIVPS:
+        *reads = src | dst;
+        *writes = WrittenRegisters(instr->dst);
+        break;
+    case X86_CDQ:
+        *reads = REGISTER_BIT(REG_RAX);
+        *writes = REGISTER_BIT(REG_RDX);
+        break;
+    case X86_IDIV:
+        *reads = src | REGISTER_BIT(REG_RAX) | REGISTER_BIT(REG_RDX);
+        *writes = REGISTER_BIT(REG_RAX) | REGISTER_BIT(REG_RDX) | FLAGS_BIT;
+        break;
+    case X86_SETCC:
+        *reads = dst | FLAGS_BIT;
+        *writes = WrittenRegisters(instr->dst);
+        break;
+    case X86_JCC:
+        *reads = FLAGS_BIT;
+        *writes = 0;
+        break;
+    case X86_PUSH:
+        *reads = src | REGISTER_BIT(REG_RSP);
+        *writes = REGISTER_BIT(REG_RSP);
+        break;
+    case X86_POP:
+        *reads = REGISTER_BIT(REG_RSP) | address;
+        *writes = WrittenRegisters(instr->dst) | REGISTER_BIT(REG_RSP);
+        break;
+    default:
+        *reads = 0;
+        *writes = 0;
+        break;
+    }
+}
+
+/**
+ * @brief Checks whether any of a set of registers may be read, from an instruction on, before being written
+ *
+ * Follows jumps to their labels and both ways out of conditional ones. It
+ * answers yes whenever it cannot tell: on a jump out of the function, or
+ * once it has looked at more instructions than the budget allows.
+ *
+ * @param peephole The pass
+ * @param at The first instruction to look at
+ * @param regs The registers, and FLAGS_BIT for the flags
+ * @param budget The instructions left to look at, shared by every path followed
+ */
+static int IsLive(const Peephole* peephole, int at, RegisterSet regs, int* budget) {
+    const MachineFunction* function = peephole->function;
+
+    for (int i = at; regs != 0; i++) {
+        if (i >= function->count || --*budget < 0) {
+            return 1;
+        }
+
+        const MachineInstr* instr = &function->code[i];
+        RegisterSet reads;
+        RegisterSet writes;
+        switch (instr->op) {
+        case X86_LABEL:
+            break;
+        case X86_JMP:
+            if (instr->src.kind != MOP_LABEL) {
+                return 1;
+            }
+            i = peephole->labelIndex[instr->src.symbol];
+            break;
+        case X86_JCC:
+            if ((regs & FLAGS_BIT) || IsLive(peephole, peephole->labelIndex[instr->src.symbol], regs, budget)) {
+                return 1;
+            }
+            break;
+        case X86_RET:
+            return (regs & RETURN_LIVE) != 0;
+        case X86_CALL:
+            if (regs & ARGUMENT_REGISTERS) {
+                return 1;
+            }
+            regs &= ~CALLER_SAVED;
+            break;
+        default:
+            InstrEffects(instr, &reads, &writes);
+            if (reads & regs) {
+                return 1;
+            }
+            regs &= ~writes;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int IsDead(const Peephole* peephole, int at, RegisterSet regs) {
+    int budget = LIVENESS_BUDGET;
+    return !IsLive(peephole, at, regs, &budget);
+}
+
+static int IsGeneralRegister(MachineOperand operand) {
+    return operand.kind == MOP_REG && operand.reg < REG_XMM0;
+}
+
+// Plain copies: general-purpose ones of 4 or 8 bytes, and scalar floats
+static int IsCopy(const MachineInstr* instr) {
+    return (instr->op == X86_MOV && instr->size != 1) || instr->op == X86_MOVSS;
+}
+
+/**
+ * @brief mov %r, %r copies a register onto itself
+ */
+static int RemoveSelfMove(Peephole* peephole, int at) {
+    MachineInstr* instr = &peephole->function->code[at];
+
+    if (!IsCopy(instr) || instr->src.kind != MOP_REG || !SameMachineOperand(instr->src, instr->dst)) {
+        return 0;
+    }
+    DeleteInstrs(peephole, at, 1);
+    return 1;
+}
+
+/**
+ * @brief mov %r, M; mov M, %s reloads what was just stored, so copy %r to %s instead
+ */
+static int ForwardStore(Peephole* peephole, int at) {
+    MachineInstr* store = &peephole->function->code[at];
+    MachineInstr* load = store + 1;
+
+    if (!IsCopy(store) || store->dst.kind != MOP_MEM || (store->src.kind != MOP_REG && store->src.kind != MOP_IMM) ||
+        load->op != store->op || load->size != store->size || load->dst.kind != MOP_REG ||
+        !SameMachineOperand(load->src, store->dst)) {
+        return 0;
+    }
+    if (SameMachineOperand(store->src, load->dst)) {
+        DeleteInstrs(peephole, at + 1, 1);
+    } else {
+        load->src = store->src;
+    }
+    return 1;
+}
+
+/**
+ * @brief mov M, %r; mov %r, M stores back what was just loaded
+ */
+static int RemoveStoreBack(Peephole* peephole, int at) {
+    MachineInstr* load = &peephole->function->code[at];
+    MachineInstr* store = load + 1;
+
+    if (!IsCopy(load) || load->src.kind != MOP_MEM || load->dst.kind != MOP_REG || store->op != load->op ||
+        store->size != load->size || !SameMachineOperand(store->src, load->dst) ||
+        !SameMachineOperand(store->dst, load->src) || (OperandRegisters(load->src) & REGISTER_BIT(load->dst.reg))) {
+        return 0;
+    }
+    DeleteInstrs(peephole, at + 1, 1);
+    return 1;
+}
+
+/**
+ * @brief mov A, M; mov B, M overwrites the first store before anything reads it
+ */
+static int RemoveDeadStore(Peephole* peephole, int at) {
+    MachineInstr* first = &peephole->function->code[at];
+    MachineInstr* second = first + 1;
+
+    if (!IsCopy(first) || first->dst.kind != MOP_MEM || second->op != first->op || second->size != first->size ||
+        !SameMachineOperand(second->dst, first->dst) || second->src.kind == MOP_MEM) {
+        return 0;
+    }
+    DeleteInstrs(peephole, at, 1);
+    return 1;
+}
+
+/**
+ * @brief Checks whether an instruction can take a copy's source in place of the register it was copied to
+ */
+static int CanForwardCopy(const MachineInstr* copy, const MachineInstr* use) {
+    MachineOperand source = copy->src;
+    int memoryDst = use->dst.kind == MOP_MEM;
+
+    if (copy->op == X86_MOVSS) {
+        switch (use->op) {
+        case X86_MOVSS:
+            return !(source.kind == MOP_MEM && memoryDst);
+        case X86_ADDSS:
+        case X86_SUBSS:
+        case X86_MULSS:
+        case X86_DIVSS:
+        case X86_UCOMISS:
+            return 1;
+        default:
+            return 0;
+        }
+    }
+
+    switch (use->op) {
+    case X86_MOV:
+    case X86_ADD:
+    case X86_SUB:
+    case X86_AND:
+    case X86_OR:
+    case X86_XOR:
+    case X86_CMP:
+        return use->size == copy->size && !(source.kind == MOP_MEM && memoryDst);
+    case X86_IMUL:
+        return use->size == copy->size && source.kind != MOP_IMM;
+    case X86_MOVSXD:
+        return copy->size == 4 && source.kind != MOP_IMM;
+    case X86_CVTSI2SS:
+        return use->size == copy->size && source.kind != MOP_IMM;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief mov S, %r; op %r, D with %r dead afterwards becomes op S, D
+ *
+ * Collapses the chains of moves lowering leaves between a value's home
+ * and the instruction that uses it.
+ */
+static int ForwardCopy(Peephole* peephole, int at) {
+    MachineInstr* copy = &peephole->function->code[at];
+    MachineInstr* use = copy + 1;
+
+    if (!IsCopy(copy) || copy->dst.kind != MOP_REG || !SameMachineOperand(use->src, copy->dst) ||
+        (OperandRegisters(use->dst) & REGISTER_BIT(copy->dst.reg)) || !CanForwardCopy(copy, use) ||
+        !IsDead(peephole, at + 2, REGISTER_BIT(copy->dst.reg))) {
+        return 0;
+    }
+    use->src = copy->src;
+    DeleteInstrs(peephole, at, 1);
+    return 1;
+}
+
+/**
+ * @brief mov $0, %r becomes the shorter xor %r, %r when nothing reads the flags it clobbers
+ */
+static int ZeroWithXor(Peephole* peephole, int at) {
+    MachineInstr* instr = &peephole->function->code[at];
+
+    if (instr->op != X86_MOV || instr->size == 1 || instr->src.kind != MOP_IMM || instr->src.value != 0 ||
+        !IsGeneralRegister(instr->dst) || !IsDead(peephole, at + 1, FLAGS_BIT)) {
+        return 0;
+    }
+    instr->op = X86_XOR;
+    instr->size = 4;
+    instr->src = instr->dst;
+    return 1;
+}
+
+/**
+ * @brief Builds the address base + index * scale + disp, keeping rsp out of the index, which cannot hold it
+ *
+ * @return Whether the address can be encoded
+ */
+static int MakeAddress(int base, int index, int scale, long long disp, MachineOperand* address) {
+    if (index == REG_RSP && scale == 1) {
+        index = base;
+        base = REG_RSP;
+    }
+    if (index == REG_RSP || disp != (int)disp) {
+        return 0;
+    }
+    *address = index < 0 ? MemOperand(base, disp) : IndexedOperand(base, index, scale, disp);
+    return 1;
+}
+
+/**
+ * @brief Turns an instruction into lea address, %r
+ */
+static void MakeLea(MachineInstr* instr, int size, MachineOperand address, int reg) {
+    instr->op = X86_LEA;
+    instr->size = size;
+    instr->src = address;
+    instr->dst = RegOperand(reg);
+}
+
+/**
+ * @brief mov %a, %r; add X, %r becomes lea X(%a), %r or lea (%a,X), %r
+ */
+static int FuseMoveAdd(Peephole* peephole, int at) {
+    MachineInstr* copy = &peephole->function->code[at];
+    MachineInstr* add = copy + 1;
+    MachineOperand address;
+
+    if (copy->op != X86_MOV || copy->size == 1 || !IsGeneralRegister(copy->src) || !IsGeneralRegister(copy->dst) ||
+        (add->op != X86_ADD && add->op != X86_SUB) || add->size != copy->size ||
+        !SameMachineOperand(add->dst, copy->dst) || !IsDead(peephole, at + 2, FLAGS_BIT)) {
+        return 0;
+    }
+
+    int base = copy->src.reg;
+    if (add->src.kind == MOP_IMM) {
+        long long disp = add->op == X86_ADD ? add->src.value : -add->src.value;
+        if (!MakeAddress(base, -1, 1, disp, &address)) {
+            return 0;
+        }
+    } else if (add->op == X86_ADD && IsGeneralRegister(add->src) && add->src.reg != copy->dst.reg) {
+        if (!MakeAddress(base, add->src.reg, 1, 0, &address)) {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+
+    MakeLea(copy, copy->size, address, copy->dst.reg);
+    DeleteInstrs(peephole, at + 1, 1);
+    return 1;
+}
+
+/**
+ * @brief Gets the lea scale for multiplying a register by itself plus a scaled copy, 0 if there is none
+ */
+static int SelfScale(long long factor) {
+    return factor == 2 || factor == 3 || factor == 5 || factor == 9 ? (int)factor - 1 : 0;
+}
+
+/**
+ * @brief mov %a, %r; imul $k, %r becomes lea (%a,%a,k-1), %r for k of 2, 3, 5 or 9
+ */
+static int FuseMoveMultiply(Peephole* peephole, int at) {
+    MachineInstr* copy = &peephole->function->code[at];
+    MachineInstr* multiply = copy + 1;
+    MachineOperand address;
+
+    if (copy->op != X86_MOV || copy->size == 1 || !IsGeneralRegister(copy->src) || !IsGeneralRegister(copy->dst) ||
+        multiply->op != X86_IMUL || multiply->size != copy->size || multiply->src.kind != MOP_IMM ||
+        SelfScale(multiply->src.value) == 0 || !SameMachineOperand(multiply->dst, copy->dst) ||
+        !MakeAddress(copy->src.reg, copy->src.reg, SelfScale(multiply->src.value), 0, &address) ||
+        !IsDead(peephole, at + 2, FLAGS_BIT)) {
+        return 0;
+    }
+    MakeLea(copy, copy->size, address, copy->dst.reg);
+    DeleteInstrs(peephole, at + 1, 1);
+    return 1;
+}
+
+/**
+ * @brief imul $k, %r becomes lea (%r,%r,k-1), %r for k of 2, 3, 5 or 9
+ */
+static int MultiplyWithLea(Peephole* peephole, int at) {
+    MachineInstr* multiply = &peephole->function->code[at];
+    MachineOperand address;
+
+    if (multiply->op != X86_IMUL || multiply->src.kind != MOP_IMM || SelfScale(multiply->src.value) == 0 ||
+        !IsGeneralRegister(multiply->dst) ||
+        !MakeAddress(multiply->dst.reg, multiply->dst.reg, SelfScale(multiply->src.value), 0, &address) ||
+        !IsDead(peephole, at + 1, FLAGS_BIT)) {
+        return 0;
+    }
+    MakeLea(multiply, multiply->size, address, multiply->dst.reg);
+    return 1;
+}
+
+/**
+ * @brief imul $s, %r; add %b, %r becomes lea (%b,%r,s), %r, the scaled-index address, for s of 2, 4 or 8
+ */
+static int FuseScaleAdd(Peephole* peephole, int at) {
+    MachineInstr* multiply = &peephole->function->code[at];
+    MachineInstr* add = multiply + 1;
+    MachineOperand address;
+
+    if (multiply->op != X86_IMUL || multiply->src.kind != MOP_IMM ||
+        (multiply->src.value != 2 && multiply->src.value != 4 && multiply->src.value != 8) ||
+        !IsGeneralRegister(multiply->dst) || add->op != X86_ADD || add->size != multiply->size ||
+        !IsGeneralRegister(add->src) || add->src.reg == multiply->dst.reg ||
+        !SameMachineOperand(add->dst, multiply->dst) ||
+        !MakeAddress(add->src.reg, multiply->dst.reg, (int)multiply->src.value, 0, &address) ||
+        !IsDead(peephole, at + 2, FLAGS_BIT)) {
+        return 0;
+    }
+    MakeLea(multiply, multiply->size, address, multiply->dst.reg);
+    DeleteInstrs(peephole, at + 1, 1);
+    return 1;
+}
+
+/**
+ * @brief lea A, %r; add $k, %r folds the constant into the displacement of A
+ */
+static int FoldLeaOffset(Peephole* peephole, int at) {
+    MachineInstr* lea = &peephole->function->code[at];
+    MachineInstr* add = lea + 1;
+
+    if (lea->op != X86_LEA || lea->src.reg == REG_RIP || (add->op != X86_ADD && add->op != X86_SUB) ||
+        add->size != lea->size || add->src.kind != MOP_IMM || !SameMachineOperand(add->dst, lea->dst) ||
+        !IsDead(peephole, at + 2, FLAGS_BIT)) {
+        return 0;
+    }
+
+    long long disp = lea->src.value + (add->op == X86_ADD ? add->src.value : -add->src.value);
+    if (disp != (int)disp) {
+        return 0;
+    }
+    lea->src.value = disp;
+    DeleteInstrs(peephole, at + 1, 1);
+    return 1;
+}
+
+/**
+ * @brief setcc %al; movzbl %al, %r; cmpl $0, %r; je L branches on the comparison before it directly
+ *
+ * Only when neither the flag byte nor %r is read again, on either way out of the branch.
+ */
+static int FuseCompareBranch(Peephole* peephole, int at) {
+    MachineInstr* set = &peephole->function->code[at];
+    MachineInstr* widen = set + 1;
+    MachineInstr* test = set + 2;
+    MachineInstr* branch = set + 3;
+
+    if (set->op != X86_SETCC || set->dst.kind != MOP_REG || widen->op != X86_MOVZB ||
+        !SameMachineOperand(widen->src, set->dst) || widen->dst.kind != MOP_REG || test->op != X86_CMP ||
+        test->src.kind != MOP_IMM || test->src.value != 0 || !SameMachineOperand(test->dst, widen->dst) ||
+        branch->op != X86_JCC || (branch->cond != COND_E && branch->cond != COND_NE)) {
+        return 0;
+    }
+
+    RegisterSet unread = REGISTER_BIT(set->dst.reg) | REGISTER_BIT(widen->dst.reg) | FLAGS_BIT;
+    if (!IsDead(peephole, at + 4, unread) || !IsDead(peephole, peephole->labelIndex[branch->src.symbol], unread)) {
+        return 0;
+    }
+
+    // je jumps when the comparison was false, jne when it was true
+    branch->cond = branch->cond == COND_E ? set->cond ^ 1 : set->cond;
+    DeleteInstrs(peephole, at, 3);
+    return 1;
+}
+
+/**
+ * @brief A jump to a label that only jumps on goes straight to where that one does
+ */
+static int ThreadJump(Peephole* peephole, int at) {
+    MachineFunction* function = peephole->function;
+    MachineInstr* jump = &function->code[at];
+
+    if ((jump->op != X86_JMP && jump->op != X86_JCC) || jump->src.kind != MOP_LABEL) {
+        return 0;
+    }
+
+    int target = SkipLabels(function, peephole->labelIndex[jump->src.symbol]);
+    if (target == at || target >= function->count) {
+        return 0;
+    }
+    MachineInstr* next = &function->code[target];
+    if (next->op != X86_JMP || next->src.kind != MOP_LABEL || next->src.symbol == jump->src.symbol) {
+        return 0;
+    }
+    jump->src = next->src;
+    return 1;
+}
+
+/**
+ * @brief A jump to the label right after it does nothing
+ */
+static int RemoveJumpToNext(Peephole* peephole, int at) {
+    MachineInstr* jump = &peephole->function->code[at];
+
+    if ((jump->op != X86_JMP && jump->op != X86_JCC) || jump->src.kind != MOP_LABEL ||
+        !LabelFollows(peephole, at + 1, jump->src.symbol)) {
+        return 0;
+    }
+    DeleteInstrs(peephole, at, 1);
+    return 1;
+}
+
+/**
+ * @brief jcc L1; jmp L2; L1: becomes a single jncc L2
+ */
+static int InvertBranchOverJump(Peephole* peephole, int at) {
+    MachineInstr* branch = &peephole->function->code[at];
+    MachineInstr* jump = branch + 1;
+
+    if (branch->op != X86_JCC || jump->op != X86_JMP || jump->src.kind != MOP_LABEL ||
+        !LabelFollows(peephole, at + 2, branch->src.symbol)) {
+        return 0;
+    }
+    branch->cond ^= 1;
+    branch->src = jump->src;
+    DeleteInstrs(peephole, at + 1, 1);
+    return 1;
+}
+
+/**
+ * @brief Nothing after a jump or return runs until the next label
+ */
+static int RemoveUnreachable(Peephole* peephole, int at) {
+    MachineInstr* instr = &peephole->function->code[at];
+
+    if ((instr->op != X86_JMP && instr->op != X86_RET) || instr[1].op == X86_LABEL) {
+        return 0;
+    }
+    DeleteInstrs(peephole, at + 1, 1);
+    return 1;
+}
+
+/**
+ * @brief A label nothing jumps to only keeps the instructions around it apart
+ */
+static int RemoveUnusedLabel(Peephole* peephole, int at) {
+    MachineInstr* instr = &peephole->function->code[at];
+
+    if (instr->op != X86_LABEL || peephole->labelUses[instr->src.symbol] > 0) {
+        return 0;
+    }
+    DeleteInstrs(peephole, at, 1);
+    return 1;
+}
+
+static const PeepholeRule rules[] = {
+    {"self-move", 1, RemoveSelfMove},
+    {"store-forwarding", 2, ForwardStore},
+    {"store-back", 2, RemoveStoreBack},
+    {"dead-store", 2, RemoveDeadStore},
+    {"copy-forwarding", 2, ForwardCopy},
+    {"compare-branch", 4, FuseCompareBranch},
+    {"move-add-lea", 2, FuseMoveAdd},
+    {"move-multiply-lea", 2, FuseMoveMultiply},
+    {"scale-add-lea", 2, FuseScaleAdd},
+    {"multiply-lea", 1, MultiplyWithLea},
+    {"lea-offset", 2, FoldLeaOffset},
+    {"xor-zero", 1, ZeroWithXor},
+    {"jump-threading", 1, ThreadJump},
+    {"jump-to-next", 1, RemoveJumpToNext},
+    {"branch-over-jump", 2, InvertBranchOverJump},
+    {"unreachable", 2, RemoveUnreachable},
+    {"unused-label", 1, RemoveUnusedLabel},
+};
+
+/**
+ * @brief Rewrites short sequences of a generated function into cheaper ones
+ *
+ * Slides a window along the instructions and tries every rule of the table
+ * at each position. After a rewrite the window backs up far enough for
+ * the rules to see what the rewrite exposed, and whole sweeps repeat until
+ * one changes nothing.
+ *
+ * @param function The function, after code generation
+ * @return The number of rewrites made
+ */
+int RunPeephole(MachineFunction* function) {
+    Peephole peephole;
+    int rewrites = 0;
+    int changed = 1;
+
+    peephole.function = function;
+    peephole.labelIndex = CheckedMalloc((function->labelCount + 1) * sizeof(int));
+    peephole.labelUses = CheckedMalloc((function->labelCount + 1) * sizeof(int));
+
+    while (changed) {
+        changed = 0;
+        IndexLabels(&peephole);
+        for (int at = 0; at < function->count; at++) {
+            for (size_t r = 0; r < sizeof(rules) / sizeof(rules[0]); r++) {
+                if (at + rules[r].window > function->count || !rules[r].apply(&peephole, at)) {
+                    continue;
+                }
+                IndexLabels(&peephole);
+                rewrites++;
+                changed = 1;
+                at = at > MAX_WINDOW ? at - MAX_WINDOW : 0;
+                r = (size_t)-1;
+                if (at >= function->count) {
+                    break;
+                }
+            }
+        }
+    }
+
+    free(peephole.labelIndex);
+    free(peephole.labelUses);
+    return rewrites;
+}
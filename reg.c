@@ -1,25 +1,33 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define NUM_REGISTERS 4  // Assume 4 physical registers for simplicity
-#define MAX_VARIABLES 10 // Max number of variables for this example
+#include "reg.h"
 
-typedef struct Variable {
-    int id;
-    int is_spilled;
-    int register_num;
-    int live_range_start;
-    int live_range_end;
-} Variable;
-
-typedef struct Register {
-    int occupied;
-    int var_id;
-} Register;
-
-Register registers[NUM_REGISTERS];
-Variable variables[MAX_VARIABLES];
+// Caller-saved registers come first, so values that never live across a
+// call leave the callee-saved ones for those that do
+Register registers[NUM_REGISTERS] = {
+    {0, -1, "rcx", INT_REGISTER, 0},    {0, -1, "rsi", INT_REGISTER, 0},    {0, -1, "rdi", INT_REGISTER, 0},
+    {0, -1, "r8", INT_REGISTER, 0},     {0, -1, "r9", INT_REGISTER, 0},     {0, -1, "r10", INT_REGISTER, 0},
+    {0, -1, "rbx", INT_REGISTER, 1},    {0, -1, "r12", INT_REGISTER, 1},    {0, -1, "r13", INT_REGISTER, 1},
+    {0, -1, "r14", INT_REGISTER, 1},    {0, -1, "r15", INT_REGISTER, 1},
+    {0, -1, "xmm0", FLOAT_REGISTER, 0}, {0, -1, "xmm1", FLOAT_REGISTER, 0}, {0, -1, "xmm2", FLOAT_REGISTER, 0},
+    {0, -1, "xmm3", FLOAT_REGISTER, 0}, {0, -1, "xmm4", FLOAT_REGISTER, 0}, {0, -1, "xmm5", FLOAT_REGISTER, 0},
+    {0, -1, "xmm6", FLOAT_REGISTER, 0}, {0, -1, "xmm7", FLOAT_REGISTER, 0}, {0, -1, "xmm8", FLOAT_REGISTER, 0},
+    {0, -1, "xmm9", FLOAT_REGISTER, 0}, {0, -1, "xmm10", FLOAT_REGISTER, 0}, {0, -1, "xmm11", FLOAT_REGISTER, 0},
+    {0, -1, "xmm12", FLOAT_REGISTER, 0}, {0, -1, "xmm13", FLOAT_REGISTER, 0},
+};
+Variable* variables = NULL;
 int num_variables = 0;
+int num_spill_slots = 0;
+static int variable_capacity = 0;
+
+static const Liveness* current_liveness = NULL; // Function being allocated, NULL for hand-added variables
+static IntList active;      // Pieces holding their register at the current position
+static IntList inactive;    // Pieces with a register that are in a lifetime hole
+static int* first_piece = NULL; // Variable id -> index of its first piece
+static int first_piece_count = 0;
 
 /**
  * @brief Initializes all registers to be unoccupied and sets their variable IDs to -1.
@@ -48,70 +56,474 @@ void initialize_registers() {
  * @param end The end of the live range of the variable
  */
 void add_variable(int id, int start, int end) {
+    if (num_variables == variable_capacity) {
+        variable_capacity = variable_capacity == 0 ? 16 : variable_capacity * 2;
+        variables = CheckedRealloc(variables, variable_capacity * sizeof(Variable));
+    }
     variables[num_variables].id = id;
     variables[num_variables].live_range_start = start;
     variables[num_variables].live_range_end = end;
     variables[num_variables].is_spilled = 0;
     variables[num_variables].register_num = -1;
+    variables[num_variables].interval = NULL;
+    variables[num_variables].reg_class = INT_REGISTER;
+    variables[num_variables].crosses_call = 0;
+    variables[num_variables].spill_slot = -1;
+    variables[num_variables].next_split = -1;
     num_variables++;
 }
 
+/**
+ * @brief Empties the table of variables so another function can be allocated
+ */
+void reset_variables() {
+    num_variables = 0;
+    num_spill_slots = 0;
+    current_liveness = NULL;
+}
+
+/**
+ * @brief Fills the table of variables from the live intervals of a function
+ *
+ * Every variable that is live somewhere is added with the span of its
+ * interval, in order of where the interval starts, and keeps a pointer to
+ * the interval so its lifetime holes stay visible to the allocator.
+ *
+ * @param liveness The liveness analysis of the function being allocated
+ */
+void add_live_intervals(const Liveness* liveness) {
+    reset_variables();
+    current_liveness = liveness;
+
+    for (int v = 0; v < liveness->varCount; v++) {
+        const LiveInterval* interval = &liveness->intervals[v];
+        if (interval->rangeCount == 0) {
+            continue;
+        }
+        add_variable(v, IntervalStart(interval), IntervalEnd(interval));
+        variables[num_variables - 1].interval = interval;
+        variables[num_variables - 1].crosses_call = interval->crossesCall;
+        if (liveness->function->vars[v].type == FLOAT) {
+            variables[num_variables - 1].reg_class = FLOAT_REGISTER;
+        }
+
+        // Insertion sort by start; intervals mostly arrive in order already
+        for (int i = num_variables - 1; i > 0 && variables[i - 1].live_range_start > variables[i].live_range_start; i--) {
+            Variable swap = variables[i];
+            variables[i] = variables[i - 1];
+            variables[i - 1] = swap;
+        }
+    }
+}
+
+
+/**
+ * @brief Checks whether a piece of a variable is live at a position
+ *
+ * Positions in a lifetime hole of the variable are not covered, which is
+ * what lets another variable use the register there.
+ */
+static int piece_covers(const Variable* piece, int position) {
+    if (position < piece->live_range_start || position >= piece->live_range_end) {
+        return 0;
+    }
+    return piece->interval == NULL || IntervalCovers(piece->interval, position);
+}
+
+static int piece_range_count(const Variable* piece) {
+    return piece->interval != NULL ? piece->interval->rangeCount : 1;
+}
+
+/**
+ * @brief Returns a live range of a piece, cut to the part of the variable the piece owns
+ */
+static LiveRange piece_range(const Variable* piece, int r) {
+    LiveRange range;
+
+    if (piece->interval != NULL) {
+        range = piece->interval->ranges[r];
+    } else {
+        range.start = piece->live_range_start;
+        range.end = piece->live_range_end;
+    }
+    if (range.start < piece->live_range_start) {
+        range.start = piece->live_range_start;
+    }
+    if (range.end > piece->live_range_end) {
+        range.end = piece->live_range_end;
+    }
+    return range;
+}
+
+/**
+ * @brief Finds the first position two pieces are both live at
+ *
+ * @return The position, or -1 if they never overlap
+ */
+static int next_intersection(const Variable* a, const Variable* b) {
+    int i = 0;
+    int j = 0;
+
+    while (i < piece_range_count(a) && j < piece_range_count(b)) {
+        LiveRange x = piece_range(a, i);
+        LiveRange y = piece_range(b, j);
+        if (x.start >= x.end || x.end <= y.start) {
+            i++;
+        } else if (y.start >= y.end || y.end <= x.start) {
+            j++;
+        } else {
+            return x.start > y.start ? x.start : y.start;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Finds the first use or definition of a piece's variable at or after a position
+ *
+ * @return The position, or -1 if the piece has none left
+ */
+static int next_use_after(const Variable* piece, int position) {
+    if (piece->interval == NULL) {
+        return -1;
+    }
+    int use = NextUseAfter(piece->interval, position);
+    return use < piece->live_range_end ? use : -1;
+}
+
+/**
+ * @brief Recomputes whether a piece is live across any call of the function
+ */
+static void update_crosses_call(int var_index) {
+    Variable* piece = &variables[var_index];
+
+    if (current_liveness == NULL) {
+        return;
+    }
+    piece->crosses_call = 0;
+    for (int c = 0; c < current_liveness->calls.count; c++) {
+        int call = current_liveness->calls.items[c];
+        if (TACDefinedVar(&current_liveness->function->code[call]) != piece->id &&
+            piece_covers(piece, DEF_POSITION(call))) {
+            piece->crosses_call = 1;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Splits a piece of a variable in two at a position
+ *
+ * The first part keeps the piece's place and location; the rest becomes a
+ * new piece with no location yet. Positions are kept even so the value
+ * moves between the two locations before an instruction starts, never
+ * halfway through one.
+ *
+ * @param var_index The piece to split
+ * @param position Where the new piece starts, even and inside the piece
+ * @return The index of the new piece
+ */
+static int split_variable(int var_index, int position) {
+    Variable* piece = &variables[var_index];
+    int end = piece->live_range_end;
+    int next = piece->next_split;
+    const LiveInterval* interval = piece->interval;
+    RegisterClass reg_class = piece->reg_class;
+
+    piece->live_range_end = position;
+    add_variable(piece->id, position, end);
+
+    int child = num_variables - 1;
+    variables[child].interval = interval;
+    variables[child].reg_class = reg_class;
+    variables[child].next_split = next;
+    variables[var_index].next_split = child;
+    update_crosses_call(var_index);
+    update_crosses_call(child);
+    return child;
+}
+
+/**
+ * @brief Queues a piece to be allocated, keeping the queue sorted by start
+ *
+ * The queue is sorted with the earliest start last, so the next piece is
+ * taken from the end.
+ */
+static void push_unhandled(IntList* unhandled, int var_index) {
+    int i = unhandled->count;
+
+    IntListPush(unhandled, var_index);
+    while (i > 0 && variables[unhandled->items[i - 1]].live_range_start < variables[var_index].live_range_start) {
+        unhandled->items[i] = unhandled->items[i - 1];
+        i--;
+    }
+    unhandled->items[i] = var_index;
+}
+
+static void remove_at(IntList* list, int i) {
+    list->items[i] = list->items[--list->count];
+}
+
 /**
  * @brief Allocates a register to a variable
  *
- * This function takes the ID of a variable as input and allocates the first
- * available register to the variable. If all registers are occupied, the function
- * returns -1 to indicate that no register is available.
+ * Picks among the registers of the variable's class that no active piece
+ * holds. A register held by a piece in a lifetime hole is free only until
+ * that piece is live again; a register free for the whole piece wins,
+ * otherwise the one free the longest, and the piece is split where that
+ * register is needed back. Among equally free registers, pieces live
+ * across a call prefer callee-saved ones and the others caller-saved ones.
  *
- * @param var_id The ID of the variable to allocate a register
+ * @param var_index The index of the piece in the table of variables
  * @return The number of the allocated register, or -1 if no register is available
  */
-int allocate_register(int var_id) {
-    for (int i = 0; i < NUM_REGISTERS; i++) {
-        if (!registers[i].occupied) {
-            registers[i].occupied = 1;
-            registers[i].var_id = var_id;
-            return i;
+int allocate_register(int var_index) {
+    Variable* current = &variables[var_index];
+    int free_until[NUM_REGISTERS];
+    int best = -1;
+
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        free_until[r] = registers[r].reg_class == current->reg_class ? INT_MAX : -1;
+    }
+    for (int i = 0; i < active.count; i++) {
+        free_until[variables[active.items[i]].register_num] = -1;
+    }
+    for (int i = 0; i < inactive.count; i++) {
+        Variable* other = &variables[inactive.items[i]];
+        int r = other->register_num;
+        int position = next_intersection(other, current);
+        if (position >= 0 && position < free_until[r]) {
+            free_until[r] = position;
         }
     }
-    return -1;  
+
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (free_until[r] <= current->live_range_start) {
+            continue;
+        }
+        if (best < 0) {
+            best = r;
+            continue;
+        }
+        int mine = free_until[r] < current->live_range_end ? free_until[r] : current->live_range_end;
+        int theirs = free_until[best] < current->live_range_end ? free_until[best] : current->live_range_end;
+        if (mine > theirs ||
+            (mine == theirs && registers[r].callee_saved == current->crosses_call &&
+             registers[best].callee_saved != current->crosses_call)) {
+            best = r;
+        }
+    }
+
+    if (best < 0) {
+        return -1;
+    }
+    if (free_until[best] < current->live_range_end) {
+        int position = free_until[best] & ~1;
+        if (position <= current->live_range_start) {
+            return -1;
+        }
+        // The caller queues the rest once the register is taken
+        split_variable(var_index, position);
+    }
+
+    variables[var_index].register_num = best;
+    registers[best].occupied = 1;
+    registers[best].var_id = variables[var_index].id;
+    return best;
 }
 
 /**
  * @brief Marks a variable as being spilled to memory
  *
- * This function takes the index of a variable in the table of variables
- * and marks the variable as being spilled to memory. A message is printed
- * to the console to indicate that the variable has been spilled to memory.
+ * Every piece of a variable that lives in memory uses the same stack slot,
+ * so moving the value between pieces never needs a memory-to-memory copy.
  *
  * @param var_index The index of the variable in the table of variables
  */
 void spill_variable(int var_index) {
+    int slot = -1;
+
+    for (int i = 0; i < num_variables && slot < 0; i++) {
+        if (variables[i].id == variables[var_index].id) {
+            slot = variables[i].spill_slot;
+        }
+    }
+    if (slot < 0) {
+        slot = num_spill_slots++;
+    }
+
     variables[var_index].is_spilled = 1;
-    printf("Variable %d is spilled to memory.\n", variables[var_index].id);
+    variables[var_index].register_num = -1;
+    variables[var_index].spill_slot = slot;
 }
 
 /**
- * @brief Performs register allocation for a set of variables
+ * @brief Spills a piece, splitting off the part from its next use to try for a register again
+ */
+static void spill_until_next_use(int var_index, IntList* unhandled) {
+    int start = variables[var_index].live_range_start;
+    int use = next_use_after(&variables[var_index], start + 1);
+
+    spill_variable(var_index);
+    if (use >= 0 && (use & ~1) > start) {
+        push_unhandled(unhandled, split_variable(var_index, use & ~1));
+    }
+}
+
+/**
+ * @brief Frees a register for a piece when every register of its class is taken
+ *
+ * Of the piece and the active pieces of its class, the one whose interval
+ * ends furthest away is spilled, as Poletto and Sarkar do. The spilled
+ * piece goes to memory only until its next use, from where it competes for
+ * a register again, so a value is reloaded near where it is needed rather
+ * than living in memory for the rest of its life.
  *
- * This function takes no parameters and performs register allocation for all
- * variables in the table of variables. If a register is available, the function
- * assigns the register to the variable. If no register is available, the
- * function marks the variable as being spilled to memory.
+ * @return The register given to the piece, or -1 if the piece itself was spilled
  */
-void register_allocation() {
+static int allocate_blocked_register(int var_index, IntList* unhandled) {
+    int victim = var_index;
+    int victim_at = -1;
+    int start = variables[var_index].live_range_start;
+
+    for (int i = 0; i < active.count; i++) {
+        Variable* other = &variables[active.items[i]];
+        if (other->reg_class == variables[var_index].reg_class &&
+            other->live_range_end > variables[victim].live_range_end) {
+            victim = active.items[i];
+            victim_at = i;
+        }
+    }
+
+    if (victim == var_index) {
+        spill_until_next_use(var_index, unhandled);
+        return -1;
+    }
+
+    int reg = variables[victim].register_num;
+    remove_at(&active, victim_at);
+    free_register(variables[victim].id);
+    if ((start & ~1) > variables[victim].live_range_start) {
+        spill_until_next_use(split_variable(victim, start & ~1), unhandled);
+    } else {
+        spill_until_next_use(victim, unhandled);
+    }
+
+    // A piece in a lifetime hole may still want the register back later
+    int blocked = INT_MAX;
+    for (int i = 0; i < inactive.count; i++) {
+        Variable* other = &variables[inactive.items[i]];
+        int position = next_intersection(other, &variables[var_index]);
+        if (other->register_num == reg && position >= 0 && position < blocked) {
+            blocked = position;
+        }
+    }
+    if (blocked < variables[var_index].live_range_end) {
+        if ((blocked & ~1) <= start) {
+            spill_until_next_use(var_index, unhandled);
+            return -1;
+        }
+        push_unhandled(unhandled, split_variable(var_index, blocked & ~1));
+    }
+
+    variables[var_index].register_num = reg;
+    registers[reg].occupied = 1;
+    registers[reg].var_id = variables[var_index].id;
+    return reg;
+}
+
+/**
+ * @brief Clears the results of any earlier allocation, leaving one piece per variable
+ */
+static void begin_allocation() {
     initialize_registers();
+    num_spill_slots = 0;
 
+    first_piece_count = 0;
     for (int i = 0; i < num_variables; i++) {
-        int reg_num = allocate_register(variables[i].id);
+        if (variables[i].id >= first_piece_count) {
+            first_piece_count = variables[i].id + 1;
+        }
+    }
+    first_piece = CheckedRealloc(first_piece, (first_piece_count + 1) * sizeof(int));
+    for (int v = 0; v < first_piece_count; v++) {
+        first_piece[v] = -1;
+    }
 
-        if (reg_num != -1) {
-            variables[i].register_num = reg_num;
-            printf("Variable %d assigned to register %d\n", variables[i].id, reg_num);
-        } else {
-            spill_variable(i);
+    for (int i = num_variables - 1; i >= 0; i--) {
+        variables[i].is_spilled = 0;
+        variables[i].register_num = -1;
+        variables[i].spill_slot = -1;
+        variables[i].next_split = -1;
+        first_piece[variables[i].id] = i;
+    }
+}
+
+/**
+ * @brief Performs register allocation for a set of variables
+ *
+ * Linear scan after Poletto and Sarkar, with the lifetime holes and
+ * interval splitting of Wimmer and Franz. Pieces are visited in order of
+ * their start. Active pieces that have ended give their registers back,
+ * and those entering a lifetime hole lend theirs out until they are live
+ * again. A piece then takes a free register, or one is freed for it by
+ * spilling, so values only go to memory when more of them are live at
+ * once than there are registers.
+ */
+void register_allocation() {
+    IntList unhandled = {NULL, 0, 0};
+
+    begin_allocation();
+    active.count = 0;
+    inactive.count = 0;
+    for (int i = num_variables - 1; i >= 0; i--) {
+        push_unhandled(&unhandled, i);
+    }
+
+    while (unhandled.count > 0) {
+        int current = unhandled.items[--unhandled.count];
+        int position = variables[current].live_range_start;
+
+        for (int i = 0; i < active.count;) {
+            Variable* piece = &variables[active.items[i]];
+            if (piece->live_range_end <= position || !piece_covers(piece, position)) {
+                free_register(piece->id);
+                if (piece->live_range_end > position) {
+                    IntListPush(&inactive, active.items[i]);
+                }
+                remove_at(&active, i);
+            } else {
+                i++;
+            }
+        }
+        for (int i = 0; i < inactive.count;) {
+            Variable* piece = &variables[inactive.items[i]];
+            if (piece->live_range_end <= position) {
+                remove_at(&inactive, i);
+            } else if (piece_covers(piece, position)) {
+                registers[piece->register_num].occupied = 1;
+                registers[piece->register_num].var_id = piece->id;
+                IntListPush(&active, inactive.items[i]);
+                remove_at(&inactive, i);
+            } else {
+                i++;
+            }
+        }
+
+        int pieces = num_variables;
+        int reg = allocate_register(current);
+        if (reg >= 0 && num_variables > pieces) {
+            push_unhandled(&unhandled, num_variables - 1);
+        }
+        if (reg < 0) {
+            reg = allocate_blocked_register(current, &unhandled);
+        }
+        if (reg >= 0) {
+            IntListPush(&active, current);
         }
     }
+
+    IntListFree(&unhandled);
 }
 
 /**
@@ -133,21 +545,544 @@ void free_register(int var_id) {
     }
 }
 
-int main() {
-    
-    add_variable(0, 0, 3);
-    add_variable(1, 2, 5);
-    add_variable(2, 1, 4);
-    add_variable(3, 4, 6);
-    
-    register_allocation();
+/**
+ * @brief Finds the piece of a variable that owns a position
+ *
+ * Positions in a lifetime hole, or past the end, belong to the piece that
+ * started last before them.
+ *
+ * @param var_id The ID of the variable
+ * @param position The position to look up
+ * @return The index of the piece in the table of variables, or -1 if the variable was never live
+ */
+int variable_at(int var_id, int position) {
+    if (var_id >= first_piece_count || first_piece[var_id] < 0) {
+        return -1;
+    }
+    int piece = first_piece[var_id];
+    while (variables[piece].next_split >= 0 && variables[variables[piece].next_split].live_range_start <= position) {
+        piece = variables[piece].next_split;
+    }
+    return piece;
+}
 
-    for (int i = 0; i < num_variables; i++) {
-        if (!variables[i].is_spilled) {
-            free_register(variables[i].id);
-            printf("Variable %d freed from register %d\n", variables[i].id, variables[i].register_num);
+/**
+ * @brief Prints where every piece of every variable ended up
+ */
+void print_allocation() {
+    for (int v = 0; v < first_piece_count; v++) {
+        for (int i = first_piece[v]; i >= 0; i = variables[i].next_split) {
+            const Variable* piece = &variables[i];
+            if (current_liveness != NULL) {
+                printf("Variable %s [%d, %d) ", current_liveness->function->vars[piece->id].name,
+                       piece->live_range_start, piece->live_range_end);
+            } else {
+                printf("Variable %d [%d, %d) ", piece->id, piece->live_range_start, piece->live_range_end);
+            }
+            if (piece->is_spilled) {
+                printf("is spilled to slot %d\n", piece->spill_slot);
+            } else {
+                printf("assigned to register %s\n", registers[piece->register_num].name);
+            }
         }
     }
+}
+
+// Iterated register coalescing (George and Appel). Nodes are indices into
+// the table of variables, one per variable; every node sits in exactly
+// one of the sets below, and the worklists drop stale entries lazily.
+typedef enum {
+    NODE_INITIAL,
+    NODE_SIMPLIFY,
+    NODE_FREEZE,
+    NODE_SPILL,
+    NODE_SPILLED,
+    NODE_COALESCED,
+    NODE_COLORED,
+    NODE_SELECT,
+} NodeState;
+
+typedef enum {
+    MOVE_WORKLIST,
+    MOVE_ACTIVE,
+    MOVE_COALESCED,
+    MOVE_CONSTRAINED,
+    MOVE_FROZEN,
+} MoveState;
+
+typedef struct {
+    int dst;
+    int src;
+    MoveState state;
+} Move;
+
+typedef struct {
+    int count;
+    Bitset matrix;      // Bit u * count + v is set when u and v interfere
+    IntList* adjacent;  // Node -> the nodes it interferes with
+    int* degree;
+    IntList* moves;     // Node -> the moves it takes part in
+    NodeState* state;
+    int* alias;
+    double* cost;       // Uses and definitions, weighted by 10 per level of loop nesting
+
+    Move* move;
+    int moveCount;
+
+    IntList simplify;
+    IntList freeze;
+    IntList worklist_moves;
+    IntList select;
+} InterferenceGraph;
+
+static int colors_of(int node) {
+    return variables[node].reg_class == FLOAT_REGISTER ? NUM_FLOAT_REGISTERS : NUM_INT_REGISTERS;
+}
+
+static int interferes(const InterferenceGraph* graph, int u, int v) {
+    return BitsetContains(&graph->matrix, u * graph->count + v);
+}
+
+static void add_edge(InterferenceGraph* graph, int u, int v) {
+    if (u == v || interferes(graph, u, v) || variables[u].reg_class != variables[v].reg_class) {
+        return;
+    }
+    BitsetAdd(&graph->matrix, u * graph->count + v);
+    BitsetAdd(&graph->matrix, v * graph->count + u);
+    IntListPush(&graph->adjacent[u], v);
+    IntListPush(&graph->adjacent[v], u);
+    graph->degree[u]++;
+    graph->degree[v]++;
+}
+
+/**
+ * @brief Checks whether a TAC instruction copies one variable into another of the same type
+ */
+static int is_move(const TACFunction* function, const TACInstruction* instr) {
+    return instr->op == TAC_ASSIGN && instr->arg1.kind == TAC_OPERAND_VAR &&
+           function->vars[instr->arg1.value.id].type == function->vars[instr->result.value.id].type;
+}
+
+/**
+ * @brief Builds the interference graph and the list of moves from the block live-out sets
+ *
+ * Each block is walked backwards from its live-out set. A definition
+ * interferes with everything live after it, except the source of a move,
+ * which may share the destination's register. Variables live on entry to
+ * the function are all defined there, so they interfere with each other.
+ */
+static void build_graph(InterferenceGraph* graph, const Liveness* liveness, const int* node_of) {
+    TACFunction* function = liveness->function;
+    const CFG* cfg = &liveness->cfg;
+    Bitset live = NewBitset(liveness->varCount);
+
+    for (int b = 0; b < cfg->blockCount; b++) {
+        const BasicBlock* block = &cfg->blocks[b];
+        BitsetCopy(&live, &liveness->liveOut[b]);
+
+        for (int i = block->end - 1; i >= block->start; i--) {
+            TACInstruction* instr = &function->code[i];
+            int def = TACDefinedVar(instr);
+
+            if (IsFoldedInstruction(liveness, i)) {
+                continue;
+            }
+            if (def >= 0 && is_move(function, instr) && node_of[def] >= 0 && node_of[instr->arg1.value.id] >= 0) {
+                int m = graph->moveCount++;
+                graph->move[m].dst = node_of[def];
+                graph->move[m].src = node_of[instr->arg1.value.id];
+                graph->move[m].state = MOVE_WORKLIST;
+                IntListPush(&graph->moves[graph->move[m].dst], m);
+                IntListPush(&graph->moves[graph->move[m].src], m);
+                IntListPush(&graph->worklist_moves, m);
+                BitsetRemove(&live, instr->arg1.value.id);
+            }
+            if (def >= 0 && node_of[def] >= 0) {
+                for (int v = BitsetNext(&live, 0); v >= 0; v = BitsetNext(&live, v + 1)) {
+                    if (node_of[v] >= 0) {
+                        add_edge(graph, node_of[def], node_of[v]);
+                    }
+                }
+                BitsetRemove(&live, def);
+            }
+            // A root reads the operands of the instructions folded into it as well
+            for (int j = i; j >= 0; j = liveness->nextFolded[j]) {
+                TACInstruction* member = &function->code[j];
+                for (int k = 0; k < TACUseCount(member); k++) {
+                    TACOperand* use = TACUseAt(member, k);
+                    if (use->kind == TAC_OPERAND_VAR) {
+                        BitsetAdd(&live, use->value.id);
+                    }
+                }
+            }
+        }
+    }
+
+    const Bitset* entry = &liveness->liveIn[0];
+    for (int u = BitsetNext(entry, 0); u >= 0; u = BitsetNext(entry, u + 1)) {
+        for (int v = BitsetNext(entry, u + 1); v >= 0; v = BitsetNext(entry, v + 1)) {
+            if (node_of[u] >= 0 && node_of[v] >= 0) {
+                add_edge(graph, node_of[u], node_of[v]);
+            }
+        }
+    }
+    FreeBitset(&live);
+}
+
+static int get_alias(const InterferenceGraph* graph, int node) {
+    while (graph->state[node] == NODE_COALESCED) {
+        node = graph->alias[node];
+    }
+    return node;
+}
+
+static int is_active_move(const InterferenceGraph* graph, int m) {
+    return graph->move[m].state == MOVE_ACTIVE || graph->move[m].state == MOVE_WORKLIST;
+}
 
+static int move_related(const InterferenceGraph* graph, int node) {
+    for (int i = 0; i < graph->moves[node].count; i++) {
+        if (is_active_move(graph, graph->moves[node].items[i])) {
+            return 1;
+        }
+    }
     return 0;
 }
+
+/**
+ * @brief Checks whether a neighbor still counts toward a node's degree
+ */
+static int is_adjacent(const InterferenceGraph* graph, int node) {
+    return graph->state[node] != NODE_SELECT && graph->state[node] != NODE_COALESCED;
+}
+
+static void set_state(InterferenceGraph* graph, int node, NodeState state) {
+    graph->state[node] = state;
+    if (state == NODE_SIMPLIFY) {
+        IntListPush(&graph->simplify, node);
+    } else if (state == NODE_FREEZE) {
+        IntListPush(&graph->freeze, node);
+    }
+}
+
+static void enable_moves(InterferenceGraph* graph, int node) {
+    for (int i = 0; i < graph->moves[node].count; i++) {
+        int m = graph->moves[node].items[i];
+        if (graph->move[m].state == MOVE_ACTIVE) {
+            graph->move[m].state = MOVE_WORKLIST;
+            IntListPush(&graph->worklist_moves, m);
+        }
+    }
+}
+
+static void decrement_degree(InterferenceGraph* graph, int node) {
+    int degree = graph->degree[node]--;
+
+    if (degree != colors_of(node) || graph->state[node] != NODE_SPILL) {
+        return;
+    }
+    // Now colorable, so the moves of the node and its neighbors may coalesce after all
+    enable_moves(graph, node);
+    for (int i = 0; i < graph->adjacent[node].count; i++) {
+        if (is_adjacent(graph, graph->adjacent[node].items[i])) {
+            enable_moves(graph, graph->adjacent[node].items[i]);
+        }
+    }
+    set_state(graph, node, move_related(graph, node) ? NODE_FREEZE : NODE_SIMPLIFY);
+}
+
+static void simplify(InterferenceGraph* graph, int node) {
+    graph->state[node] = NODE_SELECT;
+    IntListPush(&graph->select, node);
+    for (int i = 0; i < graph->adjacent[node].count; i++) {
+        int other = graph->adjacent[node].items[i];
+        if (is_adjacent(graph, other)) {
+            decrement_degree(graph, other);
+        }
+    }
+}
+
+static void add_worklist(InterferenceGraph* graph, int node) {
+    if (graph->state[node] == NODE_FREEZE && !move_related(graph, node) &&
+        graph->degree[node] < colors_of(node)) {
+        set_state(graph, node, NODE_SIMPLIFY);
+    }
+}
+
+/**
+ * @brief George's test: every neighbor of v is harmless to u
+ */
+static int george_test(const InterferenceGraph* graph, int u, int v) {
+    for (int i = 0; i < graph->adjacent[v].count; i++) {
+        int t = graph->adjacent[v].items[i];
+        if (is_adjacent(graph, t) && graph->degree[t] >= colors_of(t) && !interferes(graph, t, u)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Briggs's test: the merged node has fewer significant neighbors than colors
+ */
+static int briggs_test(const InterferenceGraph* graph, int u, int v) {
+    int significant = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        int node = pass == 0 ? u : v;
+        for (int i = 0; i < graph->adjacent[node].count; i++) {
+            int t = graph->adjacent[node].items[i];
+            // A neighbor of both is counted once, through u
+            if (!is_adjacent(graph, t) || (pass == 1 && interferes(graph, t, u))) {
+                continue;
+            }
+            if (graph->degree[t] >= colors_of(t)) {
+                significant++;
+            }
+        }
+    }
+    return significant < colors_of(u);
+}
+
+static void combine(InterferenceGraph* graph, int u, int v) {
+    graph->state[v] = NODE_COALESCED;
+    graph->alias[v] = u;
+    graph->cost[u] += graph->cost[v];
+    variables[u].crosses_call |= variables[v].crosses_call;
+    for (int i = 0; i < graph->moves[v].count; i++) {
+        IntListPush(&graph->moves[u], graph->moves[v].items[i]);
+    }
+    enable_moves(graph, v);
+
+    for (int i = 0; i < graph->adjacent[v].count; i++) {
+        int t = graph->adjacent[v].items[i];
+        if (is_adjacent(graph, t)) {
+            add_edge(graph, t, u);
+            decrement_degree(graph, t);
+        }
+    }
+    if (graph->degree[u] >= colors_of(u) && graph->state[u] == NODE_FREEZE) {
+        graph->state[u] = NODE_SPILL;
+    }
+}
+
+static void coalesce(InterferenceGraph* graph, int m) {
+    int u = get_alias(graph, graph->move[m].dst);
+    int v = get_alias(graph, graph->move[m].src);
+
+    if (u == v) {
+        graph->move[m].state = MOVE_COALESCED;
+        add_worklist(graph, u);
+    } else if (interferes(graph, u, v)) {
+        graph->move[m].state = MOVE_CONSTRAINED;
+        add_worklist(graph, u);
+        add_worklist(graph, v);
+    } else if (george_test(graph, u, v) || briggs_test(graph, u, v)) {
+        graph->move[m].state = MOVE_COALESCED;
+        combine(graph, u, v);
+        add_worklist(graph, u);
+    } else {
+        graph->move[m].state = MOVE_ACTIVE;
+    }
+}
+
+static void freeze_moves(InterferenceGraph* graph, int u) {
+    for (int i = 0; i < graph->moves[u].count; i++) {
+        int m = graph->moves[u].items[i];
+        if (!is_active_move(graph, m)) {
+            continue;
+        }
+        int x = get_alias(graph, graph->move[m].dst);
+        int y = get_alias(graph, graph->move[m].src);
+        int v = y == get_alias(graph, u) ? x : y;
+        graph->move[m].state = MOVE_FROZEN;
+        if (graph->state[v] == NODE_FREEZE && !move_related(graph, v) && graph->degree[v] < colors_of(v)) {
+            set_state(graph, v, NODE_SIMPLIFY);
+        }
+    }
+}
+
+/**
+ * @brief Picks the node to push as a potential spill: the cheapest per interference removed
+ *
+ * @return The node, or -1 if no node is waiting to be spilled
+ */
+static int select_spill(const InterferenceGraph* graph) {
+    int best = -1;
+    double best_ratio = 0;
+
+    for (int n = 0; n < graph->count; n++) {
+        if (graph->state[n] != NODE_SPILL) {
+            continue;
+        }
+        double ratio = graph->cost[n] / (graph->degree[n] + 1);
+        if (best < 0 || ratio < best_ratio) {
+            best = n;
+            best_ratio = ratio;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Pops the select stack, giving each node a color none of its neighbors has
+ *
+ * Nodes pushed as potential spills may still find a color; those that
+ * do not are spilled. Nodes live across a call prefer callee-saved
+ * registers.
+ */
+static void assign_colors(InterferenceGraph* graph) {
+    while (graph->select.count > 0) {
+        int n = graph->select.items[--graph->select.count];
+        char taken[NUM_REGISTERS] = {0};
+
+        for (int i = 0; i < graph->adjacent[n].count; i++) {
+            int w = get_alias(graph, graph->adjacent[n].items[i]);
+            if (graph->state[w] == NODE_COLORED) {
+                taken[variables[w].register_num] = 1;
+            }
+        }
+
+        int color = -1;
+        for (int r = 0; r < NUM_REGISTERS; r++) {
+            if (taken[r] || registers[r].reg_class != variables[n].reg_class) {
+                continue;
+            }
+            if (color < 0 || (registers[r].callee_saved == variables[n].crosses_call &&
+                              registers[color].callee_saved != variables[n].crosses_call)) {
+                color = r;
+            }
+        }
+
+        if (color < 0) {
+            graph->state[n] = NODE_SPILLED;
+            spill_variable(n);
+        } else {
+            graph->state[n] = NODE_COLORED;
+            variables[n].register_num = color;
+        }
+    }
+
+    for (int n = 0; n < graph->count; n++) {
+        if (graph->state[n] != NODE_COALESCED) {
+            continue;
+        }
+        int a = get_alias(graph, n);
+        variables[n].register_num = variables[a].register_num;
+        variables[n].is_spilled = variables[a].is_spilled;
+        // Coalesced variables never interfere, so they may share a slot as well
+        variables[n].spill_slot = variables[a].spill_slot;
+    }
+}
+
+/**
+ * @brief Performs register allocation by graph coloring with copy coalescing
+ *
+ * The slower, higher-quality alternative to register_allocation, after
+ * George and Appel's iterated register coalescing. The interference graph
+ * is kept both as a bit matrix, for constant-time interference checks, and
+ * as adjacency lists, for walking neighbors. Simplify removes nodes with
+ * fewer neighbors than registers; moves are coalesced when Briggs's or
+ * George's conservative test shows the merged node stays colorable, so the
+ * copy disappears without causing a spill; when neither can make progress
+ * a move-related node is frozen, and as a last resort the node with the
+ * lowest spill cost per neighbor is pushed as a potential spill. Uses
+ * inside loops count ten times per level of nesting, so values in hot
+ * loops are the last to go to memory. Every variable stays in one piece.
+ */
+void coloring_allocation() {
+    InterferenceGraph graph;
+    const Liveness* liveness = current_liveness;
+    int n = num_variables;
+
+    begin_allocation();
+    if (liveness == NULL || n == 0) {
+        return;
+    }
+
+    memset(&graph, 0, sizeof(InterferenceGraph));
+    graph.count = n;
+    graph.matrix = NewBitset(n * n);
+    graph.adjacent = CheckedCalloc(n, sizeof(IntList));
+    graph.degree = CheckedCalloc(n, sizeof(int));
+    graph.moves = CheckedCalloc(n, sizeof(IntList));
+    graph.state = CheckedCalloc(n, sizeof(NodeState));
+    graph.alias = CheckedMalloc(n * sizeof(int));
+    graph.cost = CheckedCalloc(n, sizeof(double));
+    graph.move = CheckedMalloc((liveness->function->count + 1) * sizeof(Move));
+
+    int* node_of = CheckedMalloc((liveness->varCount + 1) * sizeof(int));
+    for (int v = 0; v < liveness->varCount; v++) {
+        node_of[v] = v < first_piece_count ? first_piece[v] : -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        graph.alias[i] = i;
+        const IntList* uses = &variables[i].interval->uses;
+        for (int u = 0; u < uses->count; u++) {
+            int block = liveness->cfg.blockOf[uses->items[u] / 2];
+            double weight = 1;
+            for (int d = 0; d < liveness->cfg.blocks[block].loopDepth; d++) {
+                weight *= 10;
+            }
+            graph.cost[i] += weight;
+        }
+    }
+
+    build_graph(&graph, liveness, node_of);
+
+    for (int i = 0; i < n; i++) {
+        if (graph.degree[i] >= colors_of(i)) {
+            graph.state[i] = NODE_SPILL;
+        } else {
+            set_state(&graph, i, move_related(&graph, i) ? NODE_FREEZE : NODE_SIMPLIFY);
+        }
+    }
+
+    for (;;) {
+        if (graph.simplify.count > 0) {
+            int node = graph.simplify.items[--graph.simplify.count];
+            if (graph.state[node] == NODE_SIMPLIFY) {
+                simplify(&graph, node);
+            }
+        } else if (graph.worklist_moves.count > 0) {
+            int m = graph.worklist_moves.items[--graph.worklist_moves.count];
+            if (graph.move[m].state == MOVE_WORKLIST) {
+                coalesce(&graph, m);
+            }
+        } else if (graph.freeze.count > 0) {
+            int node = graph.freeze.items[--graph.freeze.count];
+            if (graph.state[node] == NODE_FREEZE) {
+                set_state(&graph, node, NODE_SIMPLIFY);
+                freeze_moves(&graph, node);
+            }
+        } else {
+            int node = select_spill(&graph);
+            if (node < 0) {
+                break;
+            }
+            set_state(&graph, node, NODE_SIMPLIFY);
+            freeze_moves(&graph, node);
+        }
+    }
+
+    assign_colors(&graph);
+
+    for (int i = 0; i < n; i++) {
+        IntListFree(&graph.adjacent[i]);
+        IntListFree(&graph.moves[i]);
+    }
+    FreeBitset(&graph.matrix);
+    free(graph.adjacent);
+    free(graph.degree);
+    free(graph.moves);
+    free(graph.state);
+    free(graph.alias);
+    free(graph.cost);
+    free(graph.move);
+    IntListFree(&graph.simplify);
+    IntListFree(&graph.freeze);
+    IntListFree(&graph.worklist_moves);
+    IntListFree(&graph.select);
+    free(node_of);
+}
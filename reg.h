@@ -0,0 +1,53 @@
+#ifndef reg_h
+#define reg_h
+
+#include "liveness.h"
+
+#define NUM_INT_REGISTERS 11   // General-purpose registers handed out; rax, rdx and r11 stay free as scratch
+#define NUM_FLOAT_REGISTERS 14 // xmm0 to xmm13; xmm14 and xmm15 stay free as scratch
+#define NUM_REGISTERS (NUM_INT_REGISTERS + NUM_FLOAT_REGISTERS)
+
+typedef enum {
+    INT_REGISTER,
+    FLOAT_REGISTER,
+} RegisterClass;
+
+typedef struct Variable {
+    int id;
+    int is_spilled;
+    int register_num;
+    int live_range_start;
+    int live_range_end;
+    const LiveInterval* interval; // Exact live ranges, NULL for a variable added by hand
+    RegisterClass reg_class;
+    int crosses_call;   // Whether this piece is live across a call
+    int spill_slot;     // Stack slot shared by every piece of the variable, -1 if it has none
+    int next_split;     // Index of the piece of the same variable that follows this one, -1 if none
+} Variable;
+
+typedef struct Register {
+    int occupied;
+    int var_id;
+    const char* name;
+    RegisterClass reg_class;
+    int callee_saved;
+} Register;
+
+extern Register registers[NUM_REGISTERS];
+extern Variable* variables;
+extern int num_variables;
+extern int num_spill_slots;
+
+void initialize_registers();
+void add_variable(int id, int start, int end);
+void reset_variables();
+void add_live_intervals(const Liveness* liveness);
+int allocate_register(int var_index);
+void spill_variable(int var_index);
+void register_allocation();
+void coloring_allocation();
+void free_register(int var_id);
+int variable_at(int var_id, int position);
+void print_allocation();
+
+#endif
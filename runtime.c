@@ -0,0 +1,274 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "runtime.h"
+
+/*
+ * Runtime support for compiled Zara programs. Link it with the assembly
+ * the compiler writes:
+ *
+ *     gcc program.s runtime.c -o program
+ *
+ * The compiler links it in as well, for programs run with --jit.
+ *
+ * An array is a pointer to its length, stored in 8 bytes, followed by its
+ * 4-byte elements.
+ *
+ * A stack keeps its first ZARA_STACK_INLINE elements inside its header, so a
+ * shallow one costs a single allocation, and doubles its capacity whenever it
+ * fills up. Compiled code pushes, pops and peeks inline and only calls in
+ * here to grow a full stack.
+ *
+ * A string is never changed once made. Short ones carry their text in
+ * place, as literals do in read-only data, and long ones built with + keep
+ * it in a shared buffer that a string ending where the buffer does can
+ * append to in place. Adding to the end of a string in a loop so copies
+ * each character once, as a string builder would, while every earlier
+ * value of it still sees its own text. The hash is worked out the first
+ * time two strings of the same length are compared, and kept.
+ */
+
+void zara_print_int(int value) {
+    printf("%d ", value);
+}
+
+void zara_print_float(float value) {
+    printf("%g ", value);
+}
+
+static const char* string_text(const ZaraString* string) {
+    return string->buffer != NULL ? string->buffer->bytes : string->text;
+}
+
+void zara_print_string(const ZaraString* value) {
+    printf("%.*s ", value->length, string_text(value));
+}
+
+void zara_print_array(const long long* array) {
+    const int* elements = (const int*)(array + 1);
+
+    printf("{");
+    for (long long i = 0; i < array[0]; i++) {
+        printf(i == 0 ? "%d" : ", %d", elements[i]);
+    }
+    printf("} ");
+}
+
+void zara_print_float_array(const long long* array) {
+    const float* elements = (const float*)(array + 1);
+
+    printf("{");
+    for (long long i = 0; i < array[0]; i++) {
+        printf(i == 0 ? "%g" : ", %g", elements[i]);
+    }
+    printf("} ");
+}
+
+void zara_print_end(void) {
+    printf("\n");
+}
+
+long long* zara_new_array(int length) {
+    long long* array = calloc(1, sizeof(long long) + (length > 0 ? length : 0) * sizeof(int));
+
+    if (array == NULL) {
+        fprintf(stderr, "Error: out of memory allocating an array of %d elements\n", length);
+        exit(EXIT_FAILURE);
+    }
+    array[0] = length;
+    return array;
+}
+
+void zara_bounds_error(void) {
+    fflush(stdout);
+    fprintf(stderr, "Error: array index out of bounds\n");
+    exit(EXIT_FAILURE);
+}
+
+void zara_print_stack(const ZaraStack* stack) {
+    printf("{");
+    for (int i = 0; i < stack->size; i++) {
+        printf(i == 0 ? "%d" : ", %d", stack->elements[i]);
+    }
+    printf("} ");
+}
+
+void zara_print_float_stack(const ZaraStack* stack) {
+    const float* elements = (const float*)stack->elements;
+
+    printf("{");
+    for (int i = 0; i < stack->size; i++) {
+        printf(i == 0 ? "%g" : ", %g", elements[i]);
+    }
+    printf("} ");
+}
+
+ZaraStack* zara_new_stack(void) {
+    ZaraStack* stack = malloc(sizeof(ZaraStack));
+
+    if (stack == NULL) {
+        fprintf(stderr, "Error: out of memory allocating a stack\n");
+        exit(EXIT_FAILURE);
+    }
+    stack->size = 0;
+    stack->capacity = ZARA_STACK_INLINE;
+    stack->elements = stack->inlineElements;
+    return stack;
+}
+
+// Doubles the capacity of a full stack, moving it out of its inline buffer the first time
+static void grow_stack(ZaraStack* stack) {
+    int* elements = NULL;
+
+    if (stack->capacity <= (1 << 29)) {
+        size_t bytes = 2 * (size_t)stack->capacity * sizeof(int);
+        if (stack->elements == stack->inlineElements) {
+            elements = malloc(bytes);
+            if (elements != NULL) {
+                memcpy(elements, stack->inlineElements, sizeof(stack->inlineElements));
+            }
+        } else {
+            elements = realloc(stack->elements, bytes);
+        }
+    }
+    if (elements == NULL) {
+        fprintf(stderr, "Error: out of memory growing a stack of %d elements\n", stack->size);
+        exit(EXIT_FAILURE);
+    }
+    stack->elements = elements;
+    stack->capacity *= 2;
+}
+
+void zara_stack_push_int(ZaraStack* stack, int value) {
+    if (stack->size == stack->capacity) {
+        grow_stack(stack);
+    }
+    stack->elements[stack->size++] = value;
+}
+
+void zara_stack_push_float(ZaraStack* stack, float value) {
+    if (stack->size == stack->capacity) {
+        grow_stack(stack);
+    }
+    memcpy(&stack->elements[stack->size++], &value, sizeof(float));
+}
+
+void zara_stack_empty_error(void) {
+    fflush(stdout);
+    fprintf(stderr, "Error: pop or peek on an empty stack\n");
+    exit(EXIT_FAILURE);
+}
+
+// 32-bit FNV-1a, never 0 so that 0 can mean a hash not worked out yet
+unsigned int zara_string_hash(const char* text, int length) {
+    unsigned int hash = 2166136261u;
+
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+static ZaraString* allocate_string(int length, ZaraStringBuffer* buffer) {
+    ZaraString* string = malloc(sizeof(ZaraString) + (buffer == NULL ? (size_t)length + 1 : 0));
+
+    if (string == NULL) {
+        fprintf(stderr, "Error: out of memory allocating a string of %d characters\n", length);
+        exit(EXIT_FAILURE);
+    }
+    string->length = length;
+    string->hash = 0;
+    string->buffer = buffer;
+    return string;
+}
+
+ZaraString* zara_new_string(const char* text, int length) {
+    ZaraString* string = allocate_string(length, NULL);
+
+    memcpy(string->text, text, length);
+    string->text[length] = '\0';
+    string->hash = zara_string_hash(text, length);
+    return string;
+}
+
+// Makes room for size bytes in a string buffer, doubling its capacity
+static void reserve_string_buffer(ZaraStringBuffer* buffer, int size) {
+    if (buffer->capacity >= size) {
+        return;
+    }
+
+    size_t capacity = buffer->capacity > 0 ? (size_t)buffer->capacity : 64;
+    while (capacity < (size_t)size) {
+        capacity *= 2;
+    }
+    if (capacity > INT_MAX) {
+        capacity = INT_MAX;
+    }
+    char* bytes = realloc(buffer->bytes, capacity);
+    if (bytes == NULL) {
+        fprintf(stderr, "Error: out of memory growing a string of %d characters\n", buffer->used);
+        exit(EXIT_FAILURE);
+    }
+    buffer->bytes = bytes;
+    buffer->capacity = (int)capacity;
+}
+
+ZaraString* zara_string_concat(ZaraString* left, ZaraString* right) {
+    if (left->length == 0) {
+        return right;
+    }
+    if (right->length == 0) {
+        return left;
+    }
+    if (left->length > INT_MAX - 1 - right->length) {
+        fprintf(stderr, "Error: string longer than %d characters\n", INT_MAX - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    int length = left->length + right->length;
+    if (length <= ZARA_STRING_INLINE) {
+        ZaraString* string = allocate_string(length, NULL);
+        memcpy(string->text, string_text(left), left->length);
+        memcpy(string->text + left->length, string_text(right), right->length);
+        string->text[length] = '\0';
+        return string;
+    }
+
+    ZaraStringBuffer* buffer = left->buffer;
+    if (buffer == NULL || buffer->used != left->length) {
+        // Something else has been appended to that buffer already: start one of its own
+        buffer = calloc(1, sizeof(ZaraStringBuffer));
+        if (buffer == NULL) {
+            fprintf(stderr, "Error: out of memory allocating a string of %d characters\n", length);
+            exit(EXIT_FAILURE);
+        }
+        reserve_string_buffer(buffer, length + 1);
+        memcpy(buffer->bytes, string_text(left), left->length);
+    } else {
+        reserve_string_buffer(buffer, length + 1);
+    }
+    // The right string may share the buffer, so its text is found after the buffer moves
+    memcpy(buffer->bytes + left->length, string_text(right), right->length);
+    buffer->bytes[length] = '\0';
+    buffer->used = length;
+    return allocate_string(length, buffer);
+}
+
+static unsigned int string_hash(ZaraString* string) {
+    if (string->hash == 0) {
+        string->hash = zara_string_hash(string_text(string), string->length);
+    }
+    return string->hash;
+}
+
+int zara_string_equals(ZaraString* left, ZaraString* right) {
+    if (left == right) {
+        return 1;
+    }
+    if (left->length != right->length || string_hash(left) != string_hash(right)) {
+        return 0;
+    }
+    return memcmp(string_text(left), string_text(right), left->length) == 0;
+}
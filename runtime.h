@@ -0,0 +1,57 @@
+#ifndef runtime_h
+#define runtime_h
+
+// Elements a stack holds in place before it first needs a buffer of its own
+#define ZARA_STACK_INLINE 8
+
+// A stack of 4-byte ints or floats, stored as they are. The code generator
+// reaches into it, so the layout is fixed: size at 0, capacity at 4, the
+// elements pointer at 8.
+typedef struct {
+    int size;
+    int capacity;
+    int* elements;              // The inline buffer until the stack outgrows it
+    int inlineElements[ZARA_STACK_INLINE];
+} ZaraStack;
+
+// Strings up to this long are allocated with their text in place
+#define ZARA_STRING_INLINE 24
+
+// The text of long strings built by concatenation. Each one shares the
+// buffer of the string it extends, and only the string ending at 'used' may
+// append to it, so the text a string sees never changes.
+typedef struct {
+    int used;
+    int capacity;
+    char* bytes;
+} ZaraStringBuffer;
+
+// An immutable string. Literals are laid out the same way in read-only data,
+// so the layout is fixed: length at 0, hash at 4, buffer at 8, text at 16.
+typedef struct {
+    int length;
+    unsigned int hash;          // 0 until it is first needed; literals come with theirs
+    ZaraStringBuffer* buffer;   // NULL when the text is in place
+    char text[];                // In place text, NUL-terminated
+} ZaraString;
+
+void zara_print_int(int value);
+void zara_print_float(float value);
+void zara_print_string(const ZaraString* value);
+void zara_print_array(const long long* array);
+void zara_print_float_array(const long long* array);
+void zara_print_end(void);
+long long* zara_new_array(int length);
+void zara_bounds_error(void);
+void zara_print_stack(const ZaraStack* stack);
+void zara_print_float_stack(const ZaraStack* stack);
+ZaraStack* zara_new_stack(void);
+void zara_stack_push_int(ZaraStack* stack, int value);
+void zara_stack_push_float(ZaraStack* stack, float value);
+void zara_stack_empty_error(void);
+unsigned int zara_string_hash(const char* text, int length);
+ZaraString* zara_new_string(const char* text, int length);
+ZaraString* zara_string_concat(ZaraString* left, ZaraString* right);
+int zara_string_equals(ZaraString* left, ZaraString* right);
+
+#endif
@@ -0,0 +1,542 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "optimize.h"
+#include "cfg.h"
+#include "ssa.h"
+
+typedef enum {
+    LATTICE_TOP,       // No evidence yet: the value may still turn out constant
+    LATTICE_CONST,
+    LATTICE_BOTTOM     // Known to vary at run time
+} LatticeState;
+
+typedef struct {
+    LatticeState state;
+    TACOperand constant;
+} LatticeValue;
+
+typedef struct {
+    TACFunction* function;
+    CFG cfg;
+    DefUseChains chains;
+    LatticeValue* values;
+    int* edgeBase;         // Block -> index of its first outgoing edge flag
+    char* edgeExecutable;
+    char* blockVisited;
+    IntList flowWork;      // Pairs of (from, to) blocks
+    IntList ssaWork;       // Instruction indices
+} SCCPState;
+
+static LatticeValue Top(void) {
+    LatticeValue value;
+    value.state = LATTICE_TOP;
+    value.constant = NoOperand();
+    return value;
+}
+
+static LatticeValue Bottom(void) {
+    LatticeValue value;
+    value.state = LATTICE_BOTTOM;
+    value.constant = NoOperand();
+    return value;
+}
+
+static LatticeValue Constant(TACOperand constant) {
+    LatticeValue value;
+    value.state = LATTICE_CONST;
+    value.constant = constant;
+    return value;
+}
+
+/**
+ * @brief Returns the lattice value of an operand
+ *
+ * @param state The pass state
+ * @param operand A constant or variable operand
+ * @return The operand's current lattice value
+ */
+static LatticeValue OperandValue(SCCPState* state, TACOperand operand) {
+    switch (operand.kind) {
+    case TAC_OPERAND_VAR:
+        return state->values[operand.value.id];
+    case TAC_OPERAND_INT:
+    case TAC_OPERAND_FLOAT:
+    case TAC_OPERAND_STRING:
+        return Constant(operand);
+    default:
+        return Bottom();
+    }
+}
+
+/**
+ * @brief Converts a constant to the representation used by a variable's type
+ *
+ * Assigning an int to a float variable converts it, and assigning a float
+ * to an int variable truncates it, exactly as the generated code does.
+ *
+ * @param type The type of the variable receiving the constant
+ * @param constant The constant
+ * @param converted Receives the converted constant
+ * @return 1 on success, 0 if the constant cannot be held by the type
+ */
+static int ConvertConstant(DataType type, TACOperand constant, TACOperand* converted) {
+    if (type == FLOAT) {
+        if (constant.kind == TAC_OPERAND_INT) {
+            *converted = FloatOperand((float)constant.value.intValue);
+            return 1;
+        }
+        *converted = constant;
+        return constant.kind == TAC_OPERAND_FLOAT;
+    }
+    if (type == INTEGER) {
+        if (constant.kind == TAC_OPERAND_FLOAT) {
+            float f = constant.value.floatValue;
+            if (!(f > (float)INT_MIN && f < (float)INT_MAX)) {
+                return 0;
+            }
+            *converted = IntOperand((int)f);
+            return 1;
+        }
+        *converted = constant;
+        return constant.kind == TAC_OPERAND_INT;
+    }
+    if (type == STRING) {
+        *converted = constant;
+        return constant.kind == TAC_OPERAND_STRING;
+    }
+    return 0;
+}
+
+/**
+ * @brief Folds a binary operation on two constants
+ *
+ * Integer arithmetic wraps around like the generated code. Division by
+ * zero and INT_MIN / -1 are left for run time so the trap is preserved.
+ *
+ * @param op The operation
+ * @param a The left constant
+ * @param b The right constant
+ * @param result Receives the folded constant
+ * @return 1 if the operation was folded, 0 if it must be evaluated at run time
+ */
+int FoldBinary(TACOpcode op, TACOperand a, TACOperand b, TACOperand* result) {
+    if ((a.kind != TAC_OPERAND_INT && a.kind != TAC_OPERAND_FLOAT) ||
+        (b.kind != TAC_OPERAND_INT && b.kind != TAC_OPERAND_FLOAT)) {
+        return 0;
+    }
+
+    if (a.kind == TAC_OPERAND_FLOAT || b.kind == TAC_OPERAND_FLOAT) {
+        float x = a.kind == TAC_OPERAND_FLOAT ? a.value.floatValue : (float)a.value.intValue;
+        float y = b.kind == TAC_OPERAND_FLOAT ? b.value.floatValue : (float)b.value.intValue;
+
+        switch (op) {
+        case TAC_ADD: *result = FloatOperand(x + y); return 1;
+        case TAC_SUB: *result = FloatOperand(x - y); return 1;
+        case TAC_MUL: *result = FloatOperand(x * y); return 1;
+        case TAC_DIV: *result = FloatOperand(x / y); return 1;
+        case TAC_LT: *result = IntOperand(x < y); return 1;
+        case TAC_LE: *result = IntOperand(x <= y); return 1;
+        case TAC_GT: *result = IntOperand(x > y); return 1;
+        case TAC_GE: *result = IntOperand(x >= y); return 1;
+        case TAC_EQ: *result = IntOperand(x == y); return 1;
+        case TAC_NE: *result = IntOperand(x != y); return 1;
+        default: return 0;
+        }
+    }
+
+    int x = a.value.intValue;
+    int y = b.value.intValue;
+
+    switch (op) {
+    case TAC_ADD: *result = IntOperand((int)((unsigned)x + (unsigned)y)); return 1;
+    case TAC_SUB: *result = IntOperand((int)((unsigned)x - (unsigned)y)); return 1;
+    case TAC_MUL: *result = IntOperand((int)((unsigned)x * (unsigned)y)); return 1;
+    case TAC_DIV:
+        if (y == 0 || (x == INT_MIN && y == -1)) {
+            return 0;
+        }
+        *result = IntOperand(x / y);
+        return 1;
+    case TAC_MOD:
+        if (y == 0 || (x == INT_MIN && y == -1)) {
+            return 0;
+        }
+        *result = IntOperand(x % y);
+        return 1;
+    case TAC_LT: *result = IntOperand(x < y); return 1;
+    case TAC_LE: *result = IntOperand(x <= y); return 1;
+    case TAC_GT: *result = IntOperand(x > y); return 1;
+    case TAC_GE: *result = IntOperand(x >= y); return 1;
+    case TAC_EQ: *result = IntOperand(x == y); return 1;
+    case TAC_NE: *result = IntOperand(x != y); return 1;
+    default: return 0;
+    }
+}
+
+/**
+ * @brief Folds joining or comparing two string literals
+ *
+ * The joined text is interned like any other literal. Equal texts are
+ * interned once, so two literals are equal exactly when their ids are.
+ *
+ * @param program The program whose strings the literals are
+ * @param op TAC_CONCAT or TAC_STREQ
+ * @param a The left constant
+ * @param b The right constant
+ * @param result Receives the folded constant
+ * @return 1 if the operation was folded, 0 if the operands are not both strings
+ */
+static int FoldStrings(TACProgram* program, TACOpcode op, TACOperand a, TACOperand b, TACOperand* result) {
+    if (a.kind != TAC_OPERAND_STRING || b.kind != TAC_OPERAND_STRING) {
+        return 0;
+    }
+    if (op == TAC_STREQ) {
+        *result = IntOperand(a.value.id == b.value.id);
+        return 1;
+    }
+
+    const char* left = program->strings[a.value.id];
+    const char* right = program->strings[b.value.id];
+    char* joined = CheckedMalloc(strlen(left) + strlen(right) + 1);
+    strcpy(joined, left);
+    strcat(joined, right);
+    *result = StringOperand(InternString(program, joined));
+    free(joined);
+    return 1;
+}
+
+/**
+ * @brief Returns the index of the flag for the edge from one block to another
+ *
+ * @return The edge index, or -1 if there is no such edge
+ */
+static int EdgeIndex(SCCPState* state, int from, int to) {
+    IntList* succs = &state->cfg.blocks[from].succs;
+    for (int k = 0; k < succs->count; k++) {
+        if (succs->items[k] == to) {
+            return state->edgeBase[from] + k;
+        }
+    }
+    return -1;
+}
+
+static void QueueEdge(SCCPState* state, int from, int to) {
+    IntListPush(&state->flowWork, from);
+    IntListPush(&state->flowWork, to);
+}
+
+/**
+ * @brief Lowers a variable's lattice value and queues its uses if it changed
+ */
+static void SetValue(SCCPState* state, int var, LatticeValue value) {
+    LatticeValue* old = &state->values[var];
+
+    if (old->state == LATTICE_BOTTOM || value.state == LATTICE_TOP) {
+        return;
+    }
+    if (old->state == LATTICE_CONST && value.state == LATTICE_CONST) {
+        if (SameOperand(old->constant, value.constant)) {
+            return;
+        }
+        value = Bottom();
+    }
+
+    *old = value;
+    IntList* uses = &state->chains.uses[var];
+    for (int i = 0; i < uses->count; i++) {
+        IntListPush(&state->ssaWork, uses->items[i]);
+    }
+}
+
+/**
+ * @brief Evaluates one instruction over the lattice
+ *
+ * Phis merge only the arguments arriving over executable edges. Branches
+ * with a constant condition mark just the edge that will be taken.
+ *
+ * @param state The pass state
+ * @param index The index of the instruction
+ */
+static void Evaluate(SCCPState* state, int index) {
+    TACFunction* function = state->function;
+    TACInstruction* instr = &function->code[index];
+    int block = state->cfg.blockOf[index];
+    int def = TACDefinedVar(instr);
+
+    switch (instr->op) {
+    case TAC_PHI: {
+        LatticeValue merged = Top();
+        for (int k = 0; k < instr->phiCount && merged.state != LATTICE_BOTTOM; k++) {
+            int predLabel = instr->phiArgs[k].pred;
+            int pred = predLabel < function->labelCount ? state->cfg.labelBlock[predLabel] : -1;
+            int edge = pred >= 0 ? EdgeIndex(state, pred, block) : -1;
+            if (edge < 0 || !state->edgeExecutable[edge]) {
+                continue;
+            }
+
+            LatticeValue arg = OperandValue(state, instr->phiArgs[k].value);
+            if (arg.state == LATTICE_CONST && !ConvertConstant(function->vars[def].type, arg.constant, &arg.constant)) {
+                arg = Bottom();
+            }
+            if (arg.state == LATTICE_TOP) {
+                continue;
+            }
+            if (merged.state == LATTICE_TOP) {
+                merged = arg;
+            } else if (arg.state == LATTICE_BOTTOM || !SameOperand(merged.constant, arg.constant)) {
+                merged = Bottom();
+            }
+        }
+        SetValue(state, def, merged);
+        break;
+    }
+    case TAC_ASSIGN: {
+        LatticeValue value = OperandValue(state, instr->arg1);
+        if (value.state == LATTICE_CONST && !ConvertConstant(function->vars[def].type, value.constant, &value.constant)) {
+            value = Bottom();
+        }
+        SetValue(state, def, value);
+        break;
+    }
+    case TAC_IF:
+    case TAC_IFFALSE: {
+        LatticeValue cond = OperandValue(state, instr->arg1);
+        int target = state->cfg.labelBlock[instr->result.value.id];
+        int fallthrough = block + 1 < state->cfg.blockCount ? block + 1 : -1;
+
+        if (cond.state == LATTICE_BOTTOM || (cond.state == LATTICE_CONST && cond.constant.kind != TAC_OPERAND_INT)) {
+            QueueEdge(state, block, target);
+            if (fallthrough >= 0) {
+                QueueEdge(state, block, fallthrough);
+            }
+        } else if (cond.state == LATTICE_CONST) {
+            int taken = (cond.constant.value.intValue != 0) == (instr->op == TAC_IF);
+            if (taken) {
+                QueueEdge(state, block, target);
+            } else if (fallthrough >= 0) {
+                QueueEdge(state, block, fallthrough);
+            }
+        }
+        break;
+    }
+    default:
+        if (def < 0) {
+            break;
+        }
+        if (IsBinaryOp(instr->op) || instr->op == TAC_CONCAT || instr->op == TAC_STREQ) {
+            LatticeValue a = OperandValue(state, instr->arg1);
+            LatticeValue b = OperandValue(state, instr->arg2);
+            int isString = instr->op == TAC_CONCAT || instr->op == TAC_STREQ;
+            TACOperand folded;
+
+            if (a.state == LATTICE_BOTTOM || b.state == LATTICE_BOTTOM) {
+                SetValue(state, def, Bottom());
+            } else if (a.state == LATTICE_TOP || b.state == LATTICE_TOP) {
+                break;
+            } else if ((isString ? FoldStrings(function->program, instr->op, a.constant, b.constant, &folded)
+                                 : FoldBinary(instr->op, a.constant, b.constant, &folded)) &&
+                       ConvertConstant(function->vars[def].type, folded, &folded)) {
+                SetValue(state, def, Constant(folded));
+            } else {
+                SetValue(state, def, Bottom());
+            }
+        } else {
+            // Loads, calls and allocations are not known at compile time
+            SetValue(state, def, Bottom());
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Evaluates a block reached for the first time and queues its unconditional successors
+ */
+static void VisitBlock(SCCPState* state, int b) {
+    BasicBlock* block = &state->cfg.blocks[b];
+    TACFunction* function = state->function;
+
+    for (int i = block->start; i < block->end; i++) {
+        Evaluate(state, i);
+    }
+
+    if (block->end == block->start) {
+        if (b + 1 < state->cfg.blockCount) {
+            QueueEdge(state, b, b + 1);
+        }
+        return;
+    }
+
+    TACInstruction* last = &function->code[block->end - 1];
+    if (last->op == TAC_GOTO) {
+        QueueEdge(state, b, state->cfg.labelBlock[last->result.value.id]);
+    } else if (last->op != TAC_IF && last->op != TAC_IFFALSE && last->op != TAC_RETURN && b + 1 < state->cfg.blockCount) {
+        QueueEdge(state, b, b + 1);
+    }
+}
+
+/**
+ * @brief Rewrites the function using the facts the analysis proved
+ *
+ * Uses of constant variables are replaced by the constant and their
+ * definitions deleted, branches on constants become jumps or disappear,
+ * phi arguments from dead edges are dropped, and blocks that can never
+ * execute are removed.
+ *
+ * @return The number of changes made
+ */
+static int Rewrite(SCCPState* state) {
+    TACFunction* function = state->function;
+    int changes = 0;
+
+    for (int i = 0; i < function->count; i++) {
+        TACInstruction* instr = &function->code[i];
+        int block = state->cfg.blockOf[i];
+
+        if (!state->blockVisited[block]) {
+            continue;
+        }
+
+        int def = TACDefinedVar(instr);
+        if (def >= 0 && state->values[def].state == LATTICE_CONST && !HasSideEffects(instr)) {
+            MakeNop(instr);
+            changes++;
+            continue;
+        }
+
+        if (instr->op == TAC_PHI) {
+            int kept = 0;
+            for (int k = 0; k < instr->phiCount; k++) {
+                int predLabel = instr->phiArgs[k].pred;
+                int pred = predLabel < function->labelCount ? state->cfg.labelBlock[predLabel] : -1;
+                int edge = pred >= 0 ? EdgeIndex(state, pred, block) : -1;
+                if (edge >= 0 && state->edgeExecutable[edge]) {
+                    instr->phiArgs[kept++] = instr->phiArgs[k];
+                }
+            }
+            changes += instr->phiCount - kept;
+            instr->phiCount = kept;
+        }
+
+        for (int k = 0; k < TACUseCount(instr); k++) {
+            TACOperand* use = TACUseAt(instr, k);
+            if (use->kind == TAC_OPERAND_VAR && state->values[use->value.id].state == LATTICE_CONST) {
+                *use = state->values[use->value.id].constant;
+                changes++;
+            }
+        }
+
+        if (instr->op == TAC_PHI && instr->phiCount == 1) {
+            TACOperand value = instr->phiArgs[0].value;
+            TACOperand result = instr->result;
+            MakeNop(instr);
+            instr->op = TAC_ASSIGN;
+            instr->arg1 = value;
+            instr->result = result;
+        }
+
+        if ((instr->op == TAC_IF || instr->op == TAC_IFFALSE) && instr->arg1.kind == TAC_OPERAND_INT) {
+            int taken = (instr->arg1.value.intValue != 0) == (instr->op == TAC_IF);
+            if (taken) {
+                instr->op = TAC_GOTO;
+                instr->arg1 = NoOperand();
+            } else {
+                MakeNop(instr);
+            }
+            changes++;
+        }
+    }
+
+    RemoveNops(function);
+    changes += RemoveUnreachableBlocks(function);
+    return changes;
+}
+
+/**
+ * @brief Runs sparse conditional constant propagation on a function in SSA form
+ *
+ * Implements the algorithm of Wegman and Zadeck: values start at "top" and
+ * are only lowered, and code is only evaluated once an edge reaching it is
+ * known to be executable. This finds constants that flow around loops and
+ * through branches that plain constant folding misses. Each instruction is
+ * re-evaluated at most twice per operand, since a value can only be lowered
+ * twice, so the pass is linear in the size of the function.
+ *
+ * @param function The function to optimize; converted to SSA if needed
+ * @return The number of changes made
+ */
+int RunSCCP(TACFunction* function) {
+    BuildSSA(function);
+
+    SCCPState state;
+    memset(&state, 0, sizeof(SCCPState));
+    state.function = function;
+    state.cfg = BuildCFG(function);
+    state.chains = BuildDefUseChains(function);
+
+    state.values = CheckedMalloc(function->varCount * sizeof(LatticeValue));
+    for (int v = 0; v < function->varCount; v++) {
+        DataType type = function->vars[v].type;
+        int trackable = type == INTEGER || type == FLOAT || type == STRING;
+        state.values[v] = function->vars[v].isParam || !trackable ? Bottom() : Top();
+    }
+
+    int edgeCount = 0;
+    state.edgeBase = CheckedMalloc(state.cfg.blockCount * sizeof(int));
+    for (int b = 0; b < state.cfg.blockCount; b++) {
+        state.edgeBase[b] = edgeCount;
+        edgeCount += state.cfg.blocks[b].succs.count;
+    }
+    state.edgeExecutable = CheckedCalloc(edgeCount, sizeof(char));
+    state.blockVisited = CheckedCalloc(state.cfg.blockCount, sizeof(char));
+
+    state.blockVisited[0] = 1;
+    VisitBlock(&state, 0);
+
+    while (state.flowWork.count > 0 || state.ssaWork.count > 0) {
+        while (state.flowWork.count > 0) {
+            int to = state.flowWork.items[--state.flowWork.count];
+            int from = state.flowWork.items[--state.flowWork.count];
+            int edge = EdgeIndex(&state, from, to);
+            if (edge < 0 || state.edgeExecutable[edge]) {
+                continue;
+            }
+            state.edgeExecutable[edge] = 1;
+
+            if (!state.blockVisited[to]) {
+                state.blockVisited[to] = 1;
+                VisitBlock(&state, to);
+            } else {
+                // Only the phis can change when another edge into a visited block opens
+                BasicBlock* block = &state.cfg.blocks[to];
+                for (int i = block->start; i < block->end; i++) {
+                    if (function->code[i].op == TAC_PHI) {
+                        Evaluate(&state, i);
+                    }
+                }
+            }
+        }
+
+        while (state.ssaWork.count > 0) {
+            int index = state.ssaWork.items[--state.ssaWork.count];
+            if (state.blockVisited[state.cfg.blockOf[index]]) {
+                Evaluate(&state, index);
+            }
+        }
+    }
+
+    int changes = Rewrite(&state);
+
+    FreeCFG(&state.cfg);
+    FreeDefUseChains(&state.chains);
+    free(state.values);
+    free(state.edgeBase);
+    free(state.edgeExecutable);
+    free(state.blockVisited);
+    IntListFree(&state.flowWork);
+    IntListFree(&state.ssaWork);
+
+    return changes;
+}
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reg.h"
+#include "schedule.h"
+
+#define ISSUE_WIDTH 4   // Instructions a core starts per cycle
+
+// An instruction together with those folded into it, which code generation
+// emits as one piece, so they move as one
+typedef struct {
+    int root;           // The instruction the unit's code is generated at
+    IntList members;    // Instructions folded into it, in order
+    IntList reads;      // Variables it reads from outside the unit
+    int def;            // Variable it writes, -1 if none
+    int latency;        // Cycles before its result can be used
+    int ordered;        // Whether it may trap, so keeps its order among the others that may
+    int pinned;         // Whether it ends the region and has to stay there
+
+    IntList succs;      // Units that have to come after it, as pairs: unit, cycles they wait for it
+    int preds;          // Units it has to come after that are not scheduled yet
+    int height;         // Cycles from its start to the end of the region along the longest chain
+    int readyCycle;     // Earliest cycle all its operands are ready
+    int scheduled;
+} Unit;
+
+typedef struct {
+    TACFunction* function;
+    const Liveness* liveness;
+    const Selection* selection;
+    int* remaining;     // Variable -> unscheduled units of the region reading it
+    char* live;         // Variable -> whether it holds a value at this point of the schedule
+    char* dies;         // Variable -> whether it is dead after the region, so its last read there frees it
+    int pressure[2];    // Values live in each register class: integer, float
+} Scheduler;
+
+/**
+ * @brief Checks whether nothing can move across an instruction
+ *
+ * Labels and jumps end the blocks, and calls, array and stack allocations,
+ * pushes that may grow a stack and string joins and comparisons included,
+ * clobber registers and print. A call finds its arguments in the params
+ * right before it, so those stay put as well. A vector loop reads and
+ * writes whole arrays, and its reductions are read back right after it.
+ * A bounds guard stands for the checks of the loop after it.
+ */
+static int IsBarrier(TACOpcode op) {
+    switch (op) {
+    case TAC_PARAM:
+    case TAC_LABEL:
+    case TAC_GOTO:
+    case TAC_IF:
+    case TAC_IFFALSE:
+    case TAC_RETURN:
+    case TAC_CALL:
+    case TAC_NEWARRAY:
+    case TAC_NEWSTACK:
+    case TAC_PUSH:
+    case TAC_CONCAT:
+    case TAC_STREQ:
+    case TAC_PHI:
+    case TAC_VECLOOP:
+    case TAC_VECREDUCE:
+    case TAC_CHECKBOUNDS:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Estimates the cycles before an instruction's result can be used on a current x86-64 core
+ *
+ * Simple integer operations take a cycle, imul three and idiv a few dozen;
+ * SSE adds and multiplies take four, divides eleven, and converting between
+ * integers and floats four more. An element load is an L1 hit after its
+ * bounds check.
+ */
+static int InstructionLatency(TACFunction* function, const TACInstruction* instr) {
+    int isFloat = OperandType(function, instr->arg1) == FLOAT || OperandType(function, instr->arg2) == FLOAT;
+    int converts = instr->result.kind == TAC_OPERAND_VAR && instr->op != TAC_STORE_INDEX &&
+                   (function->vars[instr->result.value.id].type == FLOAT) != isFloat;
+    int latency;
+
+    switch (instr->op) {
+    case TAC_ADD:
+    case TAC_SUB:
+        latency = isFloat ? 4 : 1;
+        break;
+    case TAC_MUL:
+        latency = isFloat ? 4 : 3;
+        break;
+    case TAC_DIV:
+    case TAC_MOD:
+        latency = isFloat ? 11 : 26;
+        break;
+    case TAC_LT:
+    case TAC_LE:
+    case TAC_GT:
+    case TAC_GE:
+    case TAC_EQ:
+    case TAC_NE:
+        return isFloat ? 3 : 1;
+    case TAC_LOAD_INDEX:
+        return 5;
+    case TAC_ASSIGN:
+        latency = 1;
+        break;
+    default:
+        return 1;
+    }
+    return converts ? latency + 4 : latency;
+}
+
+static int ValueClass(const Scheduler* scheduler, int var) {
+    return scheduler->function->vars[var].type == FLOAT ? 1 : 0;
+}
+
+/**
+ * @brief Gathers the instructions of a unit and what it reads, writes and costs
+ */
+static void BuildUnit(Scheduler* scheduler, Unit* unit, int root, int first) {
+    TACFunction* function = scheduler->function;
+    const Selection* selection = scheduler->selection;
+    IntList defined = {NULL, 0, 0};
+
+    memset(unit, 0, sizeof(Unit));
+    unit->root = root;
+    unit->def = TACDefinedVar(&function->code[root]);
+    unit->pinned = IsBarrier(function->code[root].op);
+    for (int i = first; i < root; i++) {
+        if (selection->root[i] == root) {
+            IntListPush(&unit->members, i);
+        }
+    }
+
+    // The unit's latency is its longest chain, from the members to the root
+    int* ready = CheckedMalloc((unit->members.count + 1) * sizeof(int));
+    for (int m = 0; m <= unit->members.count; m++) {
+        int index = m < unit->members.count ? unit->members.items[m] : root;
+        TACInstruction* instr = &function->code[index];
+        int start = 0;
+
+        for (int k = 0; k < TACUseCount(instr); k++) {
+            TACOperand* use = TACUseAt(instr, k);
+            if (use->kind != TAC_OPERAND_VAR) {
+                continue;
+            }
+            int producer = -1;
+            for (int d = 0; d < defined.count; d++) {
+                if (defined.items[d] == use->value.id) {
+                    producer = d;
+                }
+            }
+            if (producer >= 0) {
+                start = ready[producer] > start ? ready[producer] : start;
+            } else if (!IntListContains(&unit->reads, use->value.id)) {
+                IntListPush(&unit->reads, use->value.id);
+            }
+        }
+        ready[m] = start + InstructionLatency(function, instr);
+        IntListPush(&defined, TACDefinedVar(instr));
+
+        if (instr->op == TAC_LOAD_INDEX || HasSideEffects(instr)) {
+            unit->ordered = 1;
+        }
+    }
+    unit->latency = ready[unit->members.count];
+
+    free(ready);
+    IntListFree(&defined);
+}
+
+static void AddDependence(Unit* from, Unit* to, int latency) {
+    IntListPush(&from->succs, (int)(to - from));
+    IntListPush(&from->succs, latency);
+    to->preds++;
+}
+
+/**
+ * @brief Links every pair of units whose order matters
+ *
+ * A read waits for the write it reads, with the writer's latency; a write
+ * waits for the reads and writes of the same variable before it. Units
+ * that may trap keep their order, so the same error is reported first, and
+ * the branch ending the region comes after everything.
+ */
+static void LinkUnits(Unit* units, int count) {
+    for (int b = 0; b < count; b++) {
+        for (int a = 0; a < b; a++) {
+            Unit* first = &units[a];
+            Unit* second = &units[b];
+            int latency = -1;
+
+            if (first->def >= 0 && IntListContains(&second->reads, first->def)) {
+                latency = first->latency;
+            } else if ((second->def >= 0 &&
+                        (IntListContains(&first->reads, second->def) || first->def == second->def)) ||
+                       (first->ordered && second->ordered) || second->pinned) {
+                latency = 0;
+            }
+            if (latency >= 0) {
+                AddDependence(first, second, latency);
+            }
+        }
+    }
+
+    // Successors always come later, so heights are done last to first
+    for (int u = count - 1; u >= 0; u--) {
+        Unit* unit = &units[u];
+        unit->height = unit->latency;
+        for (int s = 0; s < unit->succs.count; s += 2) {
+            int height = unit->succs.items[s + 1] + units[u + unit->succs.items[s]].height;
+            if (height > unit->height) {
+                unit->height = height;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Returns how many more values would be live after scheduling a unit
+ */
+static int PressureChange(const Scheduler* scheduler, const Unit* unit) {
+    int change = unit->def >= 0 && !scheduler->live[unit->def] ? 1 : 0;
+
+    for (int r = 0; r < unit->reads.count; r++) {
+        int var = unit->reads.items[r];
+        if (scheduler->dies[var] && scheduler->live[var] && scheduler->remaining[var] == 1 && var != unit->def) {
+            change--;
+        }
+    }
+    return change;
+}
+
+static int UnderPressure(const Scheduler* scheduler) {
+    return scheduler->pressure[0] >= NUM_INT_REGISTERS || scheduler->pressure[1] >= NUM_FLOAT_REGISTERS;
+}
+
+/**
+ * @brief Checks whether a ready unit is a better pick than another for the cycle
+ *
+ * While either register class is full, whatever frees the most registers
+ * goes first, and source order decides the rest. Otherwise a unit whose
+ * operands are ready beats one that would stall, then the longer chain
+ * left behind it goes first, then source order.
+ */
+static int Prefer(const Scheduler* scheduler, const Unit* a, const Unit* b, int cycle) {
+    if (UnderPressure(scheduler)) {
+        int pa = PressureChange(scheduler, a);
+        int pb = PressureChange(scheduler, b);
+        if (pa != pb) {
+            return pa < pb;
+        }
+        return a->root < b->root;
+    }
+    int stallA = a->readyCycle > cycle ? a->readyCycle - cycle : 0;
+    int stallB = b->readyCycle > cycle ? b->readyCycle - cycle : 0;
+    if (stallA != stallB) {
+        return stallA < stallB;
+    }
+    if (a->height != b->height) {
+        return a->height > b->height;
+    }
+    return a->root < b->root;
+}
+
+static void Issue(Scheduler* scheduler, Unit* unit) {
+    for (int r = 0; r < unit->reads.count; r++) {
+        int var = unit->reads.items[r];
+        if (--scheduler->remaining[var] == 0 && scheduler->dies[var] && scheduler->live[var]) {
+            scheduler->live[var] = 0;
+            scheduler->pressure[ValueClass(scheduler, var)]--;
+        }
+    }
+    if (unit->def >= 0 && !scheduler->live[unit->def] &&
+        (!scheduler->dies[unit->def] || scheduler->remaining[unit->def] > 0)) {
+        scheduler->live[unit->def] = 1;
+        scheduler->pressure[ValueClass(scheduler, unit->def)]++;
+    }
+    unit->scheduled = 1;
+}
+
+/**
+ * @brief List-schedules the instructions from first up to end, which have no barrier among them
+ *
+ * @return The number of instructions that moved
+ */
+static int ScheduleRegion(Scheduler* scheduler, int first, int end) {
+    TACFunction* function = scheduler->function;
+    const Selection* selection = scheduler->selection;
+    Unit* units = CheckedMalloc((end - first + 1) * sizeof(Unit));
+    int count = 0;
+    int moved = 0;
+
+    // A tree reaching past the region has to stay where it is
+    for (int i = first; i < end; i++) {
+        if (selection->root[i] >= end) {
+            free(units);
+            return 0;
+        }
+    }
+    for (int i = first; i < end; i++) {
+        if (selection->root[i] < 0) {
+            BuildUnit(scheduler, &units[count++], i, first);
+        }
+    }
+    LinkUnits(units, count);
+    for (int u = 0; u < count; u++) {
+        for (int r = 0; r < units[u].reads.count; r++) {
+            scheduler->remaining[units[u].reads.items[r]]++;
+        }
+    }
+
+    // Pressure starts with everything live on entry, whether the region touches it or not
+    scheduler->pressure[0] = 0;
+    scheduler->pressure[1] = 0;
+    for (int v = 0; v < scheduler->liveness->varCount; v++) {
+        const LiveInterval* interval = &scheduler->liveness->intervals[v];
+        scheduler->live[v] = (char)IntervalCovers(interval, USE_POSITION(first));
+        scheduler->dies[v] = (char)!IntervalCovers(interval, DEF_POSITION(end - 1));
+        if (scheduler->live[v]) {
+            scheduler->pressure[ValueClass(scheduler, v)]++;
+        }
+    }
+
+    TACInstruction* code = CheckedMalloc((end - first + 1) * sizeof(TACInstruction));
+    int placed = 0;
+    int cycle = 0;
+    int issued = 0;
+    for (int n = 0; n < count; n++) {
+        Unit* best = NULL;
+        for (int u = 0; u < count; u++) {
+            if (!units[u].scheduled && units[u].preds == 0 &&
+                (best == NULL || Prefer(scheduler, &units[u], best, cycle))) {
+                best = &units[u];
+            }
+        }
+
+        if (best->readyCycle > cycle) {
+            cycle = best->readyCycle;
+            issued = 0;
+        }
+        Issue(scheduler, best);
+        for (int s = 0; s < best->succs.count; s += 2) {
+            Unit* succ = best + best->succs.items[s];
+            int ready = cycle + best->succs.items[s + 1];
+            succ->readyCycle = ready > succ->readyCycle ? ready : succ->readyCycle;
+            succ->preds--;
+        }
+        if (++issued == ISSUE_WIDTH) {
+            cycle++;
+            issued = 0;
+        }
+
+        for (int m = 0; m <= best->members.count; m++) {
+            int index = m < best->members.count ? best->members.items[m] : best->root;
+            moved += first + placed != index;
+            code[placed++] = function->code[index];
+        }
+    }
+    memcpy(&function->code[first], code, (end - first) * sizeof(TACInstruction));
+
+    for (int u = 0; u < count; u++) {
+        for (int r = 0; r < units[u].reads.count; r++) {
+            scheduler->remaining[units[u].reads.items[r]] = 0;
+        }
+        IntListFree(&units[u].members);
+        IntListFree(&units[u].reads);
+        IntListFree(&units[u].succs);
+    }
+    free(units);
+    free(code);
+    return moved;
+}
+
+/**
+ * @brief Reorders the instructions of each basic block to keep a superscalar core busy
+ *
+ * A list scheduler over the dependence graph of each stretch of a block
+ * between calls: every step starts the ready instruction with the longest
+ * chain of latencies behind it, preferring ones whose operands have
+ * arrived, so independent computations interleave and long-latency loads,
+ * multiplies and divides start early. An instruction and those folded into
+ * its tree move as one. The values live at each point are tracked from
+ * the live intervals; while they fill a register class, whatever frees
+ * registers goes first and source order decides the rest, so the schedule
+ * does not cause spills the source order would not.
+ *
+ * Runs before register allocation. Instruction indices change, so the
+ * selection and liveness have to be computed again afterwards.
+ *
+ * @param liveness Liveness of the function, out of SSA form, with the selection's instructions folded
+ * @param selection The instructions folded into the trees of others
+ * @return The number of instructions that moved
+ */
+int ScheduleBlocks(const Liveness* liveness, const Selection* selection) {
+    TACFunction* function = liveness->function;
+    Scheduler scheduler;
+    int moved = 0;
+
+    memset(&scheduler, 0, sizeof(Scheduler));
+    scheduler.function = function;
+    scheduler.liveness = liveness;
+    scheduler.selection = selection;
+    scheduler.remaining = CheckedCalloc(function->varCount + 1, sizeof(int));
+    scheduler.live = CheckedCalloc(function->varCount + 1, sizeof(char));
+    scheduler.dies = CheckedCalloc(function->varCount + 1, sizeof(char));
+
+    int first = 0;
+    for (int i = 0; i <= function->count; i++) {
+        if (i < function->count && !IsBarrier(function->code[i].op)) {
+            continue;
+        }
+        // A branch ends its region, since the tree it tests is part of it
+        int end = i < function->count && (function->code[i].op == TAC_IF || function->code[i].op == TAC_IFFALSE)
+                      ? i + 1
+                      : i;
+        if (end - first > 2) {
+            moved += ScheduleRegion(&scheduler, first, end);
+        }
+        first = i + 1;
+    }
+
+    free(scheduler.remaining);
+    free(scheduler.live);
+    free(scheduler.dies);
+    return moved;
+}
@@ -0,0 +1,9 @@
+#ifndef schedule_h
+#define schedule_h
+
+#include "isel.h"
+#include "liveness.h"
+
+int ScheduleBlocks(const Liveness* liveness, const Selection* selection);
+
+#endif
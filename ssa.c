@@ -0,0 +1,707 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ssa.h"
+#include "cfg.h"
+
+/**
+ * @brief Makes every basic block start with a label
+ *
+ * Phi arguments name the predecessor they flow in from by its label, so
+ * every block needs one while the function is in SSA form. If the entry
+ * block is itself the target of a jump (a loop at the very top of the
+ * function), a fresh entry label is placed in front of it so that the entry
+ * block has no predecessors.
+ *
+ * @param function The function to label
+ */
+void EnsureBlockLabels(TACFunction* function) {
+    int n = function->count;
+    char* leader = CheckedCalloc(n + 1, sizeof(char));
+    leader[0] = 1;
+    for (int i = 0; i < n; i++) {
+        if (EndsBlock(function->code[i].op)) {
+            leader[i + 1] = 1;
+        }
+    }
+
+    int missing = 0;
+    for (int i = 0; i < n; i++) {
+        if (leader[i] && function->code[i].op != TAC_LABEL) {
+            missing++;
+        }
+    }
+
+    int entryIsTarget = 0;
+    if (n > 0 && function->code[0].op == TAC_LABEL) {
+        int entryLabel = function->code[0].result.value.id;
+        for (int i = 0; i < n; i++) {
+            if (IsBranchOp(function->code[i].op) && function->code[i].result.value.id == entryLabel) {
+                entryIsTarget = 1;
+                break;
+            }
+        }
+    }
+
+    if (missing == 0 && !entryIsTarget && n > 0) {
+        free(leader);
+        return;
+    }
+
+    int capacity = n + missing + 1;
+    TACInstruction* code = CheckedMalloc(capacity * sizeof(TACInstruction));
+    int out = 0;
+
+    TACInstruction label;
+    memset(&label, 0, sizeof(TACInstruction));
+    label.op = TAC_LABEL;
+
+    if (entryIsTarget || n == 0) {
+        label.result = LabelOperand(NewLabel(function));
+        code[out++] = label;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (leader[i] && function->code[i].op != TAC_LABEL) {
+            label.result = LabelOperand(NewLabel(function));
+            code[out++] = label;
+        }
+        code[out++] = function->code[i];
+    }
+    free(leader);
+
+    free(function->code);
+    function->code = code;
+    function->count = out;
+    function->capacity = capacity;
+}
+
+/**
+ * @brief Returns the value a variable has on a path where it was never assigned
+ *
+ * Zara variables are initialized when declared, so this only happens for
+ * variables declared in a branch and read after it.
+ *
+ * @param function The function the variable belongs to
+ * @param var The variable
+ * @return A zero constant of the variable's type
+ */
+static TACOperand UndefinedValue(TACFunction* function, int var) {
+    switch (function->vars[var].type) {
+    case FLOAT:
+        return FloatOperand(0.0f);
+    case STRING:
+        return StringOperand(InternString(function->program, ""));
+    default:
+        return IntOperand(0);
+    }
+}
+
+/**
+ * @brief Creates the next SSA version of a variable
+ *
+ * The first definition reached keeps the original variable, so variables
+ * that are assigned once (most temporaries) keep their names.
+ *
+ * @param function The function the variable belongs to
+ * @param versionCount The number of versions created so far, per variable
+ * @param var The original variable
+ * @return The id of the new version
+ */
+static int NewVersion(TACFunction* function, int* versionCount, int var) {
+    if (versionCount[var]++ == 0) {
+        return var;
+    }
+
+    char name[MAX_NAME_LENGTH];
+    snprintf(name, sizeof(name), "%.*s_%d", MAX_NAME_LENGTH - 16, function->vars[var].name, versionCount[var] - 1);
+
+    int id = AddTACVariable(function, name, function->vars[var].type);
+    function->vars[id].elementType = function->vars[var].elementType;
+    function->vars[id].isTemp = function->vars[var].isTemp;
+    function->vars[id].origin = var;
+    return id;
+}
+
+static TACOperand CurrentVersion(TACFunction* function, IntList* stacks, int var) {
+    if (stacks[var].count == 0) {
+        return UndefinedValue(function, var);
+    }
+    return VarOperand(stacks[var].items[stacks[var].count - 1]);
+}
+
+/**
+ * @brief Inserts phi functions at the dominance frontiers of each variable's definitions
+ *
+ * Phis are placed only for variables that are live on entry to some block
+ * (semi-pruned SSA), using the iterated dominance frontier worklist of
+ * Cytron et al. Each phi gets one argument slot per predecessor.
+ *
+ * @param function The function to modify
+ * @param cfg The graph of the function, with dominance frontiers
+ * @param phiOrigin Set to an array mapping each new instruction index to the
+ *                  variable its phi merges, -1 for other instructions
+ */
+static void PlacePhis(TACFunction* function, CFG* cfg, int** phiOrigin) {
+    int varCount = function->varCount;
+    int blockCount = cfg->blockCount;
+
+    IntList* defBlocks = CheckedCalloc(varCount, sizeof(IntList));
+    char* isGlobal = CheckedCalloc(varCount, sizeof(char));
+    int* killed = CheckedMalloc(varCount * sizeof(int));
+    for (int v = 0; v < varCount; v++) {
+        killed[v] = -1;
+    }
+
+    for (int p = 0; p < function->paramCount; p++) {
+        IntListPush(&defBlocks[p], 0);
+        killed[p] = 0;
+    }
+
+    for (int r = 0; r < cfg->rpoCount; r++) {
+        int b = cfg->rpo[r];
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            TACInstruction* instr = &function->code[i];
+            for (int k = 0; k < TACUseCount(instr); k++) {
+                TACOperand* use = TACUseAt(instr, k);
+                if (use->kind == TAC_OPERAND_VAR && killed[use->value.id] != b) {
+                    isGlobal[use->value.id] = 1;
+                }
+            }
+            int def = TACDefinedVar(instr);
+            if (def >= 0 && killed[def] != b) {
+                killed[def] = b;
+                IntListPush(&defBlocks[def], b);
+            }
+        }
+    }
+
+    IntList* phiVars = CheckedCalloc(blockCount, sizeof(IntList));
+    int* hasPhi = CheckedMalloc(blockCount * sizeof(int));
+    int* inWork = CheckedMalloc(blockCount * sizeof(int));
+    for (int b = 0; b < blockCount; b++) {
+        hasPhi[b] = -1;
+        inWork[b] = -1;
+    }
+
+    IntList work = {0};
+    int phiTotal = 0;
+    for (int v = 0; v < varCount; v++) {
+        if (!isGlobal[v]) {
+            continue;
+        }
+
+        work.count = 0;
+        for (int i = 0; i < defBlocks[v].count; i++) {
+            inWork[defBlocks[v].items[i]] = v;
+            IntListPush(&work, defBlocks[v].items[i]);
+        }
+
+        while (work.count > 0) {
+            int b = work.items[--work.count];
+            IntList* frontier = &cfg->blocks[b].frontier;
+            for (int i = 0; i < frontier->count; i++) {
+                int d = frontier->items[i];
+                if (hasPhi[d] != v) {
+                    hasPhi[d] = v;
+                    IntListPush(&phiVars[d], v);
+                    phiTotal++;
+                    if (inWork[d] != v) {
+                        inWork[d] = v;
+                        IntListPush(&work, d);
+                    }
+                }
+            }
+        }
+    }
+    IntListFree(&work);
+
+    int capacity = function->count + phiTotal;
+    TACInstruction* code = CheckedMalloc(capacity * sizeof(TACInstruction));
+    int* origin = CheckedMalloc(capacity * sizeof(int));
+    int out = 0;
+
+    for (int b = 0; b < blockCount; b++) {
+        BasicBlock* block = &cfg->blocks[b];
+        for (int i = block->start; i < block->end; i++) {
+            origin[out] = -1;
+            code[out++] = function->code[i];
+
+            if (i != block->start) {
+                continue;
+            }
+            for (int k = 0; k < phiVars[b].count; k++) {
+                int v = phiVars[b].items[k];
+                TACInstruction* phi = &code[out];
+                memset(phi, 0, sizeof(TACInstruction));
+                phi->op = TAC_PHI;
+                phi->result = VarOperand(v);
+                phi->phiCount = block->preds.count;
+                phi->phiArgs = CheckedMalloc(block->preds.count * sizeof(TACPhiArg));
+                for (int j = 0; j < block->preds.count; j++) {
+                    phi->phiArgs[j].value = NoOperand();
+                    phi->phiArgs[j].pred = BlockLabel(cfg, block->preds.items[j]);
+                }
+                origin[out++] = v;
+            }
+        }
+    }
+
+    free(function->code);
+    function->code = code;
+    function->count = out;
+    function->capacity = capacity;
+    *phiOrigin = origin;
+
+    for (int v = 0; v < varCount; v++) {
+        IntListFree(&defBlocks[v]);
+    }
+    for (int b = 0; b < blockCount; b++) {
+        IntListFree(&phiVars[b]);
+    }
+    free(defBlocks);
+    free(isGlobal);
+    free(killed);
+    free(phiVars);
+    free(hasPhi);
+    free(inWork);
+}
+
+/**
+ * @brief Renames every definition to a fresh version and every use to the version reaching it
+ *
+ * Walks the dominator tree keeping a stack of the current version of each
+ * original variable. The walk uses an explicit stack, and the versions a
+ * block pushed are popped through a log when the walk leaves the block.
+ *
+ * @param function The function to rename
+ * @param cfg The graph of the function, with dominators
+ * @param phiOrigin The variable merged by each phi, indexed by instruction
+ */
+static void RenameVariables(TACFunction* function, CFG* cfg, const int* phiOrigin) {
+    int originalCount = function->varCount;
+    IntList* stacks = CheckedCalloc(originalCount, sizeof(IntList));
+    int* versionCount = CheckedCalloc(originalCount, sizeof(int));
+    IntList log = {0};
+
+    for (int p = 0; p < function->paramCount; p++) {
+        versionCount[p] = 1;
+        IntListPush(&stacks[p], p);
+    }
+
+    int blockCount = cfg->blockCount;
+    int* savedLog = CheckedMalloc(blockCount * sizeof(int));
+    char* entered = CheckedCalloc(blockCount, sizeof(char));
+    int* walk = CheckedMalloc(blockCount * sizeof(int));
+    int top = 0;
+    walk[top++] = 0;
+
+    while (top > 0) {
+        int b = walk[top - 1];
+        BasicBlock* block = &cfg->blocks[b];
+
+        if (entered[b]) {
+            while (log.count > savedLog[b]) {
+                stacks[log.items[--log.count]].count--;
+            }
+            top--;
+            continue;
+        }
+        entered[b] = 1;
+        savedLog[b] = log.count;
+
+        for (int i = block->start; i < block->end; i++) {
+            TACInstruction* instr = &function->code[i];
+
+            if (instr->op == TAC_PHI) {
+                int v = phiOrigin[i];
+                int version = NewVersion(function, versionCount, v);
+                instr->result = VarOperand(version);
+                IntListPush(&stacks[v], version);
+                IntListPush(&log, v);
+                continue;
+            }
+
+            for (int k = 0; k < TACUseCount(instr); k++) {
+                TACOperand* use = TACUseAt(instr, k);
+                if (use->kind == TAC_OPERAND_VAR) {
+                    *use = CurrentVersion(function, stacks, use->value.id);
+                }
+            }
+
+            int def = TACDefinedVar(instr);
+            if (def >= 0) {
+                int version = NewVersion(function, versionCount, def);
+                instr->result = VarOperand(version);
+                IntListPush(&stacks[def], version);
+                IntListPush(&log, def);
+            }
+        }
+
+        int label = BlockLabel(cfg, b);
+        for (int s = 0; s < block->succs.count; s++) {
+            BasicBlock* succ = &cfg->blocks[block->succs.items[s]];
+            for (int i = succ->start; i < succ->end; i++) {
+                TACInstruction* phi = &function->code[i];
+                if (phi->op == TAC_LABEL) {
+                    continue;
+                }
+                if (phi->op != TAC_PHI) {
+                    break;
+                }
+                for (int k = 0; k < phi->phiCount; k++) {
+                    if (phi->phiArgs[k].pred == label) {
+                        phi->phiArgs[k].value = CurrentVersion(function, stacks, phiOrigin[i]);
+                    }
+                }
+            }
+        }
+
+        for (int c = block->domChild; c != -1; c = cfg->blocks[c].domSibling) {
+            walk[top++] = c;
+        }
+    }
+
+    for (int v = 0; v < originalCount; v++) {
+        IntListFree(&stacks[v]);
+    }
+    free(stacks);
+    free(versionCount);
+    IntListFree(&log);
+    free(savedLog);
+    free(entered);
+    free(walk);
+}
+
+/**
+ * @brief Converts a function to static single assignment form
+ *
+ * Unreachable blocks are dropped, every block is given a label, phis are
+ * placed with dominance frontiers and variables are renamed so that each one
+ * is assigned exactly once. Versions are named after the original variable
+ * (x, x_1, x_2, ...) and record it in their origin field.
+ *
+ * @param function The function to convert
+ */
+void BuildSSA(TACFunction* function) {
+    if (function->isSSA) {
+        return;
+    }
+
+    RemoveUnreachableBlocks(function);
+    EnsureBlockLabels(function);
+
+    CFG cfg = BuildCFG(function);
+    ComputeDominators(&cfg);
+    ComputeDominanceFrontiers(&cfg);
+
+    int* phiOrigin = NULL;
+    PlacePhis(function, &cfg, &phiOrigin);
+    FreeCFG(&cfg);
+
+    cfg = BuildCFG(function);
+    ComputeDominators(&cfg);
+    RenameVariables(function, &cfg, phiOrigin);
+    FreeCFG(&cfg);
+
+    free(phiOrigin);
+    function->isSSA = 1;
+}
+
+/**
+ * @brief Orders a set of parallel copies so they can run one after another
+ *
+ * A copy is emitted once no other pending copy still reads its destination.
+ * When only cycles remain (for example a swap), one destination is saved in
+ * a fresh temporary and the copies reading it are redirected there.
+ *
+ * @param function The function the copies belong to
+ * @param dests The destination variable of each copy
+ * @param srcs The source of each copy; may be modified
+ * @param n The number of copies
+ * @param out Receives the sequential copies; must have room for 2 * n
+ * @return The number of instructions written to out
+ */
+static int SequentializeCopies(TACFunction* function, const int* dests, TACOperand* srcs, int n, TACInstruction* out) {
+    char* pending = CheckedMalloc(n + 1);
+    int remaining = 0;
+    int count = 0;
+
+    for (int i = 0; i < n; i++) {
+        pending[i] = !(srcs[i].kind == TAC_OPERAND_VAR && srcs[i].value.id == dests[i]);
+        remaining += pending[i];
+    }
+
+    while (remaining > 0) {
+        int progress = 0;
+
+        for (int i = 0; i < n; i++) {
+            if (!pending[i]) {
+                continue;
+            }
+
+            int blocked = 0;
+            for (int j = 0; j < n && !blocked; j++) {
+                blocked = j != i && pending[j] && srcs[j].kind == TAC_OPERAND_VAR && srcs[j].value.id == dests[i];
+            }
+            if (blocked) {
+                continue;
+            }
+
+            memset(&out[count], 0, sizeof(TACInstruction));
+            out[count].op = TAC_ASSIGN;
+            out[count].arg1 = srcs[i];
+            out[count].result = VarOperand(dests[i]);
+            count++;
+            pending[i] = 0;
+            remaining--;
+            progress = 1;
+        }
+
+        if (progress) {
+            continue;
+        }
+
+        // Every pending copy is on a cycle: save one destination and break it
+        for (int i = 0; i < n; i++) {
+            if (!pending[i]) {
+                continue;
+            }
+
+            int temp = NewTemp(function, function->vars[dests[i]].type);
+            memset(&out[count], 0, sizeof(TACInstruction));
+            out[count].op = TAC_ASSIGN;
+            out[count].arg1 = VarOperand(dests[i]);
+            out[count].result = VarOperand(temp);
+            count++;
+
+            for (int j = 0; j < n; j++) {
+                if (pending[j] && srcs[j].kind == TAC_OPERAND_VAR && srcs[j].value.id == dests[i]) {
+                    srcs[j] = VarOperand(temp);
+                }
+            }
+            break;
+        }
+    }
+
+    free(pending);
+    return count;
+}
+
+typedef struct {
+    TACInstruction* items;
+    int count;
+    int capacity;
+} InstructionList;
+
+static void InstructionListAppend(InstructionList* list, const TACInstruction* instrs, int n) {
+    if (list->count + n > list->capacity) {
+        while (list->count + n > list->capacity) {
+            list->capacity = list->capacity == 0 ? 8 : list->capacity * 2;
+        }
+        list->items = CheckedRealloc(list->items, list->capacity * sizeof(TACInstruction));
+    }
+    memcpy(&list->items[list->count], instrs, n * sizeof(TACInstruction));
+    list->count += n;
+}
+
+/**
+ * @brief Translates a function out of SSA form
+ *
+ * Each phi becomes a parallel copy on every incoming edge. Copies go at the
+ * end of the predecessor when it has a single successor; critical edges are
+ * split, either by a new block placed between a predecessor and the block it
+ * falls into, or by a new block at the end of the function that the branch
+ * is redirected to. Labels that are no longer needed are removed.
+ *
+ * @param function The function to convert
+ */
+void DestroySSA(TACFunction* function) {
+    if (!function->isSSA) {
+        return;
+    }
+
+    CFG cfg = BuildCFG(function);
+    int n = function->count;
+    InstructionList* before = CheckedCalloc(n + 1, sizeof(InstructionList));
+    InstructionList appendix = {0};
+
+    int* dests = NULL;
+    TACOperand* srcs = NULL;
+    TACInstruction* copies = NULL;
+    int copyCapacity = 0;
+
+    for (int b = 0; b < cfg.blockCount; b++) {
+        BasicBlock* block = &cfg.blocks[b];
+        int firstPhi = block->start;
+        while (firstPhi < block->end && function->code[firstPhi].op == TAC_LABEL) {
+            firstPhi++;
+        }
+        int lastPhi = firstPhi;
+        while (lastPhi < block->end && function->code[lastPhi].op == TAC_PHI) {
+            lastPhi++;
+        }
+        int phiCount = lastPhi - firstPhi;
+        if (phiCount == 0) {
+            continue;
+        }
+
+        if (phiCount > copyCapacity) {
+            copyCapacity = phiCount;
+            dests = CheckedRealloc(dests, copyCapacity * sizeof(int));
+            srcs = CheckedRealloc(srcs, copyCapacity * sizeof(TACOperand));
+            copies = CheckedRealloc(copies, 2 * copyCapacity * sizeof(TACInstruction));
+        }
+
+        int labelB = BlockLabel(&cfg, b);
+
+        for (int i = 0; i < block->preds.count; i++) {
+            int p = block->preds.items[i];
+            int labelP = BlockLabel(&cfg, p);
+            int copyCount = 0;
+
+            for (int k = firstPhi; k < lastPhi; k++) {
+                TACInstruction* phi = &function->code[k];
+                for (int a = 0; a < phi->phiCount; a++) {
+                    if (phi->phiArgs[a].pred == labelP) {
+                        dests[copyCount] = phi->result.value.id;
+                        srcs[copyCount] = phi->phiArgs[a].value;
+                        copyCount++;
+                        break;
+                    }
+                }
+            }
+
+            int sequenced = SequentializeCopies(function, dests, srcs, copyCount, copies);
+            if (sequenced == 0) {
+                continue;
+            }
+
+            BasicBlock* pred = &cfg.blocks[p];
+            TACInstruction* last = &function->code[pred->end - 1];
+
+            if (last->op == TAC_GOTO) {
+                InstructionListAppend(&before[pred->end - 1], copies, sequenced);
+            } else if (last->op == TAC_IF || last->op == TAC_IFFALSE) {
+                if (pred->succs.count == 1) {
+                    last->op = TAC_GOTO;
+                    last->arg1 = NoOperand();
+                    InstructionListAppend(&before[pred->end - 1], copies, sequenced);
+                } else if (last->result.value.id == labelB) {
+                    // Critical taken edge: branch to a new block that copies and jumps on
+                    TACInstruction jump;
+                    memset(&jump, 0, sizeof(TACInstruction));
+                    jump.op = TAC_LABEL;
+                    jump.result = LabelOperand(NewLabel(function));
+                    last->result = jump.result;
+                    InstructionListAppend(&appendix, &jump, 1);
+                    InstructionListAppend(&appendix, copies, sequenced);
+                    jump.op = TAC_GOTO;
+                    jump.result = LabelOperand(labelB);
+                    InstructionListAppend(&appendix, &jump, 1);
+                } else {
+                    // Critical fallthrough edge: the copies form a block of their own
+                    InstructionListAppend(&before[pred->end], copies, sequenced);
+                }
+            } else {
+                InstructionListAppend(&before[pred->end], copies, sequenced);
+            }
+        }
+    }
+    FreeCFG(&cfg);
+
+    int total = n + appendix.count;
+    for (int i = 0; i <= n; i++) {
+        total += before[i].count;
+    }
+
+    TACInstruction* code = CheckedMalloc((total + 1) * sizeof(TACInstruction));
+    int out = 0;
+    for (int i = 0; i <= n; i++) {
+        if (before[i].count > 0) {
+            memcpy(&code[out], before[i].items, before[i].count * sizeof(TACInstruction));
+            out += before[i].count;
+        }
+        free(before[i].items);
+
+        if (i == n) {
+            break;
+        }
+        if (function->code[i].op == TAC_PHI) {
+            free(function->code[i].phiArgs);
+            continue;
+        }
+        code[out++] = function->code[i];
+    }
+    if (appendix.count > 0) {
+        memcpy(&code[out], appendix.items, appendix.count * sizeof(TACInstruction));
+        out += appendix.count;
+    }
+
+    free(appendix.items);
+    free(before);
+    free(dests);
+    free(srcs);
+    free(copies);
+
+    free(function->code);
+    function->code = code;
+    function->count = out;
+    function->capacity = total + 1;
+    function->isSSA = 0;
+
+    RemoveUnusedLabels(function);
+}
+
+/**
+ * @brief Builds def-use chains for a function
+ *
+ * In SSA form every variable has exactly one definition, so the chains give
+ * constant-time access from a value to its definition and to all its uses.
+ *
+ * @param function The function to analyze
+ * @return The chains; release them with FreeDefUseChains
+ */
+DefUseChains BuildDefUseChains(TACFunction* function) {
+    DefUseChains chains;
+    chains.varCount = function->varCount;
+    chains.def = CheckedMalloc(function->varCount * sizeof(int));
+    chains.uses = CheckedCalloc(function->varCount, sizeof(IntList));
+
+    for (int v = 0; v < function->varCount; v++) {
+        chains.def[v] = -1;
+    }
+
+    for (int i = 0; i < function->count; i++) {
+        TACInstruction* instr = &function->code[i];
+        int def = TACDefinedVar(instr);
+        if (def >= 0) {
+            chains.def[def] = i;
+        }
+        for (int k = 0; k < TACUseCount(instr); k++) {
+            TACOperand* use = TACUseAt(instr, k);
+            if (use->kind == TAC_OPERAND_VAR) {
+                IntListPush(&chains.uses[use->value.id], i);
+            }
+        }
+    }
+
+    return chains;
+}
+
+/**
+ * @brief Releases def-use chains
+ *
+ * @param chains The chains to free
+ */
+void FreeDefUseChains(DefUseChains* chains) {
+    for (int v = 0; v < chains->varCount; v++) {
+        IntListFree(&chains->uses[v]);
+    }
+    free(chains->def);
+    free(chains->uses);
+    chains->def = NULL;
+    chains->uses = NULL;
+    chains->varCount = 0;
+}
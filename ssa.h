@@ -0,0 +1,20 @@
+#ifndef ssa_h
+#define ssa_h
+
+#include "tac.h"
+#include "util.h"
+
+typedef struct {
+    int varCount;
+    int* def;          // Variable -> index of its defining instruction, -1 for params
+    IntList* uses;     // Variable -> indices of the instructions that read it
+} DefUseChains;
+
+void EnsureBlockLabels(TACFunction* function);
+void BuildSSA(TACFunction* function);
+void DestroySSA(TACFunction* function);
+
+DefUseChains BuildDefUseChains(TACFunction* function);
+void FreeDefUseChains(DefUseChains* chains);
+
+#endif
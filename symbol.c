@@ -1,4 +1,5 @@
 #include "symbol.h"
+#include "util.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,6 +15,21 @@ void InitSymbolTable(SymbolTable *table)
     table->count = 0;
 }
 
+/**
+ * @brief Sets the value of a string symbol to a heap copy of the given text,
+ *        releasing any value it held before
+ *
+ * @param symbol The symbol to set
+ * @param value The text to copy
+ */
+static void CopyStringValue(Symbol *symbol, const char *value)
+{
+
+    free(symbol->value.stringValue);
+    symbol->value.stringValue = CheckedMalloc(strlen(value) + 1);
+    strcpy(symbol->value.stringValue, value);
+}
+
 /**
  * @brief Adds a symbol to the symbol table
  *
@@ -47,6 +63,14 @@ int AddSymbol(SymbolTable *table, char *name, DataType type, void *value)
     strcpy(table->symbols[table->count].name, name);
     table->symbols[table->count].type = type;
 
+    if (value == NULL)
+    {
+        // Declared without an initializer: start from a zeroed value
+        memset(&table->symbols[table->count].value, 0, sizeof(table->symbols[table->count].value));
+        table->count++;
+        return 0;
+    }
+
     switch (type)
     {
     case INTEGER:
@@ -56,7 +80,8 @@ int AddSymbol(SymbolTable *table, char *name, DataType type, void *value)
         table->symbols[table->count].value.floatValue = *(float *)value;
         break;
     case STRING:
-        strcpy(table->symbols[table->count].value.stringValue, (char *)value);
+        table->symbols[table->count].value.stringValue = NULL;
+        CopyStringValue(&table->symbols[table->count], (char *)value);
         break;
     case ARRAY:
 
@@ -131,7 +156,7 @@ int UpdateSymbolValue(SymbolTable *table, char *name, void *value)
 
     case STRING:
 
-        strcpy(sym->value.stringValue, (char *)value);
+        CopyStringValue(sym, (char *)value);
         break;
 
     case ARRAY:
@@ -173,7 +198,8 @@ void DisplayTable(SymbolTable *table)
             printf("Type: FLOAT, Value: %.2f\n", table->symbols[i].value.floatValue);
             break;
         case STRING:
-            printf("Type: STRING, Value: %s\n", table->symbols[i].value.stringValue);
+            printf("Type: STRING, Value: %s\n",
+                   table->symbols[i].value.stringValue != NULL ? table->symbols[i].value.stringValue : "");
             break;
         case ARRAY:
             printf("Type: ARRAY, Value: ");
@@ -183,6 +209,9 @@ void DisplayTable(SymbolTable *table)
             }
             printf("\n");
             break;
+        case STACK:
+            printf("Type: STACK\n");
+            break;
         }
     }
 }
\ No newline at end of file
@@ -22,7 +22,7 @@ typedef struct
     {
         int intValue;
         float floatValue;
-        char stringValue[MAX_NAME_LENGTH];
+        char* stringValue;
         int intArray[MAX_ARRAY_LENGTH];
     } value;
     
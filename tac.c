@@ -0,0 +1,786 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tac.h"
+#include "util.h"
+
+/**
+ * @brief Initializes an empty TAC program
+ *
+ * @param program The program to initialize
+ */
+void InitTACProgram(TACProgram* program) {
+    program->functions = NULL;
+    program->functionCount = 0;
+    program->functionCapacity = 0;
+    program->strings = NULL;
+    program->stringCount = 0;
+    program->stringCapacity = 0;
+}
+
+/**
+ * @brief Releases the instructions and variables owned by a TAC function
+ *
+ * @param function The function to free
+ */
+void FreeTACFunction(TACFunction* function) {
+    for (int j = 0; j < function->count; j++) {
+        free(function->code[j].phiArgs);
+    }
+    for (int j = 0; j < function->vectorLoopCount; j++) {
+        free(function->vectorLoops[j].ops);
+        free(function->vectorLoops[j].reductions);
+    }
+    free(function->code);
+    free(function->vars);
+    free(function->vectorLoops);
+    function->vectorLoops = NULL;
+    function->vectorLoopCount = 0;
+    function->reductionSlots = 0;
+    function->code = NULL;
+    function->count = 0;
+    function->capacity = 0;
+    function->vars = NULL;
+    function->varCount = 0;
+    function->varCapacity = 0;
+}
+
+/**
+ * @brief Releases every function, variable and string owned by a TAC program
+ *
+ * @param program The program to free
+ */
+void FreeTACProgram(TACProgram* program) {
+    for (int i = 0; i < program->functionCount; i++) {
+        FreeTACFunction(&program->functions[i]);
+    }
+    free(program->functions);
+
+    for (int i = 0; i < program->stringCount; i++) {
+        free(program->strings[i]);
+    }
+    free(program->strings);
+
+    InitTACProgram(program);
+}
+
+/**
+ * @brief Adds an empty function to a TAC program
+ *
+ * The returned pointer stays valid until the next function is added to the
+ * program, since the function array may be moved when it grows.
+ *
+ * @param program The program to add the function to
+ * @param name The name of the function
+ * @param returnType The declared return type of the function
+ * @return The newly added function
+ */
+TACFunction* AddTACFunction(TACProgram* program, const char* name, DataType returnType) {
+    if (program->functionCount == program->functionCapacity) {
+        program->functionCapacity = program->functionCapacity == 0 ? 4 : program->functionCapacity * 2;
+        program->functions = CheckedRealloc(program->functions, program->functionCapacity * sizeof(TACFunction));
+    }
+
+    TACFunction* function = &program->functions[program->functionCount++];
+    memset(function, 0, sizeof(TACFunction));
+    strncpy(function->name, name, MAX_NAME_LENGTH - 1);
+    function->returnType = returnType;
+    function->program = program;
+
+    // Function pointers handed out earlier may have moved; re-link every back-pointer
+    for (int i = 0; i < program->functionCount; i++) {
+        program->functions[i].program = program;
+    }
+
+    return function;
+}
+
+/**
+ * @brief Looks up a function in a TAC program by name
+ *
+ * @param program The program to search
+ * @param name The name of the function
+ * @return The function if found, or NULL if not found
+ */
+TACFunction* LookUpTACFunction(TACProgram* program, const char* name) {
+    for (int i = 0; i < program->functionCount; i++) {
+        if (strcmp(program->functions[i].name, name) == 0) {
+            return &program->functions[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the id of a string in the program's string pool, adding it if needed
+ *
+ * String literals and the names of called functions are both stored in the
+ * pool, so operands only have to carry an integer id.
+ *
+ * @param program The program that owns the pool
+ * @param text The string to intern
+ * @return The id of the interned string
+ */
+int InternString(TACProgram* program, const char* text) {
+    for (int i = 0; i < program->stringCount; i++) {
+        if (strcmp(program->strings[i], text) == 0) {
+            return i;
+        }
+    }
+
+    if (program->stringCount == program->stringCapacity) {
+        program->stringCapacity = program->stringCapacity == 0 ? 8 : program->stringCapacity * 2;
+        program->strings = CheckedRealloc(program->strings, program->stringCapacity * sizeof(char*));
+    }
+
+    char* copy = CheckedMalloc(strlen(text) + 1);
+    strcpy(copy, text);
+    program->strings[program->stringCount] = copy;
+    return program->stringCount++;
+}
+
+/**
+ * @brief Adds a named variable to a function
+ *
+ * @param function The function that owns the variable
+ * @param name The name of the variable
+ * @param type The type of the variable
+ * @return The id of the new variable
+ */
+int AddTACVariable(TACFunction* function, const char* name, DataType type) {
+    if (function->varCount == function->varCapacity) {
+        function->varCapacity = function->varCapacity == 0 ? 16 : function->varCapacity * 2;
+        function->vars = CheckedRealloc(function->vars, function->varCapacity * sizeof(TACVariable));
+    }
+
+    TACVariable* var = &function->vars[function->varCount];
+    memset(var, 0, sizeof(TACVariable));
+    strncpy(var->name, name, MAX_NAME_LENGTH - 1);
+    var->type = type;
+    var->elementType = INTEGER;
+    var->origin = function->varCount;
+
+    return function->varCount++;
+}
+
+/**
+ * @brief Looks up a named (non-temporary) variable in a function
+ *
+ * @param function The function to search
+ * @param name The name of the variable
+ * @return The id of the variable, or -1 if it is not declared
+ */
+int LookUpTACVariable(TACFunction* function, const char* name) {
+    for (int i = 0; i < function->varCount; i++) {
+        if (!function->vars[i].isTemp && strcmp(function->vars[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Creates a fresh temporary variable
+ *
+ * @param function The function that owns the temporary
+ * @param type The type of the value the temporary will hold
+ * @return The id of the new temporary
+ */
+int NewTemp(TACFunction* function, DataType type) {
+    char temp[MAX_NAME_LENGTH];
+    sprintf(temp, "t%d", function->tempCount++);
+
+    int id = AddTACVariable(function, temp, type);
+    function->vars[id].isTemp = 1;
+    return id;
+}
+
+/**
+ * @brief Creates a new variable with the same type and origin as an existing one
+ *
+ * Used by passes that duplicate code and need a fresh name for each copy
+ * of a definition.
+ *
+ * @param function The function the variable belongs to
+ * @param var The variable to copy
+ * @return The id of the new variable
+ */
+int CloneTACVariable(TACFunction* function, int var) {
+    char name[MAX_NAME_LENGTH];
+    snprintf(name, sizeof(name), "%.*s_%d", MAX_NAME_LENGTH - 16, function->vars[var].name, function->varCount);
+
+    int id = AddTACVariable(function, name, function->vars[var].type);
+    function->vars[id].elementType = function->vars[var].elementType;
+    function->vars[id].isTemp = function->vars[var].isTemp;
+    function->vars[id].origin = function->vars[var].origin;
+    return id;
+}
+
+/**
+ * @brief Creates a fresh label id
+ *
+ * @param function The function that owns the label
+ * @return The id of the new label
+ */
+int NewLabel(TACFunction* function) {
+    return function->labelCount++;
+}
+
+TACOperand NoOperand(void) {
+    TACOperand operand;
+    operand.kind = TAC_OPERAND_NONE;
+    operand.value.id = 0;
+    return operand;
+}
+
+TACOperand VarOperand(int id) {
+    TACOperand operand;
+    operand.kind = TAC_OPERAND_VAR;
+    operand.value.id = id;
+    return operand;
+}
+
+TACOperand IntOperand(int value) {
+    TACOperand operand;
+    operand.kind = TAC_OPERAND_INT;
+    operand.value.intValue = value;
+    return operand;
+}
+
+TACOperand FloatOperand(float value) {
+    TACOperand operand;
+    operand.kind = TAC_OPERAND_FLOAT;
+    operand.value.floatValue = value;
+    return operand;
+}
+
+TACOperand StringOperand(int id) {
+    TACOperand operand;
+    operand.kind = TAC_OPERAND_STRING;
+    operand.value.id = id;
+    return operand;
+}
+
+TACOperand LabelOperand(int id) {
+    TACOperand operand;
+    operand.kind = TAC_OPERAND_LABEL;
+    operand.value.id = id;
+    return operand;
+}
+
+TACOperand FunctionOperand(int id) {
+    TACOperand operand;
+    operand.kind = TAC_OPERAND_FUNCTION;
+    operand.value.id = id;
+    return operand;
+}
+
+/**
+ * @brief Checks whether two operands denote the same variable or constant
+ *
+ * @return 1 if the operands are identical, 0 if they are not
+ */
+int SameOperand(TACOperand a, TACOperand b) {
+    if (a.kind != b.kind) {
+        return 0;
+    }
+    switch (a.kind) {
+    case TAC_OPERAND_NONE:
+        return 1;
+    case TAC_OPERAND_FLOAT:
+        return memcmp(&a.value.floatValue, &b.value.floatValue, sizeof(float)) == 0;
+    default:
+        return a.value.id == b.value.id;
+    }
+}
+
+/**
+ * @brief Returns the data type of the value an operand denotes
+ *
+ * @param function The function the operand belongs to
+ * @param operand The operand to inspect
+ * @return The type of the operand; labels and function names report INTEGER
+ */
+DataType OperandType(TACFunction* function, TACOperand operand) {
+    switch (operand.kind) {
+    case TAC_OPERAND_VAR:
+        return function->vars[operand.value.id].type;
+    case TAC_OPERAND_FLOAT:
+        return FLOAT;
+    case TAC_OPERAND_STRING:
+        return STRING;
+    default:
+        return INTEGER;
+    }
+}
+
+/**
+ * @brief Appends a TAC instruction to a function
+ *
+ * @param function The function to append to
+ * @param op The operation
+ * @param arg1 The first argument
+ * @param arg2 The second argument
+ * @param result The result (or branch target)
+ */
+void Emit(TACFunction* function, TACOpcode op, TACOperand arg1, TACOperand arg2, TACOperand result) {
+    if (function->count == function->capacity) {
+        function->capacity = function->capacity == 0 ? 32 : function->capacity * 2;
+        function->code = CheckedRealloc(function->code, function->capacity * sizeof(TACInstruction));
+    }
+
+    TACInstruction* instr = &function->code[function->count++];
+    instr->op = op;
+    instr->arg1 = arg1;
+    instr->arg2 = arg2;
+    instr->result = result;
+    instr->phiArgs = NULL;
+    instr->phiCount = 0;
+    instr->inBounds = 0;
+}
+
+/**
+ * @brief Inserts a run of instructions before the given position
+ *
+ * @param function The function to modify
+ * @param index The position to insert at; existing instructions from here on move down
+ * @param instructions The instructions to insert
+ * @param n The number of instructions to insert
+ */
+void InsertInstructions(TACFunction* function, int index, const TACInstruction* instructions, int n) {
+    if (n <= 0) {
+        return;
+    }
+
+    if (function->count + n > function->capacity) {
+        while (function->count + n > function->capacity) {
+            function->capacity = function->capacity == 0 ? 32 : function->capacity * 2;
+        }
+        function->code = CheckedRealloc(function->code, function->capacity * sizeof(TACInstruction));
+    }
+
+    memmove(&function->code[index + n], &function->code[index], (function->count - index) * sizeof(TACInstruction));
+    memcpy(&function->code[index], instructions, n * sizeof(TACInstruction));
+    function->count += n;
+}
+
+/**
+ * @brief Moves the instructions in [start, end) to the end of the function
+ *
+ * Used by the parser to place the increment of a for loop after its body,
+ * since the increment is parsed first.
+ *
+ * @param function The function to modify
+ * @param start The first instruction to move
+ * @param end One past the last instruction to move
+ */
+void MoveInstructionsToEnd(TACFunction* function, int start, int end) {
+    int n = end - start;
+    if (n <= 0 || end == function->count) {
+        return;
+    }
+
+    TACInstruction* saved = CheckedMalloc(n * sizeof(TACInstruction));
+    memcpy(saved, &function->code[start], n * sizeof(TACInstruction));
+    memmove(&function->code[start], &function->code[end], (function->count - end) * sizeof(TACInstruction));
+    memcpy(&function->code[function->count - n], saved, n * sizeof(TACInstruction));
+    free(saved);
+}
+
+/**
+ * @brief Turns an instruction into a no-op, releasing its phi arguments
+ *
+ * @param instr The instruction to delete
+ */
+void MakeNop(TACInstruction* instr) {
+    free(instr->phiArgs);
+    instr->phiArgs = NULL;
+    instr->phiCount = 0;
+    instr->op = TAC_NOP;
+    instr->arg1 = NoOperand();
+    instr->arg2 = NoOperand();
+    instr->result = NoOperand();
+}
+
+/**
+ * @brief Compacts a function by dropping every TAC_NOP instruction
+ *
+ * Passes delete instructions by turning them into no-ops and call this once
+ * at the end, which keeps deletion linear in the size of the function.
+ *
+ * @param function The function to compact
+ */
+void RemoveNops(TACFunction* function) {
+    int out = 0;
+    for (int i = 0; i < function->count; i++) {
+        if (function->code[i].op != TAC_NOP) {
+            function->code[out++] = function->code[i];
+        }
+    }
+    function->count = out;
+}
+
+/**
+ * @brief Deletes every label that no jump and no phi refers to
+ *
+ * @param function The function to clean up
+ */
+void RemoveUnusedLabels(TACFunction* function) {
+    char* used = CheckedCalloc(function->labelCount + 1, sizeof(char));
+
+    for (int i = 0; i < function->count; i++) {
+        TACInstruction* instr = &function->code[i];
+        if (IsBranchOp(instr->op)) {
+            used[instr->result.value.id] = 1;
+        }
+        for (int k = 0; instr->op == TAC_PHI && k < instr->phiCount; k++) {
+            used[instr->phiArgs[k].pred] = 1;
+        }
+    }
+
+    for (int i = 0; i < function->count; i++) {
+        TACInstruction* instr = &function->code[i];
+        if (instr->op == TAC_LABEL && !used[instr->result.value.id]) {
+            MakeNop(instr);
+        }
+    }
+    free(used);
+
+    RemoveNops(function);
+}
+
+int IsBinaryOp(TACOpcode op) {
+    return op >= TAC_ADD && op <= TAC_NE;
+}
+
+int IsComparisonOp(TACOpcode op) {
+    return op >= TAC_LT && op <= TAC_NE;
+}
+
+int IsBranchOp(TACOpcode op) {
+    return op == TAC_GOTO || op == TAC_IF || op == TAC_IFFALSE;
+}
+
+/**
+ * @brief Checks whether an instruction ends a basic block
+ *
+ * @param op The operation to check
+ * @return 1 for jumps and returns, 0 otherwise
+ */
+int EndsBlock(TACOpcode op) {
+    return IsBranchOp(op) || op == TAC_RETURN;
+}
+
+/**
+ * @brief Checks whether an instruction does anything besides defining its result
+ *
+ * Instructions with side effects must be kept even if their result is unused,
+ * and must not be reordered across each other.
+ *
+ * @param instr The instruction to check
+ * @return 1 if the instruction has side effects, 0 otherwise
+ */
+int HasSideEffects(const TACInstruction* instr) {
+    switch (instr->op) {
+    case TAC_STORE_INDEX:
+    case TAC_LABEL:
+    case TAC_GOTO:
+    case TAC_IF:
+    case TAC_IFFALSE:
+    case TAC_PARAM:
+    case TAC_CALL:
+    case TAC_RETURN:
+    case TAC_VECLOOP:
+    case TAC_VECREDUCE:
+    case TAC_CHECKBOUNDS:
+        return 1;
+    case TAC_PUSH:
+    case TAC_POP:
+    case TAC_PEEK:
+    case TAC_STACKSIZE:
+        // A stack changes in place, and popping or peeking at an empty one fails
+        return 1;
+    case TAC_DIV:
+    case TAC_MOD:
+        // Integer division by zero traps, so it cannot be dropped or speculated
+        return instr->arg2.kind != TAC_OPERAND_INT || instr->arg2.value.intValue == 0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Returns the variable an instruction defines
+ *
+ * @param instr The instruction to inspect
+ * @return The id of the defined variable, or -1 if it defines none
+ */
+int TACDefinedVar(const TACInstruction* instr) {
+    switch (instr->op) {
+    case TAC_NOP:
+    case TAC_STORE_INDEX:
+    case TAC_LABEL:
+    case TAC_GOTO:
+    case TAC_IF:
+    case TAC_IFFALSE:
+    case TAC_PARAM:
+    case TAC_RETURN:
+    case TAC_CHECKBOUNDS:
+    case TAC_PUSH:
+        return -1;
+    default:
+        return instr->result.kind == TAC_OPERAND_VAR ? instr->result.value.id : -1;
+    }
+}
+
+/**
+ * @brief Returns the number of operand slots an instruction reads
+ *
+ * Slots are returned by TACUseAt and may hold constants as well as
+ * variables; callers check the kind of each one.
+ *
+ * @param instr The instruction to inspect
+ * @return The number of use slots
+ */
+int TACUseCount(const TACInstruction* instr) {
+    switch (instr->op) {
+    case TAC_NOP:
+    case TAC_LABEL:
+    case TAC_GOTO:
+    case TAC_NEWSTACK:
+        return 0;
+    case TAC_ASSIGN:
+    case TAC_NEWARRAY:
+    case TAC_POP:
+    case TAC_PEEK:
+    case TAC_STACKSIZE:
+    case TAC_IF:
+    case TAC_IFFALSE:
+    case TAC_PARAM:
+    case TAC_RETURN:
+        return 1;
+    case TAC_CALL:
+        return 0;
+    case TAC_STORE_INDEX:
+        return 3;
+    case TAC_PHI:
+    case TAC_VECLOOP:
+    case TAC_CHECKBOUNDS:
+        return instr->phiCount;
+    default:
+        return 2;
+    }
+}
+
+/**
+ * @brief Returns a pointer to the k-th operand slot an instruction reads
+ *
+ * @param instr The instruction to inspect
+ * @param k The index of the use, below TACUseCount(instr)
+ * @return A pointer to the operand, which passes may overwrite in place
+ */
+TACOperand* TACUseAt(TACInstruction* instr, int k) {
+    if (instr->op == TAC_PHI || instr->op == TAC_VECLOOP || instr->op == TAC_CHECKBOUNDS) {
+        return &instr->phiArgs[k].value;
+    }
+    if (instr->op == TAC_STORE_INDEX) {
+        return k == 0 ? &instr->result : (k == 1 ? &instr->arg1 : &instr->arg2);
+    }
+    return k == 0 ? &instr->arg1 : &instr->arg2;
+}
+
+const char* OpcodeSymbol(TACOpcode op) {
+    switch (op) {
+    case TAC_ADD: return "+";
+    case TAC_SUB: return "-";
+    case TAC_MUL: return "*";
+    case TAC_DIV: return "/";
+    case TAC_MOD: return "%";
+    case TAC_LT: return "<";
+    case TAC_LE: return "<=";
+    case TAC_GT: return ">";
+    case TAC_GE: return ">=";
+    case TAC_EQ: return "==";
+    case TAC_NE: return "!=";
+    default: return "?";
+    }
+}
+
+/**
+ * @brief Formats an operand the way it appears in printed TAC
+ *
+ * @param function The function the operand belongs to
+ * @param operand The operand to format
+ * @param buffer The buffer to write to
+ * @param size The size of the buffer
+ */
+void FormatOperand(TACFunction* function, TACOperand operand, char* buffer, int size) {
+    switch (operand.kind) {
+    case TAC_OPERAND_NONE:
+        snprintf(buffer, size, "_");
+        break;
+    case TAC_OPERAND_VAR:
+        snprintf(buffer, size, "%s", function->vars[operand.value.id].name);
+        break;
+    case TAC_OPERAND_INT:
+        snprintf(buffer, size, "%d", operand.value.intValue);
+        break;
+    case TAC_OPERAND_FLOAT:
+        snprintf(buffer, size, "%g", operand.value.floatValue);
+        if (strpbrk(buffer, ".e") == NULL) {
+            strncat(buffer, ".0", size - strlen(buffer) - 1);
+        }
+        break;
+    case TAC_OPERAND_STRING:
+        snprintf(buffer, size, "\"%s\"", function->program->strings[operand.value.id]);
+        break;
+    case TAC_OPERAND_LABEL:
+        snprintf(buffer, size, "L%d", operand.value.id);
+        break;
+    case TAC_OPERAND_FUNCTION:
+        snprintf(buffer, size, "%s", function->program->strings[operand.value.id]);
+        break;
+    }
+}
+
+/**
+ * @brief Prints a single TAC instruction
+ *
+ * @param function The function the instruction belongs to
+ * @param instr The instruction to print
+ */
+void PrintInstruction(TACFunction* function, const TACInstruction* instr) {
+    char result[MAX_NAME_LENGTH + 2], arg1[MAX_NAME_LENGTH + 2], arg2[MAX_NAME_LENGTH + 2];
+    FormatOperand(function, instr->result, result, sizeof(result));
+    FormatOperand(function, instr->arg1, arg1, sizeof(arg1));
+    FormatOperand(function, instr->arg2, arg2, sizeof(arg2));
+
+    switch (instr->op) {
+    case TAC_NOP:
+        printf("    nop\n");
+        break;
+    case TAC_ASSIGN:
+        printf("    %s = %s\n", result, arg1);
+        break;
+    case TAC_NEWARRAY:
+        printf("    %s = newarray %s\n", result, arg1);
+        break;
+    case TAC_LOAD_INDEX:
+        printf("    %s = %s[%s]%s\n", result, arg1, arg2, instr->inBounds ? " (unchecked)" : "");
+        break;
+    case TAC_STORE_INDEX:
+        printf("    %s[%s] = %s%s\n", result, arg1, arg2, instr->inBounds ? " (unchecked)" : "");
+        break;
+    case TAC_NEWSTACK:
+        printf("    %s = newstack\n", result);
+        break;
+    case TAC_PUSH:
+        printf("    push %s, %s\n", arg1, arg2);
+        break;
+    case TAC_POP:
+    case TAC_PEEK:
+    case TAC_STACKSIZE: {
+        const char* name = instr->op == TAC_POP ? "pop" : (instr->op == TAC_PEEK ? "peek" : "size");
+        if (instr->result.kind == TAC_OPERAND_NONE) {
+            printf("    %s %s\n", name, arg1);
+        } else {
+            printf("    %s = %s %s\n", result, name, arg1);
+        }
+        break;
+    }
+    case TAC_CONCAT:
+    case TAC_STREQ:
+        printf("    %s = %s %s %s\n", result, arg1, instr->op == TAC_CONCAT ? "concat" : "streq", arg2);
+        break;
+    case TAC_LABEL:
+        printf("%s:\n", result);
+        break;
+    case TAC_GOTO:
+        printf("    goto %s\n", result);
+        break;
+    case TAC_IF:
+        printf("    if %s goto %s\n", arg1, result);
+        break;
+    case TAC_IFFALSE:
+        printf("    ifFalse %s goto %s\n", arg1, result);
+        break;
+    case TAC_PARAM:
+        printf("    param %s\n", arg1);
+        break;
+    case TAC_CALL:
+        if (instr->result.kind == TAC_OPERAND_NONE) {
+            printf("    call %s, %s\n", arg1, arg2);
+        } else {
+            printf("    %s = call %s, %s\n", result, arg1, arg2);
+        }
+        break;
+    case TAC_RETURN:
+        if (instr->arg1.kind == TAC_OPERAND_NONE) {
+            printf("    return\n");
+        } else {
+            printf("    return %s\n", arg1);
+        }
+        break;
+    case TAC_PHI:
+        printf("    %s = phi(", result);
+        for (int k = 0; k < instr->phiCount; k++) {
+            FormatOperand(function, instr->phiArgs[k].value, arg1, sizeof(arg1));
+            printf(k == 0 ? "%s [L%d]" : ", %s [L%d]", arg1, instr->phiArgs[k].pred);
+        }
+        printf(")\n");
+        break;
+    case TAC_VECLOOP:
+        printf("    %s = vecloop %s(", result, arg1);
+        for (int k = 0; k < instr->phiCount; k++) {
+            FormatOperand(function, instr->phiArgs[k].value, arg1, sizeof(arg1));
+            printf(k == 0 ? "%s" : ", %s", arg1);
+        }
+        printf(")\n");
+        break;
+    case TAC_VECREDUCE:
+        printf("    %s = vecreduce %s, %s\n", result, arg1, arg2);
+        break;
+    case TAC_CHECKBOUNDS: {
+        char array[MAX_NAME_LENGTH + 2], first[MAX_NAME_LENGTH + 2], bound[MAX_NAME_LENGTH + 2];
+        FormatOperand(function, instr->phiArgs[0].value, array, sizeof(array));
+        FormatOperand(function, instr->phiArgs[1].value, first, sizeof(first));
+        FormatOperand(function, instr->phiArgs[2].value, bound, sizeof(bound));
+        printf("    checkbounds %s[%s + %s .. %s - 1 + %s]\n", array, first, arg1, bound, arg2);
+        break;
+    }
+    default:
+        printf("    %s = %s %s %s\n", result, arg1, OpcodeSymbol(instr->op), arg2);
+        break;
+    }
+}
+
+/**
+ * @brief Prints the TAC of one function
+ *
+ * @param function The function to print
+ */
+void PrintTACFunction(TACFunction* function) {
+    printf("function %s(", function->name);
+    for (int i = 0; i < function->paramCount; i++) {
+        printf(i == 0 ? "%s" : ", %s", function->vars[i].name);
+    }
+    printf("):\n");
+
+    for (int i = 0; i < function->count; i++) {
+        PrintInstruction(function, &function->code[i]);
+    }
+}
+
+/**
+ * @brief Prints the TAC of every function in a program
+ *
+ * @param program The program to print
+ */
+void PrintTAC(TACProgram* program) {
+    printf("Three-Address Code (TAC):\n");
+    for (int i = 0; i < program->functionCount; i++) {
+        PrintTACFunction(&program->functions[i]);
+        printf("\n");
+    }
+}
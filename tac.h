@@ -0,0 +1,208 @@
+#ifndef tac_h
+#define tac_h
+
+#include "symbol.h"
+
+typedef enum {
+    TAC_NOP,
+    TAC_ASSIGN,        // result = arg1
+    TAC_ADD,           // result = arg1 + arg2
+    TAC_SUB,
+    TAC_MUL,
+    TAC_DIV,
+    TAC_MOD,
+    TAC_LT,            // result = arg1 < arg2
+    TAC_LE,
+    TAC_GT,
+    TAC_GE,
+    TAC_EQ,
+    TAC_NE,
+    TAC_NEWARRAY,      // result = newarray arg1
+    TAC_LOAD_INDEX,    // result = arg1[arg2]
+    TAC_STORE_INDEX,   // result[arg1] = arg2
+    TAC_NEWSTACK,      // result = newstack
+    TAC_PUSH,          // push arg1, arg2
+    TAC_POP,           // result = pop arg1
+    TAC_PEEK,          // result = peek arg1
+    TAC_STACKSIZE,     // result = size arg1
+    TAC_CONCAT,        // result = arg1 concat arg2, for strings
+    TAC_STREQ,         // result = arg1 streq arg2, 1 if the strings are equal
+    TAC_LABEL,         // result:
+    TAC_GOTO,          // goto result
+    TAC_IF,            // if arg1 goto result
+    TAC_IFFALSE,       // ifFalse arg1 goto result
+    TAC_PARAM,         // param arg1
+    TAC_CALL,          // result = call arg1, arg2
+    TAC_RETURN,        // return arg1
+    TAC_PHI,           // result = phi(value from each predecessor label)
+    TAC_VECLOOP,       // result = iterations run by vector loop arg1 over its operands, taken from phiArgs
+    TAC_VECREDUCE,     // result = reduction arg2 of the vector loop before it, arg1 if that ran none
+    TAC_CHECKBOUNDS    // fail unless array a has elements first + arg1 to bound - 1 + arg2, if first < bound;
+                       // a, first and bound are taken from phiArgs
+} TACOpcode;
+
+typedef enum {
+    TAC_OPERAND_NONE,
+    TAC_OPERAND_VAR,
+    TAC_OPERAND_INT,
+    TAC_OPERAND_FLOAT,
+    TAC_OPERAND_STRING,
+    TAC_OPERAND_LABEL,
+    TAC_OPERAND_FUNCTION
+} TACOperandKind;
+
+typedef struct {
+    TACOperandKind kind;
+    union {
+        int id;            // variable, label, string or function name
+        int intValue;
+        float floatValue;
+    } value;
+} TACOperand;
+
+typedef struct {
+    TACOperand value;
+    int pred;          // Label of the predecessor block the value flows in from
+} TACPhiArg;
+
+// Structure to represent an instruction in TAC
+typedef struct {
+    TACOpcode op;
+    TACOperand arg1;
+    TACOperand arg2;
+    TACOperand result;
+    TACPhiArg* phiArgs;
+    int phiCount;
+    int inBounds;      // Element access whose index is known to be in range, so is not checked
+} TACInstruction;
+
+typedef struct {
+    char name[MAX_NAME_LENGTH];
+    DataType type;
+    DataType elementType;
+    int isTemp;
+    int isParam;
+    int origin;        // Variable this one is an SSA version of (itself otherwise)
+} TACVariable;
+
+typedef enum {
+    VEC_LOAD,          // Lanes read from array operand a, at the counter plus offset
+    VEC_SPLAT,         // Operand a in every lane
+    VEC_CONVERT,       // Integer lanes of op a as floats
+    VEC_ADD,           // Lanes of op a and op b
+    VEC_SUB,
+    VEC_MUL,
+    VEC_DIV,
+    VEC_STORE,         // Lanes of op b written to array operand a, at the counter plus offset
+    VEC_REDUCE,        // Lanes of op b folded into reduction a
+} TACVectorOpKind;
+
+// One operation of a vector loop body, applied to every lane at once
+typedef struct {
+    TACVectorOpKind kind;
+    int isFloat;       // Whether the lanes it produces or reads are floats
+    int a;             // An earlier op, an operand of the vecloop, or a reduction, depending on kind
+    int b;             // An earlier op
+    int offset;
+} TACVectorOp;
+
+typedef struct {
+    int operand;       // Operand of the vecloop holding its value on entry
+    int slot;          // Number the vecreduce reading it back refers to it by
+    int isFloat;
+    int subtract;      // Whether the loop subtracts from it rather than adds
+} TACReduction;
+
+// The body of a counted loop as operations on whole vectors. Operand 0 of
+// its vecloop is the first value of the counter and operand 1 its bound.
+typedef struct {
+    int header;        // Label of the scalar loop finishing the iterations left over
+    int inclusive;     // Whether the loop runs while the counter is <= the bound rather than <
+    TACVectorOp* ops;
+    int opCount;
+    TACReduction* reductions;
+    int reductionCount;
+} TACVectorLoop;
+
+struct TACProgram;
+
+typedef struct {
+    char name[MAX_NAME_LENGTH];
+    DataType returnType;
+    DataType returnElementType; // Of the array or stack returned; ints unless declared
+    struct TACProgram* program;
+
+    TACInstruction* code;
+    int count;
+    int capacity;
+
+    TACVariable* vars;
+    int varCount;
+    int varCapacity;
+
+    int paramCount;
+    int labelCount;
+    int tempCount;
+    int isSSA;
+
+    TACVectorLoop* vectorLoops;
+    int vectorLoopCount;
+    int reductionSlots; // Reductions of every vector loop, numbered for vecreduce
+} TACFunction;
+
+typedef struct TACProgram {
+    TACFunction* functions;
+    int functionCount;
+    int functionCapacity;
+
+    char** strings;
+    int stringCount;
+    int stringCapacity;
+} TACProgram;
+
+void InitTACProgram(TACProgram* program);
+void FreeTACProgram(TACProgram* program);
+void FreeTACFunction(TACFunction* function);
+TACFunction* AddTACFunction(TACProgram* program, const char* name, DataType returnType);
+TACFunction* LookUpTACFunction(TACProgram* program, const char* name);
+int InternString(TACProgram* program, const char* text);
+
+int AddTACVariable(TACFunction* function, const char* name, DataType type);
+int LookUpTACVariable(TACFunction* function, const char* name);
+int NewTemp(TACFunction* function, DataType type);
+int CloneTACVariable(TACFunction* function, int var);
+int NewLabel(TACFunction* function);
+
+TACOperand NoOperand(void);
+TACOperand VarOperand(int id);
+TACOperand IntOperand(int value);
+TACOperand FloatOperand(float value);
+TACOperand StringOperand(int id);
+TACOperand LabelOperand(int id);
+TACOperand FunctionOperand(int id);
+int SameOperand(TACOperand a, TACOperand b);
+DataType OperandType(TACFunction* function, TACOperand operand);
+
+void Emit(TACFunction* function, TACOpcode op, TACOperand arg1, TACOperand arg2, TACOperand result);
+void InsertInstructions(TACFunction* function, int index, const TACInstruction* instructions, int n);
+void MoveInstructionsToEnd(TACFunction* function, int start, int end);
+void MakeNop(TACInstruction* instr);
+void RemoveNops(TACFunction* function);
+void RemoveUnusedLabels(TACFunction* function);
+
+int IsBinaryOp(TACOpcode op);
+int IsComparisonOp(TACOpcode op);
+int IsBranchOp(TACOpcode op);
+int EndsBlock(TACOpcode op);
+int HasSideEffects(const TACInstruction* instr);
+int TACDefinedVar(const TACInstruction* instr);
+int TACUseCount(const TACInstruction* instr);
+TACOperand* TACUseAt(TACInstruction* instr, int k);
+
+const char* OpcodeSymbol(TACOpcode op);
+void FormatOperand(TACFunction* function, TACOperand operand, char* buffer, int size);
+void PrintInstruction(TACFunction* function, const TACInstruction* instr);
+void PrintTACFunction(TACFunction* function);
+void PrintTAC(TACProgram* program);
+
+#endif
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimize.h"
+
+typedef struct {
+    int first;         // First param of the call
+    int last;          // The return ending the site
+    TACOpcode op;      // Accumulating operation, TAC_NOP for a plain tail call
+    TACOperand other;  // Operand combined with the call's result
+} TailSite;
+
+/**
+ * @brief Returns the index of the next instruction that is not a no-op
+ */
+static int NextInstruction(const TACFunction* function, int i) {
+    i++;
+    while (i < function->count && function->code[i].op == TAC_NOP) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * @brief Checks whether a call's result is returned straight away
+ *
+ * The backend turns such calls into jumps, reusing the caller's frame.
+ *
+ * @param function The function containing the call
+ * @param index The index of the call instruction
+ * @return 1 if the call is in tail position
+ */
+int IsTailCall(const TACFunction* function, int index) {
+    const TACInstruction* call = &function->code[index];
+    int next = NextInstruction(function, index);
+
+    if (call->op != TAC_CALL || next >= function->count || function->code[next].op != TAC_RETURN) {
+        return 0;
+    }
+    return call->result.kind == TAC_OPERAND_VAR && SameOperand(function->code[next].arg1, call->result);
+}
+
+/**
+ * @brief Checks whether the call at an index is a recursive call that can become a jump
+ *
+ * Either the result is returned as it is, or it is combined with another
+ * value by + or * and that is returned, as in return n * fact(n - 1).
+ * Integer + and * are associative even when they wrap around, so the
+ * pending operations can be collected in an accumulator instead.
+ *
+ * @return 1 and fills in the site if it matches
+ */
+static int MatchTailSite(TACFunction* function, int index, TailSite* site) {
+    TACInstruction* call = &function->code[index];
+    TACProgram* program = function->program;
+
+    if (call->op != TAC_CALL || strcmp(program->strings[call->arg1.value.id], function->name) != 0 ||
+        call->arg2.value.intValue != function->paramCount || call->result.kind != TAC_OPERAND_VAR) {
+        return 0;
+    }
+
+    site->first = index - function->paramCount;
+    if (site->first < 0) {
+        return 0;
+    }
+    for (int i = site->first; i < index; i++) {
+        if (function->code[i].op != TAC_PARAM) {
+            return 0;
+        }
+    }
+
+    if (IsTailCall(function, index)) {
+        site->last = NextInstruction(function, index);
+        site->op = TAC_NOP;
+        return 1;
+    }
+
+    int combine = NextInstruction(function, index);
+    if (combine >= function->count) {
+        return 0;
+    }
+    TACInstruction* instr = &function->code[combine];
+    int ret = NextInstruction(function, combine);
+    int isInt = function->returnType == INTEGER && instr->result.kind == TAC_OPERAND_VAR &&
+                function->vars[instr->result.value.id].type == INTEGER;
+    if ((instr->op != TAC_ADD && instr->op != TAC_MUL) || !isInt || ret >= function->count ||
+        function->code[ret].op != TAC_RETURN || !SameOperand(function->code[ret].arg1, instr->result)) {
+        return 0;
+    }
+
+    if (SameOperand(instr->arg2, call->result) && !SameOperand(instr->arg1, call->result)) {
+        site->other = instr->arg1;
+    } else if (SameOperand(instr->arg1, call->result) && !SameOperand(instr->arg2, call->result)) {
+        site->other = instr->arg2;
+    } else {
+        return 0;
+    }
+    if (OperandType(function, site->other) != INTEGER) {
+        return 0;
+    }
+
+    site->op = instr->op;
+    site->last = ret;
+    return 1;
+}
+
+static void Push(TACInstruction** code, int* count, int* capacity, TACOpcode op,
+                 TACOperand arg1, TACOperand arg2, TACOperand result) {
+    if (*count == *capacity) {
+        *capacity = *capacity == 0 ? 32 : *capacity * 2;
+        *code = CheckedRealloc(*code, *capacity * sizeof(TACInstruction));
+    }
+    TACInstruction* instr = &(*code)[(*count)++];
+    memset(instr, 0, sizeof(TACInstruction));
+    instr->op = op;
+    instr->arg1 = arg1;
+    instr->arg2 = arg2;
+    instr->result = result;
+}
+
+/**
+ * @brief Turns self-recursive calls in tail position into jumps back to the function's start
+ *
+ * return f(a, b) inside f becomes an assignment of the arguments to the
+ * parameters (through temporaries, as the arguments may read them) and a
+ * jump to a label at the top of the function, so the recursion runs in
+ * constant stack space as an ordinary loop. return x * f(...) and
+ * return x + f(...) are handled too, by keeping the pending products or
+ * sums in an accumulator that every other return folds into its value.
+ * Must run before the function is put in SSA form.
+ *
+ * @param function The function to transform
+ * @return The number of recursive calls removed
+ */
+int EliminateTailRecursion(TACFunction* function) {
+    if (function->isSSA) {
+        return 0;
+    }
+
+    TailSite* sites = CheckedMalloc((function->count + 1) * sizeof(TailSite));
+    int siteCount = 0;
+    TACOpcode accumulate = TAC_NOP;
+
+    for (int i = 0; i < function->count; i++) {
+        TailSite site;
+        if (!MatchTailSite(function, i, &site)) {
+            continue;
+        }
+        if (site.op != TAC_NOP) {
+            // All accumulating sites must share one operation
+            if (accumulate != TAC_NOP && accumulate != site.op) {
+                continue;
+            }
+            accumulate = site.op;
+        }
+        sites[siteCount++] = site;
+    }
+
+    if (siteCount == 0) {
+        free(sites);
+        return 0;
+    }
+
+    TACInstruction* code = NULL;
+    int count = 0;
+    int capacity = 0;
+    int start = NewLabel(function);
+    TACOperand acc = NoOperand();
+
+    if (accumulate != TAC_NOP) {
+        acc = VarOperand(NewTemp(function, INTEGER));
+        Push(&code, &count, &capacity, TAC_ASSIGN, IntOperand(accumulate == TAC_MUL ? 1 : 0), NoOperand(), acc);
+    }
+    Push(&code, &count, &capacity, TAC_LABEL, NoOperand(), NoOperand(), LabelOperand(start));
+
+    int* temps = CheckedMalloc((function->paramCount + 1) * sizeof(int));
+    int s = 0;
+    for (int i = 0; i < function->count; i++) {
+        TACInstruction* instr = &function->code[i];
+
+        if (s < siteCount && i == sites[s].first) {
+            TailSite* site = &sites[s++];
+            if (site->op != TAC_NOP) {
+                Push(&code, &count, &capacity, site->op, acc, site->other, acc);
+            }
+            for (int k = 0; k < function->paramCount; k++) {
+                temps[k] = NewTemp(function, function->vars[k].type);
+                Push(&code, &count, &capacity, TAC_ASSIGN, function->code[site->first + k].arg1, NoOperand(),
+                     VarOperand(temps[k]));
+            }
+            for (int k = 0; k < function->paramCount; k++) {
+                Push(&code, &count, &capacity, TAC_ASSIGN, VarOperand(temps[k]), NoOperand(), VarOperand(k));
+            }
+            Push(&code, &count, &capacity, TAC_GOTO, NoOperand(), NoOperand(), LabelOperand(start));
+            i = site->last;
+            continue;
+        }
+
+        if (instr->op == TAC_RETURN && accumulate != TAC_NOP && instr->arg1.kind != TAC_OPERAND_NONE) {
+            TACOperand value = VarOperand(NewTemp(function, INTEGER));
+            Push(&code, &count, &capacity, accumulate, acc, instr->arg1, value);
+            Push(&code, &count, &capacity, TAC_RETURN, value, NoOperand(), NoOperand());
+            continue;
+        }
+
+        if (instr->op != TAC_NOP) {
+            Push(&code, &count, &capacity, instr->op, instr->arg1, instr->arg2, instr->result);
+        }
+    }
+
+    free(function->code);
+    function->code = code;
+    function->count = count;
+    function->capacity = capacity;
+
+    free(temps);
+    free(sites);
+    return siteCount;
+}
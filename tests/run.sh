@@ -0,0 +1,35 @@
+#!/bin/bash
+# Runs every tests/*.z natively, through the JIT and through the VM, comparing with its .out file
+# usage: tests/run.sh [path to zara]
+zara=${1:-./zara}
+dir=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+
+check() {
+    if ! diff -u "$2" "$work/out" >"$work/diff"; then
+        echo "FAIL $1"
+        cat "$work/diff"
+        failed=1
+    fi
+}
+
+for test in "$dir"/*.z; do
+    name=$(basename "$test" .z)
+    for level in -O0 -O1 -O2; do
+        if "$zara" $level -o "$work/$name.s" "$test" >/dev/null && cc "$work/$name.s" "$dir/../runtime.c" -o "$work/$name"; then
+            "$work/$name" >"$work/out"
+        else
+            : >"$work/out"
+        fi
+        check "$name $level native" "${test%.z}.out"
+        for backend in --jit --vm; do
+            "$zara" $level $backend "$test" | sed '1,/^Running main:$/d' >"$work/out"
+            check "$name $level $backend" "${test%.z}.out"
+        done
+    done
+done
+
+[ $failed -eq 0 ] && echo "all tests passed"
+exit $failed
@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimize.h"
+#include "cfg.h"
+#include "ssa.h"
+
+#define MAX_COUNTED_TRIPS (1 << 20)
+
+UnrollOptions unrollOptions = {4, 8, 160};
+
+typedef struct {
+    TACFunction* function;
+    TACOperand* map;       // Original variable -> value it has in the copy being made
+    int mapSize;
+    TACInstruction* code;
+    int count;
+    int capacity;
+} CloneBuffer;
+
+/**
+ * @brief Shape of a loop simple enough to unroll
+ *
+ * Either a top-tested for loop (a header holding the test and a single
+ * body block jumping back to it) or a bottom-tested do-while loop whose
+ * whole body is the header. seq lists the instructions of one iteration
+ * in order, without labels, phis and branches; its first headerLength
+ * entries come from the header.
+ */
+typedef struct {
+    int header;
+    int latch;
+    int exitLabel;
+    IntList seq;
+    int headerLength;
+} UnrollCandidate;
+
+static TACOperand Remap(const CloneBuffer* buffer, TACOperand operand) {
+    if (operand.kind == TAC_OPERAND_VAR && operand.value.id < buffer->mapSize) {
+        return buffer->map[operand.value.id];
+    }
+    return operand;
+}
+
+static void Append(CloneBuffer* buffer, const TACInstruction* instr) {
+    if (buffer->count == buffer->capacity) {
+        buffer->capacity = buffer->capacity == 0 ? 32 : buffer->capacity * 2;
+        buffer->code = CheckedRealloc(buffer->code, buffer->capacity * sizeof(TACInstruction));
+    }
+    buffer->code[buffer->count++] = *instr;
+}
+
+/**
+ * @brief Appends a copy of an instruction with its operands renamed
+ *
+ * @param buffer The buffer to append to
+ * @param instr The original instruction
+ * @param fresh Whether the copy defines a new variable or keeps the original one
+ */
+static void AppendClone(CloneBuffer* buffer, const TACInstruction* instr, int fresh) {
+    TACInstruction copy = *instr;
+    copy.phiArgs = NULL;
+    copy.phiCount = 0;
+    // A vector loop keeps its operands in the phi arguments, so the copy needs its own
+    if (instr->op == TAC_VECLOOP) {
+        copy.phiArgs = CheckedMalloc(instr->phiCount * sizeof(TACPhiArg));
+        memcpy(copy.phiArgs, instr->phiArgs, instr->phiCount * sizeof(TACPhiArg));
+        copy.phiCount = instr->phiCount;
+    }
+
+    for (int k = 0; k < TACUseCount(&copy); k++) {
+        TACOperand* use = TACUseAt(&copy, k);
+        *use = Remap(buffer, *use);
+    }
+
+    int def = TACDefinedVar(instr);
+    if (def >= 0) {
+        int id = fresh ? CloneTACVariable(buffer->function, def) : def;
+        copy.result = VarOperand(id);
+        buffer->map[def] = VarOperand(id);
+    }
+
+    Append(buffer, &copy);
+}
+
+/**
+ * @brief Appends the instructions seq[from..to) of one iteration
+ */
+static void AppendIteration(CloneBuffer* buffer, const UnrollCandidate* loop, int from, int to, int fresh) {
+    for (int i = from; i < to; i++) {
+        AppendClone(buffer, &buffer->function->code[loop->seq.items[i]], fresh);
+    }
+}
+
+/**
+ * @brief Moves the loop's phi variables on to their values for the next iteration
+ *
+ * All latch values are read before any phi is updated, as the phis of a
+ * block take their values simultaneously.
+ */
+static void AdvancePhis(CloneBuffer* buffer, const CFG* cfg, const UnrollCandidate* loop) {
+    TACFunction* function = buffer->function;
+    const BasicBlock* header = &cfg->blocks[loop->header];
+    int latchLabel = BlockLabel(cfg, loop->latch);
+    TACOperand* values = CheckedMalloc((header->end - header->start) * sizeof(TACOperand));
+    int n = 0;
+
+    for (int i = header->start; i < header->end; i++) {
+        TACInstruction* phi = &function->code[i];
+        if (phi->op != TAC_PHI) {
+            continue;
+        }
+        values[n] = phi->result;
+        for (int k = 0; k < phi->phiCount; k++) {
+            if (phi->phiArgs[k].pred == latchLabel) {
+                values[n] = Remap(buffer, phi->phiArgs[k].value);
+            }
+        }
+        n++;
+    }
+
+    n = 0;
+    for (int i = header->start; i < header->end; i++) {
+        if (function->code[i].op == TAC_PHI) {
+            buffer->map[function->code[i].result.value.id] = values[n++];
+        }
+    }
+    free(values);
+}
+
+/**
+ * @brief Points every phi variable at the value it has on entry to the loop
+ */
+static void StartPhis(CloneBuffer* buffer, const CFG* cfg, const UnrollCandidate* loop) {
+    TACFunction* function = buffer->function;
+    const BasicBlock* header = &cfg->blocks[loop->header];
+    int latchLabel = BlockLabel(cfg, loop->latch);
+
+    for (int v = 0; v < buffer->mapSize; v++) {
+        buffer->map[v] = VarOperand(v);
+    }
+    for (int i = header->start; i < header->end; i++) {
+        TACInstruction* phi = &function->code[i];
+        if (phi->op != TAC_PHI) {
+            continue;
+        }
+        for (int k = 0; k < phi->phiCount; k++) {
+            if (phi->phiArgs[k].pred != latchLabel) {
+                buffer->map[phi->result.value.id] = phi->phiArgs[k].value;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Checks whether a loop has one of the shapes the unroller handles
+ *
+ * @return 1 and fills in the candidate if it does
+ */
+static int MatchLoop(TACFunction* function, const CFG* cfg, int loop, UnrollCandidate* candidate) {
+    const Loop* l = &cfg->loops[loop];
+    int h = l->header;
+    const BasicBlock* header = &cfg->blocks[h];
+
+    for (int other = 0; other < cfg->loopCount; other++) {
+        if (cfg->loops[other].parent == loop) {
+            return 0;
+        }
+    }
+    if (l->latches.count != 1 || header->end == header->start) {
+        return 0;
+    }
+
+    TACInstruction* branch = &function->code[header->end - 1];
+    if (branch->op != TAC_IF && branch->op != TAC_IFFALSE) {
+        return 0;
+    }
+    int target = cfg->labelBlock[branch->result.value.id];
+
+    memset(candidate, 0, sizeof(UnrollCandidate));
+    candidate->header = h;
+    candidate->latch = l->latches.items[0];
+
+    if (l->blocks.count == 1 && target == h && h + 1 < cfg->blockCount) {
+        candidate->exitLabel = BlockLabel(cfg, h + 1);
+    } else if (l->blocks.count == 2 && !LoopContains(cfg, loop, target) && candidate->latch == h + 1) {
+        const BasicBlock* body = &cfg->blocks[h + 1];
+        if (body->preds.count != 1 || body->end == body->start || function->code[body->end - 1].op != TAC_GOTO) {
+            return 0;
+        }
+        candidate->exitLabel = branch->result.value.id;
+    } else {
+        return 0;
+    }
+
+    for (int i = header->start; i < header->end - 1; i++) {
+        TACOpcode op = function->code[i].op;
+        if (op != TAC_LABEL && op != TAC_PHI) {
+            IntListPush(&candidate->seq, i);
+        }
+    }
+    candidate->headerLength = candidate->seq.count;
+
+    if (candidate->latch != h) {
+        const BasicBlock* body = &cfg->blocks[candidate->latch];
+        for (int i = body->start; i < body->end - 1; i++) {
+            if (function->code[i].op != TAC_LABEL) {
+                IntListPush(&candidate->seq, i);
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Replaces instructions [start, end) with new code
+ */
+static void ReplaceRange(TACFunction* function, int start, int end, CloneBuffer* buffer) {
+    for (int i = start; i < end; i++) {
+        MakeNop(&function->code[i]);
+    }
+    InsertInstructions(function, start, buffer->code, buffer->count);
+    buffer->count = 0;
+}
+
+/**
+ * @brief Replaces a loop with one straight copy of its body per iteration
+ *
+ * The copies are followed by a last run of the header with the original
+ * variable names, so code after the loop still sees the values it expects.
+ */
+static void UnrollFully(TACFunction* function, const CFG* cfg, const UnrollCandidate* loop,
+                        long trips, CloneBuffer* buffer) {
+    const BasicBlock* header = &cfg->blocks[loop->header];
+    int start = header->start;
+    int end = cfg->blocks[loop->latch].end;
+
+    TACInstruction instr;
+    memset(&instr, 0, sizeof(TACInstruction));
+    instr.op = TAC_LABEL;
+    instr.result = LabelOperand(BlockLabel(cfg, loop->header));
+    Append(buffer, &instr);
+
+    StartPhis(buffer, cfg, loop);
+    for (long t = 0; t < trips; t++) {
+        AppendIteration(buffer, loop, 0, loop->seq.count, 1);
+        AdvancePhis(buffer, cfg, loop);
+    }
+
+    for (int i = header->start; i < header->end; i++) {
+        TACInstruction* phi = &function->code[i];
+        if (phi->op == TAC_PHI) {
+            memset(&instr, 0, sizeof(TACInstruction));
+            instr.op = TAC_ASSIGN;
+            instr.arg1 = buffer->map[phi->result.value.id];
+            instr.result = phi->result;
+            Append(buffer, &instr);
+        }
+    }
+    for (int v = 0; v < buffer->mapSize; v++) {
+        buffer->map[v] = VarOperand(v);
+    }
+    AppendIteration(buffer, loop, 0, loop->headerLength, 0);
+
+    memset(&instr, 0, sizeof(TACInstruction));
+    instr.op = TAC_GOTO;
+    instr.result = LabelOperand(loop->exitLabel);
+    Append(buffer, &instr);
+
+    ReplaceRange(function, start, end, buffer);
+}
+
+/**
+ * @brief Unrolls a loop by a factor, peeling the iterations that do not divide evenly
+ *
+ * The leftover iterations run first, in the preheader, so the unrolled
+ * loop runs a whole number of times and keeps its original exit test. The
+ * last copy in the unrolled body keeps the original variable names, so
+ * only back-edge values naming a phi or a header definition need updating.
+ */
+static void UnrollPartially(TACFunction* function, const CFG* cfg, const UnrollCandidate* loop,
+                            int preheader, int factor, long peel, CloneBuffer* buffer) {
+    const BasicBlock* header = &cfg->blocks[loop->header];
+    const BasicBlock* latch = &cfg->blocks[loop->latch];
+    int latchLabel = BlockLabel(cfg, loop->latch);
+
+    // Leftover iterations, straight-line in the preheader
+    CloneBuffer peeled;
+    memset(&peeled, 0, sizeof(CloneBuffer));
+    peeled.function = function;
+    peeled.mapSize = buffer->mapSize;
+    peeled.map = CheckedMalloc(peeled.mapSize * sizeof(TACOperand));
+    StartPhis(&peeled, cfg, loop);
+    for (long t = 0; t < peel; t++) {
+        AppendIteration(&peeled, loop, 0, loop->seq.count, 1);
+        AdvancePhis(&peeled, cfg, loop);
+    }
+    for (int i = header->start; i < header->end && peel > 0; i++) {
+        TACInstruction* phi = &function->code[i];
+        for (int k = 0; phi->op == TAC_PHI && k < phi->phiCount; k++) {
+            if (phi->phiArgs[k].pred != latchLabel) {
+                phi->phiArgs[k].value = peeled.map[phi->result.value.id];
+            }
+        }
+    }
+
+    // The unrolled body replaces the latch block
+    for (int v = 0; v < buffer->mapSize; v++) {
+        buffer->map[v] = VarOperand(v);
+    }
+    int firstSeq = latch->start;
+    while (firstSeq < latch->end - 1 &&
+           (function->code[firstSeq].op == TAC_LABEL || function->code[firstSeq].op == TAC_PHI)) {
+        firstSeq++;
+    }
+    for (int i = latch->start; i < firstSeq; i++) {
+        Append(buffer, &function->code[i]);
+    }
+
+    int skip = loop->latch == loop->header ? 0 : loop->headerLength;
+    AppendIteration(buffer, loop, skip, loop->seq.count, 1);
+    for (int copy = 1; copy < factor - 1; copy++) {
+        AdvancePhis(buffer, cfg, loop);
+        AppendIteration(buffer, loop, 0, loop->seq.count, 1);
+    }
+    AdvancePhis(buffer, cfg, loop);
+    AppendIteration(buffer, loop, 0, skip, 1);
+    AppendIteration(buffer, loop, skip, loop->seq.count, 0);
+    AppendClone(buffer, &function->code[latch->end - 1], 0);
+
+    // Values carried around the back edge now come from the last copy
+    for (int i = header->start; i < header->end; i++) {
+        TACInstruction* phi = &function->code[i];
+        for (int k = 0; phi->op == TAC_PHI && k < phi->phiCount; k++) {
+            if (phi->phiArgs[k].pred == latchLabel) {
+                phi->phiArgs[k].value = Remap(buffer, phi->phiArgs[k].value);
+            }
+        }
+    }
+
+    // The phis were moved into the new code, which now owns their arguments
+    for (int i = latch->start; i < firstSeq; i++) {
+        function->code[i].phiArgs = NULL;
+    }
+
+    int at = PreheaderInsertIndex(function, cfg, preheader);
+    if (at > latch->start) {
+        InsertInstructions(function, at, peeled.code, peeled.count);
+        ReplaceRange(function, latch->start, latch->end, buffer);
+    } else {
+        ReplaceRange(function, latch->start, latch->end, buffer);
+        InsertInstructions(function, at, peeled.code, peeled.count);
+    }
+    free(peeled.code);
+    free(peeled.map);
+}
+
+/**
+ * @brief Unrolls one loop with a constant trip count that has not been unrolled yet
+ *
+ * @return 1 if a loop was unrolled
+ */
+static int UnrollOne(TACFunction* function, const UnrollOptions* options, IntList* done) {
+    CFG cfg = AnalyzeCFG(function);
+    DefUseChains chains = BuildDefUseChains(function);
+    CloneBuffer buffer;
+    int unrolled = 0;
+
+    memset(&buffer, 0, sizeof(CloneBuffer));
+    buffer.function = function;
+    buffer.mapSize = function->varCount;
+    buffer.map = CheckedMalloc(buffer.mapSize * sizeof(TACOperand));
+
+    for (int l = cfg.loopCount - 1; l >= 0 && !unrolled; l--) {
+        UnrollCandidate loop;
+        int preheader = FindPreheader(&cfg, l);
+        if (preheader < 0 || IntListContains(done, BlockLabel(&cfg, cfg.loops[l].header)) ||
+            IsVectorized(function, BlockLabel(&cfg, cfg.loops[l].header)) || !MatchLoop(function, &cfg, l, &loop)) {
+            continue;
+        }
+
+        int ivCount;
+        LoopExit exit;
+        InductionVariable* ivs = FindInductionVariables(function, &cfg, &chains, l, &ivCount);
+        long trips = -1;
+        if (FindLoopExit(function, &cfg, &chains, l, ivs, ivCount, &exit)) {
+            trips = ConstantTripCount(function, &exit, &ivs[exit.iv], MAX_COUNTED_TRIPS);
+        }
+        free(ivs);
+
+        // Iterations of the whole body: the test of a do-while loop runs after it
+        long runs = loop.latch == loop.header ? trips + 1 : trips;
+        long size = loop.seq.count;
+
+        if (trips >= 0 && trips <= options->maxFullTrips && (trips + 1) * size <= options->maxSize) {
+            IntListPush(done, BlockLabel(&cfg, loop.header));
+            UnrollFully(function, &cfg, &loop, trips, &buffer);
+            unrolled = 1;
+        } else if (trips >= 0 && options->factor > 1 && runs >= options->factor &&
+                   (options->factor + runs % options->factor) * size <= options->maxSize) {
+            IntListPush(done, BlockLabel(&cfg, loop.header));
+            UnrollPartially(function, &cfg, &loop, preheader, options->factor, runs % options->factor, &buffer);
+            unrolled = 1;
+        }
+
+        IntListFree(&loop.seq);
+    }
+
+    RemoveNops(function);
+    FreeCFG(&cfg);
+    FreeDefUseChains(&chains);
+    free(buffer.map);
+    free(buffer.code);
+    return unrolled;
+}
+
+/**
+ * @brief Unrolls the innermost loops of a function that run a constant number of times
+ *
+ * A loop whose trip count is at most options->maxFullTrips is replaced by
+ * straight-line copies of its body, removing every branch. A longer loop is
+ * unrolled by options->factor, with the remaining iterations peeled off in
+ * front of it. Neither is done if the loop would grow past
+ * options->maxSize instructions.
+ *
+ * @param function The function to optimize; converted to SSA if needed
+ * @param options How far to unroll
+ * @return The number of loops unrolled
+ */
+int RunUnroll(TACFunction* function, const UnrollOptions* options) {
+    InsertPreheaders(function);
+
+    IntList done = {0};
+    int unrolled = 0;
+    while (UnrollOne(function, options, &done)) {
+        unrolled++;
+    }
+
+    IntListFree(&done);
+    return unrolled;
+}
@@ -0,0 +1,200 @@
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Allocates memory, exiting the compiler if the allocation fails
+ *
+ * @param size The number of bytes to allocate
+ * @return A pointer to the allocated memory
+ */
+void* CheckedMalloc(size_t size) {
+    void* ptr = malloc(size == 0 ? 1 : size);
+
+    if (ptr == NULL) {
+        perror("Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return ptr;
+}
+
+/**
+ * @brief Allocates zero-initialized memory, exiting the compiler if the allocation fails
+ *
+ * @param count The number of elements to allocate
+ * @param size The size of each element
+ * @return A pointer to the allocated memory
+ */
+void* CheckedCalloc(size_t count, size_t size) {
+    void* ptr = calloc(count == 0 ? 1 : count, size == 0 ? 1 : size);
+
+    if (ptr == NULL) {
+        perror("Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return ptr;
+}
+
+/**
+ * @brief Resizes a block of memory, exiting the compiler if the allocation fails
+ *
+ * @param ptr The block to resize, or NULL to allocate a new one
+ * @param size The new size in bytes
+ * @return A pointer to the resized memory
+ */
+void* CheckedRealloc(void* ptr, size_t size) {
+    void* resized = realloc(ptr, size == 0 ? 1 : size);
+
+    if (resized == NULL) {
+        perror("Error allocating memory");
+        exit(EXIT_FAILURE);
+    }
+
+    return resized;
+}
+
+/**
+ * @brief Appends a value to a growable list of integers
+ *
+ * The list doubles its capacity when it runs out of room, so a sequence of
+ * pushes costs amortized constant time per element.
+ *
+ * @param list The list to append to
+ * @param value The value to append
+ */
+void IntListPush(IntList* list, int value) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+        list->items = CheckedRealloc(list->items, list->capacity * sizeof(int));
+    }
+    list->items[list->count++] = value;
+}
+
+/**
+ * @brief Checks whether a list contains a value
+ *
+ * @param list The list to search
+ * @param value The value to look for
+ * @return 1 if the value is in the list, 0 if it is not
+ */
+int IntListContains(const IntList* list, int value) {
+    for (int i = 0; i < list->count; i++) {
+        if (list->items[i] == value) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases the storage held by a list and leaves it empty
+ *
+ * @param list The list to free
+ */
+void IntListFree(IntList* list) {
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+/**
+ * @brief Creates an empty set able to hold the integers 0 to size - 1
+ *
+ * @param size The number of possible members
+ * @return The new set, to be released with FreeBitset
+ */
+Bitset NewBitset(int size) {
+    Bitset set;
+    set.size = size;
+    set.wordCount = (size + 63) / 64;
+    set.words = CheckedCalloc(set.wordCount, sizeof(unsigned long long));
+    return set;
+}
+
+void FreeBitset(Bitset* set) {
+    free(set->words);
+    set->words = NULL;
+    set->size = 0;
+    set->wordCount = 0;
+}
+
+void BitsetAdd(Bitset* set, int bit) {
+    set->words[bit / 64] |= 1ULL << (bit % 64);
+}
+
+void BitsetRemove(Bitset* set, int bit) {
+    set->words[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+int BitsetContains(const Bitset* set, int bit) {
+    return (set->words[bit / 64] >> (bit % 64)) & 1;
+}
+
+void BitsetClearAll(Bitset* set) {
+    for (int w = 0; w < set->wordCount; w++) {
+        set->words[w] = 0;
+    }
+}
+
+/**
+ * @brief Overwrites a set with the members of another set of the same size
+ */
+void BitsetCopy(Bitset* dst, const Bitset* src) {
+    for (int w = 0; w < dst->wordCount; w++) {
+        dst->words[w] = src->words[w];
+    }
+}
+
+/**
+ * @brief Adds the members of one set to another of the same size, a word at a time
+ *
+ * @param dst The set to add to
+ * @param src The set whose members are added
+ * @return 1 if dst gained any member
+ */
+int BitsetUnion(Bitset* dst, const Bitset* src) {
+    unsigned long long changed = 0;
+    for (int w = 0; w < dst->wordCount; w++) {
+        unsigned long long merged = dst->words[w] | src->words[w];
+        changed |= merged ^ dst->words[w];
+        dst->words[w] = merged;
+    }
+    return changed != 0;
+}
+
+/**
+ * @brief Removes the members of one set from another of the same size
+ */
+void BitsetDifference(Bitset* dst, const Bitset* src) {
+    for (int w = 0; w < dst->wordCount; w++) {
+        dst->words[w] &= ~src->words[w];
+    }
+}
+
+/**
+ * @brief Finds the smallest member of a set that is at least a given value
+ *
+ * Whole empty words are skipped, so iterating a sparse set is cheap:
+ * for (int i = BitsetNext(&set, 0); i >= 0; i = BitsetNext(&set, i + 1))
+ *
+ * @param set The set to search
+ * @param from The smallest value to consider
+ * @return The member found, or -1 if there is none
+ */
+int BitsetNext(const Bitset* set, int from) {
+    if (from >= set->size) {
+        return -1;
+    }
+    int w = from / 64;
+    unsigned long long word = set->words[w] & (~0ULL << (from % 64));
+    while (word == 0) {
+        if (++w == set->wordCount) {
+            return -1;
+        }
+        word = set->words[w];
+    }
+    return w * 64 + __builtin_ctzll(word);
+}
@@ -0,0 +1,51 @@
+#ifndef util_h
+#define util_h
+
+#include <stddef.h>
+
+typedef struct {
+    int* items;
+    int count;
+    int capacity;
+} IntList;
+
+// A fixed-size set of small integers, packed 64 to a word
+typedef struct {
+    unsigned long long* words;
+    int size;
+    int wordCount;
+} Bitset;
+
+void* CheckedMalloc(size_t size);
+
+void* CheckedCalloc(size_t count, size_t size);
+
+void* CheckedRealloc(void* ptr, size_t size);
+
+void IntListPush(IntList* list, int value);
+
+int IntListContains(const IntList* list, int value);
+
+void IntListFree(IntList* list);
+
+Bitset NewBitset(int size);
+
+void FreeBitset(Bitset* set);
+
+void BitsetAdd(Bitset* set, int bit);
+
+void BitsetRemove(Bitset* set, int bit);
+
+int BitsetContains(const Bitset* set, int bit);
+
+void BitsetClearAll(Bitset* set);
+
+void BitsetCopy(Bitset* dst, const Bitset* src);
+
+int BitsetUnion(Bitset* dst, const Bitset* src);
+
+void BitsetDifference(Bitset* dst, const Bitset* src);
+
+int BitsetNext(const Bitset* set, int from);
+
+#endif
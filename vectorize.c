@@ -0,0 +1,581 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimize.h"
+#include "cfg.h"
+#include "ssa.h"
+
+#define MAX_VECTOR_OPS 48
+#define MAX_VECTOR_ARRAYS 6
+#define MAX_INDEX_OFFSET (1 << 20)
+
+// What a variable of the loop body is in the vector loop
+typedef enum {
+    LANE_NONE,          // Nothing the vector loop computes
+    LANE_INDEX,         // The counter plus a constant, only good as an array index
+    LANE_VALUE,         // The lanes of an op
+    LANE_REDUCTION,     // A reduction's running value, only good for updating it
+} LaneKind;
+
+typedef struct {
+    LaneKind kind;
+    int value;          // The constant, op or reduction
+} Lane;
+
+typedef struct {
+    TACFunction* function;
+    const CFG* cfg;
+    const DefUseChains* chains;
+    int loop;
+    Lane* lanes;                // Variable -> what it is in the vector loop
+    int* updates;               // Variable -> the reduction its body instruction updates, -1 if none
+
+    TACVectorLoop plan;
+    int opCapacity;
+    TACPhiArg* operands;
+    int operandCount;
+    int operandCapacity;
+} Vectorizer;
+
+/**
+ * @brief Checks whether the header of a loop is that of a loop with a vector part
+ *
+ * The scalar loop left behind only runs the last few iterations, so it is
+ * not worth unrolling.
+ */
+int IsVectorized(const TACFunction* function, int headerLabel) {
+    for (int i = 0; i < function->vectorLoopCount; i++) {
+        if (function->vectorLoops[i].header == headerLabel) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds an operand to the vecloop, or finds it there
+ *
+ * @param fixed Whether the operand must get a place of its own, even if it is already there
+ */
+static int AddOperand(Vectorizer* v, TACOperand operand, int fixed) {
+    for (int i = 0; i < v->operandCount && !fixed; i++) {
+        if (SameOperand(v->operands[i].value, operand)) {
+            return i;
+        }
+    }
+    if (v->operandCount == v->operandCapacity) {
+        v->operandCapacity = v->operandCapacity == 0 ? 8 : v->operandCapacity * 2;
+        v->operands = CheckedRealloc(v->operands, v->operandCapacity * sizeof(TACPhiArg));
+    }
+    v->operands[v->operandCount].value = operand;
+    v->operands[v->operandCount].pred = -1;
+    return v->operandCount++;
+}
+
+/**
+ * @brief Appends an op to the vector body
+ *
+ * @return The index of the op, or -1 once the body has grown too large
+ */
+static int AddOp(Vectorizer* v, TACVectorOpKind kind, int isFloat, int a, int b, int offset) {
+    if (v->plan.opCount == MAX_VECTOR_OPS) {
+        return -1;
+    }
+    if (v->plan.opCount == v->opCapacity) {
+        v->opCapacity = v->opCapacity == 0 ? 8 : v->opCapacity * 2;
+        v->plan.ops = CheckedRealloc(v->plan.ops, v->opCapacity * sizeof(TACVectorOp));
+    }
+    TACVectorOp* op = &v->plan.ops[v->plan.opCount];
+    op->kind = kind;
+    op->isFloat = isFloat;
+    op->a = a;
+    op->b = b;
+    op->offset = offset;
+    return v->plan.opCount++;
+}
+
+/**
+ * @brief Finds or adds the op holding a loop-invariant value in every lane
+ */
+static int Splat(Vectorizer* v, TACOperand operand, int isFloat) {
+    int slot = AddOperand(v, operand, 0);
+
+    for (int i = 0; i < v->plan.opCount; i++) {
+        const TACVectorOp* op = &v->plan.ops[i];
+        if (op->kind == VEC_SPLAT && op->a == slot && op->isFloat == isFloat) {
+            return i;
+        }
+    }
+    return AddOp(v, VEC_SPLAT, isFloat, slot, -1, 0);
+}
+
+/**
+ * @brief Returns the op giving the lanes of an operand of the body, as floats or as integers
+ *
+ * Integer lanes are converted when floats are wanted, as the scalar code
+ * would convert the value; floats are never truncated to integers.
+ *
+ * @return The op, or -1 if the vector loop cannot compute the operand
+ */
+static int LanesOf(Vectorizer* v, TACOperand operand, int wantFloat) {
+    TACFunction* function = v->function;
+    DataType type = OperandType(function, operand);
+
+    if (type != INTEGER && type != FLOAT) {
+        return -1;
+    }
+    if (wantFloat && operand.kind == TAC_OPERAND_INT) {
+        return Splat(v, FloatOperand((float)operand.value.intValue), 1);
+    }
+    if (!wantFloat && type == FLOAT) {
+        return -1;
+    }
+
+    int op;
+    if (IsLoopInvariant(v->cfg, v->chains, v->loop, operand)) {
+        op = Splat(v, operand, type == FLOAT);
+    } else if (v->lanes[operand.value.id].kind == LANE_VALUE) {
+        op = v->lanes[operand.value.id].value;
+    } else {
+        return -1;
+    }
+
+    if (op >= 0 && wantFloat && type != FLOAT) {
+        op = AddOp(v, VEC_CONVERT, 1, op, -1, 0);
+    }
+    return op;
+}
+
+/**
+ * @brief Returns the array operand an element access goes through and the offset of its index
+ *
+ * @return The operand of the vecloop, or -1 if the access is not at the counter plus a constant
+ */
+static int ElementAccess(Vectorizer* v, TACOperand array, TACOperand index, int* offset) {
+    if (array.kind != TAC_OPERAND_VAR || OperandType(v->function, array) != ARRAY ||
+        !IsLoopInvariant(v->cfg, v->chains, v->loop, array)) {
+        return -1;
+    }
+    if (index.kind != TAC_OPERAND_VAR || v->lanes[index.value.id].kind != LANE_INDEX) {
+        return -1;
+    }
+    *offset = v->lanes[index.value.id].value;
+    return AddOperand(v, array, 0);
+}
+
+/**
+ * @brief Translates one instruction of the loop body into ops
+ *
+ * @return 1 if the vector loop can do what the instruction does
+ */
+static int TranslateInstruction(Vectorizer* v, int index) {
+    TACFunction* function = v->function;
+    TACInstruction* instr = &function->code[index];
+    int def = TACDefinedVar(instr);
+    int offset;
+
+    switch (instr->op) {
+    case TAC_LOAD_INDEX: {
+        DataType type = function->vars[def].type;
+        int array = ElementAccess(v, instr->arg1, instr->arg2, &offset);
+        if (array < 0 || (type != INTEGER && type != FLOAT)) {
+            return 0;
+        }
+        v->lanes[def].kind = LANE_VALUE;
+        v->lanes[def].value = AddOp(v, VEC_LOAD, type == FLOAT, array, -1, offset);
+        return v->lanes[def].value >= 0;
+    }
+    case TAC_STORE_INDEX: {
+        int array = ElementAccess(v, instr->result, instr->arg1, &offset);
+        // Lanes are stored as the element type, as the scalar store converts them
+        int isFloat = function->vars[instr->result.value.id].elementType == FLOAT;
+        int value = array >= 0 ? LanesOf(v, instr->arg2, isFloat) : -1;
+        return value >= 0 && AddOp(v, VEC_STORE, isFloat, array, value, offset) >= 0;
+    }
+    case TAC_ASSIGN: {
+        int isFloat = function->vars[def].type == FLOAT;
+        if (!isFloat && function->vars[def].type != INTEGER) {
+            return 0;
+        }
+        v->lanes[def].kind = LANE_VALUE;
+        v->lanes[def].value = LanesOf(v, instr->arg1, isFloat);
+        return v->lanes[def].value >= 0;
+    }
+    case TAC_ADD:
+    case TAC_SUB:
+    case TAC_MUL:
+    case TAC_DIV:
+        break;
+    default:
+        return 0;
+    }
+
+    // The counter plus or minus a constant is another index
+    const Lane* left = instr->arg1.kind == TAC_OPERAND_VAR ? &v->lanes[instr->arg1.value.id] : NULL;
+    const Lane* right = instr->arg2.kind == TAC_OPERAND_VAR ? &v->lanes[instr->arg2.value.id] : NULL;
+    if ((left != NULL && left->kind == LANE_INDEX) || (right != NULL && right->kind == LANE_INDEX)) {
+        int base = left != NULL && left->kind == LANE_INDEX ? left->value : right->value;
+        TACOperand other = left != NULL && left->kind == LANE_INDEX ? instr->arg2 : instr->arg1;
+        int constant = other.kind == TAC_OPERAND_INT ? other.value.intValue : MAX_INDEX_OFFSET;
+        if (constant <= -MAX_INDEX_OFFSET || constant >= MAX_INDEX_OFFSET ||
+            (instr->op != TAC_ADD && !(instr->op == TAC_SUB && left != NULL && left->kind == LANE_INDEX))) {
+            return 0;
+        }
+        v->lanes[def].kind = LANE_INDEX;
+        v->lanes[def].value = base + (instr->op == TAC_ADD ? constant : -constant);
+        return 1;
+    }
+
+    int isFloat = OperandType(function, instr->arg1) == FLOAT || OperandType(function, instr->arg2) == FLOAT;
+    if (function->vars[def].type != (isFloat ? FLOAT : INTEGER) || (instr->op == TAC_DIV && !isFloat)) {
+        return 0;
+    }
+
+    int reduction = v->updates[def];
+    if (reduction >= 0) {
+        TACReduction* r = &v->plan.reductions[reduction];
+        int leftIsSum = left != NULL && left->kind == LANE_REDUCTION;
+        int value = LanesOf(v, leftIsSum ? instr->arg2 : instr->arg1, r->isFloat);
+        r->subtract = instr->op == TAC_SUB;
+        return value >= 0 && AddOp(v, VEC_REDUCE, r->isFloat, reduction, value, 0) >= 0;
+    }
+
+    static const TACVectorOpKind kinds[] = {VEC_ADD, VEC_SUB, VEC_MUL, VEC_DIV};
+    int a = LanesOf(v, instr->arg1, isFloat);
+    int b = a >= 0 ? LanesOf(v, instr->arg2, isFloat) : -1;
+    v->lanes[def].kind = LANE_VALUE;
+    v->lanes[def].value = b >= 0 ? AddOp(v, kinds[instr->op - TAC_ADD], isFloat, a, b, 0) : -1;
+    return v->lanes[def].value >= 0;
+}
+
+/**
+ * @brief Checks whether every use of a variable inside the loop is by one instruction
+ */
+static int OnlyUsedBy(const Vectorizer* v, int var, int user) {
+    const IntList* uses = &v->chains->uses[var];
+
+    for (int u = 0; u < uses->count; u++) {
+        if (uses->items[u] != user && LoopContains(v->cfg, v->loop, v->cfg->blockOf[uses->items[u]])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Recognizes a header phi as a sum the body adds to or subtracts from once per iteration
+ *
+ * The running value may only feed that one update, whose result only
+ * feeds the phi, so the partial sums are never observed inside the loop.
+ */
+static int MatchReduction(Vectorizer* v, const TACInstruction* phi, int latchLabel) {
+    TACFunction* function = v->function;
+    int var = phi->result.value.id;
+    DataType type = function->vars[var].type;
+
+    if (phi->phiCount != 2 || (type != INTEGER && type != FLOAT)) {
+        return 0;
+    }
+    int back = phi->phiArgs[0].pred == latchLabel ? 0 : 1;
+    TACOperand next = phi->phiArgs[back].value;
+    if (phi->phiArgs[back].pred != latchLabel || next.kind != TAC_OPERAND_VAR) {
+        return 0;
+    }
+    int update = v->chains->def[next.value.id];
+    if (update < 0 || !LoopContains(v->cfg, v->loop, v->cfg->blockOf[update])) {
+        return 0;
+    }
+
+    const TACInstruction* instr = &function->code[update];
+    int onLeft = instr->arg1.kind == TAC_OPERAND_VAR && instr->arg1.value.id == var;
+    int onRight = instr->arg2.kind == TAC_OPERAND_VAR && instr->arg2.value.id == var;
+    if (!(instr->op == TAC_ADD && onLeft != onRight) && !(instr->op == TAC_SUB && onLeft && !onRight)) {
+        return 0;
+    }
+    if (function->vars[next.value.id].type != type || !OnlyUsedBy(v, var, update) ||
+        !OnlyUsedBy(v, next.value.id, phi - function->code)) {
+        return 0;
+    }
+
+    TACReduction* r = &v->plan.reductions[v->plan.reductionCount];
+    r->operand = AddOperand(v, phi->phiArgs[1 - back].value, 0);
+    r->isFloat = type == FLOAT;
+    r->subtract = 0;
+    v->lanes[var].kind = LANE_REDUCTION;
+    v->lanes[var].value = v->plan.reductionCount;
+    v->updates[next.value.id] = v->plan.reductionCount++;
+    return 1;
+}
+
+/**
+ * @brief Checks that running the body on several iterations at once keeps the order of every array access that matters
+ *
+ * A store and another access to the same array must be to the same
+ * element of it, so no iteration reads what an earlier one wrote or
+ * writes what a later one reads. Different array variables may still
+ * name the same array; the generated code checks that at run time
+ * wherever their offsets differ.
+ */
+static int AccessesIndependent(const TACVectorLoop* plan) {
+    int arrays = 0;
+
+    for (int i = 0; i < plan->opCount; i++) {
+        const TACVectorOp* op = &plan->ops[i];
+        if (op->kind != VEC_LOAD && op->kind != VEC_STORE) {
+            continue;
+        }
+        int first = 1;
+        for (int j = 0; j < i && first; j++) {
+            const TACVectorOp* other = &plan->ops[j];
+            first = !((other->kind == VEC_LOAD || other->kind == VEC_STORE) && other->a == op->a);
+        }
+        arrays += first;
+
+        for (int j = 0; j < plan->opCount; j++) {
+            const TACVectorOp* other = &plan->ops[j];
+            if ((op->kind == VEC_STORE || other->kind == VEC_STORE) &&
+                (other->kind == VEC_LOAD || other->kind == VEC_STORE) && other->a == op->a &&
+                other->offset != op->offset) {
+                return 0;
+            }
+        }
+    }
+    return arrays > 0 && arrays <= MAX_VECTOR_ARRAYS;
+}
+
+/**
+ * @brief Works out whether the exit test keeps the loop running while the counter is below its bound
+ *
+ * @return 1 for counter < bound, 2 for counter <= bound, 0 for any other test
+ */
+static int CountedTest(TACFunction* function, const LoopExit* exit) {
+    TACOpcode op = function->code[exit->compare].op;
+
+    if (!exit->ivOnLeft) {
+        op = op == TAC_LT ? TAC_GT : op == TAC_GT ? TAC_LT : op == TAC_LE ? TAC_GE : op == TAC_GE ? TAC_LE : op;
+    }
+    if (!exit->continueIfTrue) {
+        op = op == TAC_LT ? TAC_GE : op == TAC_GE ? TAC_LT : op == TAC_LE ? TAC_GT : op == TAC_GT ? TAC_LE : op;
+    }
+    return op == TAC_LT ? 1 : (op == TAC_LE ? 2 : 0);
+}
+
+/**
+ * @brief Translates a loop into a vector loop if it has the shape and body one needs
+ *
+ * The loop must be a top-tested for loop, its header holding nothing but
+ * phis and the test and its one body block nothing but element loads and
+ * stores at the counter plus constants, arithmetic and reductions.
+ */
+static int PlanLoop(Vectorizer* v) {
+    TACFunction* function = v->function;
+    const CFG* cfg = v->cfg;
+    const Loop* l = &cfg->loops[v->loop];
+    int h = l->header;
+    const BasicBlock* header = &cfg->blocks[h];
+
+    for (int other = 0; other < cfg->loopCount; other++) {
+        if (cfg->loops[other].parent == v->loop) {
+            return 0;
+        }
+    }
+    if (l->blocks.count != 2 || SingleLatch(cfg, v->loop) != h + 1) {
+        return 0;
+    }
+    const BasicBlock* body = &cfg->blocks[h + 1];
+    if (body->preds.count != 1 || body->end == body->start || function->code[body->end - 1].op != TAC_GOTO) {
+        return 0;
+    }
+
+    int ivCount;
+    LoopExit exit;
+    InductionVariable* ivs = FindInductionVariables(function, cfg, v->chains, v->loop, &ivCount);
+    int counted = FindLoopExit(function, cfg, v->chains, v->loop, ivs, ivCount, &exit) && exit.block == h &&
+                  !exit.usesNext && ivs[exit.iv].step == 1 && CountedTest(function, &exit) != 0 &&
+                  LoopContains(cfg, v->loop, h + 1);
+    // Loops short enough to unroll completely are better off that way
+    if (!counted || ConstantTripCount(function, &exit, &ivs[exit.iv], unrollOptions.maxFullTrips) >= 0) {
+        free(ivs);
+        return 0;
+    }
+    InductionVariable iv = ivs[exit.iv];
+    free(ivs);
+
+    v->plan.header = BlockLabel(cfg, h);
+    v->plan.inclusive = CountedTest(function, &exit) == 2;
+    AddOperand(v, iv.init, 1);
+    AddOperand(v, exit.bound, 1);
+    v->lanes[iv.var].kind = LANE_INDEX;
+    v->lanes[iv.var].value = 0;
+    v->lanes[iv.next].kind = LANE_INDEX;
+    v->lanes[iv.next].value = 1;
+
+    int latchLabel = BlockLabel(cfg, h + 1);
+    v->plan.reductions = CheckedMalloc((header->end - header->start) * sizeof(TACReduction));
+    for (int i = header->start; i < header->end; i++) {
+        const TACInstruction* instr = &function->code[i];
+        if (instr->op == TAC_LABEL || i == exit.compare || i == exit.branch || i == iv.phiIndex) {
+            continue;
+        }
+        if (instr->op != TAC_PHI || !MatchReduction(v, instr, latchLabel)) {
+            return 0;
+        }
+    }
+
+    for (int i = body->start; i < body->end - 1; i++) {
+        if (function->code[i].op == TAC_LABEL || i == iv.nextIndex) {
+            continue;
+        }
+        if (!TranslateInstruction(v, i)) {
+            return 0;
+        }
+    }
+    return AccessesIndependent(&v->plan);
+}
+
+/**
+ * @brief Puts the vector loop in front of the scalar one, which then starts where it stopped
+ *
+ * The counter and every reduction enter the scalar loop with the values
+ * the vector loop leaves them, so it finishes the iterations too few to
+ * fill a vector, or all of them if the vector loop could not run.
+ */
+static void EmitVectorLoop(Vectorizer* v, const CFG* cfg, int preheader) {
+    TACFunction* function = v->function;
+    int count = 2 + v->plan.reductionCount;
+    TACInstruction* code = CheckedCalloc(count, sizeof(TACInstruction));
+    TACOperand* entry = CheckedMalloc((count - 1) * sizeof(TACOperand));
+    int preheaderLabel = BlockLabel(cfg, preheader);
+    int at = PreheaderInsertIndex(function, cfg, preheader);
+
+    int done = NewTemp(function, INTEGER);
+    code[0].op = TAC_VECLOOP;
+    code[0].arg1 = IntOperand(function->vectorLoopCount);
+    code[0].result = VarOperand(done);
+    code[0].phiArgs = v->operands;
+    code[0].phiCount = v->operandCount;
+
+    entry[0] = VarOperand(NewTemp(function, INTEGER));
+    code[1].op = TAC_ADD;
+    code[1].arg1 = v->operands[0].value;
+    code[1].arg2 = VarOperand(done);
+    code[1].result = entry[0];
+
+    for (int r = 0; r < v->plan.reductionCount; r++) {
+        TACReduction* reduction = &v->plan.reductions[r];
+        reduction->slot = function->reductionSlots++;
+        entry[1 + r] = VarOperand(NewTemp(function, reduction->isFloat ? FLOAT : INTEGER));
+        code[2 + r].op = TAC_VECREDUCE;
+        code[2 + r].arg1 = v->operands[reduction->operand].value;
+        code[2 + r].arg2 = IntOperand(reduction->slot);
+        code[2 + r].result = entry[1 + r];
+    }
+
+    // The phis the values enter through, found before the insertion moves them
+    int* phis = CheckedMalloc((count - 1) * sizeof(int));
+    for (int i = 0; i < function->count; i++) {
+        const TACInstruction* instr = &function->code[i];
+        if (instr->op != TAC_PHI || cfg->blockOf[i] != cfg->loops[v->loop].header) {
+            continue;
+        }
+        Lane lane = v->lanes[instr->result.value.id];
+        if (lane.kind == LANE_INDEX) {
+            phis[0] = i;
+        } else if (lane.kind == LANE_REDUCTION) {
+            phis[1 + lane.value] = i;
+        }
+    }
+    for (int k = 0; k < count - 1; k++) {
+        TACInstruction* phi = &function->code[phis[k]];
+        for (int a = 0; a < phi->phiCount; a++) {
+            if (phi->phiArgs[a].pred == preheaderLabel) {
+                phi->phiArgs[a].value = entry[k];
+            }
+        }
+    }
+
+    InsertInstructions(function, at, code, count);
+    free(phis);
+    free(entry);
+    free(code);
+}
+
+/**
+ * @brief Vectorizes one innermost loop not looked at yet
+ *
+ * @return 1 if a loop was vectorized
+ */
+static int VectorizeOne(TACFunction* function, IntList* done) {
+    CFG cfg = AnalyzeCFG(function);
+    DefUseChains chains = BuildDefUseChains(function);
+    Vectorizer v;
+    int vectorized = 0;
+
+    for (int l = cfg.loopCount - 1; l >= 0 && !vectorized; l--) {
+        int preheader = FindPreheader(&cfg, l);
+        int label = BlockLabel(&cfg, cfg.loops[l].header);
+        if (preheader < 0 || IntListContains(done, label)) {
+            continue;
+        }
+        IntListPush(done, label);
+
+        memset(&v, 0, sizeof(Vectorizer));
+        v.function = function;
+        v.cfg = &cfg;
+        v.chains = &chains;
+        v.loop = l;
+        v.lanes = CheckedCalloc(function->varCount + 1, sizeof(Lane));
+        v.updates = CheckedMalloc((function->varCount + 1) * sizeof(int));
+        for (int i = 0; i < function->varCount; i++) {
+            v.updates[i] = -1;
+        }
+
+        if (PlanLoop(&v)) {
+            EmitVectorLoop(&v, &cfg, preheader);
+            function->vectorLoops = CheckedRealloc(function->vectorLoops,
+                                                   (function->vectorLoopCount + 1) * sizeof(TACVectorLoop));
+            function->vectorLoops[function->vectorLoopCount++] = v.plan;
+            vectorized = 1;
+        } else {
+            free(v.plan.ops);
+            free(v.plan.reductions);
+            free(v.operands);
+        }
+        free(v.lanes);
+        free(v.updates);
+    }
+
+    FreeCFG(&cfg);
+    FreeDefUseChains(&chains);
+    return vectorized;
+}
+
+/**
+ * @brief Runs counted loops over arrays several iterations at a time, one per vector lane
+ *
+ * A loop for (i = start; i < n; i = i + 1), or with i <= n, whose body
+ * loads and stores elements at i plus constants and combines them with
+ * arithmetic gets a vecloop in its preheader: the same body over whole
+ * vectors, as many iterations as fill them, with sums the body keeps
+ * carried in vector registers. The loop stays behind to finish the rest
+ * and to run alone whenever the vector loop's checks of the bounds and
+ * of overlapping arrays fail, so errors still happen where they would.
+ * Code generation decides how the vecloop runs; elsewhere it runs no
+ * iterations.
+ *
+ * @param function The function to optimize, in SSA form
+ * @return The number of loops vectorized
+ */
+int RunVectorize(TACFunction* function) {
+    InsertPreheaders(function);
+
+    IntList done = {0};
+    int vectorized = 0;
+    while (VectorizeOne(function, &done)) {
+        vectorized++;
+    }
+
+    IntListFree(&done);
+    return vectorized;
+}
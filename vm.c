@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "runtime.h"
+
+// Computed goto is a GNU extension; define ZARA_VM_SWITCH to dispatch through a switch anyway
+#if defined(__GNUC__) && !defined(ZARA_VM_SWITCH)
+#define VM_COMPUTED_GOTO
+#endif
+
+// Define ZARA_VM_PROFILE to count which instruction follows which, the pairs
+// worth turning into superinstructions
+#ifdef ZARA_VM_PROFILE
+static long long pairCounts[BC_OPCODE_COUNT][BC_OPCODE_COUNT];
+static int previousOp;
+#define VM_PROFILE(op) (pairCounts[previousOp][op]++, previousOp = (op))
+#else
+#define VM_PROFILE(op) ((void)0)
+#endif
+
+// Deep enough for any recursion the native code runs in its default 8 MB stack. Both are
+// allocated up front, but the system only backs the pages a program reaches
+#define VM_STACK_SLOTS (1 << 23)
+#define VM_MAX_DEPTH (1 << 20)
+
+typedef struct {
+    const BytecodeFunction* function;
+    const BytecodeInstr* pc;
+    VMValue* frame;
+    int result;         // Slot of the caller's frame that receives the returned value
+} CallRecord;
+
+static void VMError(const char* message) {
+    fflush(stdout);
+    fprintf(stderr, "Error: %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+static VMValue* EnterFrame(const BytecodeFunction* function, VMValue* frame, VMValue* stackEnd) {
+    // Leave room for the arguments of a call out of the frame
+    if (frame + function->frameSize + BC_MAX_SLOTS > stackEnd) {
+        char message[96];
+        snprintf(message, sizeof(message), "stack overflow in the bytecode interpreter, past %d slots of frames",
+                 VM_STACK_SLOTS);
+        VMError(message);
+    }
+    memset(frame + function->paramCount, 0, (function->varCount - function->paramCount) * sizeof(VMValue));
+    if (function->constantCount > 0) {
+        memcpy(frame + function->varCount, function->constants, function->constantCount * sizeof(VMValue));
+    }
+    return frame;
+}
+
+#ifdef ZARA_VM_PROFILE
+static void PrintProfile(void) {
+    fprintf(stderr, "Most frequent instruction pairs:\n");
+    for (int n = 0; n < 10; n++) {
+        int bestFirst = 0;
+        int bestSecond = 0;
+        for (int a = 0; a < BC_OPCODE_COUNT; a++) {
+            for (int b = 0; b < BC_OPCODE_COUNT; b++) {
+                if (pairCounts[a][b] > pairCounts[bestFirst][bestSecond]) {
+                    bestFirst = a;
+                    bestSecond = b;
+                }
+            }
+        }
+        if (pairCounts[bestFirst][bestSecond] == 0) {
+            break;
+        }
+        fprintf(stderr, "  %12lld  %s %s\n", pairCounts[bestFirst][bestSecond], BytecodeOpcodeName(bestFirst),
+                BytecodeOpcodeName(bestSecond));
+        pairCounts[bestFirst][bestSecond] = 0;
+    }
+}
+#endif
+
+static int* ElementAddress(VMValue array, VMValue index) {
+    long long* header = array.p;
+
+    // A negative index compares as a huge unsigned one
+    if ((unsigned long long)(long long)index.i >= (unsigned long long)header[0]) {
+        zara_bounds_error();
+    }
+    return (int*)(header + 1) + index.i;
+}
+
+/**
+ * @brief Runs a lowered program from its main function
+ *
+ * Each call gets a frame of slots on one value stack, right after its
+ * caller's, and arguments are written straight into the parameter slots of
+ * the frame to come. Dispatch jumps from one handler straight to the next
+ * through a table of label addresses, with no loop and no bounds check
+ * around it, where the compiler supports computed goto, and goes through a
+ * switch otherwise. Printing, arrays, stacks and strings share the helpers
+ * of runtime.c, so the output matches the compiled program.
+ *
+ * @param program The lowered program
+ * @return The value main returned
+ */
+int RunBytecode(const BytecodeProgram* program) {
+    if (program->mainFunction < 0) {
+        VMError("program has no main function to run");
+    }
+
+    VMValue* stack = CheckedMalloc(VM_STACK_SLOTS * sizeof(VMValue));
+    VMValue* stackEnd = stack + VM_STACK_SLOTS;
+    CallRecord* calls = CheckedMalloc(VM_MAX_DEPTH * sizeof(CallRecord));
+    int depth = 0;
+
+    const BytecodeFunction* function = &program->functions[program->mainFunction];
+    VMValue* frame = EnterFrame(function, stack, stackEnd);
+    const BytecodeInstr* pc = function->code;
+    BytecodeInstr instr;
+    VMValue value;
+    ZaraStack* operands;
+    int32_t offset;
+
+#define RA frame[BC_A(instr)]
+#define RB frame[BC_B(instr)]
+#define RC frame[BC_C(instr)]
+
+#ifdef VM_COMPUTED_GOTO
+    static void* const dispatch[BC_OPCODE_COUNT] = {
+        [BC_MOVE] = &&op_MOVE,           [BC_ITOF] = &&op_ITOF,         [BC_FTOI] = &&op_FTOI,
+        [BC_LOADFAR] = &&op_LOADFAR,     [BC_STOREFAR] = &&op_STOREFAR,
+        [BC_ADDI] = &&op_ADDI,           [BC_SUBI] = &&op_SUBI,         [BC_MULI] = &&op_MULI,
+        [BC_DIVI] = &&op_DIVI,           [BC_MODI] = &&op_MODI,         [BC_ADDF] = &&op_ADDF,
+        [BC_SUBF] = &&op_SUBF,           [BC_MULF] = &&op_MULF,         [BC_DIVF] = &&op_DIVF,
+        [BC_LTI] = &&op_LTI,             [BC_LEI] = &&op_LEI,           [BC_GTI] = &&op_GTI,
+        [BC_GEI] = &&op_GEI,             [BC_EQI] = &&op_EQI,           [BC_NEI] = &&op_NEI,
+        [BC_LTF] = &&op_LTF,             [BC_LEF] = &&op_LEF,           [BC_GTF] = &&op_GTF,
+        [BC_GEF] = &&op_GEF,             [BC_EQF] = &&op_EQF,           [BC_NEF] = &&op_NEF,
+        [BC_NEWARRAY] = &&op_NEWARRAY,   [BC_LOADINDEX] = &&op_LOADINDEX, [BC_STOREINDEX] = &&op_STOREINDEX,
+        [BC_NEWSTACK] = &&op_NEWSTACK,   [BC_PUSH] = &&op_PUSH,         [BC_POP] = &&op_POP,
+        [BC_PEEK] = &&op_PEEK,           [BC_STACKSIZE] = &&op_STACKSIZE, [BC_PRINTK] = &&op_PRINTK,
+        [BC_CONCAT] = &&op_CONCAT,       [BC_STREQ] = &&op_STREQ,
+        [BC_JUMP] = &&op_JUMP,           [BC_JUMPIF] = &&op_JUMPIF,     [BC_JUMPIFNOT] = &&op_JUMPIFNOT,
+        [BC_ARG] = &&op_ARG,             [BC_CALL] = &&op_CALL,         [BC_RETURN] = &&op_RETURN,
+        [BC_PRINTI] = &&op_PRINTI,       [BC_PRINTF] = &&op_PRINTF,     [BC_PRINTS] = &&op_PRINTS,
+        [BC_PRINTA] = &&op_PRINTA,       [BC_PRINTEND] = &&op_PRINTEND, [BC_ADDIK] = &&op_ADDIK,
+        [BC_JLTI] = &&op_JLTI,           [BC_JLEI] = &&op_JLEI,         [BC_JGTI] = &&op_JGTI,
+        [BC_JGEI] = &&op_JGEI,           [BC_JEQI] = &&op_JEQI,         [BC_JNEI] = &&op_JNEI,
+        [BC_MOVEJ] = &&op_MOVEJ,
+    };
+#define VM_CASE(name) op_##name
+#define VM_NEXT()                          \
+    do {                                   \
+        instr = *pc++;                     \
+        VM_PROFILE(BC_OP(instr));          \
+        goto *dispatch[BC_OP(instr)];      \
+    } while (0)
+    VM_NEXT();
+#else
+#define VM_CASE(name) case BC_##name
+#define VM_NEXT() goto next
+next:
+    instr = *pc++;
+    VM_PROFILE(BC_OP(instr));
+    switch (BC_OP(instr)) {
+#endif
+
+    VM_CASE(MOVE):
+        RA = RB;
+        VM_NEXT();
+    VM_CASE(ITOF):
+        RA.f = (float)RB.i;
+        VM_NEXT();
+    VM_CASE(FTOI):
+        RA.i = (int32_t)RB.f;
+        VM_NEXT();
+    VM_CASE(LOADFAR):
+        RA = frame[BC_BX(instr)];
+        VM_NEXT();
+    VM_CASE(STOREFAR):
+        frame[BC_BX(instr)] = RA;
+        VM_NEXT();
+
+    // Integer arithmetic wraps like the 32-bit machine instructions
+    VM_CASE(ADDI):
+        RA.i = (int32_t)((uint32_t)RB.i + (uint32_t)RC.i);
+        VM_NEXT();
+    VM_CASE(SUBI):
+        RA.i = (int32_t)((uint32_t)RB.i - (uint32_t)RC.i);
+        VM_NEXT();
+    VM_CASE(MULI):
+        RA.i = (int32_t)((uint32_t)RB.i * (uint32_t)RC.i);
+        VM_NEXT();
+    VM_CASE(DIVI):
+        if (RC.i == 0) {
+            VMError("division by zero");
+        }
+        RA.i = RB.i / RC.i;
+        VM_NEXT();
+    VM_CASE(MODI):
+        if (RC.i == 0) {
+            VMError("division by zero");
+        }
+        RA.i = RB.i % RC.i;
+        VM_NEXT();
+    VM_CASE(ADDF):
+        RA.f = RB.f + RC.f;
+        VM_NEXT();
+    VM_CASE(SUBF):
+        RA.f = RB.f - RC.f;
+        VM_NEXT();
+    VM_CASE(MULF):
+        RA.f = RB.f * RC.f;
+        VM_NEXT();
+    VM_CASE(DIVF):
+        RA.f = RB.f / RC.f;
+        VM_NEXT();
+
+    VM_CASE(LTI):
+        RA.i = RB.i < RC.i;
+        VM_NEXT();
+    VM_CASE(LEI):
+        RA.i = RB.i <= RC.i;
+        VM_NEXT();
+    VM_CASE(GTI):
+        RA.i = RB.i > RC.i;
+        VM_NEXT();
+    VM_CASE(GEI):
+        RA.i = RB.i >= RC.i;
+        VM_NEXT();
+    VM_CASE(EQI):
+        RA.i = RB.i == RC.i;
+        VM_NEXT();
+    VM_CASE(NEI):
+        RA.i = RB.i != RC.i;
+        VM_NEXT();
+    VM_CASE(LTF):
+        RA.i = RB.f < RC.f;
+        VM_NEXT();
+    VM_CASE(LEF):
+        RA.i = RB.f <= RC.f;
+        VM_NEXT();
+    VM_CASE(GTF):
+        RA.i = RB.f > RC.f;
+        VM_NEXT();
+    VM_CASE(GEF):
+        RA.i = RB.f >= RC.f;
+        VM_NEXT();
+    VM_CASE(EQF):
+        RA.i = RB.f == RC.f;
+        VM_NEXT();
+    VM_CASE(NEF):
+        RA.i = RB.f != RC.f;
+        VM_NEXT();
+
+    // Elements are 4 bytes, copied as they are whether they hold ints or floats
+    VM_CASE(NEWARRAY):
+        RA.p = zara_new_array(RB.i);
+        VM_NEXT();
+    VM_CASE(LOADINDEX):
+        RA.i = *ElementAddress(RB, RC);
+        VM_NEXT();
+    VM_CASE(STOREINDEX):
+        *ElementAddress(RA, RB) = RC.i;
+        VM_NEXT();
+
+    // Stack elements are stored the same way; a push only calls out when the stack is full
+    VM_CASE(NEWSTACK):
+        RA.p = zara_new_stack();
+        VM_NEXT();
+    VM_CASE(PUSH):
+        operands = RA.p;
+        if (operands->size == operands->capacity) {
+            zara_stack_push_int(operands, RB.i);
+        } else {
+            operands->elements[operands->size++] = RB.i;
+        }
+        VM_NEXT();
+    VM_CASE(POP):
+        operands = RB.p;
+        if (operands->size == 0) {
+            zara_stack_empty_error();
+        }
+        RA.i = operands->elements[--operands->size];
+        VM_NEXT();
+    VM_CASE(PEEK):
+        operands = RB.p;
+        if (operands->size == 0) {
+            zara_stack_empty_error();
+        }
+        RA.i = operands->elements[operands->size - 1];
+        VM_NEXT();
+    VM_CASE(STACKSIZE):
+        RA.i = ((ZaraStack*)RB.p)->size;
+        VM_NEXT();
+    VM_CASE(CONCAT):
+        RA.p = zara_string_concat(RB.p, RC.p);
+        VM_NEXT();
+    VM_CASE(STREQ):
+        RA.i = zara_string_equals(RB.p, RC.p);
+        VM_NEXT();
+
+    VM_CASE(JUMP):
+        pc += BC_SBX(instr);
+        VM_NEXT();
+    VM_CASE(JUMPIF):
+        if (RA.i) {
+            pc += BC_SBX(instr);
+        }
+        VM_NEXT();
+    VM_CASE(JUMPIFNOT):
+        if (!RA.i) {
+            pc += BC_SBX(instr);
+        }
+        VM_NEXT();
+
+    VM_CASE(ARG):
+        frame[function->frameSize + BC_B(instr)] = RA;
+        VM_NEXT();
+    VM_CASE(CALL):
+        if (depth == VM_MAX_DEPTH) {
+            char message[96];
+            snprintf(message, sizeof(message), "call stack overflow in the bytecode interpreter, past %d nested calls",
+                     VM_MAX_DEPTH);
+            VMError(message);
+        }
+        calls[depth].function = function;
+        calls[depth].pc = pc;
+        calls[depth].frame = frame;
+        calls[depth].result = BC_A(instr);
+        depth++;
+        frame = EnterFrame(&program->functions[BC_BX(instr)], frame + function->frameSize, stackEnd);
+        function = &program->functions[BC_BX(instr)];
+        pc = function->code;
+        VM_NEXT();
+    VM_CASE(RETURN):
+        value = RA;
+        if (depth == 0) {
+#ifdef ZARA_VM_PROFILE
+            PrintProfile();
+#endif
+            free(stack);
+            free(calls);
+            fflush(stdout);
+            return value.i;
+        }
+        depth--;
+        function = calls[depth].function;
+        pc = calls[depth].pc;
+        frame = calls[depth].frame;
+        frame[calls[depth].result] = value;
+        VM_NEXT();
+
+    VM_CASE(PRINTI):
+        zara_print_int(RA.i);
+        VM_NEXT();
+    VM_CASE(PRINTF):
+        zara_print_float(RA.f);
+        VM_NEXT();
+    VM_CASE(PRINTS):
+        zara_print_string(RA.p);
+        VM_NEXT();
+    VM_CASE(PRINTA):
+        if (BC_B(instr)) {
+            zara_print_float_array(RA.p);
+        } else {
+            zara_print_array(RA.p);
+        }
+        VM_NEXT();
+    VM_CASE(PRINTK):
+        if (BC_B(instr)) {
+            zara_print_float_stack(RA.p);
+        } else {
+            zara_print_stack(RA.p);
+        }
+        VM_NEXT();
+    VM_CASE(PRINTEND):
+        zara_print_end();
+        VM_NEXT();
+
+    VM_CASE(ADDIK):
+        RA.i = (int32_t)((uint32_t)RB.i + (uint32_t)BC_SC(instr));
+        VM_NEXT();
+
+    // The offset word follows, counted from the instruction after it
+    VM_CASE(MOVEJ):
+        RA = RB;
+        pc += (int32_t)*pc + 1;
+        VM_NEXT();
+    VM_CASE(JLTI):
+        offset = (int32_t)*pc++;
+        pc += RA.i < RB.i ? offset : 0;
+        VM_NEXT();
+    VM_CASE(JLEI):
+        offset = (int32_t)*pc++;
+        pc += RA.i <= RB.i ? offset : 0;
+        VM_NEXT();
+    VM_CASE(JGTI):
+        offset = (int32_t)*pc++;
+        pc += RA.i > RB.i ? offset : 0;
+        VM_NEXT();
+    VM_CASE(JGEI):
+        offset = (int32_t)*pc++;
+        pc += RA.i >= RB.i ? offset : 0;
+        VM_NEXT();
+    VM_CASE(JEQI):
+        offset = (int32_t)*pc++;
+        pc += RA.i == RB.i ? offset : 0;
+        VM_NEXT();
+    VM_CASE(JNEI):
+        offset = (int32_t)*pc++;
+        pc += RA.i != RB.i ? offset : 0;
+        VM_NEXT();
+
+#ifndef VM_COMPUTED_GOTO
+    default:
+        VMError("invalid bytecode instruction");
+    }
+#endif
+
+#undef RA
+#undef RB
+#undef RC
+#undef VM_CASE
+#undef VM_NEXT
+    return 0;
+}
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "x86.h"
+
+static const char* names64[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+static const char* names32[] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+};
+static const char* names8[] = {
+    "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+};
+static const char* conditionNames[] = {
+    "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g",
+};
+
+MachineOperand NoMachineOperand(void) {
+    MachineOperand operand;
+    memset(&operand, 0, sizeof(MachineOperand));
+    operand.kind = MOP_NONE;
+    operand.index = -1;
+    operand.symbol = -1;
+    return operand;
+}
+
+MachineOperand RegOperand(int reg) {
+    MachineOperand operand = NoMachineOperand();
+    operand.kind = MOP_REG;
+    operand.reg = reg;
+    return operand;
+}
+
+MachineOperand ImmOperand(long long value) {
+    MachineOperand operand = NoMachineOperand();
+    operand.kind = MOP_IMM;
+    operand.value = value;
+    return operand;
+}
+
+MachineOperand MemOperand(int base, long long disp) {
+    MachineOperand operand = NoMachineOperand();
+    operand.kind = MOP_MEM;
+    operand.reg = base;
+    operand.value = disp;
+    return operand;
+}
+
+MachineOperand IndexedOperand(int base, int index, int scale, long long disp) {
+    MachineOperand operand = MemOperand(base, disp);
+    operand.index = index;
+    operand.scale = scale;
+    return operand;
+}
+
+/**
+ * @brief Creates a memory operand addressing a symbol relative to the instruction pointer
+ */
+MachineOperand RipOperand(int symbol) {
+    MachineOperand operand = MemOperand(REG_RIP, 0);
+    operand.symbol = symbol;
+    return operand;
+}
+
+MachineOperand LabelRef(int label) {
+    MachineOperand operand = NoMachineOperand();
+    operand.kind = MOP_LABEL;
+    operand.symbol = label;
+    return operand;
+}
+
+MachineOperand SymbolRef(int symbol) {
+    MachineOperand operand = NoMachineOperand();
+    operand.kind = MOP_SYMBOL;
+    operand.symbol = symbol;
+    return operand;
+}
+
+/**
+ * @brief Checks whether two machine operands name the same register, memory, constant or target
+ */
+int SameMachineOperand(MachineOperand a, MachineOperand b) {
+    if (a.kind != b.kind) {
+        return 0;
+    }
+    switch (a.kind) {
+    case MOP_NONE:
+        return 1;
+    case MOP_REG:
+        return a.reg == b.reg;
+    case MOP_IMM:
+        return a.value == b.value;
+    case MOP_MEM:
+        return a.reg == b.reg && a.index == b.index && (a.index < 0 || a.scale == b.scale) &&
+               a.value == b.value && a.symbol == b.symbol;
+    default:
+        return a.symbol == b.symbol;
+    }
+}
+
+/**
+ * @brief Looks up a symbol by name, adding it if the program has none by that name yet
+ *
+ * @param program The program
+ * @param name The name of the symbol
+ * @param defined Whether the program provides the symbol; once set it stays set
+ * @return The index of the symbol
+ */
+int AddMachineSymbol(MachineProgram* program, const char* name, int defined) {
+    for (int i = 0; i < program->symbolCount; i++) {
+        if (strcmp(program->symbols[i].name, name) == 0) {
+            program->symbols[i].defined |= defined;
+            return i;
+        }
+    }
+
+    if (program->symbolCount == program->symbolCapacity) {
+        program->symbolCapacity = program->symbolCapacity == 0 ? 16 : program->symbolCapacity * 2;
+        program->symbols = CheckedRealloc(program->symbols, program->symbolCapacity * sizeof(MachineSymbol));
+    }
+    MachineSymbol* symbol = &program->symbols[program->symbolCount];
+    memset(symbol, 0, sizeof(MachineSymbol));
+    symbol->name = CheckedMalloc(strlen(name) + 1);
+    strcpy(symbol->name, name);
+    symbol->defined = defined;
+    return program->symbolCount++;
+}
+
+/**
+ * @brief Places a constant in read-only data, sharing it with an identical one already there
+ *
+ * @param program The program
+ * @param bytes The contents of the constant
+ * @param size The number of bytes
+ * @param align The alignment the constant needs
+ * @return The symbol naming the constant
+ */
+int AddConstant(MachineProgram* program, const void* bytes, int size, int align) {
+    for (int i = 0; i < program->symbolCount; i++) {
+        MachineSymbol* symbol = &program->symbols[i];
+        if (symbol->data != NULL && symbol->dataSize == size && symbol->align >= align &&
+            memcmp(symbol->data, bytes, size) == 0) {
+            return i;
+        }
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), ".LC%d", program->symbolCount);
+    int index = AddMachineSymbol(program, name, 1);
+    MachineSymbol* symbol = &program->symbols[index];
+    symbol->data = CheckedMalloc(size);
+    memcpy(symbol->data, bytes, size);
+    symbol->dataSize = size;
+    symbol->align = align;
+    return index;
+}
+
+void EmitMachine(MachineFunction* function, X86Opcode op, int size, MachineOperand src, MachineOperand dst) {
+    if (function->count == function->capacity) {
+        function->capacity = function->capacity == 0 ? 64 : function->capacity * 2;
+        function->code = CheckedRealloc(function->code, function->capacity * sizeof(MachineInstr));
+    }
+    MachineInstr* instr = &function->code[function->count++];
+    instr->op = op;
+    instr->size = size;
+    instr->cond = COND_E;
+    instr->src = src;
+    instr->dst = dst;
+}
+
+/**
+ * @brief Emits a conditional jump (target in the operand) or a setcc (byte register in the operand)
+ */
+void EmitCondition(MachineFunction* function, X86Opcode op, ConditionCode cond, MachineOperand operand) {
+    if (op == X86_JCC) {
+        EmitMachine(function, op, 0, operand, NoMachineOperand());
+    } else {
+        EmitMachine(function, op, 1, NoMachineOperand(), operand);
+    }
+    function->code[function->count - 1].cond = cond;
+}
+
+void EmitMachineLabel(MachineFunction* function, int label) {
+    EmitMachine(function, X86_LABEL, 0, LabelRef(label), NoMachineOperand());
+}
+
+int NewMachineLabel(MachineFunction* function) {
+    return function->labelCount++;
+}
+
+void FreeMachineProgram(MachineProgram* program) {
+    for (int i = 0; i < program->functionCount; i++) {
+        free(program->functions[i].code);
+    }
+    for (int i = 0; i < program->symbolCount; i++) {
+        free(program->symbols[i].name);
+        free(program->symbols[i].data);
+    }
+    free(program->functions);
+    free(program->symbols);
+    memset(program, 0, sizeof(MachineProgram));
+}
+
+static void PrintRegister(FILE* out, int reg, int size) {
+    if (IS_XMM(reg)) {
+        fprintf(out, "%%xmm%d", reg - REG_XMM0);
+    } else if (reg == REG_RIP) {
+        fprintf(out, "%%rip");
+    } else if (size == 8) {
+        fprintf(out, "%%%s", names64[reg]);
+    } else if (size == 1) {
+        fprintf(out, "%%%s", names8[reg]);
+    } else {
+        fprintf(out, "%%%s", names32[reg]);
+    }
+}
+
+static void PrintOperand(FILE* out, const MachineProgram* program, const MachineFunction* function,
+                         MachineOperand operand, int size) {
+    switch (operand.kind) {
+    case MOP_NONE:
+        break;
+    case MOP_REG:
+        PrintRegister(out, operand.reg, size);
+        break;
+    case MOP_IMM:
+        fprintf(out, "$%lld", operand.value);
+        break;
+    case MOP_MEM:
+        if (operand.reg == REG_RIP) {
+            fprintf(out, "%s", program->symbols[operand.symbol].name);
+            if (operand.value != 0) {
+                fprintf(out, "%+lld", operand.value);
+            }
+            fprintf(out, "(%%rip)");
+            break;
+        }
+        if (operand.value != 0) {
+            fprintf(out, "%lld", operand.value);
+        }
+        fprintf(out, "(");
+        PrintRegister(out, operand.reg, 8);
+        if (operand.index >= 0) {
+            fprintf(out, ",");
+            PrintRegister(out, operand.index, 8);
+            fprintf(out, ",%d", operand.scale);
+        }
+        fprintf(out, ")");
+        break;
+    case MOP_LABEL:
+        fprintf(out, ".L%s_%d", program->symbols[function->symbol].name, operand.symbol);
+        break;
+    case MOP_SYMBOL:
+        fprintf(out, "%s", program->symbols[operand.symbol].name);
+        if (!program->symbols[operand.symbol].defined) {
+            fprintf(out, "@PLT");
+        }
+        break;
+    }
+}
+
+static char SizeSuffix(int size) {
+    return size == 8 ? 'q' : (size == 1 ? 'b' : 'l');
+}
+
+/**
+ * @brief Prints one machine instruction in GNU assembler (AT&T) syntax
+ */
+void PrintMachineInstr(FILE* out, const MachineProgram* program, const MachineFunction* function,
+                       const MachineInstr* instr) {
+    int srcSize = instr->size;
+    int dstSize = instr->size;
+
+    switch (instr->op) {
+    case X86_LABEL:
+        PrintOperand(out, program, function, instr->src, 0);
+        fprintf(out, ":\n");
+        return;
+    case X86_MOV: fprintf(out, "    mov%c ", SizeSuffix(instr->size)); break;
+    case X86_MOVZB: fprintf(out, "    movzbl "); srcSize = 1; dstSize = 4; break;
+    case X86_MOVSXD: fprintf(out, "    movslq "); srcSize = 4; dstSize = 8; break;
+    case X86_LEA: fprintf(out, "    lea%c ", SizeSuffix(instr->size)); break;
+    case X86_ADD: fprintf(out, "    add%c ", SizeSuffix(instr->size)); break;
+    case X86_SUB: fprintf(out, "    sub%c ", SizeSuffix(instr->size)); break;
+    case X86_IMUL: fprintf(out, "    imul%c ", SizeSuffix(instr->size)); break;
+    case X86_CDQ: fprintf(out, "    cltd\n"); return;
+    case X86_IDIV: fprintf(out, "    idiv%c ", SizeSuffix(instr->size)); break;
+    case X86_AND: fprintf(out, "    and%c ", SizeSuffix(instr->size)); break;
+    case X86_OR: fprintf(out, "    or%c ", SizeSuffix(instr->size)); break;
+    case X86_XOR: fprintf(out, "    xor%c ", SizeSuffix(instr->size)); break;
+    case X86_CMP: fprintf(out, "    cmp%c ", SizeSuffix(instr->size)); break;
+    case X86_TEST: fprintf(out, "    test%c ", SizeSuffix(instr->size)); break;
+    case X86_SETCC: fprintf(out, "    set%s ", conditionNames[instr->cond]); break;
+    case X86_JMP: fprintf(out, "    jmp "); break;
+    case X86_JCC: fprintf(out, "    j%s ", conditionNames[instr->cond]); break;
+    case X86_CALL: fprintf(out, "    call "); break;
+    case X86_RET: fprintf(out, "    ret\n"); return;
+    case X86_PUSH: fprintf(out, "    pushq "); srcSize = 8; break;
+    case X86_POP: fprintf(out, "    popq "); dstSize = 8; break;
+    case X86_MOVSS: fprintf(out, "    movss "); break;
+    case X86_MOVD: fprintf(out, "    mov%c ", instr->size == 8 ? 'q' : 'd'); break;
+    case X86_ADDSS: fprintf(out, "    addss "); break;
+    case X86_SUBSS: fprintf(out, "    subss "); break;
+    case X86_MULSS: fprintf(out, "    mulss "); break;
+    case X86_DIVSS: fprintf(out, "    divss "); break;
+    case X86_UCOMISS: fprintf(out, "    ucomiss "); break;
+    case X86_CVTSI2SS: fprintf(out, "    cvtsi2ss%c ", SizeSuffix(instr->size)); break;
+    case X86_CVTTSS2SI: fprintf(out, "    cvttss2si "); break;
+    case X86_MOVUPS: fprintf(out, "    movups "); break;
+    case X86_PUNPCKLDQ: fprintf(out, "    punpckldq "); break;
+    case X86_PUNPCKLQDQ: fprintf(out, "    punpcklqdq "); break;
+    case X86_PADDD: fprintf(out, "    paddd "); break;
+    case X86_PSUBD: fprintf(out, "    psubd "); break;
+    case X86_PMULLD: fprintf(out, "    pmulld "); break;
+    case X86_ADDPS: fprintf(out, "    addps "); break;
+    case X86_SUBPS: fprintf(out, "    subps "); break;
+    case X86_MULPS: fprintf(out, "    mulps "); break;
+    case X86_DIVPS: fprintf(out, "    divps "); break;
+    case X86_CVTDQ2PS: fprintf(out, "    cvtdq2ps "); break;
+    }
+
+    PrintOperand(out, program, function, instr->src, srcSize);
+    if (instr->src.kind != MOP_NONE && instr->dst.kind != MOP_NONE) {
+        fprintf(out, ", ");
+    }
+    PrintOperand(out, program, function, instr->dst, dstSize);
+    fprintf(out, "\n");
+}
+
+/**
+ * @brief Prints a constant as a .string when it is text, or as .byte values otherwise
+ */
+static void PrintData(FILE* out, const MachineSymbol* symbol) {
+    int text = symbol->dataSize > 0 && symbol->data[symbol->dataSize - 1] == '\0';
+    for (int i = 0; text && i < symbol->dataSize - 1; i++) {
+        if (symbol->data[i] == '\0') {
+            text = 0;
+        }
+    }
+
+    if (text) {
+        fprintf(out, "    .string \"");
+        for (int i = 0; i < symbol->dataSize - 1; i++) {
+            unsigned char c = symbol->data[i];
+            if (c == '"' || c == '\\') {
+                fprintf(out, "\\%c", c);
+            } else if (c < 32 || c >= 127) {
+                fprintf(out, "\\%03o", c);
+            } else {
+                fputc(c, out);
+            }
+        }
+        fprintf(out, "\"\n");
+        return;
+    }
+
+    fprintf(out, "    .byte ");
+    for (int i = 0; i < symbol->dataSize; i++) {
+        fprintf(out, i == 0 ? "%d" : ", %d", symbol->data[i]);
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * @brief Writes a whole program as a GNU assembler source file
+ *
+ * @param out The file to write to
+ * @param program The program to write
+ */
+void WriteAssembly(FILE* out, const MachineProgram* program) {
+    fprintf(out, "    .text\n");
+    for (int f = 0; f < program->functionCount; f++) {
+        const MachineFunction* function = &program->functions[f];
+        const char* name = program->symbols[function->symbol].name;
+
+        fprintf(out, "\n    .globl %s\n    .type %s, @function\n%s:\n", name, name, name);
+        for (int i = 0; i < function->count; i++) {
+            PrintMachineInstr(out, program, function, &function->code[i]);
+        }
+        fprintf(out, "    .size %s, .-%s\n", name, name);
+    }
+
+    int header = 0;
+    for (int s = 0; s < program->symbolCount; s++) {
+        const MachineSymbol* symbol = &program->symbols[s];
+        if (symbol->data == NULL) {
+            continue;
+        }
+        if (!header) {
+            fprintf(out, "\n    .section .rodata\n");
+            header = 1;
+        }
+        fprintf(out, "    .p2align %d\n%s:\n", symbol->align >= 8 ? 3 : (symbol->align >= 4 ? 2 : 0), symbol->name);
+        PrintData(out, symbol);
+    }
+
+    fprintf(out, "\n    .section .note.GNU-stack,\"\",@progbits\n");
+}
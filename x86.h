@@ -0,0 +1,176 @@
+#ifndef x86_h
+#define x86_h
+
+#include <stdio.h>
+
+#include "util.h"
+
+// Numbered as in the instruction encoding, so the low three bits go in ModRM
+typedef enum {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+    REG_XMM0, REG_XMM1, REG_XMM2, REG_XMM3, REG_XMM4, REG_XMM5, REG_XMM6, REG_XMM7,
+    REG_XMM8, REG_XMM9, REG_XMM10, REG_XMM11, REG_XMM12, REG_XMM13, REG_XMM14, REG_XMM15,
+    REG_RIP,
+} MachineRegister;
+
+#define IS_XMM(reg) ((reg) >= REG_XMM0 && (reg) <= REG_XMM15)
+
+// Numbered as the low nibble of the Jcc and SETcc opcodes
+typedef enum {
+    COND_O, COND_NO, COND_B, COND_AE, COND_E, COND_NE, COND_BE, COND_A,
+    COND_S, COND_NS, COND_P, COND_NP, COND_L, COND_GE, COND_LE, COND_G,
+} ConditionCode;
+
+typedef enum {
+    X86_LABEL,
+    X86_MOV,
+    X86_MOVZB,      // Zero-extend a byte register
+    X86_MOVSXD,     // Sign-extend 32 bits to 64
+    X86_LEA,
+    X86_ADD,
+    X86_SUB,
+    X86_IMUL,
+    X86_CDQ,        // Sign-extend eax into edx before a division
+    X86_IDIV,
+    X86_AND,
+    X86_OR,
+    X86_XOR,
+    X86_CMP,
+    X86_TEST,
+    X86_SETCC,
+    X86_JMP,
+    X86_JCC,
+    X86_CALL,
+    X86_RET,
+    X86_PUSH,
+    X86_POP,
+    X86_MOVSS,
+    X86_MOVD,       // Copy 32 bits between a general-purpose and an xmm register
+    X86_ADDSS,
+    X86_SUBSS,
+    X86_MULSS,
+    X86_DIVSS,
+    X86_UCOMISS,
+    X86_CVTSI2SS,
+    X86_CVTTSS2SI,
+    X86_MOVUPS,     // Copy all four lanes of an xmm register, memory unaligned
+    X86_PUNPCKLDQ,  // Interleave the low lanes: with itself, repeats lane 0 into lane 1
+    X86_PUNPCKLQDQ, // Interleave the low halves: with itself, repeats lanes 0-1 into 2-3
+    X86_PADDD,
+    X86_PSUBD,
+    X86_PMULLD,     // SSE4.1
+    X86_ADDPS,
+    X86_SUBPS,
+    X86_MULPS,
+    X86_DIVPS,
+    X86_CVTDQ2PS,
+} X86Opcode;
+
+typedef enum {
+    MOP_NONE,
+    MOP_REG,
+    MOP_IMM,
+    MOP_MEM,
+    MOP_LABEL,
+    MOP_SYMBOL,
+} MachineOperandKind;
+
+typedef struct {
+    MachineOperandKind kind;
+    int reg;            // The register, or the base register of a memory operand
+    int index;          // Index register of a memory operand, -1 if none
+    int scale;
+    long long value;    // Immediate value, or displacement of a memory operand
+    int symbol;         // Label of the function, symbol of the program, or symbol a REG_RIP operand is relative to
+} MachineOperand;
+
+// AT&T operand order: src, then dst. Instructions with one operand read it
+// from src (push, idiv, jumps, calls) or write it to dst (pop, setcc).
+typedef struct {
+    X86Opcode op;
+    int size;           // Operand size in bytes: 1, 4 or 8
+    ConditionCode cond;
+    MachineOperand src;
+    MachineOperand dst;
+} MachineInstr;
+
+typedef struct {
+    char* name;
+    int defined;        // Whether the program provides it, rather than the runtime or libc
+    unsigned char* data; // Contents of a read-only constant, NULL for a function
+    int dataSize;
+    int align;
+} MachineSymbol;
+
+typedef struct {
+    int symbol;
+    MachineInstr* code;
+    int count;
+    int capacity;
+    int labelCount;
+} MachineFunction;
+
+typedef struct {
+    MachineFunction* functions;
+    int functionCount;
+    MachineSymbol* symbols;
+    int symbolCount;
+    int symbolCapacity;
+} MachineProgram;
+
+typedef enum {
+    RELOC_PC32,         // Offset from the field to a constant in read-only data
+    RELOC_PLT32,        // Offset from the field to a function outside the program
+} RelocationKind;
+
+typedef struct {
+    int offset;         // Where the 4-byte field to patch starts in the text
+    int symbol;
+    RelocationKind kind;
+    long long addend;   // Added to the symbol's address before the field's own is subtracted
+} MachineRelocation;
+
+// A program encoded as bytes: every function in one text section, every
+// constant in one read-only data section, and relocations for the rest
+typedef struct {
+    unsigned char* text;
+    int textSize;
+    int textCapacity;
+    unsigned char* rodata;
+    int rodataSize;
+    int* symbolOffsets; // Symbol -> offset in text or rodata, -1 if outside the program
+    MachineRelocation* relocations;
+    int relocationCount;
+    int relocationCapacity;
+} MachineCode;
+
+MachineOperand NoMachineOperand(void);
+MachineOperand RegOperand(int reg);
+MachineOperand ImmOperand(long long value);
+MachineOperand MemOperand(int base, long long disp);
+MachineOperand IndexedOperand(int base, int index, int scale, long long disp);
+MachineOperand RipOperand(int symbol);
+MachineOperand LabelRef(int label);
+MachineOperand SymbolRef(int symbol);
+int SameMachineOperand(MachineOperand a, MachineOperand b);
+
+int AddMachineSymbol(MachineProgram* program, const char* name, int defined);
+int AddConstant(MachineProgram* program, const void* bytes, int size, int align);
+
+void EmitMachine(MachineFunction* function, X86Opcode op, int size, MachineOperand src, MachineOperand dst);
+void EmitCondition(MachineFunction* function, X86Opcode op, ConditionCode cond, MachineOperand operand);
+void EmitMachineLabel(MachineFunction* function, int label);
+int NewMachineLabel(MachineFunction* function);
+
+void FreeMachineProgram(MachineProgram* program);
+void PrintMachineInstr(FILE* out, const MachineProgram* program, const MachineFunction* function,
+                       const MachineInstr* instr);
+void WriteAssembly(FILE* out, const MachineProgram* program);
+
+int RunPeephole(MachineFunction* function);
+
+MachineCode EncodeProgram(const MachineProgram* program);
+void FreeMachineCode(MachineCode* code);
+
+#endif
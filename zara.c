@@ -3,6 +3,16 @@
 #include <string.h>
 #include "symbol.h"
 #include "parser.h"
+#include "cfg.h"
+#include "ssa.h"
+#include "optimize.h"
+#include "liveness.h"
+#include "reg.h"
+#include "codegen.h"
+#include "object.h"
+#include "jit.h"
+#include "bytecode.h"
+#include "cache.h"
 
 #define MAX_BUFFER_SIZE 4096 
 
@@ -36,6 +46,16 @@ char * ReadFileToString(const char* filename) {
     return content;
 }
 
+static int RunVM(BytecodeProgram* bytecode, const char* heading) {
+    printf("\n%s:\n", heading);
+    PrintBytecode(bytecode);
+    printf("\nRunning main:\n");
+    fflush(stdout);
+    int result = RunBytecode(bytecode);
+    FreeBytecodeProgram(bytecode);
+    return result;
+}
+
 
 /**
  * @brief Entry point of the Zara compiler
@@ -43,25 +63,184 @@ char * ReadFileToString(const char* filename) {
  * This function is the entry point of the compiler. It should be responsible for
  * parsing the command line arguments, initializing the lexer, parser, and symbol
  * table, and driving the compilation process.
+ *
+ * Options:
+ *   --cfg   Print the control-flow graph, dominators and loops of every function
+ *   --ssa   Print every function in SSA form before translating it back out
+ *   -O<n>   Optimize at level n (0 to 2, -O alone means -O1) and print the result
+ *   --unroll=<n>  Unroll loops by n at -O2 (1 keeps only complete unrolling of short loops)
+ *   --regs  Print the liveness of every function and the registers its variables get
+ *           (linear scan, or graph coloring with coalescing at -O2)
+ *   -o <file>  Write the program for x86-64 to file, to be linked with runtime.c: an ELF
+ *           object file if the name ends in .o, assembly otherwise
+ *   --jit   Compile the program to machine code in memory and run it, exiting with what
+ *           main returns
+ *   --vm    Lower the program to bytecode, print it and run it in the bytecode interpreter,
+ *           exiting with what main returns
+ *   --cache With --vm alone, keep the bytecode in the cache directory keyed by a hash of the
+ *           source, compiler and flags, and on a hit run it without compiling at all
  */
 int main(int argc, char* argv[]) {
 
-    if(argc != 2) {
-        printf("Usage: %s <source file>\n", argv[0]);
+    const char* filename = NULL;
+    int dumpCFG = 0;
+    int dumpSSA = 0;
+    int optLevel = 0;
+    int dumpRegs = 0;
+    const char* outputName = NULL;
+    int runJIT = 0;
+    int runVM = 0;
+    int useCache = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cfg") == 0) {
+            dumpCFG = 1;
+        } else if (strcmp(argv[i], "--ssa") == 0) {
+            dumpSSA = 1;
+        } else if (strcmp(argv[i], "--regs") == 0) {
+            dumpRegs = 1;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            runJIT = 1;
+        } else if (strcmp(argv[i], "--vm") == 0) {
+            runVM = 1;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            useCache = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputName = argv[++i];
+        } else if (strncmp(argv[i], "--unroll=", 9) == 0) {
+            unrollOptions.factor = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            optLevel = argv[i][2] == '\0' ? 1 : atoi(argv[i] + 2);
+        } else if (filename == NULL) {
+            filename = argv[i];
+        } else {
+            filename = NULL;
+            break;
+        }
+    }
+
+    if(filename == NULL) {
+        printf("Usage: %s [--cfg] [--ssa] [--regs] [-O<n>] [--unroll=<n>] [-o <file>] [--jit] [--vm] [--cache] <source file>\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    char* code = ReadFileToString(argv[1]);
+    char* code = ReadFileToString(filename);
 
     if(code == NULL) {
         perror("Error reading file");
         exit(EXIT_FAILURE);
     }
+
+    // Only a plain --vm run has nothing to show but the bytecode, so only it can skip compiling
+    const char* cacheDirectory = NULL;
+    unsigned long long cacheKey = 0;
+    if (useCache && runVM && !dumpCFG && !dumpSSA && !dumpRegs && outputName == NULL && !runJIT) {
+        char flags[64];
+        snprintf(flags, sizeof(flags), "-O%d --unroll=%d", optLevel, unrollOptions.factor);
+        cacheKey = CacheKey(code, flags);
+        cacheDirectory = CacheDirectory();
+
+        BytecodeProgram cached;
+        if (cacheDirectory != NULL && LoadCachedBytecode(cacheDirectory, cacheKey, &cached)) {
+            free(code);
+            return RunVM(&cached, "Bytecode (cached)");
+        }
+    }
+
     Parser parser = InitParser(code);
     ParseProgram(&parser);
 
     printf("\nFinal Symbol Table:\n");
     DisplayTable(&parser.symbolTable);
 
-    return 0;
+    printf("\n");
+    PrintTAC(&parser.program);
+
+    if (dumpCFG) {
+        for (int i = 0; i < parser.program.functionCount; i++) {
+            CFG cfg = AnalyzeCFG(&parser.program.functions[i]);
+            PrintCFG(&cfg);
+            FreeCFG(&cfg);
+        }
+    }
+
+    if (dumpSSA) {
+        printf("\nSSA form:\n");
+        for (int i = 0; i < parser.program.functionCount; i++) {
+            BuildSSA(&parser.program.functions[i]);
+            PrintTACFunction(&parser.program.functions[i]);
+        }
+
+        printf("\nAfter SSA destruction:\n");
+        for (int i = 0; i < parser.program.functionCount; i++) {
+            DestroySSA(&parser.program.functions[i]);
+            PrintTACFunction(&parser.program.functions[i]);
+        }
+    }
+
+    if (optLevel > 0) {
+        OptimizeProgram(&parser.program, optLevel);
+        printf("\nOptimized TAC (-O%d):\n", optLevel);
+        PrintTAC(&parser.program);
+    }
+
+    if (dumpRegs) {
+        printf("\nRegister allocation:\n");
+        for (int i = 0; i < parser.program.functionCount; i++) {
+            Liveness liveness = ComputeLiveness(&parser.program.functions[i]);
+            PrintLiveness(&liveness);
+            add_live_intervals(&liveness);
+            if (optLevel >= 2) {
+                coloring_allocation();
+            } else {
+                register_allocation();
+            }
+            print_allocation();
+            FreeLiveness(&liveness);
+        }
+    }
+
+    if (outputName != NULL) {
+        size_t length = strlen(outputName);
+        int object = length > 2 && strcmp(outputName + length - 2, ".o") == 0;
+        FILE* output = fopen(outputName, object ? "wb" : "w");
+        if (output == NULL) {
+            perror("Error opening output file");
+            exit(EXIT_FAILURE);
+        }
+        MachineProgram machine = GenerateProgram(&parser.program, optLevel);
+        if (object) {
+            MachineCode code = EncodeProgram(&machine);
+            WriteObject(output, &machine, &code);
+            FreeMachineCode(&code);
+        } else {
+            WriteAssembly(output, &machine);
+        }
+        fclose(output);
+        FreeMachineProgram(&machine);
+    }
+
+    int result = 0;
+    if (runJIT) {
+        MachineProgram machine = GenerateProgram(&parser.program, optLevel);
+        MachineCode machineCode = EncodeProgram(&machine);
+        printf("\nRunning main:\n");
+        fflush(stdout);
+        result = RunJIT(&machine, &machineCode);
+        FreeMachineCode(&machineCode);
+        FreeMachineProgram(&machine);
+    }
+
+    if (runVM) {
+        BytecodeProgram bytecode = LowerProgram(&parser.program);
+        if (cacheDirectory != NULL) {
+            StoreCachedBytecode(cacheDirectory, cacheKey, &bytecode);
+        }
+        result = RunVM(&bytecode, "Bytecode");
+    }
+
+    FreeTACProgram(&parser.program);
+    free(code);
+
+    return result;
 }
\ No newline at end of file